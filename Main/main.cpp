@@ -1,13 +1,10 @@
 #include <Chimes/Optimization/steepest_descent.h>
 #include <Chimes/Optimization/lbfgs.h>
-#include <functional>
 #include <memory>
 
 void test_steepest_descent()
 {
-	using Fun = std::function<double(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)>;
-	Fun fun
-		= [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+	auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
 	{
 		double fval = (x(0) - 1) * (x(0) - 1) + (x(1) - 1) * (x(1) - 1);
 		gradient.setZero();
@@ -15,6 +12,7 @@ void test_steepest_descent()
 		gradient(1) = 2 * (x(1) - 1);
 		return fval;
 	};
+	using Fun = decltype(fun);
 	Eigen::VectorXd init_x(2);
 	init_x(0) = 53;
 	init_x(1) = -68;
@@ -26,9 +24,7 @@ void test_steepest_descent()
 
 void test_lbfgs()
 {
-	using Fun = std::function<double(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)>;
-	Fun fun
-		= [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+	auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
 	{
 		double fval = (x(0) - 1) * (x(0) - 1) + (x(1) - 1) * (x(1) - 1);
 		gradient.setZero();
@@ -36,6 +32,7 @@ void test_lbfgs()
 		gradient(1) = 2 * (x(1) - 1);
 		return fval;
 	};
+	using Fun = decltype(fun);
 	Eigen::VectorXd init_x(2);
 	init_x(0) = 53;
 	init_x(1) = -68;
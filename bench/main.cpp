@@ -0,0 +1,825 @@
+#include <Chimes/Optimization/lbfgs.h>
+#include <Chimes/Optimization/autodiff.h>
+#include <Chimes/Optimization/finite_difference.h>
+#include <Chimes/Optimization/least_squares.h>
+#include <Chimes/Optimization/lbfgs_mapped_history.h>
+#include <Chimes/Optimization/steepest_descent.h>
+#include <Chimes/Optimization/nonlinear_cg.h>
+#include <Chimes/Optimization/batch_lbfgs.h>
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Geometry/kd_tree.h>
+#include <Chimes/Geometry/point_cloud.h>
+#include "suite.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+//Seconds of wall time spent in f().
+template <class F>
+double wall_time(F&& f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Quadratic sum_i d_i * (x_i - 1)^2 with d spread over [1, condition].
+//Evaluated with the same kernels as the solver when a pool is given.
+class Quadratic
+{
+public:
+    Quadratic(size_t n, double condition, Chimes::ThreadPool* pool = nullptr) : scale_(n), kernels_(pool)
+    {
+        for (size_t i = 0; i < n; ++i)
+            scale_(i) = 1.0 + (condition - 1.0) * ((i * 7919) % n) / double(n);
+    }
+    double operator()(const Eigen::VectorXd& x, Eigen::VectorXd& gradient) const
+    {
+        return kernels_.reduce(x.size(), [&](size_t begin, size_t length)
+        {
+            auto d = scale_.segment(begin, length);
+            auto r = x.segment(begin, length).array() - 1.0;
+            gradient.segment(begin, length) = 2.0 * d.cwiseProduct(r.matrix());
+            return d.dot(r.square().matrix());
+        });
+    }
+private:
+    Eigen::VectorXd scale_;
+    Chimes::VectorKernels<double> kernels_;
+};
+
+//Time per LBFGS iteration against n and lbfgs_remain_.
+template <class History>
+double bench_lbfgs_iteration(size_t n, int m, size_t iterations)
+{
+    Quadratic fun(n, 1e4);
+    Eigen::VectorXd init_x = Eigen::VectorXd::Zero(n);
+    Chimes::LBFGS<Quadratic, double, Eigen::Dynamic, Eigen::Dynamic, History> lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.epsilon_ = 0;
+    lbfgs.parameter_.max_iteration_ = iterations;
+    lbfgs.parameter_.lbfgs_remain_ = m;
+    const double seconds = wall_time([&]() { lbfgs.solve(); });
+    return seconds / std::max<size_t>(lbfgs.get_result().iter_time, 1);
+}
+
+void bench_lbfgs_history(size_t max_n)
+{
+    std::cout << "[LBFGS history] microseconds per iteration" << std::endl;
+    std::cout << "n\tm\tvector\tmatrix" << std::endl;
+    for (size_t n = 1000; n <= max_n; n *= 10)
+    {
+        const size_t iterations = std::max<size_t>(20, 20000000 / n / 10);
+        for (int m : {3, 6, 12, 24})
+        {
+            const double vector_time = bench_lbfgs_iteration<Chimes::LBFGSVectorHistory<double>>(n, m, iterations);
+            const double matrix_time = bench_lbfgs_iteration<Chimes::LBFGSMatrixHistory<double>>(n, m, iterations);
+            std::cout << n << "\t" << m << "\t" << vector_time * 1e6 << "\t" << matrix_time * 1e6 << std::endl;
+        }
+    }
+}
+
+//[S Y] in memory against the mapped file, with the two sweeps of the pairs in each iteration as a read bandwidth.
+//The file stays in the page cache while it fits in the free memory, so this measures the cost of the mapping, not the disk.
+void bench_mapped_history(size_t max_n)
+{
+    const int m = 10;
+    std::cout << "[mapped history] m = " << m << ", milliseconds per iteration" << std::endl;
+    std::cout << "n\tmatrix\tmapped\tGB/s" << std::endl;
+    for (size_t n = 100000; n <= max_n; n *= 10)
+    {
+        const size_t iterations = std::max<size_t>(20, 20000000 / n);
+        const double matrix_time = bench_lbfgs_iteration<Chimes::LBFGSMatrixHistory<double>>(n, m, iterations);
+        const double mapped_time = bench_lbfgs_iteration<Chimes::LBFGSMappedHistory<double>>(n, m, iterations);
+        const double bytes = 2.0 * 2 * m * n * sizeof(double);
+        std::cout << n << "\t" << matrix_time * 1e3 << "\t" << mapped_time * 1e3 << "\t" << bytes / mapped_time / 1e9 << std::endl;
+    }
+}
+
+//Time per LBFGS iteration against the number of threads of the pool.
+template <class History>
+double bench_lbfgs_threads(size_t n, size_t threads, size_t iterations)
+{
+    Chimes::ThreadPool pool(threads);
+    Quadratic fun(n, 1e4, &pool);
+    Eigen::VectorXd init_x = Eigen::VectorXd::Zero(n);
+    Chimes::LBFGS<Quadratic, double, Eigen::Dynamic, Eigen::Dynamic, History> lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.epsilon_ = 0;
+    lbfgs.parameter_.max_iteration_ = iterations;
+    lbfgs.parameter_.thread_pool_ = &pool;
+    const double seconds = wall_time([&]() { lbfgs.solve(); });
+    return seconds / std::max<size_t>(lbfgs.get_result().iter_time, 1);
+}
+
+void bench_parallel_scaling(size_t n, size_t max_threads)
+{
+    std::cout << "[parallel kernels] n = " << n << ", milliseconds per iteration" << std::endl;
+    std::cout << "threads\tvector\tspeedup\tmatrix\tspeedup" << std::endl;
+    double vector_base = 0;
+    double matrix_base = 0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        const double vector_time = bench_lbfgs_threads<Chimes::LBFGSVectorHistory<double>>(n, threads, 20);
+        const double matrix_time = bench_lbfgs_threads<Chimes::LBFGSMatrixHistory<double>>(n, threads, 20);
+        if (threads == 1)
+        {
+            vector_base = vector_time;
+            matrix_base = matrix_time;
+        }
+        std::cout << threads << "\t" << vector_time * 1e3 << "\t" << vector_base / vector_time << "\t"
+            << matrix_time * 1e3 << "\t" << matrix_base / matrix_time << std::endl;
+    }
+}
+
+//Extended Rosenbrock on one problem.
+double rosenbrock(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+{
+    double fval = 0;
+    gradient.setZero();
+    for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+    {
+        const double t = x(j + 1) - x(j) * x(j);
+        const double u = 1.0 - x(j);
+        fval += 100.0 * t * t + u * u;
+        gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+        gradient(j + 1) += 200.0 * t;
+    }
+    return fval;
+}
+
+//Extended Rosenbrock on a batch, one problem per row.
+void batch_rosenbrock(Eigen::Ref<const Eigen::ArrayXXd> x, Eigen::Ref<Eigen::ArrayXXd> gradient, Eigen::Ref<Eigen::ArrayXd> fval)
+{
+    fval.setZero();
+    gradient.setZero();
+    for (Eigen::Index j = 0; j + 1 < x.cols(); ++j)
+    {
+        const auto t = x.col(j + 1) - x.col(j).square();
+        const auto u = 1.0 - x.col(j);
+        fval += 100.0 * t.square() + u.square();
+        gradient.col(j) += -400.0 * t * x.col(j) - 2.0 * u;
+        gradient.col(j + 1) += 200.0 * t;
+    }
+}
+
+//Many small problems: BatchLBFGS against a loop of LBFGS::solve() on a std::function objective, as in Main.
+void bench_batch_lbfgs(size_t batch)
+{
+    std::cout << "[batch LBFGS] " << batch << " extended Rosenbrock problems, problems per second" << std::endl;
+    std::cout << "n\tloop\tbatch\tspeedup" << std::endl;
+    for (int n : {2, 6, 12, 50})
+    {
+        Eigen::ArrayXXd init_x(batch, n);
+        for (size_t i = 0; i < batch; ++i)
+            for (int j = 0; j < n; ++j)
+                init_x(i, j) = -1.2 + 0.05 * ((i * 7 + j * 3) % 13);
+        std::function<double(const Eigen::VectorXd&, Eigen::VectorXd&)> fun = rosenbrock;
+        const double loop_time = wall_time([&]()
+        {
+            for (size_t i = 0; i < batch; ++i)
+            {
+                Eigen::VectorXd x = init_x.row(i).transpose().matrix();
+                Chimes::LBFGS<decltype(fun), double> lbfgs(fun, x);
+                lbfgs.parameter_.is_show_ = false;
+                lbfgs.solve();
+            }
+        });
+        auto batch_fun = batch_rosenbrock;
+        const double batch_time = wall_time([&]()
+        {
+            Chimes::BatchLBFGS<decltype(batch_fun), double> solver(batch_fun, init_x);
+            solver.solve();
+        });
+        std::cout << n << "\t" << batch / loop_time << "\t" << batch / batch_time << "\t" << loop_time / batch_time << std::endl;
+    }
+}
+
+//Extended Rosenbrock for any vector type, fixed-size or dynamic.
+auto generic_rosenbrock = [](const auto& x, auto& gradient)
+{
+    double fval = 0;
+    gradient.setZero();
+    for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+    {
+        const double t = x(j + 1) - x(j) * x(j);
+        const double u = 1.0 - x(j);
+        fval += 100.0 * t * t + u * u;
+        gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+        gradient(j + 1) += 200.0 * t;
+    }
+    return fval;
+};
+
+//Solves per second of LBFGS on N variables with a compile-time Dim and M, against the dynamic solver.
+template <int N>
+void bench_fixed_size_lbfgs(size_t solves)
+{
+    using FixedVector = Eigen::Matrix<double, N, 1>;
+    std::vector<FixedVector> init_x(solves);
+    for (size_t i = 0; i < solves; ++i)
+        for (int j = 0; j < N; ++j)
+            init_x[i](j) = -1.2 + 0.05 * ((i * 7 + j * 3) % 13);
+    auto fun = generic_rosenbrock;
+    const double dynamic_time = wall_time([&]()
+    {
+        Chimes::LBFGS<decltype(fun), double>::Workspace workspace;
+        Eigen::VectorXd x = init_x[0];
+        Chimes::LBFGS<decltype(fun), double> lbfgs(fun, x, workspace);
+        lbfgs.parameter_.is_show_ = false;
+        for (size_t i = 0; i < solves; ++i)
+        {
+            x = init_x[i];
+            lbfgs.set_init_x(x);
+            lbfgs.solve();
+        }
+    });
+    const double fixed_time = wall_time([&]()
+    {
+        Chimes::LBFGS<decltype(fun), double, N, 6> lbfgs(fun, init_x[0]);
+        lbfgs.parameter_.is_show_ = false;
+        for (size_t i = 0; i < solves; ++i)
+        {
+            lbfgs.set_init_x(init_x[i]);
+            lbfgs.solve();
+        }
+    });
+    std::cout << N << "\t" << solves / dynamic_time << "\t" << solves / fixed_time << "\t" << dynamic_time / fixed_time << std::endl;
+}
+
+void bench_fixed_size(size_t solves)
+{
+    std::cout << "[fixed size LBFGS] extended Rosenbrock, m = 6, solves per second" << std::endl;
+    std::cout << "n\tdynamic\tfixed\tspeedup" << std::endl;
+    bench_fixed_size_lbfgs<2>(solves);
+    bench_fixed_size_lbfgs<3>(solves);
+    bench_fixed_size_lbfgs<6>(solves);
+    bench_fixed_size_lbfgs<12>(solves);
+}
+
+//Nanoseconds per evaluation of a 2-D quadratic called directly and through std::function,
+//and per evaluation of LBFGS solves with each objective type.
+void bench_evaluation_overhead(size_t evaluations)
+{
+    auto lambda = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient(0) = 2 * (x(0) - 1);
+        gradient(1) = 20 * (x(1) - 1);
+        return (x(0) - 1) * (x(0) - 1) + 10 * (x(1) - 1) * (x(1) - 1);
+    };
+    std::function<double(const Eigen::VectorXd&, Eigen::VectorXd&)> function = lambda;
+    auto call_time = [&](auto& fun)
+    {
+        Eigen::VectorXd x = Eigen::VectorXd::Zero(2);
+        Eigen::VectorXd gradient(2);
+        double sum = 0;
+        const double seconds = wall_time([&]()
+        {
+            for (size_t i = 0; i < evaluations; ++i)
+            {
+                x(0) = 1e-9 * i;
+                sum += fun(x, gradient);
+            }
+        });
+        return sum > 0 ? seconds / evaluations : 0;
+    };
+    auto solve_time = [&](auto& fun)
+    {
+        using Fun = std::remove_reference_t<decltype(fun)>;
+        Eigen::VectorXd init_x(2);
+        size_t count = 0;
+        typename Chimes::LBFGS<Fun, double>::Workspace workspace;
+        Chimes::LBFGS<Fun, double> lbfgs(fun, init_x, workspace);
+        lbfgs.parameter_.is_show_ = false;
+        const double seconds = wall_time([&]()
+        {
+            while (count < evaluations)
+            {
+                init_x(0) = 53 + 1e-6 * count;
+                init_x(1) = -68;
+                lbfgs.set_init_x(init_x);
+                lbfgs.solve();
+                count += lbfgs.get_result().fval_eval_time;
+            }
+        });
+        return seconds / count;
+    };
+    std::cout << "[objective] nanoseconds per evaluation of a 2-D quadratic" << std::endl;
+    std::cout << "\tstd::function\tlambda" << std::endl;
+    std::cout << "call\t" << call_time(function) * 1e9 << "\t" << call_time(lambda) * 1e9 << std::endl;
+    std::cout << "LBFGS\t" << solve_time(function) * 1e9 << "\t" << solve_time(lambda) * 1e9 << std::endl;
+}
+
+//Extended Powell singular function, n a multiple of 4, singular Hessian at the minimum.
+double extended_powell(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+{
+    double fval = 0;
+    for (Eigen::Index j = 0; j + 3 < x.size(); j += 4)
+    {
+        const double t1 = x(j) + 10 * x(j + 1);
+        const double t2 = x(j + 2) - x(j + 3);
+        const double t3 = x(j + 1) - 2 * x(j + 2);
+        const double t4 = x(j) - x(j + 3);
+        fval += t1 * t1 + 5 * t2 * t2 + t3 * t3 * t3 * t3 + 10 * t4 * t4 * t4 * t4;
+        gradient(j) = 2 * t1 + 40 * t4 * t4 * t4;
+        gradient(j + 1) = 20 * t1 + 4 * t3 * t3 * t3;
+        gradient(j + 2) = 10 * t2 - 8 * t3 * t3 * t3;
+        gradient(j + 3) = -10 * t2 - 40 * t4 * t4 * t4;
+    }
+    return fval;
+}
+
+//Trigonometric function of More, Garbow and Hillstrom.
+double trigonometric(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+{
+    const double n = double(x.size());
+    const double cos_sum = x.array().cos().sum();
+    double fval = 0;
+    double f_sum = 0;
+    for (Eigen::Index i = 0; i < x.size(); ++i)
+    {
+        const double f = n - cos_sum + (i + 1) * (1 - std::cos(x(i))) - std::sin(x(i));
+        fval += f * f;
+        f_sum += f;
+        gradient(i) = 2 * f * ((i + 1) * std::sin(x(i)) - std::cos(x(i)));
+    }
+    gradient.array() += 2 * f_sum * x.array().sin();
+    return fval;
+}
+
+//Iterations, value and gradient evaluations per solve of one solver on one test function, for each step search.
+template <template <class, class, int> class Solver, class Fun>
+void bench_step_search_problem(const char* solver_name, const char* fun_name, Fun& fun, const Eigen::VectorXd& init_x)
+{
+    using Method = typename Solver<Fun, double, Eigen::Dynamic>::StepSearchMethod;
+    const std::pair<Method, const char*> methods[] = { { Method::WOLFE, "wolfe" }, { Method::STRONG_WOLFE, "strong_wolfe" },
+        { Method::MORE_THUENTE, "more_thuente" } };
+    for (const auto& method : methods)
+    {
+        Solver<Fun, double, Eigen::Dynamic> solver(fun, init_x);
+        solver.parameter_.is_show_ = false;
+        solver.parameter_.step_search_method_ = method.first;
+        solver.solve();
+        const auto& result = solver.get_result();
+        std::cout << solver_name << "\t" << fun_name << "\t" << method.second << "\t" << result.iter_time << "\t"
+            << result.fval_eval_time << "\t" << result.gradient_eval_time << "\t" << result.fval << std::endl;
+    }
+}
+
+template <class Fun, class Scalar, int Dim>
+using DefaultLBFGS = Chimes::LBFGS<Fun, Scalar, Dim>;
+
+//Evaluations per solve of the step search methods on standard test functions.
+void bench_step_search(size_t n)
+{
+    std::cout << "[step search] n = " << n << ", per solve" << std::endl;
+    std::cout << "solver\tfunction\tmethod\titerations\tvalues\tgradients\tfval" << std::endl;
+    Eigen::VectorXd rosenbrock_x(n);
+    Eigen::VectorXd powell_x(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        rosenbrock_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+        const double powell_start[] = { 3, -1, 0, 1 };
+        powell_x(i) = powell_start[i % 4];
+    }
+    const Eigen::VectorXd trigonometric_x = Eigen::VectorXd::Constant(n, 1.0 / n);
+    const Eigen::VectorXd quadratic_x = Eigen::VectorXd::Zero(n);
+    auto rosenbrock_fun = rosenbrock;
+    auto powell_fun = extended_powell;
+    auto trigonometric_fun = trigonometric;
+    Quadratic quadratic(n, 1e4);
+    bench_step_search_problem<DefaultLBFGS>("lbfgs", "rosenbrock", rosenbrock_fun, rosenbrock_x);
+    bench_step_search_problem<DefaultLBFGS>("lbfgs", "powell", powell_fun, powell_x);
+    bench_step_search_problem<DefaultLBFGS>("lbfgs", "trigonometric", trigonometric_fun, trigonometric_x);
+    bench_step_search_problem<DefaultLBFGS>("lbfgs", "quadratic", quadratic, quadratic_x);
+    bench_step_search_problem<Chimes::SteepestDescent>("steepest", "rosenbrock", rosenbrock_fun, rosenbrock_x);
+    bench_step_search_problem<Chimes::SteepestDescent>("steepest", "powell", powell_fun, powell_x);
+    bench_step_search_problem<Chimes::SteepestDescent>("steepest", "trigonometric", trigonometric_fun, trigonometric_x);
+    bench_step_search_problem<Chimes::SteepestDescent>("steepest", "quadratic", quadratic, quadratic_x);
+    bench_step_search_problem<Chimes::NonlinearCG>("cg", "rosenbrock", rosenbrock_fun, rosenbrock_x);
+    bench_step_search_problem<Chimes::NonlinearCG>("cg", "powell", powell_fun, powell_x);
+    bench_step_search_problem<Chimes::NonlinearCG>("cg", "trigonometric", trigonometric_fun, trigonometric_x);
+    bench_step_search_problem<Chimes::NonlinearCG>("cg", "quadratic", quadratic, quadratic_x);
+}
+
+//One LBFGS solve with the given history, on a workspace kept alive to read the size of the history.
+template <class History, class Fun>
+void bench_history_precision(const char* fun_name, const char* history_name, Fun& fun, const Eigen::VectorXd& init_x)
+{
+    Chimes::LBFGSWorkspace<double, Eigen::Dynamic, Eigen::Dynamic, History> workspace;
+    Chimes::LBFGS<Fun, double, Eigen::Dynamic, Eigen::Dynamic, History> lbfgs(fun, init_x, workspace);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.max_iteration_ = 2000;
+    lbfgs.parameter_.is_profile_ = true;
+    lbfgs.solve();
+    const auto& result = lbfgs.get_result();
+    const double iterations = double(std::max<size_t>(result.iter_time, 1));
+    std::cout << fun_name << "\t" << init_x.size() << "\t" << history_name << "\t" << workspace.history.bytes() / 1048576.0 << "\t"
+        << result.iter_time << "\t" << result.fval_eval_time << "\t" << result.direction_seconds / iterations * 1e6 << "\t"
+        << result.solve_seconds / iterations * 1e6 << "\t" << result.fval << "\t" << result.res_gradient.norm() << std::endl;
+}
+
+//Float against double storage of the LBFGS history: memory, time of the two-loop recursion and convergence.
+void bench_mixed_precision(size_t max_n)
+{
+    using DoubleHistory = Chimes::LBFGSVectorHistory<double>;
+    using FloatHistory = Chimes::LBFGSVectorHistory<double, Eigen::Dynamic, Eigen::Dynamic, float>;
+    std::cout << "[mixed precision] LBFGS history storage, microseconds per iteration" << std::endl;
+    std::cout << "function\tn\thistory\tMB\titerations\tvalues\tdirection\titeration\tfval\tgradient" << std::endl;
+    for (size_t n = 10000; n <= max_n; n *= 10)
+    {
+        Eigen::VectorXd powell_x(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            const double powell_start[] = { 3, -1, 0, 1 };
+            powell_x(i) = powell_start[i % 4];
+        }
+        auto powell_fun = extended_powell;
+        bench_history_precision<DoubleHistory>("powell", "double", powell_fun, powell_x);
+        bench_history_precision<FloatHistory>("powell", "float", powell_fun, powell_x);
+        const Eigen::VectorXd quadratic_x = Eigen::VectorXd::Zero(n);
+        Quadratic quadratic(n, 1e4);
+        bench_history_precision<DoubleHistory>("quadratic", "double", quadratic, quadratic_x);
+        bench_history_precision<FloatHistory>("quadratic", "float", quadratic, quadratic_x);
+    }
+}
+
+//rosenbrock() and trigonometric() as value-only functors on any scalar, for the automatic differentiation.
+class RosenbrockValue
+{
+public:
+    template <class Vector>
+    typename Vector::Scalar operator()(const Vector& x) const
+    {
+        using Real = typename Vector::Scalar;
+        Real fval(0);
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const Real t = x(j + 1) - x(j) * x(j);
+            const Real u = 1.0 - x(j);
+            fval += 100.0 * t * t + u * u;
+        }
+        return fval;
+    }
+};
+class TrigonometricValue
+{
+public:
+    template <class Vector>
+    typename Vector::Scalar operator()(const Vector& x) const
+    {
+        using std::cos, std::sin;
+        using Real = typename Vector::Scalar;
+        const double n = double(x.size());
+        Real cos_sum(0);
+        for (Eigen::Index i = 0; i < x.size(); ++i)
+            cos_sum += cos(x(i));
+        Real fval(0);
+        for (Eigen::Index i = 0; i < x.size(); ++i)
+        {
+            const Real f = n - cos_sum + double(i + 1) * (1.0 - cos(x(i))) - sin(x(i));
+            fval += f * f;
+        }
+        return fval;
+    }
+};
+
+//Microseconds per evaluation of the value alone, and of the gradient written by hand, in forward mode and in reverse mode.
+//Forward mode costs n / 8 evaluations and is only run up to n = 1000.
+template <class Value, class Hand>
+void bench_autodiff_problem(const char* fun_name, Hand& hand, size_t n)
+{
+    const Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1.0, 1.0);
+    Eigen::VectorXd gradient(n);
+    Value value;
+    auto forward = Chimes::optimization::make_forward_objective(Value());
+    auto reverse = Chimes::optimization::make_reverse_objective(Value());
+    const size_t evaluations = std::max<size_t>(10, 10000000 / n);
+    double sink = 0;
+    auto time = [&](auto&& evaluate)
+    {
+        evaluate();
+        const double seconds = wall_time([&]()
+        {
+            for (size_t i = 0; i < evaluations; ++i)
+                sink += evaluate();
+        });
+        return seconds / evaluations * 1e6;
+    };
+    const double value_time = time([&]() { return value(x); });
+    const double hand_time = time([&]() { return hand(x, gradient); });
+    const double reverse_time = time([&]() { return reverse(x, gradient); });
+    std::cout << fun_name << "\t" << n << "\t" << value_time << "\t" << hand_time << "\t";
+    if (n <= 1000)
+    {
+        const double forward_time = time([&]() { return forward(x, gradient); });
+        std::cout << forward_time << "\t" << forward_time / hand_time << "\t";
+    }
+    else
+    {
+        std::cout << "-\t-\t";
+    }
+    std::cout << reverse_time << "\t" << reverse_time / hand_time << (sink == 0.5 ? " " : "") << std::endl;
+}
+
+void bench_autodiff(size_t max_n)
+{
+    std::cout << "[autodiff] microseconds per gradient, and slowdown against the hand-written gradient" << std::endl;
+    std::cout << "function\tn\tvalue\thand\tforward\tslowdown\treverse\tslowdown" << std::endl;
+    auto rosenbrock_fun = rosenbrock;
+    auto trigonometric_fun = trigonometric;
+    for (size_t n = 10; n <= max_n; n *= 10)
+    {
+        bench_autodiff_problem<RosenbrockValue>("rosenbrock", rosenbrock_fun, n);
+        bench_autodiff_problem<TrigonometricValue>("trigonometric", trigonometric_fun, n);
+    }
+}
+
+//The elements of rosenbrock(), element j on x_j and x_j+1, on any scalar.
+class RosenbrockElements
+{
+public:
+    template <class Vector, class ElementVector>
+    void operator()(const Vector& x, ElementVector& elements) const
+    {
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const auto t = x(j + 1) - x(j) * x(j);
+            const auto u = 1.0 - x(j);
+            elements(j) = 100.0 * t * t + u * u;
+        }
+    }
+};
+
+//Milliseconds per gradient of rosenbrock() by central differences, serial and on a pool of threads, and by the
+//coloring of its elements with central differences and the complex step.
+void bench_finite_difference(size_t max_n, size_t threads)
+{
+    using Chimes::optimization::DifferenceScheme;
+    Chimes::ThreadPool pool(threads);
+    std::cout << "[finite difference] milliseconds per gradient of rosenbrock, " << threads << " threads" << std::endl;
+    std::cout << "n\thand\tcentral\tparallel\tcolored\tcolored complex" << std::endl;
+    for (size_t n = 100; n <= max_n; n *= 10)
+    {
+        const Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1.0, 1.0);
+        Eigen::VectorXd gradient(n);
+        std::vector<std::vector<Eigen::Index>> pattern(n - 1);
+        for (size_t j = 0; j + 1 < n; ++j)
+            pattern[j] = { Eigen::Index(j), Eigen::Index(j + 1) };
+        auto central = Chimes::optimization::make_finite_difference_objective(RosenbrockValue(), DifferenceScheme::CENTRAL);
+        auto parallel = Chimes::optimization::make_finite_difference_objective(RosenbrockValue(), DifferenceScheme::CENTRAL, &pool);
+        Chimes::optimization::ColoredFiniteDifferenceObjective<RosenbrockElements> colored(RosenbrockElements(), pattern);
+        Chimes::optimization::ColoredFiniteDifferenceObjective<RosenbrockElements> colored_complex(RosenbrockElements(), pattern,
+            DifferenceScheme::COMPLEX_STEP);
+        const size_t dense_evaluations = std::max<size_t>(1, 1000000 / (n * n));
+        const size_t evaluations = std::max<size_t>(10, 10000000 / n);
+        auto time = [&](size_t count, auto&& evaluate)
+        {
+            evaluate();
+            return wall_time([&]()
+            {
+                for (size_t i = 0; i < count; ++i)
+                    evaluate();
+            }) / count * 1e3;
+        };
+        std::cout << n << "\t" << time(evaluations, [&]() { return rosenbrock(x, gradient); })
+            << "\t" << time(dense_evaluations, [&]() { return central(x, gradient); })
+            << "\t" << time(dense_evaluations, [&]() { return parallel(x, gradient); })
+            << "\t" << time(evaluations, [&]() { return colored(x, gradient); })
+            << "\t" << time(evaluations, [&]() { return colored_complex(x, gradient); }) << std::endl;
+    }
+}
+
+//rosenbrock() as the residuals 10 (x_j+1 - x_j^2) and 1 - x_j with a sparse Jacobian, f = 1/2 * rosenbrock().
+class RosenbrockResiduals
+{
+public:
+    explicit RosenbrockResiduals(Eigen::Index n) : n_(n)
+    {
+
+    }
+    size_t residuals() const
+    {
+        return 2 * (n_ - 1);
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual) const
+    {
+        for (Eigen::Index j = 0; j + 1 < n_; ++j)
+        {
+            residual(2 * j) = 10.0 * (x(j + 1) - x(j) * x(j));
+            residual(2 * j + 1) = 1.0 - x(j);
+        }
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual, Eigen::SparseMatrix<double>& jacobian)
+    {
+        (*this)(x, residual);
+        triplets_.clear();
+        for (Eigen::Index j = 0; j + 1 < n_; ++j)
+        {
+            triplets_.emplace_back(2 * j, j, -20.0 * x(j));
+            triplets_.emplace_back(2 * j, j + 1, 10.0);
+            triplets_.emplace_back(2 * j + 1, j, -1.0);
+        }
+        jacobian.setFromTriplets(triplets_.begin(), triplets_.end());
+    }
+private:
+    Eigen::Index n_;
+    std::vector<Eigen::Triplet<double>> triplets_;
+};
+
+//Iterations and seconds to solve rosenbrock() from 0.5 by Levenberg-Marquardt with a sparse Cholesky factorization
+//and with CGLS, and by LBFGS on the sum of squares.
+void bench_least_squares(size_t max_n)
+{
+    using Sparse = Chimes::LevenbergMarquardt<RosenbrockResiduals, double, Eigen::SparseMatrix<double>>;
+    std::cout << "[least squares] rosenbrock from 0.5, iterations and seconds" << std::endl;
+    std::cout << "n\tcholesky\ttime\tcgls\ttime\tlbfgs\ttime" << std::endl;
+    for (size_t n = 1000; n <= max_n; n *= 10)
+    {
+        const Eigen::VectorXd init_x = Eigen::VectorXd::Constant(n, 0.5);
+        RosenbrockResiduals residuals(n);
+        Sparse cholesky(residuals, init_x);
+        Sparse cgls(residuals, init_x);
+        cholesky.parameter_.is_show_ = false;
+        cgls.parameter_.is_show_ = false;
+        cgls.parameter_.linear_solver_ = Sparse::LinearSolver::CGLS;
+        auto fun = rosenbrock;
+        Chimes::LBFGS<decltype(fun), double> lbfgs(fun, init_x);
+        lbfgs.parameter_.is_show_ = false;
+        lbfgs.parameter_.max_iteration_ = 100000;
+        const double cholesky_seconds = wall_time([&]() { cholesky.solve(); });
+        const double cgls_seconds = wall_time([&]() { cgls.solve(); });
+        const double lbfgs_seconds = wall_time([&]() { lbfgs.solve(); });
+        std::cout << n << "\t" << cholesky.get_result().iter_time << "\t" << cholesky_seconds << "\t" << cgls.get_result().iter_time
+            << "\t" << cgls_seconds << "\t" << lbfgs.get_result().iter_time << "\t" << lbfgs_seconds << std::endl;
+    }
+}
+
+//Transform and covariance of n float points, as an array of Point3f and as a PointCloud3f, in GB/s of coordinates read
+//and written (12 bytes a point, both passes of the covariance counted), the point cloud also on 1 to max_threads threads.
+void bench_point_cloud(size_t n, size_t max_threads)
+{
+    using namespace Chimes::geometry;
+    std::cout << "[point cloud] n = " << n << ", GB/s" << std::endl;
+    std::cout << "layout\tthreads\ttransform\tcovariance" << std::endl;
+    Matrix3f rotation;
+    rotation(0, 0) = 0.6f;
+    rotation(0, 1) = -0.8f;
+    rotation(1, 0) = 0.8f;
+    rotation(1, 1) = 0.6f;
+    rotation(2, 2) = 1.0f;
+    const Point3f translation(1.0f, 2.0f, 3.0f);
+    const double bytes = 3.0 * sizeof(float) * n;
+    const int repeat = 5;
+    std::vector<Point3f> points(n);
+    PointCloud3f cloud(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        points[i] = Point3f(float(i % 1000), float(i % 777), float(i % 555));
+        cloud.set(i, points[i]);
+    }
+    Matrix3f covariance;
+    //Keeps the covariance of the array of points from being optimized away.
+    volatile float trace = 0;
+    const double aos_transform = wall_time([&]()
+    {
+        for (int r = 0; r < repeat; ++r)
+        {
+            for (Point3f& p : points)
+                p = rotation * p + translation;
+        }
+    });
+    const double aos_covariance = wall_time([&]()
+    {
+        for (int r = 0; r < repeat; ++r)
+        {
+            Point3f centroid;
+            for (const Point3f& p : points)
+                centroid += p;
+            centroid /= float(n);
+            covariance = Matrix3f();
+            for (const Point3f& p : points)
+            {
+                const Point3f d = p - centroid;
+                for (size_t a = 0; a < 3; ++a)
+                {
+                    for (size_t b = 0; b < 3; ++b)
+                        covariance(a, b) += d[a] * d[b];
+                }
+            }
+            trace = trace + covariance.Trace();
+        }
+    });
+    std::cout << "aos\t1\t" << 2 * bytes * repeat / aos_transform * 1e-9 << "\t" << 2 * bytes * repeat / aos_covariance * 1e-9 << std::endl;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        Chimes::ThreadPool pool(threads);
+        cloud.set_thread_pool(&pool);
+        const double transform = wall_time([&]()
+        {
+            for (int r = 0; r < repeat; ++r)
+                cloud.transform(rotation, translation);
+        });
+        const double soa_covariance = wall_time([&]()
+        {
+            for (int r = 0; r < repeat; ++r)
+                covariance = cloud.covariance();
+        });
+        std::cout << "soa\t" << threads << "\t" << 2 * bytes * repeat / transform * 1e-9 << "\t" << 2 * bytes * repeat / soa_covariance * 1e-9
+            << std::endl;
+    }
+}
+
+//Build of a k-d tree over n random points, 8 nearest neighbours of 100000 queries, on 1 to max_threads threads, and the
+//time to map a saved tree back instead of building it.
+void bench_kd_tree(size_t n, size_t max_threads)
+{
+    using namespace Chimes::geometry;
+    using Tree = KdTree<Point3f>;
+    const size_t m = 100000, k = 8;
+    std::cout << "[k-d tree] n = " << n << ", seconds" << std::endl;
+    std::cout << "threads\tbuild\tknn\tqueries/s" << std::endl;
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<Point3f> points(n), queries(m);
+    for (Point3f& p : points)
+        p = Point3f(uniform(generator), uniform(generator), uniform(generator));
+    for (Point3f& q : queries)
+        q = Point3f(uniform(generator), uniform(generator), uniform(generator));
+    std::vector<Tree::Index> indices(m * k);
+    std::vector<float> distances(m * k);
+    Tree tree;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        Chimes::ThreadPool pool(threads);
+        const double build = wall_time([&]() { tree.build(points.data(), n, &pool); });
+        const double knn = wall_time([&]() { tree.knn(queries.data(), m, k, indices.data(), distances.data(), &pool); });
+        std::cout << threads << "\t" << build << "\t" << knn << "\t" << m / knn << std::endl;
+    }
+    const std::string path = (std::filesystem::temp_directory_path() / "chimes_bench_kd_tree.bin").string();
+    tree.save(path);
+    Tree mapped;
+    const double open = wall_time([&]() { mapped.open(path); });
+    const double knn = wall_time([&]() { mapped.knn(queries.data(), m, k, indices.data(), distances.data()); });
+    std::cout << "mapped\t" << open << "\t" << knn << "\t" << m / knn << std::endl;
+    mapped = Tree();
+    std::filesystem::remove(path);
+}
+
+//Usage: chimes_bench [max_n] [max_threads]
+//       chimes_bench --suite [--min-n n] [--max-n n] [--max-iteration k] [--json file]
+//The first form prints the tables of the benchmarks above, the second runs the parameterized suite (see suite.h)
+//and writes its results as JSON to file, or to stdout for "-", the table then going to stderr.
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::strcmp(argv[1], "--suite") == 0)
+    {
+        SuiteOptions options;
+        for (int i = 2; i < argc; i += 2)
+        {
+            if (i + 1 == argc)
+            {
+                std::cout << "[error][chimes_bench] missing value of option " << argv[i] << std::endl;
+                return 1;
+            }
+            if (std::strcmp(argv[i], "--min-n") == 0)
+                options.min_n_ = std::strtoull(argv[i + 1], nullptr, 10);
+            else if (std::strcmp(argv[i], "--max-n") == 0)
+                options.max_n_ = std::strtoull(argv[i + 1], nullptr, 10);
+            else if (std::strcmp(argv[i], "--max-iteration") == 0)
+                options.max_iteration_ = std::strtoull(argv[i + 1], nullptr, 10);
+            else if (std::strcmp(argv[i], "--json") == 0)
+                options.json_ = argv[i + 1];
+            else
+            {
+                std::cout << "[error][chimes_bench] unknown option " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        run_suite(options);
+        return 0;
+    }
+    const size_t max_n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+    bench_lbfgs_history(max_n);
+    bench_mapped_history(max_n);
+    bench_parallel_scaling(max_n, max_threads);
+    bench_mixed_precision(max_n);
+    bench_batch_lbfgs(10000);
+    bench_fixed_size(10000);
+    bench_evaluation_overhead(10000000);
+    bench_autodiff(std::min<size_t>(max_n, 1000000));
+    bench_finite_difference(std::min<size_t>(max_n, 10000), max_threads);
+    bench_least_squares(max_n);
+    bench_point_cloud(10 * max_n, max_threads);
+    bench_kd_tree(max_n, max_threads);
+    bench_step_search(100);
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include "suite.h"
+#include <Chimes/Optimization/lbfgs.h>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <random>
+#include <stdexcept>
+
+#ifndef CHIMES_VERSION
+#define CHIMES_VERSION "unknown"
+#endif
+
+//Number of heap allocations. With glibc malloc itself is replaced, so the allocations of Eigen are counted as well;
+//elsewhere only operator new is.
+static std::atomic<size_t> g_allocation_count(0);
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    ++g_allocation_count;
+    return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t count, size_t size)
+{
+    ++g_allocation_count;
+    return __libc_calloc(count, size);
+}
+extern "C" void* realloc(void* p, size_t size)
+{
+    ++g_allocation_count;
+    return __libc_realloc(p, size);
+}
+#else
+void* operator new(size_t size)
+{
+    ++g_allocation_count;
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+namespace
+{
+    //Extended Rosenbrock, minimum 0 at (1, ..., 1).
+    class Rosenbrock
+    {
+    public:
+        double operator()(const Eigen::VectorXd& x, Eigen::VectorXd& gradient) const
+        {
+            const Eigen::Index n = x.size();
+            const auto x0 = x.head(n - 1).array();
+            const auto t = x.tail(n - 1).array() - x0.square();
+            const auto u = 1.0 - x0;
+            gradient.head(n - 1) = (-400.0 * t * x0 - 2.0 * u).matrix();
+            gradient(n - 1) = 0;
+            gradient.tail(n - 1) += (200.0 * t).matrix();
+            return (100.0 * t.square() + u.square()).sum();
+        }
+    };
+
+    //0.5 * sum_i lambda_i * (x_i - 1)^2 with the eigenvalues lambda_i spread logarithmically over [1, condition].
+    class SpectrumQuadratic
+    {
+    public:
+        SpectrumQuadratic(size_t n, double condition) : lambda_(n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                lambda_(i) = std::pow(condition, n > 1 ? double((i * 7919) % n) / double(n - 1) : 0.0);
+        }
+        double operator()(const Eigen::VectorXd& x, Eigen::VectorXd& gradient) const
+        {
+            const auto r = x.array() - 1.0;
+            gradient = (lambda_.array() * r).matrix();
+            return 0.5 * (lambda_.array() * r.square()).sum();
+        }
+    private:
+        Eigen::VectorXd lambda_;
+    };
+
+    //L2-regularized logistic regression on synthetic data: Gaussian features whose scales spread over
+    //[1, sqrt(condition)], labels of a planted model with 10% of them flipped.
+    class LogisticRegression
+    {
+    public:
+        LogisticRegression(size_t samples, size_t n, double condition, double lambda) : data_(samples, n), labels_(samples),
+            margin_(samples), lambda_(lambda)
+        {
+            std::mt19937_64 random(n * 31 + samples);
+            std::normal_distribution<double> normal;
+            std::uniform_real_distribution<double> uniform;
+            for (size_t j = 0; j < n; ++j)
+            {
+                const double scale = std::pow(condition, n > 1 ? 0.5 * j / double(n - 1) : 0.0);
+                for (size_t i = 0; i < samples; ++i)
+                    data_(i, j) = scale * normal(random);
+            }
+            Eigen::VectorXd planted(n);
+            for (size_t j = 0; j < n; ++j)
+                planted(j) = normal(random) / std::sqrt(double(n));
+            margin_.noalias() = data_ * planted;
+            for (size_t i = 0; i < samples; ++i)
+                labels_(i) = (margin_(i) > 0) != (uniform(random) < 0.1) ? 1.0 : -1.0;
+        }
+        double operator()(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+        {
+            const double samples = double(labels_.size());
+            margin_.noalias() = data_ * x;
+            margin_.array() *= labels_.array();
+            //log(1 + exp(-m)) without overflow.
+            const double loss = ((-margin_.array().abs()).exp().log1p() + (-margin_.array()).max(0.0)).sum();
+            //d loss / d margin = -1 / (1 + exp(m)), times the label.
+            margin_ = (-labels_.array() / (1.0 + margin_.array().exp()) / samples).matrix();
+            gradient.noalias() = data_.transpose() * margin_;
+            gradient += lambda_ * x;
+            return loss / samples + 0.5 * lambda_ * x.squaredNorm();
+        }
+    private:
+        Eigen::MatrixXd data_;
+        Eigen::VectorXd labels_;
+        Eigen::VectorXd margin_;
+        double lambda_;
+    };
+
+    class Record
+    {
+    public:
+        std::string problem;
+        size_t n;
+        //NaN when the problem has no condition parameter.
+        double condition;
+        int remain;
+        size_t iterations;
+        size_t fval_evaluations;
+        size_t gradient_evaluations;
+        size_t allocations;
+        double seconds;
+        double fval;
+        double gradient_norm;
+    };
+
+    //Stream of the table, stderr when the JSON goes to stdout so that stdout stays parseable.
+    std::ostream& table_stream(const SuiteOptions& options)
+    {
+        return options.json_ == "-" ? std::cerr : std::cout;
+    }
+
+    //Solve with a fresh solver, so the allocations include the first-time setup of its workspace.
+    template <class Fun>
+    Record solve_case(const char* problem, Fun& fun, const Eigen::VectorXd& init_x, double condition, int remain, const SuiteOptions& options)
+    {
+        Chimes::LBFGS<Fun, double> lbfgs(fun, init_x);
+        lbfgs.parameter_.is_show_ = false;
+        lbfgs.parameter_.max_iteration_ = options.max_iteration_;
+        lbfgs.parameter_.lbfgs_remain_ = remain;
+        const size_t before = g_allocation_count;
+        lbfgs.solve();
+        const size_t allocations = g_allocation_count - before;
+        const auto& result = lbfgs.get_result();
+        Record record;
+        record.problem = problem;
+        record.n = init_x.size();
+        record.condition = condition;
+        record.remain = remain;
+        record.iterations = result.iter_time;
+        record.fval_evaluations = result.fval_eval_time;
+        record.gradient_evaluations = result.gradient_eval_time;
+        record.allocations = allocations;
+        record.seconds = result.solve_seconds;
+        record.fval = result.fval;
+        record.gradient_norm = result.res_gradient.norm();
+        std::ostream& table = table_stream(options);
+        table << record.problem << "\t" << record.n << "\t";
+        if (std::isnan(condition))
+            table << "-";
+        else
+            table << condition;
+        table << "\t" << remain << "\t" << record.iterations << "\t" << record.fval_evaluations << "\t" << record.gradient_evaluations
+            << "\t" << record.allocations << "\t" << record.seconds << "\t" << record.fval << std::endl;
+        return record;
+    }
+
+    //JSON number, null if not finite.
+    void write_number(std::ostream& os, double value)
+    {
+        if (std::isfinite(value))
+            os << value;
+        else
+            os << "null";
+    }
+
+    void write_json(std::ostream& os, const SuiteOptions& options, const std::vector<Record>& records)
+    {
+        os << std::setprecision(17);
+        os << "{\n  \"chimes_version\": \"" << CHIMES_VERSION << "\",\n";
+        os << "  \"solver\": \"lbfgs\",\n";
+        os << "  \"max_iteration\": " << options.max_iteration_ << ",\n";
+        os << "  \"logistic_samples\": " << options.samples_ << ",\n";
+        os << "  \"results\": [";
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            const Record& record = records[i];
+            os << (i == 0 ? "\n" : ",\n");
+            os << "    {\"problem\": \"" << record.problem << "\", \"n\": " << record.n << ", \"condition\": ";
+            write_number(os, record.condition);
+            os << ", \"lbfgs_remain\": " << record.remain << ", \"iterations\": " << record.iterations
+                << ", \"fval_evaluations\": " << record.fval_evaluations << ", \"gradient_evaluations\": " << record.gradient_evaluations
+                << ", \"allocations\": " << record.allocations << ", \"wall_seconds\": ";
+            write_number(os, record.seconds);
+            os << ", \"fval\": ";
+            write_number(os, record.fval);
+            os << ", \"gradient_norm\": ";
+            write_number(os, record.gradient_norm);
+            os << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+}
+
+void run_suite(const SuiteOptions& options)
+{
+    std::vector<Record> records;
+    std::ostream& table = table_stream(options);
+    table << "[suite] LBFGS, at most " << options.max_iteration_ << " iterations per solve" << std::endl;
+    table << "problem\tn\tcondition\tm\titerations\tvalues\tgradients\tallocations\tseconds\tfval" << std::endl;
+    for (size_t n = options.min_n_; n <= options.max_n_; n *= 10)
+    {
+        Eigen::VectorXd rosenbrock_x(n);
+        for (size_t i = 0; i < n; ++i)
+            rosenbrock_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+        Rosenbrock rosenbrock;
+        for (int remain : options.remains_)
+            records.push_back(solve_case("rosenbrock", rosenbrock, rosenbrock_x, std::numeric_limits<double>::quiet_NaN(), remain, options));
+        rosenbrock_x.resize(0);
+
+        const Eigen::VectorXd zero = Eigen::VectorXd::Zero(n);
+        for (double condition : options.conditions_)
+        {
+            SpectrumQuadratic quadratic(n, condition);
+            for (int remain : options.remains_)
+                records.push_back(solve_case("quadratic", quadratic, zero, condition, remain, options));
+        }
+        if (n > options.max_logistic_n_)
+            continue;
+        for (double condition : options.conditions_)
+        {
+            LogisticRegression logistic(options.samples_, n, condition, 1e-4);
+            for (int remain : options.remains_)
+                records.push_back(solve_case("logistic", logistic, zero, condition, remain, options));
+        }
+    }
+    if (options.json_.empty())
+        return;
+    if (options.json_ == "-")
+    {
+        write_json(std::cout, options, records);
+        return;
+    }
+    std::ofstream file(options.json_);
+    if (!file)
+    {
+        std::cout << "[error][suite] can't open " << options.json_ << std::endl;
+        throw std::runtime_error("[error][suite] can't open " + options.json_);
+    }
+    write_json(file, options, records);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Options of the benchmark suite, see run_suite().
+class SuiteOptions
+{
+public:
+    SuiteOptions() : min_n_(10), max_n_(10000000), max_logistic_n_(10000), samples_(1000), max_iteration_(100),
+        conditions_({ 1e2, 1e4, 1e6 }), remains_({ 3, 6, 12 })
+    {
+
+    }
+public:
+    //Dimensions from min_n_ to max_n_ by factors of 10.
+    size_t min_n_;
+    size_t max_n_;
+    //Logistic regression stores samples_ x n data, so it stops at a smaller dimension.
+    size_t max_logistic_n_;
+    size_t samples_;
+    //Iterations per solve, so that the largest problems finish in bounded time.
+    size_t max_iteration_;
+    //Condition numbers of the quadratic and of the feature scales of the logistic regression.
+    std::vector<double> conditions_;
+    //Values of lbfgs_remain_.
+    std::vector<int> remains_;
+    //File for the JSON results, "-" for stdout, empty for none.
+    std::string json_;
+};
+
+//Solve the classic problems with LBFGS for every dimension, condition number and lbfgs_remain_ of options and report
+//wall time, iterations, evaluations and heap allocations per solve, as a table and optionally as JSON.
+void run_suite(const SuiteOptions& options);
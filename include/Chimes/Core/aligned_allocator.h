@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+namespace Chimes
+{
+    //Allocator of memory aligned to Alignment bytes, e.g. std::vector<float, AlignedAllocator<float, 64>> starts on a cache
+    //line, so the loops over it can use aligned SIMD loads of any width.
+    template <class T, size_t Alignment = 64>
+    class AlignedAllocator
+    {
+    public:
+        using value_type = T;
+        static constexpr size_t alignment = Alignment < alignof(T) ? alignof(T) : Alignment;
+        template <class U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+    public:
+        AlignedAllocator() noexcept
+        {
+
+        }
+        template <class U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept
+        {
+
+        }
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+        }
+        void deallocate(T* p, size_t) noexcept
+        {
+            ::operator delete(p, std::align_val_t(alignment));
+        }
+        template <class U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept
+        {
+            return true;
+        }
+    };
+} // namespace Chimes
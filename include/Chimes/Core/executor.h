@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Chimes
+{
+    //Runs submitted jobs, e.g. the solves of solve_async(). Implement it to run the jobs on the thread pool of an
+    //application.
+    class Executor
+    {
+    public:
+        virtual ~Executor() = default;
+        //Run job later on some thread. job must not throw.
+        virtual void submit(std::function<void()> job) = 0;
+    };
+
+    //Executor of a fixed number of threads taking the jobs from a queue in order, so many solves share a bounded number
+    //of threads. Unlike ThreadPool, whose parallelFor() splits one loop, each job runs whole on one thread.
+    //The destructor runs the jobs still queued, then joins the threads.
+    class QueueExecutor final : public Executor
+    {
+    public:
+        //0 means std::thread::hardware_concurrency().
+        explicit QueueExecutor(size_t num_threads = 0) : stop_(false)
+        {
+            if (num_threads == 0)
+                num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            workers_.reserve(num_threads);
+            for (size_t i = 0; i < num_threads; ++i)
+                workers_.emplace_back([this]() { workerLoop(); });
+        }
+        QueueExecutor(const QueueExecutor&) = delete;
+        QueueExecutor& operator=(const QueueExecutor&) = delete;
+        ~QueueExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (std::thread& worker : workers_)
+                worker.join();
+        }
+        size_t size() const
+        {
+            return workers_.size();
+        }
+        void submit(std::function<void()> job) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(std::move(job));
+            }
+            cv_.notify_one();
+        }
+        //Jobs waiting for a thread.
+        size_t pending() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return jobs_.size();
+        }
+    private:
+        void workerLoop()
+        {
+            while (1)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+                    if (jobs_.empty())
+                        return;
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
+                }
+                job();
+            }
+        }
+    private:
+        std::vector<std::thread> workers_;
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::function<void()>> jobs_;
+        bool stop_;
+    };
+}
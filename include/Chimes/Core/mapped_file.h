@@ -0,0 +1,228 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Chimes
+{
+    //A file mapped in memory. The pages are read on first access and written back by the system, so a mapping can be much
+    //larger than the physical memory; only the pages in use stay resident.
+    class MappedFile
+    {
+    public:
+        MappedFile() : data_(nullptr), size_(0)
+        {
+#ifdef _WIN32
+            file_ = INVALID_HANDLE_VALUE;
+            mapping_ = nullptr;
+#else
+            file_ = -1;
+#endif
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept : MappedFile()
+        {
+            swap(other);
+        }
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                swap(other);
+            }
+            return *this;
+        }
+        ~MappedFile()
+        {
+            close();
+        }
+        //Create the file at path with bytes bytes, replacing any existing file, and map it for reading and writing.
+        //The disk space is reserved up front where the system allows it, so a full disk is reported here and not on a
+        //later write through the mapping.
+        void create(const std::string& path, size_t bytes)
+        {
+            close();
+#ifdef _WIN32
+            file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+            file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+#endif
+            map(path, bytes, true, true);
+        }
+        //Create a file of bytes bytes in directory, deleted when the mapping is closed, and map it for reading and writing.
+        void createTemporary(const std::string& directory, size_t bytes)
+        {
+            close();
+#ifdef _WIN32
+            char path[MAX_PATH];
+            if (GetTempFileNameA(directory.c_str(), "chm", 0, path) == 0)
+                fail("can't create a temporary file in", directory);
+            file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+            map(path, bytes, true, true);
+#else
+            std::string path = (std::filesystem::path(directory) / "chimes_XXXXXX").string();
+            file_ = ::mkstemp(path.data());
+            //The name is removed at once, the file lives until the descriptor is closed.
+            if (file_ != -1)
+                ::unlink(path.c_str());
+            map(path, bytes, true, true);
+#endif
+        }
+        //Map an existing file, read only unless is_writable.
+        void open(const std::string& path, bool is_writable = false)
+        {
+            close();
+#ifdef _WIN32
+            file_ = CreateFileA(path.c_str(), GENERIC_READ | (is_writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER size;
+            size.QuadPart = 0;
+            if (file_ != INVALID_HANDLE_VALUE)
+                GetFileSizeEx(file_, &size);
+            map(path, size_t(size.QuadPart), is_writable, false);
+#else
+            file_ = ::open(path.c_str(), is_writable ? O_RDWR : O_RDONLY);
+            struct stat status;
+            if (file_ != -1 && ::fstat(file_, &status) != 0)
+                fail("can't read the size of", path);
+            map(path, file_ == -1 ? 0 : size_t(status.st_size), is_writable, false);
+#endif
+        }
+        //Unmap and close the file, the pages written so far are kept in it.
+        void close()
+        {
+#ifdef _WIN32
+            if (data_ != nullptr)
+                UnmapViewOfFile(data_);
+            if (mapping_ != nullptr)
+                CloseHandle(mapping_);
+            if (file_ != INVALID_HANDLE_VALUE)
+                CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+            mapping_ = nullptr;
+#else
+            if (data_ != nullptr)
+                ::munmap(data_, size_);
+            if (file_ != -1)
+                ::close(file_);
+            file_ = -1;
+#endif
+            data_ = nullptr;
+            size_ = 0;
+        }
+        bool isOpen() const
+        {
+            return data_ != nullptr;
+        }
+        //Null for an empty file.
+        char* data()
+        {
+            return static_cast<char*>(data_);
+        }
+        const char* data() const
+        {
+            return static_cast<const char*>(data_);
+        }
+        size_t size() const
+        {
+            return size_;
+        }
+        //Start reading [offset, offset + length) in the background, so a later access does not wait for the disk.
+        //Only a hint: it returns at once and may do nothing.
+        void willNeed(size_t offset, size_t length) const
+        {
+            if (data_ == nullptr || offset >= size_)
+                return;
+            length = std::min(length, size_ - offset);
+#ifdef _WIN32
+            WIN32_MEMORY_RANGE_ENTRY range;
+            range.VirtualAddress = static_cast<char*>(data_) + offset;
+            range.NumberOfBytes = length;
+            PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+            //madvise() needs an address aligned on a page.
+            static const size_t page = size_t(::sysconf(_SC_PAGESIZE));
+            const size_t begin = offset / page * page;
+            ::madvise(static_cast<char*>(data_) + begin, offset + length - begin, MADV_WILLNEED);
+#endif
+        }
+    private:
+        //Map the file just opened, resized to bytes first if is_resize.
+        void map(const std::string& path, size_t bytes, bool is_writable, bool is_resize)
+        {
+#ifdef _WIN32
+            if (file_ == INVALID_HANDLE_VALUE)
+                fail("can't open", path);
+            if (bytes == 0)
+                return;
+            LARGE_INTEGER size;
+            size.QuadPart = LONGLONG(bytes);
+            mapping_ = CreateFileMappingA(file_, nullptr, is_writable ? PAGE_READWRITE : PAGE_READONLY, DWORD(size.HighPart),
+                size.LowPart, nullptr);
+            if (mapping_ == nullptr)
+                fail("can't map", path);
+            data_ = MapViewOfFile(mapping_, is_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, bytes);
+            if (data_ == nullptr)
+                fail("can't map", path);
+#else
+            if (file_ == -1)
+                fail("can't open", path);
+            if (is_resize && ::ftruncate(file_, off_t(bytes)) != 0)
+                fail("can't resize", path);
+#ifdef __linux__
+            if (is_resize && bytes > 0 && ::posix_fallocate(file_, 0, off_t(bytes)) != 0)
+                fail("not enough disk space for", path);
+#endif
+            if (bytes == 0)
+                return;
+            void* data = ::mmap(nullptr, bytes, is_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file_, 0);
+            if (data == MAP_FAILED)
+                fail("can't map", path);
+            data_ = data;
+#endif
+            size_ = bytes;
+        }
+        void fail(const char* message, const std::string& path)
+        {
+            close();
+            std::cout << "[error][MappedFile] " << message << " " << path << std::endl;
+            throw std::runtime_error(std::string("[error][MappedFile] ") + message + " " + path);
+        }
+        void swap(MappedFile& other) noexcept
+        {
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            std::swap(file_, other.file_);
+#ifdef _WIN32
+            std::swap(mapping_, other.mapping_);
+#endif
+        }
+    private:
+        void* data_;
+        size_t size_;
+#ifdef _WIN32
+        HANDLE file_;
+        HANDLE mapping_;
+#else
+        int file_;
+#endif
+    };
+} // namespace Chimes
@@ -1,8 +1,12 @@
 #pragma once
+#include <atomic>
 #include <cmath>
+#include <limits>
 namespace Chimes
 {
     //Operations related to numerical comparisons and calculations are accessed through singletons.
+    //The precisions of sign() can be changed at run time by set_precision() from any thread, a comparison reads the
+    //last one set without a lock. When the precision is known at compile time, NumericPolicy has no shared state at all.
     class Numerical
     {
     public:
@@ -26,7 +30,6 @@ namespace Chimes
         //Get singleton instance.
         static Numerical& instance()
         {
-            static Numerical instance_;
             return instance_;
         }
         //Square root
@@ -37,7 +40,7 @@ namespace Chimes
         //Square root
         static float sqrt(const float& f)
         {
-            return std::sqrtf(f);
+            return std::sqrt(f);
         }
         //If in<min, return min
         //if in>max, return max
@@ -63,17 +66,23 @@ namespace Chimes
             else
                 return in;
         }
-        //Numerical comparison for double type.
-        Sign sign(const double& d) const
+        //Numerical comparison of d with a given precision.
+        template <class Real>
+        static constexpr Sign compare(const Real& d, const Real& precision)
         {
-            if (d > precision_double_)
+            if (d > precision)
                 return Sign::POSITIVE;
-            else if (d > -precision_double_)
+            else if (d > -precision)
                 return Sign::ZERO;
             else
                 return Sign::NEGATIVE;
         }
         //Numerical comparison for double type.
+        Sign sign(const double& d) const
+        {
+            return compare(d, precision_double_.load(std::memory_order_relaxed));
+        }
+        //Numerical comparison for double type.
         Sign sign(const double& a, const double& b) const
         {
             return sign(a - b);
@@ -81,12 +90,7 @@ namespace Chimes
         //Numerical comparison for float type.
         Sign sign(const float& f) const
         {
-            if (f > precision_float_)
-                return Sign::POSITIVE;
-            else if (f > -precision_float_)
-                return Sign::ZERO;
-            else
-                return Sign::NEGATIVE;
+            return compare(f, precision_float_.load(std::memory_order_relaxed));
         }
         //Numerical comparison for float type.
         Sign sign(const float& a, const float& b) const
@@ -97,12 +101,12 @@ namespace Chimes
         //Set precision for double. The default is 1e-16.
         void set_precision(const double& d)
         {
-            precision_double_ = d;
+            precision_double_.store(d, std::memory_order_relaxed);
         }
         //Set precision for float. The default is 1e-6.
         void set_precision(const float& f)
         {
-            precision_float_ = f;
+            precision_float_.store(f, std::memory_order_relaxed);
         }
         static double abs(const double& d)
         {
@@ -113,13 +117,53 @@ namespace Chimes
             return fabs(f);
         }
     protected:
-        Numerical()
+        //Constant, so the instance is initialized before any code runs and instance() needs no guard.
+        constexpr Numerical() : precision_double_(1e-16), precision_float_(1e-6f)
         {
-            precision_double_ = 1e-16;
-            precision_float_ = 1e-6f;
+
         }
     protected:
-        double precision_double_;
-        float precision_float_;
-    };   
+        std::atomic<double> precision_double_;
+        std::atomic<float> precision_float_;
+    private:
+        static Numerical instance_;
+    };
+    inline constinit Numerical Numerical::instance_;
+
+    //Numerical comparisons of Scalar with a precision fixed at compile time, e.g. PrecisionPolicy<double, 1e-9>.
+    //Everything is constexpr and nothing is shared, so a comparison through a policy is safe from any thread.
+    //concept_real and the solvers use NumericPolicy<Scalar>; a policy of another precision is for the caller's own
+    //comparisons, the solvers do not take one.
+    template <class Scalar, Scalar Precision>
+    class PrecisionPolicy
+    {
+    public:
+        using Real = Scalar;
+        static constexpr Scalar precision = Precision;
+        //Relative rounding error of Scalar.
+        static constexpr Scalar epsilon = std::numeric_limits<Scalar>::epsilon();
+    public:
+        static constexpr Numerical::Sign sign(const Scalar& d)
+        {
+            return Numerical::compare(d, precision);
+        }
+        static constexpr Numerical::Sign sign(const Scalar& a, const Scalar& b)
+        {
+            return sign(a - b);
+        }
+    };
+
+    //Policy of the real types, with the default precisions of Numerical. Not defined for other types.
+    template <class Scalar>
+    class NumericPolicy;
+    template <>
+    class NumericPolicy<double> : public PrecisionPolicy<double, 1e-16>
+    {
+
+    };
+    template <>
+    class NumericPolicy<float> : public PrecisionPolicy<float, 1e-6f>
+    {
+
+    };
 }
@@ -18,7 +18,7 @@ namespace Chimes
             r = Real(1);
             r = Real(0.5);
             r = Numerical::sqrt(t);
-            s = Numerical::instance().sign(r);
+            s = NumericPolicy<Real>::sign(r);
         };
         //Describe the point whose coordinates are obtained by index.
         template <typename P>
@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Chimes
+{
+    //Fork-join pool of threads.
+    //parallelFor() runs a loop on the workers and the calling thread and does not allocate, so it can be used
+    //inside allocation-free iterations.
+    class ThreadPool
+    {
+    public:
+        //num_threads counts the calling thread, so num_threads - 1 workers are started.
+        //0 means std::thread::hardware_concurrency().
+        explicit ThreadPool(size_t num_threads = 0) : generation_(0), stop_(false), job_run_(nullptr), job_context_(nullptr),
+            job_count_(0), job_next_(0), job_active_(0)
+        {
+            if (num_threads == 0)
+                num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            workers_.reserve(num_threads - 1);
+            for (size_t i = 1; i < num_threads; ++i)
+                workers_.emplace_back([this]() { workerLoop(); });
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            start_cv_.notify_all();
+            for (std::thread& worker : workers_)
+                worker.join();
+        }
+        //Number of threads taking part in parallelFor(), the calling thread included.
+        size_t size() const
+        {
+            return workers_.size() + 1;
+        }
+        //Call f(i) for i in [0, count) and return when all calls are done.
+        //Indices are handed out dynamically, so f must not depend on which thread runs it.
+        //Calls from different threads are serialized. A call from inside f, e.g. an objective using the pool of the solve
+        //running it, runs its loop inline on the calling thread. The first exception thrown by f is rethrown here.
+        template <class F>
+        void parallelFor(size_t count, F&& f)
+        {
+            if (count == 0)
+                return;
+            if (workers_.empty() || count == 1 || running_ == this)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    f(i);
+                return;
+            }
+            using Body = std::remove_reference_t<F>;
+            std::lock_guard<std::mutex> call_lock(call_mutex_);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                job_run_ = [](void* context, size_t i) { (*static_cast<Body*>(context))(i); };
+                job_context_ = const_cast<void*>(static_cast<const void*>(&f));
+                job_count_ = count;
+                job_next_.store(0);
+                job_active_ = workers_.size();
+                job_exception_ = nullptr;
+                ++generation_;
+            }
+            start_cv_.notify_all();
+            runJob();
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this]() { return job_active_ == 0; });
+            if (job_exception_)
+                std::rethrow_exception(job_exception_);
+        }
+    private:
+        void runJob()
+        {
+            //Restored at the end, a thread may run jobs of several pools nested in one another.
+            const ThreadPool* previous = running_;
+            running_ = this;
+            try
+            {
+                for (size_t i = job_next_++; i < job_count_; i = job_next_++)
+                    job_run_(job_context_, i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!job_exception_)
+                    job_exception_ = std::current_exception();
+                job_next_.store(job_count_);
+            }
+            running_ = previous;
+        }
+        void workerLoop()
+        {
+            size_t generation = 0;
+            while (1)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    start_cv_.wait(lock, [&]() { return stop_ || generation_ != generation; });
+                    if (stop_)
+                        return;
+                    generation = generation_;
+                }
+                runJob();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --job_active_;
+                }
+                done_cv_.notify_one();
+            }
+        }
+    private:
+        //Pool whose job the thread is running, to detect nested calls of parallelFor().
+        static inline thread_local const ThreadPool* running_ = nullptr;
+        std::vector<std::thread> workers_;
+        std::mutex call_mutex_;
+        std::mutex mutex_;
+        std::condition_variable start_cv_;
+        std::condition_variable done_cv_;
+        size_t generation_;
+        bool stop_;
+        void (*job_run_)(void*, size_t);
+        void* job_context_;
+        size_t job_count_;
+        std::atomic<size_t> job_next_;
+        size_t job_active_;
+        std::exception_ptr job_exception_;
+    };
+}
@@ -0,0 +1,548 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <Chimes/Core/mapped_file.h>
+#include <Chimes/Core/template_concept.h>
+#include <Chimes/Core/thread_pool.h>
+
+namespace Chimes
+{
+    namespace geometry
+    {
+        //Coordinate d of a point of concept_point_index or concept_point_xyz.
+        template <class P>
+            requires concept_point_index<P> || concept_point_xyz<P>
+        auto coordinate(const P& p, size_t d)
+        {
+            if constexpr (concept_point_index<P>)
+                return p[d];
+            else
+                return d == 0 ? p.x() : d == 1 ? p.y() : p.z();
+        }
+
+        //Number of coordinates of P when its type tells it: P::dimension, the size of a fixed-size Eigen vector or of a
+        //std::array, 3 for a point of concept_point_xyz alone, and 0 if unknown.
+        template <class P>
+        constexpr size_t point_dimension()
+        {
+            if constexpr (requires { P::dimension; })
+                return size_t(P::dimension);
+            else if constexpr (requires { P::SizeAtCompileTime; })
+                return P::SizeAtCompileTime > 0 ? size_t(P::SizeAtCompileTime) : 0;
+            else if constexpr (requires { std::tuple_size<P>::value; })
+                return std::tuple_size<P>::value;
+            else if constexpr (!concept_point_index<P>)
+                return 3;
+            else
+                return 0;
+        }
+
+        //k-d tree over n points of N coordinates, for nearest neighbour and radius queries.
+        //The tree is flat: the nodes are one array in preorder, the left child of a node is the next node, and the points
+        //are copied in tree order so a leaf is one contiguous run of coordinates. Every node keeps the bounding box of its
+        //points and the queries prune on the distance to the boxes, like a bounding volume hierarchy, which is tighter
+        //than the splitting planes alone.
+        //Nodes are split at the median of the axis of largest extent, so the shape of the tree only depends on the points.
+        //With a pool, the top levels are split on the calling thread and the subtrees below are built in parallel; the
+        //tree is the same for any number of threads.
+        //save() writes the tree to a file that open() maps back without rebuilding it.
+        template <class P, size_t N = 3>
+            requires concept_point_index<P> || concept_point_xyz<P>
+        class KdTree
+        {
+            static_assert(point_dimension<P>() == 0 || point_dimension<P>() == N, "N must be the number of coordinates of P");
+        public:
+            using Real = std::remove_cvref_t<decltype(coordinate(std::declval<const P&>(), 0))>;
+            //Index of a point in the array the tree was built from.
+            using Index = uint32_t;
+            //Index of the slots of knn() past the number of points.
+            static constexpr Index npos = std::numeric_limits<Index>::max();
+            static constexpr size_t dimension = N;
+        private:
+            class Node
+            {
+            public:
+                Real lo[N];
+                Real hi[N];
+                //The right child, 0 for a leaf.
+                Index right;
+                //Points of the node in tree order.
+                Index begin;
+                Index end;
+                Index pad;
+            };
+            //Start of a saved tree, followed by the nodes, the coordinates and the indices, each on a 64-byte boundary.
+            class Header
+            {
+            public:
+                char magic[8];
+                uint32_t version;
+                uint32_t dimension;
+                uint32_t real_size;
+                uint32_t leaf_size;
+                uint64_t points;
+                uint64_t nodes;
+            };
+            static constexpr char magic[8] = { 'C', 'H', 'I', 'M', 'E', 'S', 'K', 'D' };
+            static constexpr uint32_t version = 1;
+            //Levels of the deepest tree traverse() can walk. A built tree has about log2(n / leaf_size) levels, open()
+            //rejects deeper ones.
+            static constexpr size_t max_depth = 128;
+            //Subtree left to a task of a parallel build, replaced by the nodes of the task.
+            class Task
+            {
+            public:
+                size_t node;
+                Index begin;
+                Index end;
+                std::vector<Node> nodes;
+            };
+        public:
+            KdTree() : leaf_size_(16), n_(0), num_nodes_(0), nodes_(nullptr), points_(nullptr), indices_(nullptr)
+            {
+
+            }
+            //Build over points[0, n), on pool if given. Leaves hold at most leaf_size points.
+            KdTree(const P* points, size_t n, ThreadPool* pool = nullptr, size_t leaf_size = 16) : KdTree()
+            {
+                build(points, n, pool, leaf_size);
+            }
+            KdTree(const std::vector<P>& points, ThreadPool* pool = nullptr, size_t leaf_size = 16) : KdTree()
+            {
+                build(points.data(), points.size(), pool, leaf_size);
+            }
+            KdTree(const KdTree&) = delete;
+            KdTree& operator=(const KdTree&) = delete;
+            KdTree(KdTree&& other) noexcept : KdTree()
+            {
+                swap(other);
+            }
+            KdTree& operator=(KdTree&& other) noexcept
+            {
+                if (this != &other)
+                    swap(other);
+                return *this;
+            }
+            void build(const P* points, size_t n, ThreadPool* pool = nullptr, size_t leaf_size = 16)
+            {
+                if (n >= size_t(npos))
+                {
+                    std::cout << "[error][KdTree] too many points." << std::endl;
+                    throw std::runtime_error("[error][KdTree] too many points");
+                }
+                file_.close();
+                leaf_size_ = std::max<size_t>(leaf_size, 1);
+                n_ = n;
+                own_points_.resize(n * N);
+                own_indices_.resize(n);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    for (size_t d = 0; d < N; ++d)
+                        own_points_[i * N + d] = coordinate(points[i], d);
+                    own_indices_[i] = Index(i);
+                }
+                own_nodes_.clear();
+                if (n > 0)
+                    buildTree(pool);
+                //The coordinates go in tree order.
+                std::vector<Real> ordered(n * N);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    for (size_t d = 0; d < N; ++d)
+                        ordered[i * N + d] = own_points_[size_t(own_indices_[i]) * N + d];
+                }
+                own_points_.swap(ordered);
+                nodes_ = own_nodes_.data();
+                points_ = own_points_.data();
+                indices_ = own_indices_.data();
+                num_nodes_ = own_nodes_.size();
+            }
+            size_t size() const
+            {
+                return n_;
+            }
+            size_t nodes() const
+            {
+                return num_nodes_;
+            }
+            //True if the tree is read from a file mapped by open().
+            bool isMapped() const
+            {
+                return file_.isOpen();
+            }
+            //The k nearest points of q, nearest first: their indices and squared distances go to indices[0, k) and
+            //squared_distances[0, k). Returns min(k, size()), the slots past it hold npos and infinity.
+            size_t knn(const P& q, size_t k, Index* indices, Real* squared_distances) const
+            {
+                std::fill(indices, indices + k, npos);
+                std::fill(squared_distances, squared_distances + k, std::numeric_limits<Real>::infinity());
+                if (n_ == 0 || k == 0)
+                    return 0;
+                Real query[N];
+                for (size_t d = 0; d < N; ++d)
+                    query[d] = coordinate(q, d);
+                size_t found = 0;
+                traverse(query, [&]() { return found < k ? std::numeric_limits<Real>::infinity() : squared_distances[k - 1]; },
+                    [&](Index i, Real distance)
+                {
+                    if (found == k && distance >= squared_distances[k - 1])
+                        return;
+                    //Insertion into the sorted slots, k is small.
+                    size_t j = found < k ? found++ : k - 1;
+                    for (; j > 0 && squared_distances[j - 1] > distance; --j)
+                    {
+                        squared_distances[j] = squared_distances[j - 1];
+                        indices[j] = indices[j - 1];
+                    }
+                    squared_distances[j] = distance;
+                    indices[j] = indices_[i];
+                });
+                return found;
+            }
+            //Append the indices of the points within distance r of q to indices, in tree order.
+            void radius(const P& q, Real r, std::vector<Index>& indices) const
+            {
+                if (n_ == 0)
+                    return;
+                Real query[N];
+                for (size_t d = 0; d < N; ++d)
+                    query[d] = coordinate(q, d);
+                const Real r2 = r * r;
+                traverse(query, [&]() { return r2; }, [&](Index i, Real distance)
+                {
+                    if (distance <= r2)
+                        indices.push_back(indices_[i]);
+                });
+            }
+            //knn() of queries[0, m), on pool if given: the k slots of query j start at indices + j * k and
+            //squared_distances + j * k.
+            void knn(const P* queries, size_t m, size_t k, Index* indices, Real* squared_distances, ThreadPool* pool = nullptr) const
+            {
+                forEachQuery(m, pool, [&](size_t j) { knn(queries[j], k, indices + j * k, squared_distances + j * k); });
+            }
+            //radius() of queries[0, m), on pool if given, into indices[j] for query j.
+            void radius(const P* queries, size_t m, Real r, std::vector<std::vector<Index>>& indices, ThreadPool* pool = nullptr) const
+            {
+                indices.resize(m);
+                forEachQuery(m, pool, [&](size_t j)
+                {
+                    indices[j].clear();
+                    radius(queries[j], r, indices[j]);
+                });
+            }
+            //Write the tree to path: a header, then the nodes, the coordinates and the indices as they are in memory, so the
+            //file is only readable on machines of the same byte order.
+            void save(const std::string& path) const
+            {
+                Header header;
+                std::memcpy(header.magic, magic, sizeof(magic));
+                header.version = version;
+                header.dimension = uint32_t(N);
+                header.real_size = uint32_t(sizeof(Real));
+                header.leaf_size = uint32_t(leaf_size_);
+                header.points = n_;
+                header.nodes = num_nodes_;
+                size_t offsets[4];
+                const size_t bytes = layout(n_, num_nodes_, offsets);
+                MappedFile file;
+                file.create(path, bytes);
+                std::memcpy(file.data(), &header, sizeof(header));
+                copyBytes(file.data() + offsets[0], nodes_, num_nodes_ * sizeof(Node));
+                copyBytes(file.data() + offsets[1], points_, n_ * N * sizeof(Real));
+                copyBytes(file.data() + offsets[2], indices_, n_ * sizeof(Index));
+            }
+            //Map a tree written by save(). Nothing is copied: the pages are read when the queries touch them, so a large
+            //tree is usable at once, and the file must not change while it is mapped.
+            void open(const std::string& path)
+            {
+                MappedFile file;
+                file.open(path);
+                Header header;
+                if (file.size() < sizeof(Header))
+                    fail("not a tree file", path);
+                std::memcpy(&header, file.data(), sizeof(header));
+                if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+                    fail("not a tree file", path);
+                if (header.dimension != N || header.real_size != sizeof(Real))
+                    fail("another dimension or real type in", path);
+                size_t offsets[4];
+                if (header.points >= uint64_t(npos) || header.nodes >= uint64_t(npos) || (header.points > 0) != (header.nodes > 0))
+                    fail("wrong size of", path);
+                if (file.size() != layout(size_t(header.points), size_t(header.nodes), offsets))
+                    fail("wrong size of", path);
+                if (!isValid(reinterpret_cast<const Node*>(file.data() + offsets[0]), size_t(header.nodes), size_t(header.points)))
+                    fail("broken nodes in", path);
+                own_nodes_ = std::vector<Node>();
+                own_points_ = std::vector<Real>();
+                own_indices_ = std::vector<Index>();
+                leaf_size_ = header.leaf_size;
+                n_ = size_t(header.points);
+                num_nodes_ = size_t(header.nodes);
+                nodes_ = reinterpret_cast<const Node*>(file.data() + offsets[0]);
+                points_ = reinterpret_cast<const Real*>(file.data() + offsets[1]);
+                indices_ = reinterpret_cast<const Index*>(file.data() + offsets[2]);
+                file_ = std::move(file);
+            }
+        private:
+            //Build own_nodes_ and the tree order own_indices_ of the points in own_points_.
+            void buildTree(ThreadPool* pool)
+            {
+                const size_t threads = pool == nullptr ? 1 : pool->size();
+                //About four subtrees a thread balance the uneven leaves, top levels are only split for large enough
+                //subtrees.
+                size_t depth = 0;
+                while (threads > 1 && (size_t(1) << depth) < 4 * threads && (n_ >> depth) > 4096)
+                    ++depth;
+                if (depth == 0)
+                {
+                    buildNode(own_nodes_, 0, Index(n_), std::numeric_limits<size_t>::max(), nullptr);
+                    return;
+                }
+                std::vector<Task> tasks;
+                buildNode(own_nodes_, 0, Index(n_), depth, &tasks);
+                pool->parallelFor(tasks.size(), [&](size_t t)
+                {
+                    buildNode(tasks[t].nodes, tasks[t].begin, tasks[t].end, std::numeric_limits<size_t>::max(), nullptr);
+                });
+                //Put the subtrees in place of their nodes, in preorder, and move the right children of the top nodes.
+                std::vector<Node> nodes;
+                std::vector<size_t> position(own_nodes_.size());
+                std::vector<bool> is_task(own_nodes_.size(), false);
+                for (const Task& task : tasks)
+                    is_task[task.node] = true;
+                size_t t = 0;
+                for (size_t i = 0; i < own_nodes_.size(); ++i)
+                {
+                    position[i] = nodes.size();
+                    if (!is_task[i])
+                    {
+                        nodes.push_back(own_nodes_[i]);
+                        continue;
+                    }
+                    const size_t offset = nodes.size();
+                    for (Node node : tasks[t++].nodes)
+                    {
+                        if (node.right != 0)
+                            node.right += Index(offset);
+                        nodes.push_back(node);
+                    }
+                }
+                for (size_t i = 0; i < own_nodes_.size(); ++i)
+                {
+                    if (!is_task[i] && own_nodes_[i].right != 0)
+                        nodes[position[i]].right = Index(position[own_nodes_[i].right]);
+                }
+                own_nodes_.swap(nodes);
+            }
+            //Append the subtree of the points [begin, end) to nodes. Below depth levels the subtree is left to a task.
+            void buildNode(std::vector<Node>& nodes, Index begin, Index end, size_t depth, std::vector<Task>* tasks)
+            {
+                const size_t self = nodes.size();
+                nodes.emplace_back();
+                nodes.back().right = 0;
+                if (depth == 0)
+                {
+                    tasks->push_back(Task{ self, begin, end, {} });
+                    return;
+                }
+                Node& node = nodes.back();
+                node.begin = begin;
+                node.end = end;
+                node.right = 0;
+                node.pad = 0;
+                for (size_t d = 0; d < N; ++d)
+                {
+                    node.lo[d] = std::numeric_limits<Real>::infinity();
+                    node.hi[d] = -std::numeric_limits<Real>::infinity();
+                }
+                for (Index i = begin; i < end; ++i)
+                {
+                    const Real* p = own_points_.data() + size_t(own_indices_[i]) * N;
+                    for (size_t d = 0; d < N; ++d)
+                    {
+                        node.lo[d] = std::min(node.lo[d], p[d]);
+                        node.hi[d] = std::max(node.hi[d], p[d]);
+                    }
+                }
+                if (end - begin <= leaf_size_)
+                    return;
+                size_t axis = 0;
+                for (size_t d = 1; d < N; ++d)
+                {
+                    if (node.hi[d] - node.lo[d] > node.hi[axis] - node.lo[axis])
+                        axis = d;
+                }
+                const Index mid = begin + (end - begin) / 2;
+                const Real* points = own_points_.data();
+                std::nth_element(own_indices_.begin() + begin, own_indices_.begin() + mid, own_indices_.begin() + end, [&](Index a, Index b)
+                {
+                    const Real pa = points[size_t(a) * N + axis], pb = points[size_t(b) * N + axis];
+                    return pa < pb || (pa == pb && a < b);
+                });
+                buildNode(nodes, begin, mid, depth - 1, tasks);
+                const size_t right = nodes.size();
+                buildNode(nodes, mid, end, depth - 1, tasks);
+                nodes[self].right = Index(right);
+            }
+            //Visit the points of the leaves whose box is nearer to query than bound(), nearest box first, calling
+            //visit(tree index, squared distance) on each.
+            template <class Bound, class Visit>
+            void traverse(const Real* query, Bound&& bound, Visit&& visit) const
+            {
+                //Far children waiting, with the squared distance to their box. The near child is taken first, so the stack
+                //holds at most one node a level.
+                std::pair<Index, Real> stack[max_depth];
+                size_t top = 0;
+                Index node = 0;
+                Real distance = boxDistance(nodes_[0], query);
+                while (1)
+                {
+                    if (distance <= bound())
+                    {
+                        const Node& current = nodes_[node];
+                        if (current.right == 0)
+                        {
+                            for (Index i = current.begin; i < current.end; ++i)
+                            {
+                                const Real* p = points_ + size_t(i) * N;
+                                Real d2 = Real(0);
+                                for (size_t d = 0; d < N; ++d)
+                                    d2 += (p[d] - query[d]) * (p[d] - query[d]);
+                                visit(i, d2);
+                            }
+                        }
+                        else
+                        {
+                            Index near = node + 1, far = current.right;
+                            Real near_distance = boxDistance(nodes_[near], query), far_distance = boxDistance(nodes_[far], query);
+                            if (far_distance < near_distance)
+                            {
+                                std::swap(near, far);
+                                std::swap(near_distance, far_distance);
+                            }
+                            stack[top++] = { far, far_distance };
+                            node = near;
+                            distance = near_distance;
+                            continue;
+                        }
+                    }
+                    if (top == 0)
+                        break;
+                    --top;
+                    node = stack[top].first;
+                    distance = stack[top].second;
+                }
+            }
+            //Whether the nodes of a file make a tree traverse() can walk: the root holds the n points, the children of a
+            //node come after it and split its points, and no node is deeper than max_depth. A node shared by two parents
+            //is caught by the split of the points.
+            static bool isValid(const Node* nodes, size_t num_nodes, size_t n)
+            {
+                if (num_nodes == 0)
+                    return true;
+                if (nodes[0].begin != 0 || nodes[0].end != n)
+                    return false;
+                std::vector<uint8_t> depth(num_nodes, 0);
+                std::vector<bool> is_child(num_nodes, false);
+                is_child[0] = true;
+                for (size_t i = 0; i < num_nodes; ++i)
+                {
+                    const Node& node = nodes[i];
+                    if (!is_child[i] || node.begin > node.end || node.end > n)
+                        return false;
+                    if (node.right == 0)
+                        continue;
+                    const size_t left = i + 1, right = node.right;
+                    if (right <= left || right >= num_nodes || is_child[left] || is_child[right] || size_t(depth[i]) + 1 >= max_depth)
+                        return false;
+                    if (nodes[left].begin != node.begin || nodes[left].end != nodes[right].begin || nodes[right].end != node.end)
+                        return false;
+                    is_child[left] = is_child[right] = true;
+                    depth[left] = depth[right] = uint8_t(depth[i] + 1);
+                }
+                return true;
+            }
+            static Real boxDistance(const Node& node, const Real* query)
+            {
+                Real d2 = Real(0);
+                for (size_t d = 0; d < N; ++d)
+                {
+                    const Real t = std::max({ node.lo[d] - query[d], query[d] - node.hi[d], Real(0) });
+                    d2 += t * t;
+                }
+                return d2;
+            }
+            //Call f(j) for j in [0, m), in chunks of queries spread over pool.
+            template <class F>
+            static void forEachQuery(size_t m, ThreadPool* pool, F&& f)
+            {
+                const size_t chunk = 64;
+                if (pool == nullptr || pool->size() == 1 || m <= chunk)
+                {
+                    for (size_t j = 0; j < m; ++j)
+                        f(j);
+                    return;
+                }
+                pool->parallelFor((m + chunk - 1) / chunk, [&](size_t c)
+                {
+                    for (size_t j = c * chunk; j < std::min(m, (c + 1) * chunk); ++j)
+                        f(j);
+                });
+            }
+            //Bytes of a saved tree, and the offsets of the nodes, the coordinates and the indices.
+            static size_t layout(size_t n, size_t num_nodes, size_t* offsets)
+            {
+                auto align = [](size_t bytes) { return (bytes + 63) / 64 * 64; };
+                offsets[0] = align(sizeof(Header));
+                offsets[1] = offsets[0] + align(num_nodes * sizeof(Node));
+                offsets[2] = offsets[1] + align(n * N * sizeof(Real));
+                offsets[3] = offsets[2] + n * sizeof(Index);
+                return offsets[3];
+            }
+            static void copyBytes(char* to, const void* from, size_t bytes)
+            {
+                if (bytes > 0)
+                    std::memcpy(to, from, bytes);
+            }
+            void fail(const char* message, const std::string& path)
+            {
+                std::cout << "[error][KdTree] " << message << " " << path << std::endl;
+                throw std::runtime_error(std::string("[error][KdTree] ") + message + " " + path);
+            }
+            void swap(KdTree& other) noexcept
+            {
+                std::swap(leaf_size_, other.leaf_size_);
+                std::swap(n_, other.n_);
+                std::swap(num_nodes_, other.num_nodes_);
+                own_nodes_.swap(other.own_nodes_);
+                own_points_.swap(other.own_points_);
+                own_indices_.swap(other.own_indices_);
+                std::swap(nodes_, other.nodes_);
+                std::swap(points_, other.points_);
+                std::swap(indices_, other.indices_);
+                std::swap(file_, other.file_);
+            }
+        private:
+            size_t leaf_size_;
+            size_t n_;
+            size_t num_nodes_;
+            //The tree built in memory; empty for a mapped tree.
+            std::vector<Node> own_nodes_;
+            std::vector<Real> own_points_;
+            std::vector<Index> own_indices_;
+            //The tree in use, in the vectors above or in file_.
+            const Node* nodes_;
+            const Real* points_;
+            const Index* indices_;
+            MappedFile file_;
+        };
+    }
+} // namespace Chimes
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+#include <Chimes/Geometry/point.h>
+
+namespace Chimes
+{
+    namespace geometry
+    {
+        //Small dense Rows x Cols matrix stored by rows, a model of concept_matrix_index, e.g. the linear part of a rigid
+        //transform or the covariance of a point cloud. The size is fixed at compile time, so every loop is unrolled.
+        template <class Real, size_t Rows, size_t Cols = Rows>
+            requires concept_real<Real>
+        class alignas(16) Matrix
+        {
+        public:
+            using R = Real;
+            static constexpr size_t rows = Rows;
+            static constexpr size_t cols = Cols;
+        public:
+            //Zero matrix.
+            Matrix() : data_{}
+            {
+
+            }
+            Real& operator()(size_t i, size_t j)
+            {
+                return data_[i * Cols + j];
+            }
+            const Real& operator()(size_t i, size_t j) const
+            {
+                return data_[i * Cols + j];
+            }
+            Real* data()
+            {
+                return data_;
+            }
+            const Real* data() const
+            {
+                return data_;
+            }
+            Matrix operator+(const Matrix& m) const
+            {
+                Matrix r;
+                for (size_t i = 0; i < Rows * Cols; ++i)
+                    r.data_[i] = data_[i] + m.data_[i];
+                return r;
+            }
+            Matrix operator-(const Matrix& m) const
+            {
+                Matrix r;
+                for (size_t i = 0; i < Rows * Cols; ++i)
+                    r.data_[i] = data_[i] - m.data_[i];
+                return r;
+            }
+            Matrix operator*(const Real& t) const
+            {
+                Matrix r;
+                for (size_t i = 0; i < Rows * Cols; ++i)
+                    r.data_[i] = data_[i] * t;
+                return r;
+            }
+            template <size_t K>
+            Matrix<Real, Rows, K> operator*(const Matrix<Real, Cols, K>& m) const
+            {
+                Matrix<Real, Rows, K> r;
+                for (size_t i = 0; i < Rows; ++i)
+                {
+                    for (size_t k = 0; k < Cols; ++k)
+                    {
+                        for (size_t j = 0; j < K; ++j)
+                            r(i, j) = r(i, j) + (*this)(i, k) * m(k, j);
+                    }
+                }
+                return r;
+            }
+            //Deduced, so that matrices of other sizes than the points are still valid types.
+            template <size_t N>
+                requires (N == Cols && (Rows == 2 || Rows == 3))
+            auto operator*(const Point<Real, N>& p) const
+            {
+                Point<Real, Rows> r;
+                for (size_t i = 0; i < Rows; ++i)
+                {
+                    for (size_t j = 0; j < Cols; ++j)
+                        r[i] = r[i] + (*this)(i, j) * p[j];
+                }
+                return r;
+            }
+            Matrix<Real, Cols, Rows> Transpose() const
+            {
+                Matrix<Real, Cols, Rows> r;
+                for (size_t i = 0; i < Rows; ++i)
+                {
+                    for (size_t j = 0; j < Cols; ++j)
+                        r(j, i) = (*this)(i, j);
+                }
+                return r;
+            }
+            Real Trace() const requires (Rows == Cols)
+            {
+                Real t = Real(0);
+                for (size_t i = 0; i < Rows; ++i)
+                    t = t + (*this)(i, i);
+                return t;
+            }
+            static Matrix Zero()
+            {
+                return Matrix();
+            }
+            static Matrix Identity() requires (Rows == Cols)
+            {
+                Matrix r;
+                for (size_t i = 0; i < Rows; ++i)
+                    r(i, i) = Real(1);
+                return r;
+            }
+        private:
+            Real data_[Rows * Cols];
+        };
+
+        //Rows separated by new lines.
+        template <class Real, size_t Rows, size_t Cols>
+        std::ostream& operator<<(std::ostream& os, const Matrix<Real, Rows, Cols>& m)
+        {
+            for (size_t i = 0; i < Rows; ++i)
+            {
+                os << m(i, 0);
+                for (size_t j = 1; j < Cols; ++j)
+                    os << " " << m(i, j);
+                if (i + 1 < Rows)
+                    os << "\n";
+            }
+            return os;
+        }
+
+        using Matrix2f = Matrix<float, 2>;
+        using Matrix2d = Matrix<double, 2>;
+        using Matrix3f = Matrix<float, 3>;
+        using Matrix3d = Matrix<double, 3>;
+        using Matrix4f = Matrix<float, 4>;
+        using Matrix4d = Matrix<double, 4>;
+    }
+} // namespace Chimes
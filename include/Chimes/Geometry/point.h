@@ -0,0 +1,204 @@
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <Chimes/Core/template_concept.h>
+
+namespace Chimes
+{
+    namespace geometry
+    {
+        //Point of N coordinates of type Real, a model of concept_point_index, concept_point_operater, concept_point_normal
+        //and the stream concepts, and of concept_point_xyz for N = 3.
+        //The storage of a 3D point is padded to 4 coordinates and the point is aligned to its size, so a point is loaded by
+        //one SIMD register and an array of points never has a point across two cache lines. The padding stays 0.
+        template <class Real, size_t N>
+            requires (N == 2 || N == 3) && concept_real<Real>
+        class alignas(sizeof(Real) * (N == 3 ? 4 : N)) Point
+        {
+        public:
+            using R = Real;
+            static constexpr size_t dimension = N;
+        private:
+            static constexpr size_t storage = N == 3 ? 4 : N;
+        public:
+            Point() : data_{}
+            {
+
+            }
+            Point(const Real& x, const Real& y) requires (N == 2) : data_{ x, y }
+            {
+
+            }
+            Point(const Real& x, const Real& y, const Real& z) requires (N == 3) : data_{ x, y, z, Real(0) }
+            {
+
+            }
+            Real& operator[](size_t i)
+            {
+                return data_[i];
+            }
+            const Real& operator[](size_t i) const
+            {
+                return data_[i];
+            }
+            Real& x()
+            {
+                return data_[0];
+            }
+            const Real& x() const
+            {
+                return data_[0];
+            }
+            Real& y()
+            {
+                return data_[1];
+            }
+            const Real& y() const
+            {
+                return data_[1];
+            }
+            Real& z() requires (N == 3)
+            {
+                return data_[2];
+            }
+            const Real& z() const requires (N == 3)
+            {
+                return data_[2];
+            }
+            Real* data()
+            {
+                return data_;
+            }
+            const Real* data() const
+            {
+                return data_;
+            }
+            //The loops run over the padded storage, so they compile to whole-register operations.
+            Point operator+(const Point& q) const
+            {
+                Point r;
+                for (size_t i = 0; i < storage; ++i)
+                    r.data_[i] = data_[i] + q.data_[i];
+                return r;
+            }
+            Point operator-(const Point& q) const
+            {
+                Point r;
+                for (size_t i = 0; i < storage; ++i)
+                    r.data_[i] = data_[i] - q.data_[i];
+                return r;
+            }
+            Point operator-() const
+            {
+                Point r;
+                for (size_t i = 0; i < storage; ++i)
+                    r.data_[i] = -data_[i];
+                return r;
+            }
+            Point operator*(const Real& t) const
+            {
+                Point r;
+                for (size_t i = 0; i < storage; ++i)
+                    r.data_[i] = data_[i] * t;
+                return r;
+            }
+            Point operator/(const Real& t) const
+            {
+                return *this * (Real(1) / t);
+            }
+            //Dot product.
+            Real operator*(const Point& q) const
+            {
+                Real t = Real(0);
+                for (size_t i = 0; i < storage; ++i)
+                    t = t + data_[i] * q.data_[i];
+                return t;
+            }
+            Point& operator+=(const Point& q)
+            {
+                return *this = *this + q;
+            }
+            Point& operator-=(const Point& q)
+            {
+                return *this = *this - q;
+            }
+            Point& operator*=(const Real& t)
+            {
+                return *this = *this * t;
+            }
+            Point& operator/=(const Real& t)
+            {
+                return *this = *this / t;
+            }
+            bool operator==(const Point& q) const
+            {
+                for (size_t i = 0; i < N; ++i)
+                {
+                    if (data_[i] != q.data_[i])
+                        return false;
+                }
+                return true;
+            }
+            Point Cross(const Point& q) const requires (N == 3)
+            {
+                return Point(data_[1] * q.data_[2] - data_[2] * q.data_[1], data_[2] * q.data_[0] - data_[0] * q.data_[2],
+                    data_[0] * q.data_[1] - data_[1] * q.data_[0]);
+            }
+            Real SquaredNorm() const
+            {
+                return *this * *this;
+            }
+            Real Norm() const
+            {
+                return Numerical::sqrt(SquaredNorm());
+            }
+            //A point of zero norm under NumericPolicy<Real> is left as it is.
+            void Normalize()
+            {
+                const Real norm = Norm();
+                if (NumericPolicy<Real>::sign(norm) != Numerical::Sign::ZERO)
+                    *this /= norm;
+            }
+            Point Normalized() const
+            {
+                Point r = *this;
+                r.Normalize();
+                return r;
+            }
+            static Point Zero()
+            {
+                return Point();
+            }
+        private:
+            Real data_[storage];
+        };
+
+        template <class Real, size_t N>
+        Point<Real, N> operator*(const Real& t, const Point<Real, N>& p)
+        {
+            return p * t;
+        }
+        //Coordinates separated by spaces.
+        template <class Real, size_t N>
+        std::ostream& operator<<(std::ostream& os, const Point<Real, N>& p)
+        {
+            os << p[0];
+            for (size_t i = 1; i < N; ++i)
+                os << " " << p[i];
+            return os;
+        }
+        template <class Real, size_t N>
+        std::istream& operator>>(std::istream& is, Point<Real, N>& p)
+        {
+            for (size_t i = 0; i < N; ++i)
+                is >> p[i];
+            return is;
+        }
+
+        using Point2f = Point<float, 2>;
+        using Point2d = Point<double, 2>;
+        using Point3f = Point<float, 3>;
+        using Point3d = Point<double, 3>;
+    }
+} // namespace Chimes
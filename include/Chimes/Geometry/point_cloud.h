@@ -0,0 +1,361 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include <Chimes/Core/aligned_allocator.h>
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Geometry/matrix.h>
+#include <Chimes/Geometry/point.h>
+
+namespace Chimes
+{
+    namespace geometry
+    {
+        //Points of N coordinates stored as structure of arrays: one contiguous, cache-line aligned array per coordinate.
+        //The batch kernels are plain loops over these arrays that the compiler vectorizes for the target (SSE2 by default,
+        //AVX with USE_NATIVE_ARCH, NEON on ARM), so they stream the coordinates at memory bandwidth where an array of
+        //points would load the padding and shuffle every point.
+        //With a thread pool, clouds of at least parallel_min_size points are cut into fixed blocks, one task per block,
+        //and the sums of the blocks are added in block order, so the results are reproducible for a fixed number of
+        //threads. Sums of float clouds are accumulated in double.
+        template <class Real, size_t N>
+            requires (N == 2 || N == 3) && concept_real<Real>
+        class PointCloud
+        {
+        public:
+            using R = Real;
+            using Point = geometry::Point<Real, N>;
+            using Matrix = geometry::Matrix<Real, N, N>;
+            using Array = std::vector<Real, AlignedAllocator<Real, 64>>;
+            static constexpr size_t dimension = N;
+            //Upper bound of the number of blocks, the partial sums live on the stack.
+            static constexpr size_t max_blocks = 256;
+        private:
+            using Sum = std::conditional_t<(sizeof(Real) < sizeof(double)), double, Real>;
+            //Independent partial sums of a reduction, enough to fill the widest registers.
+            static constexpr size_t lanes = 8;
+            //Coordinates per cache line, the blocks start on one.
+            static constexpr size_t line = 64 / sizeof(Real);
+            static constexpr size_t moments = N * (N + 1) / 2;
+        public:
+            PointCloud() : pool_(nullptr), parallel_min_size_(65536)
+            {
+
+            }
+            explicit PointCloud(size_t n) : PointCloud()
+            {
+                resize(n);
+            }
+            //Run the kernels on pool, owned by the caller, for clouds of at least parallel_min_size points.
+            void set_thread_pool(ThreadPool* pool, size_t parallel_min_size = 65536)
+            {
+                pool_ = pool;
+                parallel_min_size_ = parallel_min_size;
+            }
+            size_t size() const
+            {
+                return coordinates_[0].size();
+            }
+            bool empty() const
+            {
+                return size() == 0;
+            }
+            //New points are 0.
+            void resize(size_t n)
+            {
+                for (Array& coordinate : coordinates_)
+                    coordinate.resize(n);
+            }
+            void reserve(size_t n)
+            {
+                for (Array& coordinate : coordinates_)
+                    coordinate.reserve(n);
+            }
+            void clear()
+            {
+                for (Array& coordinate : coordinates_)
+                    coordinate.clear();
+            }
+            void push_back(const Point& p)
+            {
+                for (size_t d = 0; d < N; ++d)
+                    coordinates_[d].push_back(p[d]);
+            }
+            Point point(size_t i) const
+            {
+                Point p;
+                for (size_t d = 0; d < N; ++d)
+                    p[d] = coordinates_[d][i];
+                return p;
+            }
+            void set(size_t i, const Point& p)
+            {
+                for (size_t d = 0; d < N; ++d)
+                    coordinates_[d][i] = p[d];
+            }
+            //Array of the coordinate d of all points, aligned to 64 bytes.
+            Real* coordinate(size_t d)
+            {
+                return coordinates_[d].data();
+            }
+            const Real* coordinate(size_t d) const
+            {
+                return coordinates_[d].data();
+            }
+            //p = linear * p + translation for every point.
+            void transform(const Matrix& linear, const Point& translation)
+            {
+                forEachBlock([&](size_t, size_t begin, size_t end)
+                {
+                    if constexpr (N == 2)
+                        transform2(coordinate(0), coordinate(1), linear, translation, begin, end);
+                    else
+                        transform3(coordinate(0), coordinate(1), coordinate(2), linear, translation, begin, end);
+                });
+            }
+            //Scale every point to norm 1. A point of zero norm under NumericPolicy<Real> is left as it is, like
+            //Point::Normalize().
+            void normalize()
+            {
+                forEachBlock([&](size_t, size_t begin, size_t end)
+                {
+                    Real* __restrict x = coordinate(0);
+                    Real* __restrict y = coordinate(1);
+                    Real* __restrict z = N == 3 ? coordinate(N - 1) : nullptr;
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        Real s = x[i] * x[i] + y[i] * y[i];
+                        if constexpr (N == 3)
+                            s += z[i] * z[i];
+                        const Real norm = Numerical::sqrt(s);
+                        const Real scale = norm > NumericPolicy<Real>::precision ? Real(1) / norm : Real(1);
+                        x[i] *= scale;
+                        y[i] *= scale;
+                        if constexpr (N == 3)
+                            z[i] *= scale;
+                    }
+                });
+            }
+            //out[i] = p . point(i), out holds size() values.
+            void dot(const Point& p, Real* out) const
+            {
+                forEachBlock([&](size_t, size_t begin, size_t end)
+                {
+                    const Real* __restrict x = coordinate(0);
+                    const Real* __restrict y = coordinate(1);
+                    const Real* __restrict z = coordinate(N - 1);
+                    Real* __restrict o = out;
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        Real t = p[0] * x[i] + p[1] * y[i];
+                        if constexpr (N == 3)
+                            t += p[2] * z[i];
+                        o[i] = t;
+                    }
+                });
+            }
+            //out[i] = point(i) . other.point(i), other has the size of this cloud.
+            void dot(const PointCloud& other, Real* out) const
+            {
+                forEachBlock([&](size_t, size_t begin, size_t end)
+                {
+                    const Real* __restrict x = coordinate(0);
+                    const Real* __restrict y = coordinate(1);
+                    const Real* __restrict z = coordinate(N - 1);
+                    const Real* __restrict u = other.coordinate(0);
+                    const Real* __restrict v = other.coordinate(1);
+                    const Real* __restrict w = other.coordinate(N - 1);
+                    Real* __restrict o = out;
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        Real t = x[i] * u[i] + y[i] * v[i];
+                        if constexpr (N == 3)
+                            t += z[i] * w[i];
+                        o[i] = t;
+                    }
+                });
+            }
+            //out[i] = point(i).SquaredNorm()
+            void squaredNorm(Real* out) const
+            {
+                dot(*this, out);
+            }
+            //Mean of the points, 0 for an empty cloud.
+            Point centroid() const
+            {
+                Point c;
+                if (empty())
+                    return c;
+                std::array<Sum, N> sums = reduce<N>([&](size_t begin, size_t end, Sum* partial) { sumCoordinates(begin, end, partial); });
+                for (size_t d = 0; d < N; ++d)
+                    c[d] = Real(sums[d] / Sum(size()));
+                return c;
+            }
+            //Covariance of the points, 1/n sum (p - c)(p - c)^T about the centroid c, in two passes so that clouds far from
+            //the origin keep their precision. 0 for an empty cloud.
+            Matrix covariance() const
+            {
+                Matrix m;
+                if (empty())
+                    return m;
+                const Point c = centroid();
+                std::array<Sum, moments> sums = reduce<moments>([&](size_t begin, size_t end, Sum* partial)
+                {
+                    sumMoments(c, begin, end, partial);
+                });
+                size_t k = 0;
+                for (size_t a = 0; a < N; ++a)
+                {
+                    for (size_t b = a; b < N; ++b, ++k)
+                    {
+                        m(a, b) = Real(sums[k] / Sum(size()));
+                        m(b, a) = m(a, b);
+                    }
+                }
+                return m;
+            }
+        private:
+            //Number of blocks the points are cut into.
+            size_t blocks() const
+            {
+                if (pool_ == nullptr || pool_->size() == 1 || size() < parallel_min_size_)
+                    return 1;
+                return std::min(pool_->size(), max_blocks);
+            }
+            //Call f(block, begin, end) for each block of the points, every block but the first starts on a cache line.
+            template <class F>
+            void forEachBlock(F&& f) const
+            {
+                const size_t n = size();
+                const size_t p = blocks();
+                if (p == 1)
+                {
+                    f(size_t(0), size_t(0), n);
+                    return;
+                }
+                auto bound = [&](size_t i) { return i == p ? n : n * i / p / line * line; };
+                pool_->parallelFor(p, [&](size_t i) { f(i, bound(i), bound(i + 1)); });
+            }
+            //Sums of the M values f(begin, end, partial) adds into partial over the blocks, in block order.
+            template <size_t M, class F>
+            std::array<Sum, M> reduce(F&& f) const
+            {
+                std::array<Sum, M> sum{};
+                const size_t p = blocks();
+                if (p == 1)
+                {
+                    f(size_t(0), size(), sum.data());
+                    return sum;
+                }
+                std::array<std::array<Sum, M>, max_blocks> partial;
+                forEachBlock([&](size_t i, size_t begin, size_t end)
+                {
+                    partial[i].fill(Sum(0));
+                    f(begin, end, partial[i].data());
+                });
+                for (size_t i = 0; i < p; ++i)
+                {
+                    for (size_t k = 0; k < M; ++k)
+                        sum[k] += partial[i][k];
+                }
+                return sum;
+            }
+            static void transform2(Real* __restrict x, Real* __restrict y, const Matrix& a, const Point& t, size_t begin, size_t end)
+            {
+                const Real a00 = a(0, 0), a01 = a(0, 1), a10 = a(1, 0), a11 = a(1, 1);
+                const Real t0 = t[0], t1 = t[1];
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const Real px = x[i], py = y[i];
+                    x[i] = a00 * px + a01 * py + t0;
+                    y[i] = a10 * px + a11 * py + t1;
+                }
+            }
+            static void transform3(Real* __restrict x, Real* __restrict y, Real* __restrict z, const Matrix& a, const Point& t,
+                size_t begin, size_t end)
+            {
+                const Real a00 = a(0, 0), a01 = a(0, 1), a02 = a(0, 2);
+                const Real a10 = a(1, 0), a11 = a(1, 1), a12 = a(1, 2);
+                const Real a20 = a(2, 0), a21 = a(2, 1), a22 = a(2, 2);
+                const Real t0 = t[0], t1 = t[1], t2 = t[2];
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const Real px = x[i], py = y[i], pz = z[i];
+                    x[i] = a00 * px + a01 * py + a02 * pz + t0;
+                    y[i] = a10 * px + a11 * py + a12 * pz + t1;
+                    z[i] = a20 * px + a21 * py + a22 * pz + t2;
+                }
+            }
+            //Add the sums of the coordinates of [begin, end) to partial. Each of the lanes partial sums takes every
+            //lanes-th point, a floating point sum is not associative and would not be vectorized otherwise.
+            void sumCoordinates(size_t begin, size_t end, Sum* partial) const
+            {
+                for (size_t d = 0; d < N; ++d)
+                {
+                    const Real* __restrict x = coordinate(d);
+                    Sum acc[lanes] = {};
+                    size_t i = begin;
+                    for (; i + lanes <= end; i += lanes)
+                    {
+                        for (size_t l = 0; l < lanes; ++l)
+                            acc[l] += Sum(x[i + l]);
+                    }
+                    for (; i < end; ++i)
+                        acc[0] += Sum(x[i]);
+                    for (size_t l = 0; l < lanes; ++l)
+                        partial[d] += acc[l];
+                }
+            }
+            //Add the sums of the products (p_a - c_a)(p_b - c_b), a <= b, of [begin, end) to partial.
+            void sumMoments(const Point& c, size_t begin, size_t end, Sum* partial) const
+            {
+                const Real* __restrict x = coordinate(0);
+                const Real* __restrict y = coordinate(1);
+                const Real* __restrict z = coordinate(N - 1);
+                Sum acc[moments][lanes] = {};
+                auto add = [&](size_t l, size_t i)
+                {
+                    const Sum dx = Sum(x[i] - c[0]), dy = Sum(y[i] - c[1]);
+                    acc[0][l] += dx * dx;
+                    acc[1][l] += dx * dy;
+                    if constexpr (N == 2)
+                    {
+                        acc[2][l] += dy * dy;
+                    }
+                    else
+                    {
+                        const Sum dz = Sum(z[i] - c[2]);
+                        acc[2][l] += dx * dz;
+                        acc[3][l] += dy * dy;
+                        acc[4][l] += dy * dz;
+                        acc[5][l] += dz * dz;
+                    }
+                };
+                size_t i = begin;
+                for (; i + lanes <= end; i += lanes)
+                {
+                    for (size_t l = 0; l < lanes; ++l)
+                        add(l, i + l);
+                }
+                for (; i < end; ++i)
+                    add(0, i);
+                for (size_t k = 0; k < moments; ++k)
+                {
+                    for (size_t l = 0; l < lanes; ++l)
+                        partial[k] += acc[k][l];
+                }
+            }
+        private:
+            std::array<Array, N> coordinates_;
+            ThreadPool* pool_;
+            size_t parallel_min_size_;
+        };
+
+        using PointCloud2f = PointCloud<float, 2>;
+        using PointCloud2d = PointCloud<double, 2>;
+        using PointCloud3f = PointCloud<float, 3>;
+        using PointCloud3d = PointCloud<double, 3>;
+    }
+} // namespace Chimes
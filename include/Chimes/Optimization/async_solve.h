@@ -0,0 +1,126 @@
+#pragma once
+#include <Chimes/Core/executor.h>
+#include <Chimes/Optimization/solve_observer.h>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace Chimes
+{
+    //Handle of a solve running on an Executor, returned by solve_async().
+    //The solve can be cancelled, its latest iterate read while it runs, and its result waited for. The solver and its
+    //objective are owned by the caller and must outlive the solve; the handle may be dropped before the end, the solve then
+    //runs to its end unobserved.
+    template <class Solver>
+    class SolveHandle
+    {
+    public:
+        using Snapshot = std::remove_pointer_t<decltype(std::declval<Solver&>().parameter_.snapshot_)>;
+        using Vector = typename Snapshot::Vector;
+        using Scalar = typename Vector::Scalar;
+        using SolveResult = std::remove_cvref_t<decltype(std::declval<const Solver&>().get_result())>;
+    private:
+        class State
+        {
+        public:
+            explicit State(Solver& solver) : solver_(solver), cancel_(false)
+            {
+
+            }
+        public:
+            Solver& solver_;
+            std::atomic<bool> cancel_;
+            Snapshot snapshot_;
+            std::promise<void> done_;
+        };
+    public:
+        //An empty handle, to assign one of solve_async() to later. Only valid() may be called on it.
+        SolveHandle()
+        {
+
+        }
+        //Whether the handle refers to a solve, like std::future::valid().
+        bool valid() const
+        {
+            return state_ != nullptr;
+        }
+        //Ask the solve to stop. It stops between two trials of a step search at the latest, on a consistent iterate.
+        void cancel()
+        {
+            state_->cancel_.store(true, std::memory_order_relaxed);
+        }
+        bool isDone() const
+        {
+            return done_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+        void wait() const
+        {
+            done_.wait();
+        }
+        //Wait at most timeout, true if the solve is done.
+        template <class Rep, class Period>
+        bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const
+        {
+            return done_.wait_for(timeout) == std::future_status::ready;
+        }
+        //Wait for the end of the solve and return its result. An exception of the solve is rethrown here.
+        const SolveResult& get() const
+        {
+            done_.get();
+            return state_->solver_.get_result();
+        }
+        //Copy the latest iterate and its value, false if no iteration is done yet.
+        bool snapshot(Vector& x, Scalar& fval, size_t* iteration = nullptr) const
+        {
+            return state_->snapshot_.read(x, fval, iteration);
+        }
+    private:
+        explicit SolveHandle(std::shared_ptr<State> state) : state_(std::move(state)), done_(state_->done_.get_future().share())
+        {
+
+        }
+        template <class S>
+        friend SolveHandle<S> solve_async(S& solver, Executor& executor);
+    private:
+        std::shared_ptr<State> state_;
+        std::shared_future<void> done_;
+    };
+
+    //Submit solver.solve() to executor and return at once.
+    //While it runs, the solve uses the cancel flag and the snapshot of the handle in place of parameter_.cancel_ and
+    //parameter_.snapshot_, which are restored at the end. Set parameter_.deadline_ for a wall-clock deadline.
+    //A solve cancelled before it starts still evaluates its start point, so get() always returns a valid result.
+    template <class Solver>
+    SolveHandle<Solver> solve_async(Solver& solver, Executor& executor)
+    {
+        using State = typename SolveHandle<Solver>::State;
+        std::shared_ptr<State> state = std::make_shared<State>(solver);
+        SolveHandle<Solver> handle(state);
+        executor.submit([state]()
+        {
+            auto& parameter = state->solver_.parameter_;
+            const auto cancel = parameter.cancel_;
+            const auto snapshot = parameter.snapshot_;
+            parameter.cancel_ = &state->cancel_;
+            parameter.snapshot_ = &state->snapshot_;
+            try
+            {
+                state->solver_.solve();
+                parameter.cancel_ = cancel;
+                parameter.snapshot_ = snapshot;
+                state->done_.set_value();
+            }
+            catch (...)
+            {
+                parameter.cancel_ = cancel;
+                parameter.snapshot_ = snapshot;
+                state->done_.set_exception(std::current_exception());
+            }
+        });
+        return handle;
+    }
+} // namespace Chimes
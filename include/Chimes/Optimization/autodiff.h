@@ -0,0 +1,134 @@
+#pragma once
+#include <Chimes/Optimization/dual.h>
+#include <Chimes/Optimization/tape.h>
+#include <Chimes/Optimization/objective_concept.h>
+#include <algorithm>
+#include <concepts>
+#include <utility>
+
+namespace Chimes
+{
+    namespace optimization
+    {
+        //Describe the value-only functor that can be differentiated: fun(x) is a template on the scalar of x, written
+        //with the arithmetic operators and the functions of <cmath> (found by argument-dependent lookup, so call them
+        //unqualified or through a using-declaration) and returns the value in that scalar.
+        template <typename Fun, typename Real>
+        concept concept_differentiable = requires(Fun & fun, const Eigen::Matrix<Real, Eigen::Dynamic, 1> & x)
+        {
+            { fun(x) } -> std::convertible_to<Real>;
+        };
+
+        //Objective of value and gradient for the solvers, from a value-only functor differentiated in forward mode.
+        //The gradient takes ceil(n / Chunk) evaluations of fun on Dual<Scalar, Chunk>, each seeding Chunk variables, so
+        //it suits small n. fun(x) on Scalar is used for the evaluations of the value alone.
+        template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic, int Chunk = (Dim == Eigen::Dynamic || Dim > 8 ? 8 : Dim)>
+            requires concept_differentiable<Fun, Dual<Scalar, Chunk>>
+        class ForwardObjective
+        {
+        public:
+            using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+            using Real = Dual<Scalar, Chunk>;
+            using RealVector = Eigen::Matrix<Real, Dim, 1>;
+        public:
+            explicit ForwardObjective(Fun fun) : fun_(std::move(fun))
+            {
+
+            }
+            Scalar operator()(const Vector& x) requires std::invocable<Fun&, const Vector&>
+            {
+                return fun_(x);
+            }
+            Scalar operator()(const Vector& x, Vector& gradient)
+            {
+                const Eigen::Index n = x.size();
+                x_.resize(n);
+                for (Eigen::Index i = 0; i < n; ++i)
+                    x_(i) = Real(x(i));
+                if (n == 0)
+                    return fun_(std::as_const(x_)).value();
+                Scalar fval = 0;
+                for (Eigen::Index begin = 0; begin < n; begin += Chunk)
+                {
+                    const Eigen::Index count = std::min<Eigen::Index>(Chunk, n - begin);
+                    for (Eigen::Index j = 0; j < count; ++j)
+                        x_(begin + j) = Real::variable(x(begin + j), int(j));
+                    const Real result = fun_(std::as_const(x_));
+                    fval = result.value();
+                    gradient.segment(begin, count) = result.derivative().head(count);
+                    for (Eigen::Index j = 0; j < count; ++j)
+                        x_(begin + j) = Real(x(begin + j));
+                }
+                return fval;
+            }
+            Fun& function()
+            {
+                return fun_;
+            }
+        private:
+            Fun fun_;
+            RealVector x_;
+        };
+
+        //Objective of value and gradient for the solvers, from a value-only functor differentiated in reverse mode: one
+        //evaluation of fun on TapeVar<Scalar> records a tape, and one backward sweep of the tape gives the whole gradient,
+        //at a few times the cost of the value whatever n. The tape keeps its memory, so after the first evaluation the
+        //evaluations do not allocate unless fun records more nodes. fun(x) on Scalar is used for the evaluations of the
+        //value alone. A copy has its own tape.
+        template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+            requires concept_differentiable<Fun, TapeVar<Scalar>>
+        class ReverseObjective
+        {
+        public:
+            using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+            using Real = TapeVar<Scalar>;
+            using RealVector = Eigen::Matrix<Real, Dim, 1>;
+        public:
+            explicit ReverseObjective(Fun fun) : fun_(std::move(fun))
+            {
+
+            }
+            Scalar operator()(const Vector& x) requires std::invocable<Fun&, const Vector&>
+            {
+                return fun_(x);
+            }
+            Scalar operator()(const Vector& x, Vector& gradient)
+            {
+                const Eigen::Index n = x.size();
+                tape_.clear();
+                x_.resize(n);
+                for (Eigen::Index i = 0; i < n; ++i)
+                    x_(i) = tape_.variable(x(i));
+                const Real result = fun_(std::as_const(x_));
+                tape_.gradient(result);
+                for (Eigen::Index i = 0; i < n; ++i)
+                    gradient(i) = tape_.adjoint(x_(i));
+                return result.value();
+            }
+            Fun& function()
+            {
+                return fun_;
+            }
+            //Nodes recorded by the last gradient evaluation.
+            size_t tape_size() const
+            {
+                return tape_.size();
+            }
+        private:
+            Fun fun_;
+            Tape<Scalar> tape_;
+            RealVector x_;
+        };
+
+        template <class Scalar = double, class Fun>
+        ForwardObjective<Fun, Scalar> make_forward_objective(Fun fun)
+        {
+            return ForwardObjective<Fun, Scalar>(std::move(fun));
+        }
+        template <class Scalar = double, class Fun>
+        ReverseObjective<Fun, Scalar> make_reverse_objective(Fun fun)
+        {
+            return ReverseObjective<Fun, Scalar>(std::move(fun));
+        }
+    }
+}
@@ -0,0 +1,377 @@
+#pragma once
+#include <Eigen/Core>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace Chimes
+{
+    //LBFGS on a batch of independent problems of the same dimension, solved together.
+    //The batch is stored structure-of-arrays: a B x n column-major array whose row i is problem i, so each variable
+    //of all problems is contiguous and every step of the line search and of the two-loop recursion is a SIMD loop
+    //across problems. Large batches are solved in tiles of rows that fit in cache. Each problem keeps its own step,
+    //history scaling and stopping state; problems that stop are moved behind the active rows, so the objective and the
+    //kernels only see the problems still running.
+    //
+    //Fun is called as fun(x, gradient, fval) with
+    //  Eigen::Ref<const Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic>> x         a x n, one active problem per row
+    //  Eigen::Ref<Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic>> gradient         a x n
+    //  Eigen::Ref<Eigen::Array<Scalar, Eigen::Dynamic, 1>> fval                          a
+    //and should be written with array expressions over the columns, e.g. fval = (x.col(0) - 1).square() + ...
+    template <class Fun, class Scalar = double>
+    class BatchLBFGS
+    {
+    public:
+        using Batch = Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        using Lanes = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+        using Mask = Eigen::Array<bool, Eigen::Dynamic, 1>;
+        enum class StepSearchMethod
+        {
+            SUFFICIENT_DECREASE,
+            WOLFE,
+            STRONG_WOLFE
+        };
+        //Why a problem stopped.
+        enum class Status
+        {
+            RUNNING,
+            GRADIENT_TOLERANCE,
+            MAX_ITERATION,
+            STEPSEARCH_FAILED
+        };
+        class Parameter
+        {
+        public:
+            Parameter() :max_iteration_(1000), max_stepsearch_(100), min_step_(1e-7), epsilon_(1e-5), is_show_(false), descent_rate_(1e-4), wolfe_(0.9), lbfgs_remain_(6),
+                batch_tile_(0), tile_bytes_(262144)
+            {
+                step_search_method_ = (StepSearchMethod::WOLFE);
+            }
+        public:
+            size_t max_iteration_;
+            size_t max_stepsearch_;
+            Scalar min_step_;
+            Scalar epsilon_;
+            bool is_show_;
+            Scalar descent_rate_;
+            Scalar wolfe_;
+            int lbfgs_remain_;
+            StepSearchMethod step_search_method_;
+            //Problems solved together. 0 picks as many as keep about tile_bytes_ of buffers in cache.
+            Eigen::Index batch_tile_;
+            size_t tile_bytes_;
+        };
+        //Row i of res_x and entry i of the other members belong to problem i of init_x.
+        class SolveResult
+        {
+        public:
+            Lanes fval;
+            Batch res_x;
+            Batch res_gradient;
+            std::vector<size_t> iter_time;
+            std::vector<Status> status;
+            //Batched calls of the objective.
+            size_t evaluation_time;
+        };
+    public:
+        //Row i of init_x is the start point of problem i.
+        BatchLBFGS(Fun& fun, const Batch& init_x) : fun_(fun), init_x_(init_x), active_(0)
+        {
+            parameter_ = Parameter();
+        }
+        void solve()
+        {
+            const Eigen::Index b = init_x_.rows();
+            const Eigen::Index n = init_x_.cols();
+            const size_t m = parameter_.lbfgs_remain_;
+            const Eigen::Index tile = tileSize(n, m);
+            resize(std::min(b, tile), n, m);
+            result_.fval.resize(b);
+            result_.res_x.resize(b, n);
+            result_.res_gradient.resize(b, n);
+            result_.iter_time.assign(b, 0);
+            result_.status.assign(b, Status::RUNNING);
+            result_.evaluation_time = 0;
+            for (Eigen::Index first = 0; first < b; first += tile)
+                solveTile(first, std::min(tile, b - first));
+        }
+        const SolveResult& get_result() const
+        {
+            return result_;
+        }
+    private:
+        //Problems solved together, so that the working set of a tile stays in cache.
+        Eigen::Index tileSize(Eigen::Index n, size_t m) const
+        {
+            if (parameter_.batch_tile_ > 0)
+                return parameter_.batch_tile_;
+            const size_t row_bytes = (2 * m + 8) * n * sizeof(Scalar);
+            return std::max<Eigen::Index>(8, (Eigen::Index(parameter_.tile_bytes_ / row_bytes) / 8) * 8);
+        }
+        //Solve the problems first, ..., first + count - 1 of init_x_.
+        void solveTile(Eigen::Index first, Eigen::Index count)
+        {
+            const size_t m = parameter_.lbfgs_remain_;
+            for (Eigen::Index i = 0; i < count; ++i)
+                lane_[i] = first + i;
+            active_ = count;
+            x_.topRows(count) = init_x_.middleRows(first, count);
+            evaluate();
+            g_old_.topRows(count) = g_.topRows(count);
+            d_.topRows(count) = -g_.topRows(count);
+            step_.head(count) = d_.topRows(count).square().rowwise().sum().sqrt().inverse();
+            size_t k = 0;
+            size_t cursor = 0;
+            while (1)
+            {
+                const Lanes gnorm = g_.topRows(active_).square().rowwise().sum().sqrt();
+                for (Eigen::Index p = active_ - 1; p >= 0; --p)
+                {
+                    if (gnorm(p) < parameter_.epsilon_)
+                        retire(p, Status::GRADIENT_TOLERANCE, k);
+                }
+                if (active_ == 0)
+                    break;
+                if (parameter_.max_iteration_ != 0 && parameter_.max_iteration_ == k)
+                {
+                    for (Eigen::Index p = active_ - 1; p >= 0; --p)
+                        retire(p, Status::MAX_ITERATION, k);
+                    break;
+                }
+                stepSearch(k);
+                if (active_ == 0)
+                    break;
+                k++;
+                if (parameter_.is_show_)
+                {
+                    std::cout << k << "\t" << active_ << "\t" << fval_.head(active_).mean() << "\n";
+                }
+                //Store the new pair and run the two-loop recursion on all active problems at once.
+                const Eigen::Index a = active_;
+                auto s = s_[cursor].topRows(a);
+                auto y = y_[cursor].topRows(a);
+                s = d_.topRows(a).colwise() * step_.head(a);
+                y = g_.topRows(a) - g_old_.topRows(a);
+                g_old_.topRows(a) = g_.topRows(a);
+                ys_.col(cursor).head(a) = (y * s).rowwise().sum();
+                gamma_.head(a) = ys_.col(cursor).head(a) / y.square().rowwise().sum();
+                cursor = (cursor + 1) % m;
+                const size_t bound = std::min(k, m);
+                auto d = d_.topRows(a);
+                d = -g_.topRows(a);
+                size_t j = cursor;
+                for (size_t i = 0; i < bound; ++i)
+                {
+                    j = (j + m - 1) % m;
+                    alpha_.col(j).head(a) = (s_[j].topRows(a) * d).rowwise().sum() / ys_.col(j).head(a);
+                    d -= y_[j].topRows(a).colwise() * alpha_.col(j).head(a);
+                }
+                d.colwise() *= gamma_.head(a);
+                for (size_t i = 0; i < bound; ++i)
+                {
+                    const Lanes beta = (y_[j].topRows(a) * d).rowwise().sum() / ys_.col(j).head(a);
+                    d += s_[j].topRows(a).colwise() * (alpha_.col(j).head(a) - beta);
+                    j = (j + 1) % m;
+                }
+                step_.head(a).setOnes();
+            }
+        }
+        void resize(Eigen::Index b, Eigen::Index n, size_t m)
+        {
+            x_.resize(b, n);
+            g_.resize(b, n);
+            d_.resize(b, n);
+            x0_.resize(b, n);
+            g_old_.resize(b, n);
+            s_.resize(m);
+            y_.resize(m);
+            for (size_t i = 0; i < m; ++i)
+            {
+                s_[i].resize(b, n);
+                y_[i].resize(b, n);
+            }
+            ys_.resize(b, m);
+            alpha_.resize(b, m);
+            fval_.resize(b);
+            f0_.resize(b);
+            step_.resize(b);
+            step_l_.resize(b);
+            step_u_.resize(b);
+            idg_.resize(b);
+            gamma_.resize(b);
+            searching_.resize(b);
+            lane_.resize(b);
+            rows_.resize(b);
+            trial_x_.resize(b, n);
+            trial_g_.resize(b, n);
+            trial_f_.resize(b);
+        }
+        //Objective on the active rows.
+        void evaluate()
+        {
+            Eigen::Ref<const Batch> x = x_.topRows(active_);
+            auto g_block = g_.topRows(active_);
+            auto f_block = fval_.head(active_);
+            Eigen::Ref<Batch> g = g_block;
+            Eigen::Ref<Lanes> f = f_block;
+            fun_(x, g, f);
+            ++result_.evaluation_time;
+        }
+        //Objective on the active rows still searching a step.
+        //When some problems already have their step, the others are gathered into dense rows for the objective.
+        void evaluateSearching()
+        {
+            const Eigen::Index a = active_;
+            Eigen::Index c = 0;
+            for (Eigen::Index p = 0; p < a; ++p)
+            {
+                if (searching_(p))
+                    rows_[c++] = p;
+            }
+            if (c == a)
+            {
+                evaluate();
+                return;
+            }
+            for (Eigen::Index i = 0; i < c; ++i)
+                trial_x_.row(i) = x_.row(rows_[i]);
+            Eigen::Ref<const Batch> x = trial_x_.topRows(c);
+            auto g_block = trial_g_.topRows(c);
+            auto f_block = trial_f_.head(c);
+            Eigen::Ref<Batch> g = g_block;
+            Eigen::Ref<Lanes> f = f_block;
+            fun_(x, g, f);
+            ++result_.evaluation_time;
+            for (Eigen::Index i = 0; i < c; ++i)
+            {
+                g_.row(rows_[i]) = trial_g_.row(i);
+                fval_(rows_[i]) = trial_f_(i);
+            }
+        }
+        //Step search on all active problems, the same rules as LineSearchMethod::stepSearch applied per problem.
+        void stepSearch(size_t k)
+        {
+            const Eigen::Index a = active_;
+            idg_.head(a) = (g_.topRows(a) * d_.topRows(a)).rowwise().sum();
+            if ((idg_.head(a) > Scalar(0)).any())
+            {
+                std::cout << "[error][BatchLBFGS] direction is not a descent direction." << std::endl;
+                throw std::runtime_error("[error][BatchLBFGS] direction is not a descent direction");
+            }
+            x0_.topRows(a) = x_.topRows(a);
+            f0_.head(a) = fval_.head(a);
+            step_l_.head(a).setZero();
+            step_u_.head(a).setConstant(std::numeric_limits<Scalar>::infinity());
+            searching_.head(a).setConstant(true);
+            const Scalar c1 = parameter_.descent_rate_;
+            const Scalar c2 = parameter_.wolfe_;
+            for (size_t t = 1; active_ > 0; ++t)
+            {
+                const Eigen::Index a = active_;
+                x_.topRows(a) = x0_.topRows(a) + d_.topRows(a).colwise() * step_.head(a);
+                evaluateSearching();
+                const auto step = step_.head(a);
+                const auto idg = idg_.head(a);
+                const Mask armijo = fval_.head(a) <= f0_.head(a) + step * c1 * idg;
+                const Lanes ndg = (g_.topRows(a) * d_.topRows(a)).rowwise().sum();
+                const Mask low = ndg < c2 * idg;
+                const Mask high = ndg > -c2 * idg;
+                Mask accept = armijo;
+                if (parameter_.step_search_method_ == StepSearchMethod::WOLFE)
+                    accept = armijo && !low;
+                else if (parameter_.step_search_method_ == StepSearchMethod::STRONG_WOLFE)
+                    accept = armijo && !low && !high;
+                const Mask searching = searching_.head(a) && !accept;
+                step_u_.head(a) = (searching && (!armijo || !low)).select(step, step_u_.head(a));
+                step_l_.head(a) = (searching && armijo && low).select(step, step_l_.head(a));
+                searching_.head(a) = searching;
+                if (!searching.any())
+                    return;
+                const Mask failed = t == parameter_.max_stepsearch_ ? searching : Mask(searching && step < parameter_.min_step_);
+                const Lanes next = (step_u_.head(a) == std::numeric_limits<Scalar>::infinity()).select(Scalar(2) * step, Scalar(0.5) * (step_l_.head(a) + step_u_.head(a)));
+                step_.head(a) = searching.select(next, step);
+                if (!failed.any())
+                    continue;
+                //Back to the start point of the search, whose gradient is still in g_old_, and stop these problems.
+                //The other problems go on searching in the compacted rows.
+                for (Eigen::Index p = a - 1; p >= 0; --p)
+                {
+                    if (!failed(p))
+                        continue;
+                    x_.row(p) = x0_.row(p);
+                    g_.row(p) = g_old_.row(p);
+                    fval_(p) = f0_(p);
+                    retire(p, Status::STEPSEARCH_FAILED, k);
+                }
+            }
+        }
+        //Write the result of the problem in row p and swap it behind the active rows.
+        void retire(Eigen::Index p, Status status, size_t k)
+        {
+            const size_t lane = lane_[p];
+            result_.res_x.row(lane) = x_.row(p);
+            result_.res_gradient.row(lane) = g_.row(p);
+            result_.fval(lane) = fval_(p);
+            result_.iter_time[lane] = k;
+            result_.status[lane] = status;
+            const Eigen::Index q = --active_;
+            if (p == q)
+                return;
+            x_.row(p).swap(x_.row(q));
+            g_.row(p).swap(g_.row(q));
+            d_.row(p).swap(d_.row(q));
+            x0_.row(p).swap(x0_.row(q));
+            g_old_.row(p).swap(g_old_.row(q));
+            for (size_t i = 0; i < s_.size(); ++i)
+            {
+                s_[i].row(p).swap(s_[i].row(q));
+                y_[i].row(p).swap(y_[i].row(q));
+            }
+            ys_.row(p).swap(ys_.row(q));
+            alpha_.row(p).swap(alpha_.row(q));
+            std::swap(fval_(p), fval_(q));
+            std::swap(f0_(p), f0_(q));
+            std::swap(step_(p), step_(q));
+            std::swap(step_l_(p), step_l_(q));
+            std::swap(step_u_(p), step_u_(q));
+            std::swap(idg_(p), idg_(q));
+            std::swap(gamma_(p), gamma_(q));
+            std::swap(searching_(p), searching_(q));
+            std::swap(lane_[p], lane_[q]);
+        }
+    public:
+        Parameter parameter_;
+    private:
+        Fun& fun_;
+        Batch init_x_;
+        SolveResult result_;
+        //Number of active rows, they are the first rows of every buffer.
+        Eigen::Index active_;
+        Batch x_;
+        Batch g_;
+        Batch d_;
+        Batch x0_;
+        Batch g_old_;
+        std::vector<Batch> s_;
+        std::vector<Batch> y_;
+        Batch ys_;
+        Batch alpha_;
+        Lanes fval_;
+        Lanes f0_;
+        Lanes step_;
+        Lanes step_l_;
+        Lanes step_u_;
+        Lanes idg_;
+        Lanes gamma_;
+        Mask searching_;
+        //Problem in each row.
+        std::vector<size_t> lane_;
+        //Rows gathered by evaluateSearching().
+        std::vector<Eigen::Index> rows_;
+        Batch trial_x_;
+        Batch trial_g_;
+        Lanes trial_f_;
+    };
+} // namespace Chimes
@@ -0,0 +1,161 @@
+#pragma once
+#include <Chimes/Optimization/objective_concept.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace Chimes
+{
+    //Mini-batches of a finite-sum objective, streamed in epochs: each epoch is one pass over a random permutation of the
+    //samples cut into batches of batch_size, the last one shorter if batch_size does not divide the number of samples.
+    //With is_prefetch a background thread loads the next batch while the current one is used. The sequence of batches
+    //only depends on the seed, with or without prefetching.
+    template <class Fun>
+    class BatchStream
+    {
+    public:
+        using Batch = typename Fun::Batch;
+    public:
+        BatchStream(Fun& fun, size_t batch_size, uint64_t seed, bool is_prefetch = false) : fun_(fun),
+            batch_size_(std::max<size_t>(1, batch_size)), random_(seed), cursor_(0), epoch_(0), current_(1), stop_(false)
+        {
+            order_.resize(fun_.samples());
+            if (order_.empty())
+            {
+                std::cout << "[error][BatchStream] the objective has no samples" << std::endl;
+                throw std::runtime_error("[error][BatchStream] the objective has no samples");
+            }
+            std::iota(order_.begin(), order_.end(), size_t(0));
+            std::shuffle(order_.begin(), order_.end(), random_);
+            for (size_t i = 0; i < 2; ++i)
+            {
+                count_[i] = 0;
+                is_epoch_end_[i] = false;
+                is_ready_[i] = false;
+            }
+            if (is_prefetch)
+                prefetch_ = std::thread([this]() { prefetchLoop(); });
+        }
+        BatchStream(const BatchStream&) = delete;
+        BatchStream& operator=(const BatchStream&) = delete;
+        ~BatchStream()
+        {
+            if (!prefetch_.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            prefetch_.join();
+        }
+        //The next batch, valid until the following call.
+        const Batch& next()
+        {
+            current_ ^= 1;
+            if (!prefetch_.joinable())
+            {
+                fill(current_);
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                //Hand the previous batch back to the prefetching thread.
+                is_ready_[current_ ^ 1] = false;
+                cv_.notify_all();
+                cv_.wait(lock, [this]() { return is_ready_[current_] || exception_; });
+                if (exception_)
+                    std::rethrow_exception(exception_);
+            }
+            if (is_epoch_end_[current_])
+                ++epoch_;
+            return batches_[current_];
+        }
+        //Number of samples in the batch returned by the last next().
+        size_t count() const
+        {
+            return count_[current_];
+        }
+        //Number of epochs completed by the batches returned so far.
+        size_t epoch() const
+        {
+            return epoch_;
+        }
+        size_t batch_size() const
+        {
+            return batch_size_;
+        }
+    private:
+        //Load the next batch of the permutation into slot i, and reshuffle at the end of an epoch.
+        void fill(size_t i)
+        {
+            const size_t count = std::min(batch_size_, order_.size() - cursor_);
+            fun_.load(order_.data() + cursor_, count, batches_[i]);
+            count_[i] = count;
+            cursor_ += count;
+            is_epoch_end_[i] = cursor_ == order_.size();
+            if (is_epoch_end_[i])
+            {
+                cursor_ = 0;
+                std::shuffle(order_.begin(), order_.end(), random_);
+            }
+        }
+        //Fill the slots in turn, each one as soon as the solver has handed it back.
+        void prefetchLoop()
+        {
+            size_t i = 0;
+            while (1)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [&]() { return stop_ || !is_ready_[i]; });
+                    if (stop_)
+                        return;
+                }
+                try
+                {
+                    fill(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    exception_ = std::current_exception();
+                    cv_.notify_all();
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    is_ready_[i] = true;
+                }
+                cv_.notify_all();
+                i ^= 1;
+            }
+        }
+    private:
+        Fun& fun_;
+        size_t batch_size_;
+        std::mt19937_64 random_;
+        std::vector<size_t> order_;
+        size_t cursor_;
+        size_t epoch_;
+        //Double buffer: the solver reads slot current_ while the other one is loaded.
+        Batch batches_[2];
+        size_t count_[2];
+        bool is_epoch_end_[2];
+        bool is_ready_[2];
+        size_t current_;
+        std::thread prefetch_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stop_;
+        std::exception_ptr exception_;
+    };
+} // namespace Chimes
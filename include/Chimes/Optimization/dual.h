@@ -0,0 +1,382 @@
+#pragma once
+#include <Eigen/Core>
+#include <cmath>
+#include <ostream>
+
+namespace Chimes
+{
+    //Dual number of forward-mode automatic differentiation: a value and its derivatives along N directions, carried
+    //through every operation by the chain rule. N is fixed so the derivatives live inside the number and an operation is
+    //a few vectorized Eigen operations on them, without allocation. An objective of n variables is differentiated in
+    //ceil(n / N) evaluations, see optimization::ForwardObjective.
+    template <class Scalar = double, int N = 8>
+    class Dual
+    {
+        static_assert(N != Eigen::Dynamic, "the number of directions of a Dual is fixed");
+    public:
+        using Real = Scalar;
+        using Derivative = Eigen::Matrix<Scalar, N, 1>;
+    public:
+        Dual() : value_(0), derivative_(Derivative::Zero())
+        {
+
+        }
+        //A constant, all derivatives 0.
+        Dual(const Scalar& value) : value_(value), derivative_(Derivative::Zero())
+        {
+
+        }
+        Dual(const Scalar& value, const Derivative& derivative) : value_(value), derivative_(derivative)
+        {
+
+        }
+        //The variable of direction i: derivative 1 along i and 0 along the others.
+        static Dual variable(const Scalar& value, int i)
+        {
+            Dual dual(value);
+            dual.derivative_(i) = Scalar(1);
+            return dual;
+        }
+        const Scalar& value() const
+        {
+            return value_;
+        }
+        const Derivative& derivative() const
+        {
+            return derivative_;
+        }
+        Dual& operator+=(const Dual& b)
+        {
+            value_ += b.value_;
+            derivative_ += b.derivative_;
+            return *this;
+        }
+        Dual& operator-=(const Dual& b)
+        {
+            value_ -= b.value_;
+            derivative_ -= b.derivative_;
+            return *this;
+        }
+        Dual& operator*=(const Dual& b)
+        {
+            derivative_ = b.value_ * derivative_ + value_ * b.derivative_;
+            value_ *= b.value_;
+            return *this;
+        }
+        Dual& operator/=(const Dual& b)
+        {
+            const Scalar inverse = Scalar(1) / b.value_;
+            value_ *= inverse;
+            derivative_ = (derivative_ - value_ * b.derivative_) * inverse;
+            return *this;
+        }
+        Dual& operator+=(const Scalar& b)
+        {
+            value_ += b;
+            return *this;
+        }
+        Dual& operator-=(const Scalar& b)
+        {
+            value_ -= b;
+            return *this;
+        }
+        Dual& operator*=(const Scalar& b)
+        {
+            value_ *= b;
+            derivative_ *= b;
+            return *this;
+        }
+        Dual& operator/=(const Scalar& b)
+        {
+            value_ /= b;
+            derivative_ /= b;
+            return *this;
+        }
+    private:
+        Scalar value_;
+        Derivative derivative_;
+    };
+
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator-(const Dual<Scalar, N>& a)
+    {
+        return Dual<Scalar, N>(-a.value(), -a.derivative());
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator+(Dual<Scalar, N> a, const Dual<Scalar, N>& b)
+    {
+        return a += b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator-(Dual<Scalar, N> a, const Dual<Scalar, N>& b)
+    {
+        return a -= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator*(Dual<Scalar, N> a, const Dual<Scalar, N>& b)
+    {
+        return a *= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator/(Dual<Scalar, N> a, const Dual<Scalar, N>& b)
+    {
+        return a /= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator+(Dual<Scalar, N> a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a += b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator+(const typename Dual<Scalar, N>::Real& a, Dual<Scalar, N> b)
+    {
+        return b += a;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator-(Dual<Scalar, N> a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a -= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator-(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return Dual<Scalar, N>(a - b.value(), -b.derivative());
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator*(Dual<Scalar, N> a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a *= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator*(const typename Dual<Scalar, N>::Real& a, Dual<Scalar, N> b)
+    {
+        return b *= a;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator/(Dual<Scalar, N> a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a /= b;
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> operator/(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        const Scalar value = a / b.value();
+        return Dual<Scalar, N>(value, (-value / b.value()) * b.derivative());
+    }
+
+    //Comparisons look at the values only.
+    template <class Scalar, int N>
+    bool operator<(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() < b.value();
+    }
+    template <class Scalar, int N>
+    bool operator>(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() > b.value();
+    }
+    template <class Scalar, int N>
+    bool operator<=(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() <= b.value();
+    }
+    template <class Scalar, int N>
+    bool operator>=(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() >= b.value();
+    }
+    template <class Scalar, int N>
+    bool operator==(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() == b.value();
+    }
+    template <class Scalar, int N>
+    bool operator!=(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return a.value() != b.value();
+    }
+
+    template <class Scalar, int N>
+    bool operator<(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() < b;
+    }
+    template <class Scalar, int N>
+    bool operator<(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a < b.value();
+    }
+    template <class Scalar, int N>
+    bool operator>(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() > b;
+    }
+    template <class Scalar, int N>
+    bool operator>(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a > b.value();
+    }
+    template <class Scalar, int N>
+    bool operator<=(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() <= b;
+    }
+    template <class Scalar, int N>
+    bool operator<=(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a <= b.value();
+    }
+    template <class Scalar, int N>
+    bool operator>=(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() >= b;
+    }
+    template <class Scalar, int N>
+    bool operator>=(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a >= b.value();
+    }
+    template <class Scalar, int N>
+    bool operator==(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() == b;
+    }
+    template <class Scalar, int N>
+    bool operator==(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a == b.value();
+    }
+    template <class Scalar, int N>
+    bool operator!=(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& b)
+    {
+        return a.value() != b;
+    }
+    template <class Scalar, int N>
+    bool operator!=(const typename Dual<Scalar, N>::Real& a, const Dual<Scalar, N>& b)
+    {
+        return a != b.value();
+    }
+
+    //f(a) with f'(a) = d, by the chain rule.
+    template <class Scalar, int N>
+    Dual<Scalar, N> chain(const Dual<Scalar, N>& a, const Scalar& value, const Scalar& d)
+    {
+        return Dual<Scalar, N>(value, d * a.derivative());
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> sqrt(const Dual<Scalar, N>& a)
+    {
+        const Scalar value = std::sqrt(a.value());
+        return chain(a, value, Scalar(0.5) / value);
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> exp(const Dual<Scalar, N>& a)
+    {
+        const Scalar value = std::exp(a.value());
+        return chain(a, value, value);
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> log(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::log(a.value()), Scalar(1) / a.value());
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> log1p(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::log1p(a.value()), Scalar(1) / (Scalar(1) + a.value()));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> sin(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::sin(a.value()), std::cos(a.value()));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> cos(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::cos(a.value()), -std::sin(a.value()));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> tan(const Dual<Scalar, N>& a)
+    {
+        const Scalar value = std::tan(a.value());
+        return chain(a, value, Scalar(1) + value * value);
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> sinh(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::sinh(a.value()), std::cosh(a.value()));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> cosh(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::cosh(a.value()), std::sinh(a.value()));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> tanh(const Dual<Scalar, N>& a)
+    {
+        const Scalar value = std::tanh(a.value());
+        return chain(a, value, Scalar(1) - value * value);
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> atan(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::atan(a.value()), Scalar(1) / (Scalar(1) + a.value() * a.value()));
+    }
+    //The derivative at 0 is taken as 0.
+    template <class Scalar, int N>
+    Dual<Scalar, N> abs(const Dual<Scalar, N>& a)
+    {
+        return chain(a, std::abs(a.value()), Scalar(a.value() > 0) - Scalar(a.value() < 0));
+    }
+    template <class Scalar, int N>
+    Dual<Scalar, N> pow(const Dual<Scalar, N>& a, const typename Dual<Scalar, N>::Real& p)
+    {
+        //At a = 0 the derivative is 0 for p = 0, and pow(0, p - 1) gives 0 for p > 1, 1 for p = 1 and inf for p < 1.
+        const Scalar derivative = p == Scalar(0) ? Scalar(0) : p * std::pow(a.value(), p - Scalar(1));
+        return chain(a, std::pow(a.value(), p), derivative);
+    }
+    //a^b = exp(b * log(a)), a > 0.
+    template <class Scalar, int N>
+    Dual<Scalar, N> pow(const Dual<Scalar, N>& a, const Dual<Scalar, N>& b)
+    {
+        return exp(b * log(a));
+    }
+    template <class Scalar, int N>
+    std::ostream& operator<<(std::ostream& os, const Dual<Scalar, N>& a)
+    {
+        return os << a.value();
+    }
+} // namespace Chimes
+
+namespace Eigen
+{
+    //Dual numbers as the scalar of Eigen matrices.
+    template <class Scalar, int N>
+    struct NumTraits<Chimes::Dual<Scalar, N>> : NumTraits<Scalar>
+    {
+        using Real = Chimes::Dual<Scalar, N>;
+        using NonInteger = Chimes::Dual<Scalar, N>;
+        using Nested = Chimes::Dual<Scalar, N>;
+        using Literal = Scalar;
+        enum
+        {
+            IsComplex = 0,
+            IsInteger = 0,
+            IsSigned = 1,
+            RequireInitialization = 1,
+            ReadCost = N + 1,
+            AddCost = N + 1,
+            MulCost = 2 * N + 1
+        };
+    };
+    template <class Scalar, int N>
+    struct ScalarBinaryOpTraits<Chimes::Dual<Scalar, N>, Scalar>
+    {
+        using ReturnType = Chimes::Dual<Scalar, N>;
+    };
+    template <class Scalar, int N>
+    struct ScalarBinaryOpTraits<Scalar, Chimes::Dual<Scalar, N>>
+    {
+        using ReturnType = Chimes::Dual<Scalar, N>;
+    };
+} // namespace Eigen
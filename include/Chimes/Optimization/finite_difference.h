@@ -0,0 +1,435 @@
+#pragma once
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Optimization/objective_concept.h>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <concepts>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+
+namespace Chimes
+{
+    namespace optimization
+    {
+        enum class DifferenceScheme
+        {
+            //(f(x + h e_j) - f(x)) / h, error O(h), one evaluation per coordinate.
+            FORWARD,
+            //(f(x + h e_j) - f(x - h e_j)) / 2h, error O(h^2), two evaluations per coordinate.
+            CENTRAL,
+            //Im f(x + i h e_j) / h, exact to rounding with no cancellation, one evaluation per coordinate on complex numbers.
+            //fun must be written for complex vectors as well, with analytic operations only (no abs, no comparisons).
+            COMPLEX_STEP
+        };
+
+        //Step of the scheme at x_j, scaled by max(1, |x_j|) and rounded so that x_j + h - x_j is exactly h.
+        template <class Scalar>
+        Scalar difference_step(DifferenceScheme scheme, Scalar x_j)
+        {
+            const Scalar epsilon = std::numeric_limits<Scalar>::epsilon();
+            const Scalar scale = std::max(Scalar(1), std::abs(x_j));
+            switch (scheme)
+            {
+            case DifferenceScheme::FORWARD:
+            {
+                volatile Scalar shifted = x_j + std::sqrt(epsilon) * scale;
+                return shifted - x_j;
+            }
+            case DifferenceScheme::CENTRAL:
+            {
+                volatile Scalar shifted = x_j + std::cbrt(epsilon) * scale;
+                return shifted - x_j;
+            }
+            default:
+                return epsilon * epsilon * scale;
+            }
+        }
+
+        //Objective of value and gradient for the solvers, from a value-only functor fun(x) differentiated by finite
+        //differences. The gradient costs n + 1 evaluations of fun (2n + 1 with CENTRAL), which run concurrently on the
+        //pool if one is given, so fun must then be safe to call from several threads. With a pool of p threads, the
+        //coordinates are dealt to p slots, each with its own perturbed copy of x, so nothing is allocated after the first
+        //gradient and the result does not depend on the number of threads.
+        template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+            requires std::invocable<Fun&, const Eigen::Matrix<Scalar, Dim, 1>&>
+        class FiniteDifferenceObjective
+        {
+        public:
+            using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+            using ComplexVector = Eigen::Matrix<std::complex<Scalar>, Dim, 1>;
+        public:
+            explicit FiniteDifferenceObjective(Fun fun, DifferenceScheme scheme = DifferenceScheme::CENTRAL, ThreadPool* pool = nullptr) :
+                fun_(std::move(fun)), scheme_(scheme), pool_(pool), evaluations_(0)
+            {
+
+            }
+            Scalar operator()(const Vector& x)
+            {
+                ++evaluations_;
+                return fun_(x);
+            }
+            Scalar operator()(const Vector& x, Vector& gradient)
+            {
+                const Eigen::Index n = x.size();
+                const size_t slots = pool_ == nullptr ? 1 : std::min<size_t>(pool_->size(), std::max<Eigen::Index>(n, 1));
+                const Scalar fval = fun_(x);
+                if (scheme_ == DifferenceScheme::COMPLEX_STEP)
+                {
+                    if constexpr (std::invocable<Fun&, const ComplexVector&>)
+                    {
+                        complex_x_.resize(slots);
+                        forEachSlot(slots, [&](size_t slot)
+                        {
+                            ComplexVector& z = complex_x_[slot];
+                            z = x.template cast<std::complex<Scalar>>();
+                            for (Eigen::Index j = Eigen::Index(slot); j < n; j += Eigen::Index(slots))
+                            {
+                                const Scalar h = difference_step(scheme_, x(j));
+                                z(j) = std::complex<Scalar>(x(j), h);
+                                gradient(j) = std::imag(std::complex<Scalar>(fun_(std::as_const(z)))) / h;
+                                z(j) = x(j);
+                            }
+                        });
+                    }
+                    else
+                    {
+                        std::cout << "[error][FiniteDifference] complex step needs fun on complex vectors" << std::endl;
+                        throw std::runtime_error("[error][FiniteDifference] complex step needs fun on complex vectors");
+                    }
+                }
+                else
+                {
+                    x_.resize(slots);
+                    forEachSlot(slots, [&](size_t slot)
+                    {
+                        Vector& y = x_[slot];
+                        y = x;
+                        for (Eigen::Index j = Eigen::Index(slot); j < n; j += Eigen::Index(slots))
+                        {
+                            const Scalar h = difference_step(scheme_, x(j));
+                            y(j) = x(j) + h;
+                            const Scalar forward = fun_(std::as_const(y));
+                            if (scheme_ == DifferenceScheme::CENTRAL)
+                            {
+                                y(j) = x(j) - h;
+                                gradient(j) = (forward - fun_(std::as_const(y))) / (2 * h);
+                            }
+                            else
+                            {
+                                gradient(j) = (forward - fval) / h;
+                            }
+                            y(j) = x(j);
+                        }
+                    });
+                }
+                evaluations_ += 1 + (scheme_ == DifferenceScheme::CENTRAL ? 2 : 1) * size_t(n);
+                return fval;
+            }
+            Fun& function()
+            {
+                return fun_;
+            }
+            void set_scheme(DifferenceScheme scheme)
+            {
+                scheme_ = scheme;
+            }
+            //Evaluations of fun since the construction.
+            size_t evaluations() const
+            {
+                return evaluations_;
+            }
+        private:
+            template <class F>
+            void forEachSlot(size_t slots, F&& f)
+            {
+                if (slots == 1)
+                    f(0);
+                else
+                    pool_->parallelFor(slots, f);
+            }
+        private:
+            Fun fun_;
+            DifferenceScheme scheme_;
+            ThreadPool* pool_;
+            size_t evaluations_;
+            std::vector<Vector> x_;
+            std::vector<ComplexVector> complex_x_;
+        };
+
+        //Objective of value and gradient for the solvers, from a partially separable functor differentiated by finite
+        //differences with a coloring of its sparsity.
+        //fun(x, elements) writes the m element values of f(x) = elements.sum(), and pattern[k] lists the variables element k
+        //depends on. Variables that share no element get the same color, and one evaluation perturbs all the variables of a
+        //color at once: each element then only moves with its own variable of that color, so the difference of element k
+        //is the partial derivative for that variable (the column groups of Curtis, Powell and Reid). The gradient costs
+        //colors() + 1 evaluations (2 colors() + 1 with CENTRAL) instead of n + 1, e.g. 2 for a chain of elements on
+        //consecutive pairs whatever n. A scalar black box has no elements and needs FiniteDifferenceObjective.
+        //The colors are shared among the pool threads as in FiniteDifferenceObjective.
+        template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+        class ColoredFiniteDifferenceObjective
+        {
+        public:
+            using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+            using ElementVector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+            using ComplexVector = Eigen::Matrix<std::complex<Scalar>, Dim, 1>;
+            using ComplexElementVector = Eigen::Matrix<std::complex<Scalar>, Eigen::Dynamic, 1>;
+            using Pattern = std::vector<std::vector<Eigen::Index>>;
+        public:
+            ColoredFiniteDifferenceObjective(Fun fun, const Pattern& pattern, DifferenceScheme scheme = DifferenceScheme::CENTRAL,
+                ThreadPool* pool = nullptr) : fun_(std::move(fun)), pattern_(pattern), scheme_(scheme), pool_(pool), evaluations_(0)
+            {
+                color();
+            }
+            Scalar operator()(const Vector& x)
+            {
+                elements_.resize(pattern_.size());
+                ++evaluations_;
+                fun_(x, elements_);
+                return elements_.sum();
+            }
+            Scalar operator()(const Vector& x, Vector& gradient)
+            {
+                const Eigen::Index n = x.size();
+                if (Eigen::Index(variable_elements_.size()) > n)
+                {
+                    std::cout << "[error][FiniteDifference] the pattern has more variables than x" << std::endl;
+                    throw std::runtime_error("[error][FiniteDifference] the pattern has more variables than x");
+                }
+                const size_t m = pattern_.size();
+                const size_t colors = this->colors();
+                const size_t slots = pool_ == nullptr ? 1 : std::min<size_t>(pool_->size(), std::max<size_t>(colors, 1));
+                elements_.resize(m);
+                fun_(x, elements_);
+                //Variables in no element.
+                gradient.setZero();
+                if (scheme_ == DifferenceScheme::COMPLEX_STEP)
+                {
+                    if constexpr (std::invocable<Fun&, const ComplexVector&, ComplexElementVector&>)
+                    {
+                        complex_x_.resize(slots);
+                        complex_elements_.resize(slots);
+                        forEachSlot(slots, [&](size_t slot)
+                        {
+                            ComplexVector& z = complex_x_[slot];
+                            ComplexElementVector& r = complex_elements_[slot];
+                            z = x.template cast<std::complex<Scalar>>();
+                            r.resize(m);
+                            for (size_t c = slot; c < colors; c += slots)
+                            {
+                                for (size_t i = color_begin_[c]; i < color_begin_[c + 1]; ++i)
+                                {
+                                    const Eigen::Index j = color_variables_[i];
+                                    z(j) = std::complex<Scalar>(x(j), difference_step(scheme_, x(j)));
+                                }
+                                fun_(std::as_const(z), r);
+                                for (size_t i = color_begin_[c]; i < color_begin_[c + 1]; ++i)
+                                {
+                                    const Eigen::Index j = color_variables_[i];
+                                    const Scalar h = std::imag(z(j));
+                                    Scalar sum = 0;
+                                    for (const size_t k : variable_elements_[j])
+                                        sum += std::imag(r(k));
+                                    gradient(j) = sum / h;
+                                    z(j) = x(j);
+                                }
+                            }
+                        });
+                    }
+                    else
+                    {
+                        std::cout << "[error][FiniteDifference] complex step needs fun on complex vectors" << std::endl;
+                        throw std::runtime_error("[error][FiniteDifference] complex step needs fun on complex vectors");
+                    }
+                }
+                else
+                {
+                    x_.resize(slots);
+                    forward_elements_.resize(slots);
+                    backward_elements_.resize(slots);
+                    forEachSlot(slots, [&](size_t slot)
+                    {
+                        Vector& y = x_[slot];
+                        ElementVector& forward = forward_elements_[slot];
+                        ElementVector& backward = backward_elements_[slot];
+                        y = x;
+                        forward.resize(m);
+                        backward.resize(m);
+                        for (size_t c = slot; c < colors; c += slots)
+                        {
+                            perturb(y, x, c, 1);
+                            fun_(std::as_const(y), forward);
+                            if (scheme_ == DifferenceScheme::CENTRAL)
+                            {
+                                perturb(y, x, c, -1);
+                                fun_(std::as_const(y), backward);
+                            }
+                            for (size_t i = color_begin_[c]; i < color_begin_[c + 1]; ++i)
+                            {
+                                const Eigen::Index j = color_variables_[i];
+                                const Scalar h = difference_step(scheme_, x(j));
+                                Scalar sum = 0;
+                                if (scheme_ == DifferenceScheme::CENTRAL)
+                                {
+                                    for (const size_t k : variable_elements_[j])
+                                        sum += forward(k) - backward(k);
+                                    gradient(j) = sum / (2 * h);
+                                }
+                                else
+                                {
+                                    for (const size_t k : variable_elements_[j])
+                                        sum += forward(k) - elements_(k);
+                                    gradient(j) = sum / h;
+                                }
+                                y(j) = x(j);
+                            }
+                        }
+                    });
+                }
+                evaluations_ += 1 + (scheme_ == DifferenceScheme::CENTRAL ? 2 : 1) * colors;
+                return elements_.sum();
+            }
+            Fun& function()
+            {
+                return fun_;
+            }
+            void set_scheme(DifferenceScheme scheme)
+            {
+                scheme_ = scheme;
+            }
+            size_t colors() const
+            {
+                return color_begin_.size() - 1;
+            }
+            //Color of variable j.
+            size_t color(Eigen::Index j) const
+            {
+                return variable_color_[j];
+            }
+            size_t evaluations() const
+            {
+                return evaluations_;
+            }
+        private:
+            //Greedy coloring of the variables, largest degree first, with no two variables of an element in the same color.
+            void color()
+            {
+                Eigen::Index n = 0;
+                for (const std::vector<Eigen::Index>& element : pattern_)
+                {
+                    for (const Eigen::Index j : element)
+                    {
+                        if (j < 0)
+                        {
+                            std::cout << "[error][FiniteDifference] negative variable in the pattern" << std::endl;
+                            throw std::runtime_error("[error][FiniteDifference] negative variable in the pattern");
+                        }
+                        n = std::max(n, j + 1);
+                    }
+                }
+                variable_elements_.assign(n, std::vector<size_t>());
+                for (size_t k = 0; k < pattern_.size(); ++k)
+                {
+                    for (const Eigen::Index j : pattern_[k])
+                        variable_elements_[j].push_back(k);
+                }
+                std::vector<Eigen::Index> order(n);
+                for (Eigen::Index j = 0; j < n; ++j)
+                    order[j] = j;
+                std::stable_sort(order.begin(), order.end(), [&](Eigen::Index a, Eigen::Index b)
+                {
+                    return variable_elements_[a].size() > variable_elements_[b].size();
+                });
+                const size_t no_color = std::numeric_limits<size_t>::max();
+                variable_color_.assign(n, no_color);
+                //forbidden[c] == j marks color c as used by a neighbour of j.
+                std::vector<Eigen::Index> forbidden;
+                size_t colors = 0;
+                for (const Eigen::Index j : order)
+                {
+                    if (variable_elements_[j].empty())
+                        continue;
+                    for (const size_t k : variable_elements_[j])
+                    {
+                        for (const Eigen::Index i : pattern_[k])
+                        {
+                            if (variable_color_[i] != no_color)
+                                forbidden[variable_color_[i]] = j;
+                        }
+                    }
+                    size_t c = 0;
+                    while (c < colors && forbidden[c] == j)
+                        ++c;
+                    if (c == colors)
+                    {
+                        ++colors;
+                        forbidden.push_back(-1);
+                    }
+                    variable_color_[j] = c;
+                }
+                //Variables grouped by color.
+                color_begin_.assign(colors + 1, 0);
+                for (Eigen::Index j = 0; j < n; ++j)
+                {
+                    if (variable_color_[j] != no_color)
+                        ++color_begin_[variable_color_[j] + 1];
+                }
+                for (size_t c = 0; c < colors; ++c)
+                    color_begin_[c + 1] += color_begin_[c];
+                color_variables_.resize(color_begin_[colors]);
+                std::vector<size_t> next(color_begin_.begin(), color_begin_.end() - 1);
+                for (Eigen::Index j = 0; j < n; ++j)
+                {
+                    if (variable_color_[j] != no_color)
+                        color_variables_[next[variable_color_[j]]++] = j;
+                }
+            }
+            //Move the variables of color c by sign * h from x.
+            void perturb(Vector& y, const Vector& x, size_t c, int sign) const
+            {
+                for (size_t i = color_begin_[c]; i < color_begin_[c + 1]; ++i)
+                {
+                    const Eigen::Index j = color_variables_[i];
+                    y(j) = x(j) + Scalar(sign) * difference_step(scheme_, x(j));
+                }
+            }
+            template <class F>
+            void forEachSlot(size_t slots, F&& f)
+            {
+                if (slots == 1)
+                    f(0);
+                else
+                    pool_->parallelFor(slots, f);
+            }
+        private:
+            Fun fun_;
+            Pattern pattern_;
+            DifferenceScheme scheme_;
+            ThreadPool* pool_;
+            size_t evaluations_;
+            //Elements of each variable, color of each variable and the variables of color c in
+            //color_variables_[color_begin_[c], color_begin_[c + 1]).
+            std::vector<std::vector<size_t>> variable_elements_;
+            std::vector<size_t> variable_color_;
+            std::vector<size_t> color_begin_;
+            std::vector<Eigen::Index> color_variables_;
+            ElementVector elements_;
+            std::vector<Vector> x_;
+            std::vector<ElementVector> forward_elements_;
+            std::vector<ElementVector> backward_elements_;
+            std::vector<ComplexVector> complex_x_;
+            std::vector<ComplexElementVector> complex_elements_;
+        };
+
+        template <class Scalar = double, class Fun>
+        FiniteDifferenceObjective<Fun, Scalar> make_finite_difference_objective(Fun fun,
+            DifferenceScheme scheme = DifferenceScheme::CENTRAL, ThreadPool* pool = nullptr)
+        {
+            return FiniteDifferenceObjective<Fun, Scalar>(std::move(fun), scheme, pool);
+        }
+    }
+}
@@ -1,48 +1,161 @@
 // 14/05/2022 by BKHao in Chimes.
+#pragma once
 #include <Chimes/Optimization/line_search.h>
-#include <time.h>
+#include <Chimes/Optimization/lbfgs_history.h>
+#include <Chimes/Optimization/lbfgs_state.h>
 #include <vector>
 
 namespace Chimes
 {
-    template <class Fun, class Scalar = double>
-    class LBFGS : public LineSearchMethod<Fun, Scalar>
+    //Buffers used by LBFGS::solve().
+    //Keep one workspace alive and pass it to the solvers, then only the first solve of a given size allocates.
+    //With a fixed Dim and M nothing is allocated at all.
+    template <class Scalar = double, int Dim = Eigen::Dynamic, int M = Eigen::Dynamic, class History = LBFGSVectorHistory<Scalar, Dim, M>>
+    class LBFGSWorkspace
     {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+    public:
+        LBFGSWorkspace() : n_(0), m_(0)
+        {
+
+        }
+        LBFGSWorkspace(size_t n, size_t m) : n_(0), m_(0)
+        {
+            resize(n, m);
+        }
+        //Resize the buffers for n variables and m correction pairs and drop the history.
+        //Nothing is allocated if the size is unchanged.
+        void resize(size_t n, size_t m)
+        {
+            history.resize(n, m);
+            if (n == n_ && m == m_)
+                return;
+            iter_x.resize(n);
+            gradient.resize(n);
+            old_gradient.resize(n);
+            direction.resize(n);
+            search_x.resize(n);
+            n_ = n;
+            m_ = m;
+        }
+        size_t size() const
+        {
+            return n_;
+        }
+        size_t remain() const
+        {
+            return m_;
+        }
+    public:
+        Vector iter_x;
+        Vector gradient;
+        Vector old_gradient;
+        Vector direction;
+        //Start point of the current step search.
+        Vector search_x;
+        //Correction pairs.
+        History history;
     private:
-        using Base = LineSearchMethod<Fun, Scalar>;
+        size_t n_;
+        size_t m_;
+    };
+
+    //History selects the layout of the correction pairs, LBFGSVectorHistory or LBFGSMatrixHistory.
+    //Dim and M fix the number of variables and of correction pairs at compile time, parameter_.lbfgs_remain_ is then ignored.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic, int M = Eigen::Dynamic, class History = LBFGSVectorHistory<Scalar, Dim, M>>
+    class LBFGS final : public LineSearchMethod<Fun, Scalar, Dim>
+    {
+    private:
+        using Base = LineSearchMethod<Fun, Scalar, Dim>;
     public:
-        LBFGS(Fun& fun, const typename Base::Vector& init_x) : Base(fun, init_x)
+        using Workspace = LBFGSWorkspace<Scalar, Dim, M, History>;
+        using State = LBFGSState<Scalar, Dim>;
+    public:
+        LBFGS(Fun& fun, const typename Base::Vector& init_x) : Base(fun, init_x), external_workspace_(nullptr), init_state_(nullptr),
+            is_reevaluate_(true)
+        {
+
+        }
+        //Solve with a workspace owned by the caller, which can be shared by many solves.
+        LBFGS(Fun& fun, const typename Base::Vector& init_x, Workspace& workspace) : Base(fun, init_x), external_workspace_(&workspace),
+            init_state_(nullptr), is_reevaluate_(true)
         {
 
         }
-        virtual void solve()
+        //Start the next solves from init_x with an empty history.
+        void set_init_x(const typename Base::Vector& init_x)
+        {
+            Base::set_init_x(init_x);
+            init_state_ = nullptr;
+        }
+        //Warm start the next solves from a state of an earlier solve: its iterate, and its correction pairs instead of an
+        //empty history, so the first step is an LBFGS step of length 1. The state is not copied and must outlive the solves.
+        //The objective is evaluated again at the iterate, unless is_reevaluate is false to resume a solve of the same
+        //objective with the stored value and gradient.
+        void set_init_state(const State& state, bool is_reevaluate = true)
         {
-            const clock_t start_t = clock();
+            Base::set_init_x(state.x);
+            init_state_ = &state;
+            is_reevaluate_ = is_reevaluate;
+        }
+        //Export the iterate and the history at the end of the last solve.
+        void get_state(State& state)
+        {
+            Workspace& ws = workspace();
+            state.fval = Base::result_.fval;
+            state.x = ws.iter_x;
+            state.gradient = ws.gradient;
+            ws.history.exportPairs(state.s, state.y);
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
             const size_t n = Base::init_x_.size();
-            typename Base::Vector gradient(n);
-            typename Base::Vector old_gradient(n);
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            const size_t m = M == Eigen::Dynamic ? Base::parameter_.lbfgs_remain_ : M;
+            Workspace& ws = workspace();
+            ws.resize(n, m);
+            typename Base::Vector& gradient = ws.gradient;
+            typename Base::Vector& old_gradient = ws.old_gradient;
+            typename Base::Vector& iter_x = ws.iter_x;
+            typename Base::Vector& direction = ws.direction;
             gradient.setZero();
-            old_gradient.setZero();
-            std::vector<typename Base::Vector> s(Base::parameter_.lbfgs_remain_);
-            std::vector<typename Base::Vector> y(Base::parameter_.lbfgs_remain_);
-            std::vector<Scalar> ys(Base::parameter_.lbfgs_remain_);
-            std::vector<Scalar> alpha(Base::parameter_.lbfgs_remain_);
-            typename Base::Vector iter_x = Base::init_x_;
-            Scalar fval = Base::fun_(iter_x, gradient);
-            old_gradient = gradient;
+            kernels.copy(iter_x, Base::init_x_);
+            Base::resetStatistics();
+            Scalar fval;
+            if (init_state_ != nullptr && !is_reevaluate_)
+            {
+                fval = init_state_->fval;
+                kernels.copy(gradient, init_state_->gradient);
+            }
+            else
+            {
+                fval = Base::evaluate(iter_x, gradient);
+            }
+            kernels.copy(old_gradient, gradient);
             if (Base::parameter_.is_show_)
             {
-                std::cout << 0 << "\t" << 0 << "\t" << (clock() - start_t) * 1.0 / CLOCKS_PER_SEC << "\t" << gradient.norm() << "\t"
-                    << fval << std::endl;
+                std::cout << 0 << "\t" << 0 << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient) << "\t"
+                    << fval << "\n";
             }
-            typename Base::Vector direction = -gradient;
             size_t k = 0;
             size_t l = 0;
-            size_t cursor = 0;
-            Scalar step = Scalar(1.0) / direction.norm();
+            Scalar step;
+            if (init_state_ != nullptr && init_state_->pairs() > 0)
+            {
+                ws.history.importPairs(init_state_->s, init_state_->y, gradient, kernels);
+                ws.history.searchDirection(gradient, direction, kernels);
+                step = Scalar(1.0);
+            }
+            else
+            {
+                kernels.scale(direction, Scalar(-1), gradient);
+                step = Scalar(1.0) / kernels.norm(direction);
+            }
             while (1)
             {
-                if (gradient.norm() < Base::parameter_.epsilon_)
+                if (kernels.norm(gradient) < Base::parameter_.epsilon_)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -50,7 +163,7 @@ namespace Chimes
                     }
                     break;
                 }
-                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < (clock() - start_t) * 1000.0 / CLOCKS_PER_SEC)
+                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < Base::secondsSince(start) * 1000.0)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -58,6 +171,14 @@ namespace Chimes
                     }
                     break;
                 }
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGS]cancelled" << std::endl;
+                    }
+                    break;
+                }
                 if (Base::parameter_.max_iteration_ != 0 && Base::parameter_.max_iteration_ == k)
                 {
                     if (Base::parameter_.is_show_)
@@ -66,8 +187,8 @@ namespace Chimes
                     }
                     break;
                 }
-                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction);
-                if (num_step_search == Base::parameter_.max_stepsearch_)
+                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction, ws.search_x);
+                if (num_step_search == Base::stepsearch_exhausted)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -75,7 +196,7 @@ namespace Chimes
                     }
                     break;
                 }
-                if (num_step_search < 0)
+                if (num_step_search == Base::stepsearch_failed)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -83,48 +204,29 @@ namespace Chimes
                     }
                     break;
                 }
+                //A step search interrupted between two trials is back at its start point.
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGS]cancelled" << std::endl;
+                    }
+                    break;
+                }
                 l += num_step_search;
                 k++;
                 if (Base::parameter_.is_show_)
                 {
-                    std::cout << k << "\t" << l << "\t" << (clock() - start_t) * 1.0 / CLOCKS_PER_SEC << "\t" << gradient.norm()
-                        << "\t" << fval << std::endl;
-                }
-                s[cursor] = step * direction;
-                y[cursor] = gradient - old_gradient;
-                old_gradient = gradient;
-
-                Scalar _ys = y[cursor].dot(s[cursor]);
-                Scalar _yy = y[cursor].dot(y[cursor]);
-                ys[cursor] = _ys;
-                cursor = (cursor + 1) % Base::parameter_.lbfgs_remain_;
-
-                size_t incr, bound;
-                if (k < Base::parameter_.lbfgs_remain_)
-                {
-                    incr = 0;
-                    bound = k;
+                    std::cout << k << "\t" << l << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient)
+                        << "\t" << fval << "\n";
                 }
-                else
+                Base::observe(k, num_step_search, fval, iter_x, gradient, step, start, kernels);
+                //The history and the direction are updated in preallocated buffers, so the loop does not touch the heap.
+                Base::profile(Base::result_.direction_seconds, [&]()
                 {
-                    incr = cursor;
-                    bound = Base::parameter_.lbfgs_remain_;
-                }
-                direction = -gradient;
-                size_t j = cursor;
-                for (size_t i = 0; i < bound; ++i)
-                {
-                    j = (j + Base::parameter_.lbfgs_remain_ - 1) % Base::parameter_.lbfgs_remain_;
-                    alpha[j] = s[j].dot(direction) / ys[j];
-                    direction = direction - alpha[j] * y[j];
-                }
-                direction = (_ys / _yy) * direction;
-                for (size_t i = 0; i < bound; ++i)
-                {
-                    Scalar beta = y[j].dot(direction) / ys[j];
-                    direction = direction + (alpha[j] - beta) * s[j];
-                    j = (j + 1) % Base::parameter_.lbfgs_remain_;
-                }                
+                    ws.history.update(step, direction, gradient, old_gradient, kernels);
+                    ws.history.searchDirection(gradient, direction, kernels);
+                });
                 step = Scalar(1.0);
             }
             Base::result_.fval = fval;
@@ -132,6 +234,17 @@ namespace Chimes
             Base::result_.res_gradient = gradient;
             Base::result_.iter_time = k;
             Base::result_.stepsearch_time = l;
+            Base::result_.solve_seconds = Base::secondsSince(start);
         }
+    private:
+        Workspace& workspace()
+        {
+            return external_workspace_ ? *external_workspace_ : own_workspace_;
+        }
+    private:
+        Workspace own_workspace_;
+        Workspace* external_workspace_;
+        const State* init_state_;
+        bool is_reevaluate_;
     };
 } // namespace Chimes
@@ -0,0 +1,443 @@
+#pragma once
+#include <Chimes/Optimization/vector_kernels.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <vector>
+
+namespace Chimes
+{
+    //Correction pairs of LBFGS, each s and y in its own vector, and the two-loop recursion.
+    //Usage for each iteration: update() with the accepted step, then searchDirection() with the same gradient.
+    //Dim and M fix the number of variables and of pairs at compile time, the pairs then live inside the object.
+    //Storage is the type of the stored pairs, e.g. float for double solves: the history takes half the memory and the
+    //two-loop recursion reads half the bytes, while the dot products and the direction stay in Scalar. The pairs are
+    //rounded once when stored, and ys and gamma are computed from the rounded pairs, so H stays positive definite.
+    template <class Scalar = double, int Dim = Eigen::Dynamic, int M = Eigen::Dynamic, class Storage = Scalar>
+    class LBFGSVectorHistory
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using StorageVector = Eigen::Matrix<Storage, Dim, 1>;
+        using Pairs = std::conditional_t<M == Eigen::Dynamic, std::vector<StorageVector>, std::array<StorageVector, (M == Eigen::Dynamic ? 1 : M)>>;
+        //searchDirection() takes any gradient, not only the one of the last update().
+        static constexpr bool is_any_gradient = true;
+    public:
+        LBFGSVectorHistory() : n_(0), m_(0), k_(0), cursor_(0), gamma_(1)
+        {
+
+        }
+        //Resize for n variables and m correction pairs and drop all pairs. Nothing is allocated if the size is unchanged.
+        //With a fixed M, m is ignored.
+        void resize(size_t n, size_t m)
+        {
+            if constexpr (M != Eigen::Dynamic)
+                m = M;
+            if (n != n_ || m != m_)
+            {
+                if constexpr (M == Eigen::Dynamic)
+                {
+                    s_.resize(m);
+                    y_.resize(m);
+                }
+                for (size_t i = 0; i < m; ++i)
+                {
+                    s_[i].resize(n);
+                    y_[i].resize(n);
+                }
+                ys_.resize(m);
+                alpha_.resize(m);
+                n_ = n;
+                m_ = m;
+            }
+            clear();
+        }
+        void clear()
+        {
+            k_ = 0;
+            cursor_ = 0;
+        }
+        //Number of stored pairs.
+        size_t size() const
+        {
+            return std::min(k_, m_);
+        }
+        //Store s = step * direction and y = gradient - old_gradient, then old_gradient = gradient.
+        void update(Scalar step, const Vector& direction, const Vector& gradient, Vector& old_gradient,
+            const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            StorageVector& s = s_[cursor_];
+            StorageVector& y = y_[cursor_];
+            if (kernels.blocks(n_) == 1)
+            {
+                s.noalias() = (step * direction).template cast<Storage>();
+                y.noalias() = (gradient - old_gradient).template cast<Storage>();
+                old_gradient = gradient;
+            }
+            else
+            {
+                kernels.forEachBlock(n_, [&](size_t, size_t begin, size_t length)
+                {
+                    s.segment(begin, length).noalias() = (step * direction.segment(begin, length)).template cast<Storage>();
+                    y.segment(begin, length).noalias() = (gradient.segment(begin, length) - old_gradient.segment(begin, length)).template cast<Storage>();
+                    old_gradient.segment(begin, length) = gradient.segment(begin, length);
+                });
+            }
+            const Scalar ys = kernels.dot(pairY(cursor_), pairS(cursor_));
+            const Scalar yy = kernels.dot(pairY(cursor_), pairY(cursor_));
+            ys_[cursor_] = ys;
+            gamma_ = ys / yy;
+            cursor_ = (cursor_ + 1) % m_;
+            ++k_;
+        }
+        //Copy the stored pairs into the columns of s and y, from the oldest to the newest.
+        template <class PairMatrix>
+        void exportPairs(PairMatrix& s, PairMatrix& y) const
+        {
+            const size_t b = size();
+            s.resize(n_, b);
+            y.resize(n_, b);
+            size_t j = (cursor_ + m_ - b) % m_;
+            for (size_t i = 0; i < b; ++i)
+            {
+                s.col(i) = s_[j].template cast<typename PairMatrix::Scalar>();
+                y.col(i) = y_[j].template cast<typename PairMatrix::Scalar>();
+                j = (j + 1) % m_;
+            }
+        }
+        //Replace the pairs by the columns of s and y, from the oldest to the newest, keeping the newest m.
+        //The gradient is unused, the two-loop recursion takes any gradient.
+        template <class PairMatrix>
+        void importPairs(const PairMatrix& s, const PairMatrix& y, const Vector&,
+            const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            clear();
+            const size_t count = s.cols();
+            for (size_t i = count > m_ ? count - m_ : 0; i < count; ++i)
+            {
+                s_[cursor_] = s.col(i).template cast<Storage>();
+                y_[cursor_] = y.col(i).template cast<Storage>();
+                ys_[cursor_] = kernels.dot(pairY(cursor_), pairS(cursor_));
+                gamma_ = ys_[cursor_] / kernels.dot(pairY(cursor_), pairY(cursor_));
+                cursor_ = (cursor_ + 1) % m_;
+                ++k_;
+            }
+        }
+        //direction = -H * gradient by the two-loop recursion.
+        void searchDirection(const Vector& gradient, Vector& direction, const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            const size_t bound = size();
+            kernels.scale(direction, Scalar(-1), gradient);
+            size_t j = cursor_;
+            for (size_t i = 0; i < bound; ++i)
+            {
+                j = (j + m_ - 1) % m_;
+                alpha_[j] = kernels.dot(pairS(j), direction) / ys_[j];
+                kernels.axpy(direction, direction, -alpha_[j], pairY(j));
+            }
+            kernels.scale(direction, gamma_, direction);
+            for (size_t i = 0; i < bound; ++i)
+            {
+                Scalar beta = kernels.dot(pairY(j), direction) / ys_[j];
+                kernels.axpy(direction, direction, alpha_[j] - beta, pairS(j));
+                j = (j + 1) % m_;
+            }
+        }
+        //Bytes taken by the stored pairs.
+        size_t bytes() const
+        {
+            return 2 * m_ * n_ * sizeof(Storage);
+        }
+    private:
+        //Pair j read as Scalar, the stored vector itself when Storage is Scalar.
+        decltype(auto) pairS(size_t j) const
+        {
+            return s_[j].template cast<Scalar>();
+        }
+        decltype(auto) pairY(size_t j) const
+        {
+            return y_[j].template cast<Scalar>();
+        }
+    private:
+        size_t n_;
+        size_t m_;
+        size_t k_;
+        size_t cursor_;
+        Scalar gamma_;
+        Pairs s_;
+        Pairs y_;
+        Eigen::Matrix<Scalar, M, 1> ys_;
+        Eigen::Matrix<Scalar, M, 1> alpha_;
+    };
+
+    //Small matrices of the compact representation of LBFGS (see LBFGSMatrixHistory), by slot of the pairs, shared by the
+    //histories that keep [S Y] themselves.
+    template <class Scalar = double, int M = Eigen::Dynamic>
+    class LBFGSCompactForm
+    {
+    public:
+        using SmallMatrix = Eigen::Matrix<Scalar, M, M>;
+        using SmallVector = Eigen::Matrix<Scalar, M, 1>;
+    public:
+        void resize(size_t m)
+        {
+            sy.resize(m, m);
+            yy.resize(m, m);
+            sg.resize(m);
+            yg.resize(m);
+            r_.resize(m, m);
+            yy_order_.resize(m, m);
+            a_.resize(m);
+            u_.resize(m);
+        }
+        //Record the products of the pair in slot with the b pairs in use, sy_new(c) = s_c^T y and yy_new(c) = y_c^T y.
+        template <class Products>
+        void insert(size_t slot, size_t b, const Products& sy_new, const Products& yy_new)
+        {
+            sy.col(slot).head(b) = sy_new.head(b);
+            yy.col(slot).head(b) = yy_new.head(b);
+            yy.row(slot).head(b) = yy_new.head(b).transpose();
+        }
+        //Turn sg and yg, the products of the pairs with g, into the coefficients of the columns of S and Y in -H * g, by
+        //slot, and return gamma. The b pairs in use end before slot cursor of m slots.
+        Scalar coefficients(size_t cursor, size_t m, size_t b)
+        {
+            const size_t newest = (cursor + m - 1) % m;
+            const Scalar gamma = sy(newest, newest) / yy(newest, newest);
+            //Arrange the small matrices from the oldest pair to the newest.
+            const size_t oldest = (cursor + m - b) % m;
+            for (size_t j = 0; j < b; ++j)
+            {
+                const size_t sj = (oldest + j) % m;
+                for (size_t i = 0; i <= j; ++i)
+                {
+                    const size_t si = (oldest + i) % m;
+                    r_(i, j) = sy(si, sj);
+                    yy_order_(i, j) = yy(si, sj);
+                    yy_order_(j, i) = yy(si, sj);
+                }
+                a_(j) = sg(sj);
+                u_(j) = -gamma * yg(sj);
+            }
+            auto r = r_.topLeftCorner(b, b);
+            auto a = a_.head(b);
+            auto u = u_.head(b);
+            //a = R^-1 S^T g
+            r.template triangularView<Eigen::Upper>().solveInPlace(a);
+            //u = R^-T ((D + gamma * Y^T Y) a - gamma * Y^T g)
+            u.noalias() += gamma * yy_order_.topLeftCorner(b, b) * a;
+            u += r.diagonal().cwiseProduct(a);
+            r.transpose().template triangularView<Eigen::Lower>().solveInPlace(u);
+            //Back in slot order.
+            for (size_t j = 0; j < b; ++j)
+            {
+                const size_t sj = (oldest + j) % m;
+                sg(sj) = -u(j);
+                yg(sj) = gamma * a(j);
+            }
+            return gamma;
+        }
+    public:
+        //sy(i, j) = s_i^T y_j for pair i not newer than pair j, by slot.
+        SmallMatrix sy;
+        //yy(i, j) = y_i^T y_j by slot.
+        SmallMatrix yy;
+        //S^T g and Y^T g, then the coefficients of -H * g.
+        SmallVector sg;
+        SmallVector yg;
+    private:
+        SmallMatrix r_;
+        SmallMatrix yy_order_;
+        SmallVector a_;
+        SmallVector u_;
+    };
+
+    //Correction pairs of LBFGS stored as one column-major n x 2m matrix [S Y], and the compact representation
+    //of Byrd, Nocedal and Schnabel:
+    //  H = gamma * I + [S gamma*Y] * [R^-T (D + gamma * Y^T Y) R^-1, -R^-T; -R^-1, 0] * [S^T; gamma * Y^T]
+    //where R is the upper triangle of S^T Y and D its diagonal.
+    //Each iteration sweeps the history twice, in chunks of rows that stay in cache: update() writes the new pair and
+    //computes S^T g, Y^T g, S^T y and Y^T y in one pass, searchDirection() forms -H * g in one pass.
+    //The two-loop recursion reads the direction vector 4m times instead. This pays off once the history no longer fits
+    //in cache; for small n the extra products of the compact form make it slightly slower (see chimes_bench).
+    //Dim and M fix the number of variables and of pairs at compile time, as in LBFGSVectorHistory.
+    template <class Scalar = double, int Dim = Eigen::Dynamic, int M = Eigen::Dynamic>
+    class LBFGSMatrixHistory
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using HistoryMatrix = Eigen::Matrix<Scalar, Dim, (M == Eigen::Dynamic ? Eigen::Dynamic : 2 * M)>;
+        using SmallVector = Eigen::Matrix<Scalar, M, 1>;
+        //Fixed-size vectors are never split (see LineSearchMethod::kernels()), so one column of partial sums is enough.
+        using PartialMatrix = Eigen::Matrix<Scalar, (M == Eigen::Dynamic ? Eigen::Dynamic : 4 * M), Eigen::Dynamic, Eigen::ColMajor,
+            (M == Eigen::Dynamic ? Eigen::Dynamic : 4 * M), (Dim == Eigen::Dynamic ? Eigen::Dynamic : 1)>;
+        //Rows per chunk of the fused kernels.
+        static constexpr size_t chunk_size = 1024;
+        //searchDirection() reuses the products with the gradient of the last update().
+        static constexpr bool is_any_gradient = false;
+    public:
+        LBFGSMatrixHistory() : n_(0), m_(0), k_(0), cursor_(0)
+        {
+
+        }
+        //Resize for n variables and m correction pairs and drop all pairs. Nothing is allocated if the size is unchanged.
+        //With a fixed M, m is ignored.
+        void resize(size_t n, size_t m)
+        {
+            if constexpr (M != Eigen::Dynamic)
+                m = M;
+            if (n != n_ || m != m_)
+            {
+                sy_history_.resize(n, 2 * m);
+                partial_.resize(4 * m, 1);
+                compact_.resize(m);
+                sy_new_.resize(m);
+                yy_new_.resize(m);
+                n_ = n;
+                m_ = m;
+            }
+            clear();
+        }
+        void clear()
+        {
+            k_ = 0;
+            cursor_ = 0;
+        }
+        //Number of stored pairs.
+        size_t size() const
+        {
+            return std::min(k_, m_);
+        }
+        //Store s = step * direction and y = gradient - old_gradient, then old_gradient = gradient.
+        //The products with gradient are kept for the next searchDirection().
+        void update(Scalar step, const Vector& direction, const Vector& gradient, Vector& old_gradient,
+            const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            //Slots are filled in order, so the pairs in use are always the first b columns of S and Y.
+            const size_t b = std::min(k_ + 1, m_);
+            //Column i of partial_ holds the sums of block i: S^T g, Y^T g, S^T y, Y^T y, each m long.
+            const size_t p = kernels.blocks(n_);
+            if (size_t(partial_.cols()) < p)
+                partial_.resize(4 * m_, p);
+            kernels.forEachBlock(n_, [&](size_t block, size_t begin, size_t length)
+            {
+                auto sums = partial_.col(block);
+                sums.setZero();
+                for (size_t r = begin; r < begin + length; r += chunk_size)
+                {
+                    const size_t len = std::min(chunk_size, begin + length - r);
+                    auto g = gradient.segment(r, len);
+                    auto s_new = sy_history_.col(cursor_).segment(r, len);
+                    auto y_new = sy_history_.col(m_ + cursor_).segment(r, len);
+                    s_new.noalias() = step * direction.segment(r, len);
+                    y_new.noalias() = g - old_gradient.segment(r, len);
+                    old_gradient.segment(r, len) = g;
+                    for (size_t c = 0; c < b; ++c)
+                    {
+                        auto s_c = sy_history_.col(c).segment(r, len);
+                        auto y_c = sy_history_.col(m_ + c).segment(r, len);
+                        sums(c) += s_c.dot(g);
+                        sums(m_ + c) += y_c.dot(g);
+                        sums(2 * m_ + c) += s_c.dot(y_new);
+                        sums(3 * m_ + c) += y_c.dot(y_new);
+                    }
+                }
+            });
+            compact_.sg.head(b) = partial_.col(0).segment(0, b);
+            compact_.yg.head(b) = partial_.col(0).segment(m_, b);
+            sy_new_.head(b) = partial_.col(0).segment(2 * m_, b);
+            yy_new_.head(b) = partial_.col(0).segment(3 * m_, b);
+            for (size_t i = 1; i < p; ++i)
+            {
+                compact_.sg.head(b) += partial_.col(i).segment(0, b);
+                compact_.yg.head(b) += partial_.col(i).segment(m_, b);
+                sy_new_.head(b) += partial_.col(i).segment(2 * m_, b);
+                yy_new_.head(b) += partial_.col(i).segment(3 * m_, b);
+            }
+            compact_.insert(cursor_, b, sy_new_, yy_new_);
+            cursor_ = (cursor_ + 1) % m_;
+            ++k_;
+        }
+        //Copy the stored pairs into the columns of s and y, from the oldest to the newest.
+        template <class PairMatrix>
+        void exportPairs(PairMatrix& s, PairMatrix& y) const
+        {
+            const size_t b = size();
+            s.resize(n_, b);
+            y.resize(n_, b);
+            size_t j = (cursor_ + m_ - b) % m_;
+            for (size_t i = 0; i < b; ++i)
+            {
+                s.col(i) = sy_history_.col(j);
+                y.col(i) = sy_history_.col(m_ + j);
+                j = (j + 1) % m_;
+            }
+        }
+        //Replace the pairs by the columns of s and y, from the oldest to the newest, keeping the newest m.
+        //gradient is the current gradient, the next searchDirection() must use the same one.
+        template <class PairMatrix>
+        void importPairs(const PairMatrix& s, const PairMatrix& y, const Vector& gradient,
+            const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            clear();
+            const size_t count = s.cols();
+            for (size_t i = count > m_ ? count - m_ : 0; i < count; ++i)
+            {
+                sy_history_.col(cursor_) = s.col(i);
+                sy_history_.col(m_ + cursor_) = y.col(i);
+                cursor_ = (cursor_ + 1) % m_;
+                ++k_;
+            }
+            //The pairs fill the first b slots in order, as after b calls of update().
+            const size_t b = size();
+            for (size_t j = 0; j < b; ++j)
+            {
+                for (size_t i = 0; i <= j; ++i)
+                {
+                    compact_.sy(i, j) = kernels.dot(sy_history_.col(i), sy_history_.col(m_ + j));
+                    compact_.yy(i, j) = kernels.dot(sy_history_.col(m_ + i), sy_history_.col(m_ + j));
+                    compact_.yy(j, i) = compact_.yy(i, j);
+                }
+                compact_.sg(j) = kernels.dot(sy_history_.col(j), gradient);
+                compact_.yg(j) = kernels.dot(sy_history_.col(m_ + j), gradient);
+            }
+        }
+        //direction = -H * gradient, gradient must be the one passed to the last update() or importPairs().
+        void searchDirection(const Vector& gradient, Vector& direction, const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            const size_t b = size();
+            if (b == 0)
+            {
+                kernels.scale(direction, Scalar(-1), gradient);
+                return;
+            }
+            const Scalar gamma = compact_.coefficients(cursor_, m_, b);
+            kernels.forEachBlock(n_, [&](size_t, size_t begin, size_t length)
+            {
+                for (size_t r0 = begin; r0 < begin + length; r0 += chunk_size)
+                {
+                    const size_t len = std::min(chunk_size, begin + length - r0);
+                    auto d = direction.segment(r0, len);
+                    d.noalias() = -gamma * gradient.segment(r0, len);
+                    for (size_t c = 0; c < b; ++c)
+                    {
+                        d += compact_.sg(c) * sy_history_.col(c).segment(r0, len) + compact_.yg(c) * sy_history_.col(m_ + c).segment(r0, len);
+                    }
+                }
+            });
+        }
+    private:
+        size_t n_;
+        size_t m_;
+        size_t k_;
+        size_t cursor_;
+        //[S Y] in one allocation.
+        HistoryMatrix sy_history_;
+        LBFGSCompactForm<Scalar, M> compact_;
+        SmallVector sy_new_;
+        SmallVector yy_new_;
+        //Partial sums of the blocks in update().
+        PartialMatrix partial_;
+    };
+} // namespace Chimes
@@ -0,0 +1,268 @@
+#pragma once
+#include <Chimes/Core/mapped_file.h>
+#include <Chimes/Optimization/lbfgs_history.h>
+#include <filesystem>
+#include <string>
+
+namespace Chimes
+{
+    //Correction pairs of LBFGS in a memory-mapped file, for problems whose history does not fit in memory next to the
+    //objective. Only the pairs leave memory, the iterate, the gradient and the other vectors of the workspace stay.
+    //[S Y] is cut into chunks of chunk_rows rows, and each chunk holds those rows of all 2m columns in one contiguous block
+    //of the file. The direction is the compact representation of LBFGSMatrixHistory, so an iteration reads the file in two
+    //sequential sweeps, one in update() and one in searchDirection(); the two-loop recursion would need 4m passes, each
+    //waiting for the previous one. A sweep asks the system to read lookahead chunks ahead of the chunk in use, so the disk
+    //reads while the chunk in memory is processed, and searchDirection() sweeps backwards to start on the chunks update()
+    //read last, which are still in memory.
+    //The file is created in a directory, the system temporary directory by default, and deleted with the history.
+    template <class Scalar = double>
+    class LBFGSMappedHistory
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        using SmallVector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        //Rows per tile of the fused kernels inside a chunk, as in LBFGSMatrixHistory.
+        static constexpr size_t tile_size = 1024;
+        //searchDirection() reuses the products with the gradient of the last update().
+        static constexpr bool is_any_gradient = false;
+    public:
+        LBFGSMappedHistory() : n_(0), m_(0), k_(0), cursor_(0), chunk_rows_(1), max_chunk_rows_(size_t(1) << 16), lookahead_(2),
+            directory_(std::filesystem::temp_directory_path().string())
+        {
+
+        }
+        //Directory of the file, used from the next resize() to a new size.
+        void set_directory(const std::string& directory)
+        {
+            directory_ = directory;
+            n_ = 0;
+        }
+        //Rows of a chunk, used from the next resize() to a new size, and number of chunks read ahead.
+        void set_chunk(size_t chunk_rows, size_t lookahead)
+        {
+            max_chunk_rows_ = std::max<size_t>(1, chunk_rows);
+            lookahead_ = lookahead;
+            n_ = 0;
+        }
+        //Resize for n variables and m correction pairs and drop all pairs. The file is only created again if the size
+        //changed.
+        void resize(size_t n, size_t m)
+        {
+            if (n != n_ || m != m_)
+            {
+                chunk_rows_ = std::min(max_chunk_rows_, std::max<size_t>(1, n));
+                const size_t chunks = (n + chunk_rows_ - 1) / chunk_rows_;
+                file_.createTemporary(directory_, chunks * 2 * m * chunk_rows_ * sizeof(Scalar));
+                compact_.resize(m);
+                sy_new_.resize(m);
+                yy_new_.resize(m);
+                partial_.resize(4 * m, 1);
+                n_ = n;
+                m_ = m;
+            }
+            clear();
+        }
+        void clear()
+        {
+            k_ = 0;
+            cursor_ = 0;
+        }
+        //Number of stored pairs.
+        size_t size() const
+        {
+            return std::min(k_, m_);
+        }
+        //Store s = step * direction and y = gradient - old_gradient, then old_gradient = gradient.
+        //The products with gradient are kept for the next searchDirection().
+        void update(Scalar step, const Vector& direction, const Vector& gradient, Vector& old_gradient,
+            const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            const size_t b = std::min(k_ + 1, m_);
+            //Column i of partial_ holds the sums of block i: S^T g, Y^T g, S^T y, Y^T y, each m long.
+            const size_t p = kernels.blocks(n_);
+            if (size_t(partial_.cols()) < p)
+                partial_.resize(4 * m_, p);
+            kernels.forEachBlock(n_, [&](size_t block, size_t begin, size_t length)
+            {
+                auto sums = partial_.col(block);
+                sums.setZero();
+                forEachTile(begin, length, false, [&](size_t r, size_t len)
+                {
+                    auto g = gradient.segment(r, len);
+                    auto s_new = column(cursor_, r, len);
+                    auto y_new = column(m_ + cursor_, r, len);
+                    s_new.noalias() = step * direction.segment(r, len);
+                    y_new.noalias() = g - old_gradient.segment(r, len);
+                    old_gradient.segment(r, len) = g;
+                    for (size_t c = 0; c < b; ++c)
+                    {
+                        auto s_c = column(c, r, len);
+                        auto y_c = column(m_ + c, r, len);
+                        sums(c) += s_c.dot(g);
+                        sums(m_ + c) += y_c.dot(g);
+                        sums(2 * m_ + c) += s_c.dot(y_new);
+                        sums(3 * m_ + c) += y_c.dot(y_new);
+                    }
+                });
+            });
+            compact_.sg.head(b) = partial_.col(0).segment(0, b);
+            compact_.yg.head(b) = partial_.col(0).segment(m_, b);
+            sy_new_.head(b) = partial_.col(0).segment(2 * m_, b);
+            yy_new_.head(b) = partial_.col(0).segment(3 * m_, b);
+            for (size_t i = 1; i < p; ++i)
+            {
+                compact_.sg.head(b) += partial_.col(i).segment(0, b);
+                compact_.yg.head(b) += partial_.col(i).segment(m_, b);
+                sy_new_.head(b) += partial_.col(i).segment(2 * m_, b);
+                yy_new_.head(b) += partial_.col(i).segment(3 * m_, b);
+            }
+            compact_.insert(cursor_, b, sy_new_, yy_new_);
+            cursor_ = (cursor_ + 1) % m_;
+            ++k_;
+        }
+        //Copy the stored pairs into the columns of s and y, from the oldest to the newest.
+        template <class PairMatrix>
+        void exportPairs(PairMatrix& s, PairMatrix& y) const
+        {
+            const size_t b = size();
+            s.resize(n_, b);
+            y.resize(n_, b);
+            const size_t oldest = (cursor_ + m_ - b) % m_;
+            forEachTile(0, n_, false, [&](size_t r, size_t len)
+            {
+                for (size_t i = 0; i < b; ++i)
+                {
+                    const size_t j = (oldest + i) % m_;
+                    s.col(i).segment(r, len) = column(j, r, len);
+                    y.col(i).segment(r, len) = column(m_ + j, r, len);
+                }
+            });
+        }
+        //Replace the pairs by the columns of s and y, from the oldest to the newest, keeping the newest m.
+        //gradient is the current gradient, the next searchDirection() must use the same one.
+        template <class PairMatrix>
+        void importPairs(const PairMatrix& s, const PairMatrix& y, const Vector& gradient,
+            const VectorKernels<Scalar>& = VectorKernels<Scalar>())
+        {
+            clear();
+            const size_t count = s.cols();
+            const size_t first = count > m_ ? count - m_ : 0;
+            k_ = count - first;
+            cursor_ = k_ % m_;
+            //The pairs fill the first b slots in order, as after b calls of update(), and their products are summed in
+            //the same sweep that writes them.
+            const size_t b = size();
+            compact_.sy.setZero();
+            compact_.yy.setZero();
+            compact_.sg.setZero();
+            compact_.yg.setZero();
+            forEachTile(0, n_, false, [&](size_t r, size_t len)
+            {
+                for (size_t j = 0; j < b; ++j)
+                {
+                    column(j, r, len) = s.col(first + j).segment(r, len);
+                    column(m_ + j, r, len) = y.col(first + j).segment(r, len);
+                }
+                for (size_t j = 0; j < b; ++j)
+                {
+                    auto y_j = column(m_ + j, r, len);
+                    for (size_t i = 0; i <= j; ++i)
+                    {
+                        compact_.sy(i, j) += column(i, r, len).dot(y_j);
+                        compact_.yy(i, j) += column(m_ + i, r, len).dot(y_j);
+                    }
+                    compact_.sg(j) += column(j, r, len).dot(gradient.segment(r, len));
+                    compact_.yg(j) += y_j.dot(gradient.segment(r, len));
+                }
+            });
+            for (size_t j = 0; j < b; ++j)
+            {
+                for (size_t i = 0; i < j; ++i)
+                    compact_.yy(j, i) = compact_.yy(i, j);
+            }
+        }
+        //direction = -H * gradient, gradient must be the one passed to the last update() or importPairs().
+        void searchDirection(const Vector& gradient, Vector& direction, const VectorKernels<Scalar>& kernels = VectorKernels<Scalar>())
+        {
+            const size_t b = size();
+            if (b == 0)
+            {
+                kernels.scale(direction, Scalar(-1), gradient);
+                return;
+            }
+            const Scalar gamma = compact_.coefficients(cursor_, m_, b);
+            kernels.forEachBlock(n_, [&](size_t, size_t begin, size_t length)
+            {
+                forEachTile(begin, length, true, [&](size_t r, size_t len)
+                {
+                    auto d = direction.segment(r, len);
+                    d.noalias() = -gamma * gradient.segment(r, len);
+                    for (size_t c = 0; c < b; ++c)
+                    {
+                        d += compact_.sg(c) * column(c, r, len) + compact_.yg(c) * column(m_ + c, r, len);
+                    }
+                });
+            });
+        }
+        //Bytes of the file.
+        size_t bytes() const
+        {
+            return file_.size();
+        }
+    private:
+        size_t chunkBytes() const
+        {
+            return 2 * m_ * chunk_rows_ * sizeof(Scalar);
+        }
+        //Rows [row, row + length) of column c of [S Y], inside one chunk.
+        Eigen::Map<Vector> column(size_t c, size_t row, size_t length)
+        {
+            Scalar* data = reinterpret_cast<Scalar*>(file_.data());
+            return Eigen::Map<Vector>(data + ((row / chunk_rows_) * 2 * m_ + c) * chunk_rows_ + row % chunk_rows_, length);
+        }
+        Eigen::Map<const Vector> column(size_t c, size_t row, size_t length) const
+        {
+            const Scalar* data = reinterpret_cast<const Scalar*>(file_.data());
+            return Eigen::Map<const Vector>(data + ((row / chunk_rows_) * 2 * m_ + c) * chunk_rows_ + row % chunk_rows_, length);
+        }
+        //Call f(row, length) on [begin, begin + length) in tiles of at most tile_size rows that do not cross a chunk, chunk
+        //by chunk from the first or, if is_reverse, from the last, while the next lookahead_ chunks are read ahead.
+        template <class F>
+        void forEachTile(size_t begin, size_t length, bool is_reverse, F&& f) const
+        {
+            if (length == 0)
+                return;
+            const size_t end = begin + length;
+            const size_t first = begin / chunk_rows_;
+            const size_t last = (end - 1) / chunk_rows_;
+            const size_t count = last - first + 1;
+            for (size_t i = 0; i < count; ++i)
+            {
+                for (size_t a = (i == 0 ? 1 : lookahead_); a <= lookahead_ && i + a < count; ++a)
+                {
+                    const size_t ahead = is_reverse ? last - i - a : first + i + a;
+                    file_.willNeed(ahead * chunkBytes(), chunkBytes());
+                }
+                const size_t chunk = is_reverse ? last - i : first + i;
+                const size_t chunk_end = std::min(end, (chunk + 1) * chunk_rows_);
+                for (size_t r = std::max(begin, chunk * chunk_rows_); r < chunk_end; r += tile_size)
+                    f(r, std::min(tile_size, chunk_end - r));
+            }
+        }
+    private:
+        size_t n_;
+        size_t m_;
+        size_t k_;
+        size_t cursor_;
+        size_t chunk_rows_;
+        size_t max_chunk_rows_;
+        size_t lookahead_;
+        std::string directory_;
+        MappedFile file_;
+        LBFGSCompactForm<Scalar> compact_;
+        SmallVector sy_new_;
+        SmallVector yy_new_;
+        //Partial sums of the blocks in update().
+        Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> partial_;
+    };
+} // namespace Chimes
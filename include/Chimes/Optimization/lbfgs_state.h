@@ -0,0 +1,122 @@
+#pragma once
+#include <Eigen/Core>
+#include <cstdint>
+#include <limits>
+#include <iostream>
+#include <stdexcept>
+
+namespace Chimes
+{
+    //State of an LBFGS solve, independent of the layout of the history: the iterate, its value and gradient, and the
+    //correction pairs as the columns of s and y from the oldest to the newest (the cursor of the ring buffer is implied
+    //by the order, the scaling gamma by the newest pair).
+    //Filled by LBFGS::get_state() and used by LBFGS::set_init_state() to warm start a solve.
+    template <class Scalar = double, int Dim = Eigen::Dynamic>
+    class LBFGSState
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using PairMatrix = Eigen::Matrix<Scalar, Dim, Eigen::Dynamic>;
+    public:
+        size_t size() const
+        {
+            return x.size();
+        }
+        //Number of correction pairs.
+        size_t pairs() const
+        {
+            return s.cols();
+        }
+        //Binary form: a header (magic, version, size of Scalar, n, pairs) then fval, x, gradient, s and y as raw
+        //Scalars in the byte order of the machine.
+        void save(std::ostream& os) const
+        {
+            const uint32_t header[3] = { magic, version, uint32_t(sizeof(Scalar)) };
+            const uint64_t sizes[2] = { uint64_t(size()), uint64_t(pairs()) };
+            os.write(reinterpret_cast<const char*>(header), sizeof(header));
+            os.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+            os.write(reinterpret_cast<const char*>(&fval), sizeof(Scalar));
+            writeScalars(os, x.data(), x.size());
+            writeScalars(os, gradient.data(), gradient.size());
+            writeScalars(os, s.data(), s.size());
+            writeScalars(os, y.data(), y.size());
+            if (!os)
+            {
+                std::cout << "[error][LBFGSState] write failed" << std::endl;
+                throw std::runtime_error("[error][LBFGSState] write failed");
+            }
+        }
+        void load(std::istream& is)
+        {
+            uint32_t header[3];
+            uint64_t sizes[2];
+            is.read(reinterpret_cast<char*>(header), sizeof(header));
+            is.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+            if (!is || header[0] != magic || header[1] != version || header[2] != sizeof(Scalar))
+            {
+                std::cout << "[error][LBFGSState] not a state of this version and scalar type" << std::endl;
+                throw std::runtime_error("[error][LBFGSState] not a state of this version and scalar type");
+            }
+            if (Dim != Eigen::Dynamic && sizes[0] != uint64_t(Dim))
+            {
+                std::cout << "[error][LBFGSState] size does not match Dim" << std::endl;
+                throw std::runtime_error("[error][LBFGSState] size does not match Dim");
+            }
+            is.read(reinterpret_cast<char*>(&fval), sizeof(Scalar));
+            //The sizes are checked against the bytes left in the stream before anything is allocated.
+            if (!isStored(is, sizes[0], sizes[1]))
+            {
+                std::cout << "[error][LBFGSState] sizes exceed the state" << std::endl;
+                throw std::runtime_error("[error][LBFGSState] sizes exceed the state");
+            }
+            const Eigen::Index n = Eigen::Index(sizes[0]);
+            const Eigen::Index b = Eigen::Index(sizes[1]);
+            x.resize(n);
+            gradient.resize(n);
+            s.resize(n, b);
+            y.resize(n, b);
+            readScalars(is, x.data(), x.size());
+            readScalars(is, gradient.data(), gradient.size());
+            readScalars(is, s.data(), s.size());
+            readScalars(is, y.data(), y.size());
+            if (!is)
+            {
+                std::cout << "[error][LBFGSState] truncated state" << std::endl;
+                throw std::runtime_error("[error][LBFGSState] truncated state");
+            }
+        }
+    private:
+        //Whether the stream holds x, gradient, s and y of n variables and b pairs. Without a position, as for a pipe, only
+        //the overflow of the sizes is checked.
+        static bool isStored(std::istream& is, uint64_t n, uint64_t b)
+        {
+            const uint64_t max_scalars = uint64_t(std::numeric_limits<Eigen::Index>::max()) / sizeof(Scalar);
+            if (!is || n > max_scalars || b > max_scalars || (n != 0 && 2 * (b + 1) > max_scalars / n))
+                return false;
+            const std::istream::pos_type position = is.tellg();
+            if (position == std::istream::pos_type(-1))
+                return true;
+            is.seekg(0, std::ios::end);
+            const std::istream::pos_type end = is.tellg();
+            is.seekg(position);
+            return uint64_t(end - position) >= 2 * (b + 1) * n * sizeof(Scalar);
+        }
+        static void writeScalars(std::ostream& os, const Scalar* data, Eigen::Index count)
+        {
+            os.write(reinterpret_cast<const char*>(data), std::streamsize(count * sizeof(Scalar)));
+        }
+        static void readScalars(std::istream& is, Scalar* data, Eigen::Index count)
+        {
+            is.read(reinterpret_cast<char*>(data), std::streamsize(count * sizeof(Scalar)));
+        }
+    public:
+        static constexpr uint32_t magic = 0x42464c43;
+        static constexpr uint32_t version = 1;
+    public:
+        Scalar fval;
+        Vector x;
+        Vector gradient;
+        PairMatrix s;
+        PairMatrix y;
+    };
+} // namespace Chimes
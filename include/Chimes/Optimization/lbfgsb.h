@@ -0,0 +1,482 @@
+#pragma once
+#include <Chimes/Optimization/line_search.h>
+#include <Chimes/Core/numerical.h>
+#include <Eigen/LU>
+#include <utility>
+#include <vector>
+
+namespace Chimes
+{
+    //LBFGS for box constraints lower <= x <= upper (Byrd, Lu, Nocedal and Zhu, L-BFGS-B).
+    //Each iteration finds the generalized Cauchy point along the projected steepest descent path, minimizes the
+    //quadratic model over the variables that are still free on the compact representation B = theta * I - W * M * W^T,
+    //W = [Y, theta * S], and searches a step along the segment to that minimizer, which stays inside the box.
+    //Infinite bounds are allowed, a variable bounded on neither side is handled like in LBFGS.
+    //The solve stops when the projected gradient, clamp(x - g, lower, upper) - x, is below epsilon_.
+    //parameter_.lbfgs_remain_ is the number of correction pairs.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+    class LBFGSB final : public LineSearchMethod<Fun, Scalar, Dim>
+    {
+    private:
+        using Base = LineSearchMethod<Fun, Scalar, Dim>;
+        using PairMatrix = Eigen::Matrix<Scalar, Dim, Eigen::Dynamic>;
+        using SmallMatrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        using SmallVector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+    public:
+        LBFGSB(Fun& fun, const typename Base::Vector& init_x, const typename Base::Vector& lower, const typename Base::Vector& upper) :
+            Base(fun, init_x), lower_(lower), upper_(upper), count_(0), head_(0), theta_(1)
+        {
+
+        }
+        void set_bounds(const typename Base::Vector& lower, const typename Base::Vector& upper)
+        {
+            lower_ = lower;
+            upper_ = upper;
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
+            const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            checkBounds(n);
+            resize(n, Base::parameter_.lbfgs_remain_);
+            typename Base::Vector& iter_x = iter_x_;
+            typename Base::Vector& gradient = gradient_;
+            typename Base::Vector& direction = direction_;
+            //Start from the projection of init_x onto the box.
+            project(iter_x, Base::init_x_);
+            gradient.setZero();
+            Base::resetStatistics();
+            Scalar fval = Base::evaluate(iter_x, gradient);
+            if (Base::parameter_.is_show_)
+            {
+                std::cout << 0 << "\t" << 0 << "\t" << Base::secondsSince(start) << "\t" << projectedGradientNorm() << "\t"
+                    << fval << "\n";
+            }
+            size_t k = 0;
+            size_t l = 0;
+            while (1)
+            {
+                if (projectedGradientNorm() < Base::parameter_.epsilon_)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]reach the gradient tolerance" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < Base::secondsSince(start) * 1000.0)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]reach the max time" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_iteration_ != 0 && Base::parameter_.max_iteration_ == k)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]reach the max itertion time" << std::endl;
+                    }
+                    break;
+                }
+                bool is_descent = true;
+                Base::profile(Base::result_.direction_seconds, [&]()
+                {
+                    compactMatrix();
+                    cauchyPoint();
+                    subspaceMinimization();
+                    //Rounding can spoil the subspace step when the model is badly conditioned, the Cauchy point never does.
+                    if (kernels.dot(gradient, direction) >= 0)
+                    {
+                        direction = cauchy_x_ - iter_x;
+                        is_descent = kernels.dot(gradient, direction) < 0;
+                    }
+                });
+                if (!is_descent)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]no descent direction in the box" << std::endl;
+                    }
+                    break;
+                }
+                const Scalar max_step = feasibleStep();
+                Scalar step = count_ == 0 ? std::min(Scalar(1.0) / kernels.norm(direction), max_step) : std::min(Scalar(1.0), max_step);
+                kernels.copy(old_gradient_, gradient);
+                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction, search_x_, max_step);
+                if (num_step_search == Base::stepsearch_exhausted)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]reach the max stepsearch time" << std::endl;
+                    }
+                    break;
+                }
+                if (num_step_search == Base::stepsearch_failed)
+                {
+                    //The step search is back at its start point.
+                    if (count_ == 0)
+                    {
+                        if (Base::parameter_.is_show_)
+                        {
+                            std::cout << "[info][LBFGSB]can't fine a right step" << std::endl;
+                        }
+                        break;
+                    }
+                    //Retry along the projected steepest descent with an empty history.
+                    count_ = 0;
+                    head_ = 0;
+                    theta_ = Scalar(1);
+                    continue;
+                }
+                //A step search interrupted between two trials is back at its start point.
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][LBFGSB]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                //Absorb the rounding of a step that ends on the boundary.
+                project(iter_x, iter_x);
+                l += num_step_search;
+                k++;
+                if (Base::parameter_.is_show_)
+                {
+                    std::cout << k << "\t" << l << "\t" << Base::secondsSince(start) << "\t" << projectedGradientNorm()
+                        << "\t" << fval << "\n";
+                }
+                Base::observe(k, num_step_search, fval, iter_x, gradient, step, start, kernels);
+                Base::profile(Base::result_.direction_seconds, [&]() { update(kernels); });
+            }
+            Base::result_.fval = fval;
+            Base::result_.res_x = iter_x;
+            Base::result_.res_gradient = gradient;
+            Base::result_.iter_time = k;
+            Base::result_.stepsearch_time = l;
+            Base::result_.solve_seconds = Base::secondsSince(start);
+        }
+    private:
+        void checkBounds(size_t n) const
+        {
+            if (size_t(lower_.size()) != n || size_t(upper_.size()) != n)
+            {
+                std::cout << "[error][LBFGSB] the bounds and init x have different sizes" << std::endl;
+                throw std::runtime_error("[error][LBFGSB] the bounds and init x have different sizes");
+            }
+            if ((lower_.array() > upper_.array()).any())
+            {
+                std::cout << "[error][LBFGSB] lower bound > upper bound" << std::endl;
+                throw std::runtime_error("[error][LBFGSB] lower bound > upper bound");
+            }
+        }
+        void resize(size_t n, size_t m)
+        {
+            count_ = 0;
+            head_ = 0;
+            theta_ = Scalar(1);
+            if (size_t(iter_x_.size()) == n && size_t(s_.cols()) == m)
+                return;
+            iter_x_.resize(n);
+            gradient_.resize(n);
+            old_gradient_.resize(n);
+            direction_.resize(n);
+            search_x_.resize(n);
+            cauchy_x_.resize(n);
+            breakpoint_.resize(n);
+            s_.resize(n, m);
+            y_.resize(n, m);
+            sy_.resize(m, m);
+            ss_.resize(m, m);
+            breakpoints_.reserve(n);
+        }
+        void project(typename Base::Vector& x, const typename Base::Vector& in) const
+        {
+            for (Eigen::Index i = 0; i < in.size(); ++i)
+                x(i) = Numerical::clamp(in(i), lower_(i), upper_(i));
+        }
+        Scalar projectedGradientNorm() const
+        {
+            Scalar sum = 0;
+            for (Eigen::Index i = 0; i < iter_x_.size(); ++i)
+            {
+                const Scalar pg = Numerical::clamp(iter_x_(i) - gradient_(i), lower_(i), upper_(i)) - iter_x_(i);
+                sum += pg * pg;
+            }
+            return std::sqrt(sum);
+        }
+        //Column of the j-th oldest pair.
+        Eigen::Index slot(Eigen::Index j) const
+        {
+            return (head_ + j) % s_.cols();
+        }
+        //Row i of W, [y_0(i), ..., y_k(i), theta * s_0(i), ..., theta * s_k(i)] from the oldest pair.
+        void rowW(Eigen::Index i, SmallVector& w) const
+        {
+            for (Eigen::Index j = 0; j < count_; ++j)
+            {
+                w(j) = y_(i, slot(j));
+                w(count_ + j) = theta_ * s_(i, slot(j));
+            }
+        }
+        //M = [[-D, L^T], [L, theta * S^T S]]^-1, D the diagonal and L the strictly lower part of S^T Y.
+        void compactMatrix()
+        {
+            const Eigen::Index k = count_;
+            kkt_.setZero(2 * k, 2 * k);
+            for (Eigen::Index i = 0; i < k; ++i)
+            {
+                kkt_(i, i) = -sy_(i, i);
+                for (Eigen::Index j = 0; j < i; ++j)
+                {
+                    kkt_(k + i, j) = sy_(i, j);
+                    kkt_(j, k + i) = sy_(i, j);
+                }
+                for (Eigen::Index j = 0; j < k; ++j)
+                    kkt_(k + i, k + j) = theta_ * ss_(i, j);
+            }
+            m_ = k == 0 ? SmallMatrix(0, 0) : SmallMatrix(kkt_.partialPivLu().inverse());
+            p_.setZero(2 * k);
+            c_.setZero(2 * k);
+            w_.resize(2 * k);
+            mp_.resize(2 * k);
+            mc_.resize(2 * k);
+            mw_.resize(2 * k);
+        }
+        //Generalized Cauchy point: the first local minimizer of the quadratic model along x(t) = P(x - t * g), with the
+        //variables fixed one by one at their breakpoints. The variables with a breakpoint beyond it stay free.
+        void cauchyPoint()
+        {
+            const Eigen::Index n = iter_x_.size();
+            const Eigen::Index k = count_;
+            const typename Base::Vector& x = iter_x_;
+            const typename Base::Vector& g = gradient_;
+            typename Base::Vector& d = direction_;
+            breakpoints_.clear();
+            for (Eigen::Index i = 0; i < n; ++i)
+            {
+                Scalar t = std::numeric_limits<Scalar>::infinity();
+                if (g(i) < 0)
+                    t = (x(i) - upper_(i)) / g(i);
+                else if (g(i) > 0)
+                    t = (x(i) - lower_(i)) / g(i);
+                t = std::max(t, Scalar(0));
+                breakpoint_(i) = t;
+                d(i) = t == 0 ? Scalar(0) : -g(i);
+                if (t > 0 && std::isfinite(t))
+                    breakpoints_.emplace_back(t, i);
+            }
+            std::sort(breakpoints_.begin(), breakpoints_.end());
+            cauchy_x_ = x;
+            //p = W^T d, c = W^T (x_cp - x).
+            for (Eigen::Index j = 0; j < k; ++j)
+            {
+                p_(j) = y_.col(slot(j)).dot(d);
+                p_(k + j) = theta_ * s_.col(slot(j)).dot(d);
+            }
+            //First and second derivatives of the model along the path.
+            Scalar df = -d.squaredNorm();
+            if (df == 0)
+            {
+                free_time_ = 0;
+                return;
+            }
+            mp_.noalias() = m_ * p_;
+            Scalar ddf = -theta_ * df - p_.dot(mp_);
+            const Scalar min_ddf = NumericPolicy<Scalar>::epsilon * ddf;
+            Scalar dt_min = -df / ddf;
+            Scalar t_old = 0;
+            for (const auto& [t, i] : breakpoints_)
+            {
+                const Scalar dt = t - t_old;
+                if (dt_min < dt)
+                    break;
+                cauchy_x_(i) = d(i) > 0 ? upper_(i) : lower_(i);
+                const Scalar z = cauchy_x_(i) - x(i);
+                const Scalar gb = g(i);
+                c_ += dt * p_;
+                rowW(i, w_);
+                mc_.noalias() = m_ * c_;
+                mw_.noalias() = m_ * w_;
+                df += dt * ddf + gb * gb + theta_ * gb * z - gb * w_.dot(mc_);
+                ddf += -theta_ * gb * gb - 2 * gb * w_.dot(mp_) - gb * gb * w_.dot(mw_);
+                ddf = std::max(min_ddf, ddf);
+                p_ += gb * w_;
+                mp_.noalias() = m_ * p_;
+                d(i) = 0;
+                dt_min = -df / ddf;
+                t_old = t;
+            }
+            dt_min = std::max(dt_min, Scalar(0));
+            t_old += dt_min;
+            for (Eigen::Index i = 0; i < n; ++i)
+            {
+                if (breakpoint_(i) > t_old)
+                    cauchy_x_(i) = Numerical::clamp(x(i) + t_old * d(i), lower_(i), upper_(i));
+            }
+            c_ += dt_min * p_;
+            free_time_ = t_old;
+        }
+        //Minimize the model over the free variables from the Cauchy point (direct primal method), truncate the minimizer
+        //to the box and store the direction from x to it.
+        void subspaceMinimization()
+        {
+            const Eigen::Index n = iter_x_.size();
+            const Eigen::Index k = count_;
+            const typename Base::Vector& x = iter_x_;
+            const typename Base::Vector& g = gradient_;
+            typename Base::Vector& d = direction_;
+            //Reduced gradient of the model at the Cauchy point, r = Z^T (g + theta * (x_cp - x) - W * M * c), kept in d.
+            mc_.noalias() = m_ * c_;
+            SmallVector& v = mp_;
+            SmallMatrix& wzw = kkt_;
+            v.setZero(2 * k);
+            wzw.setZero(2 * k, 2 * k);
+            for (Eigen::Index i = 0; i < n; ++i)
+            {
+                if (!(breakpoint_(i) > free_time_))
+                    continue;
+                d(i) = g(i) + theta_ * (cauchy_x_(i) - x(i));
+                if (k == 0)
+                    continue;
+                rowW(i, w_);
+                d(i) -= w_.dot(mc_);
+                v += d(i) * w_;
+                wzw.noalias() += w_ * w_.transpose();
+            }
+            if (k > 0)
+            {
+                //v = N^-1 * M * W^T Z r with N = I - M * W^T Z Z^T W / theta.
+                mw_.noalias() = m_ * v;
+                SmallMatrix nm = SmallMatrix::Identity(2 * k, 2 * k);
+                nm.noalias() -= (m_ * wzw) / theta_;
+                v = nm.partialPivLu().solve(mw_);
+            }
+            //Free step du = -(r + W^T v / theta) / theta, then the largest fraction of it that stays in the box.
+            Scalar alpha = 1;
+            for (Eigen::Index i = 0; i < n; ++i)
+            {
+                if (!(breakpoint_(i) > free_time_))
+                    continue;
+                if (k > 0)
+                {
+                    rowW(i, w_);
+                    d(i) += w_.dot(v) / theta_;
+                }
+                d(i) = -d(i) / theta_;
+                if (d(i) > 0)
+                    alpha = std::min(alpha, (upper_(i) - cauchy_x_(i)) / d(i));
+                else if (d(i) < 0)
+                    alpha = std::min(alpha, (lower_(i) - cauchy_x_(i)) / d(i));
+            }
+            alpha = std::max(alpha, Scalar(0));
+            for (Eigen::Index i = 0; i < n; ++i)
+            {
+                if (breakpoint_(i) > free_time_)
+                    d(i) = cauchy_x_(i) + alpha * d(i) - x(i);
+                else
+                    d(i) = cauchy_x_(i) - x(i);
+            }
+        }
+        //Largest step along the direction that stays in the box, at least 1 since the direction ends inside it.
+        Scalar feasibleStep() const
+        {
+            Scalar max_step = std::numeric_limits<Scalar>::infinity();
+            for (Eigen::Index i = 0; i < direction_.size(); ++i)
+            {
+                if (direction_(i) > 0)
+                    max_step = std::min(max_step, (upper_(i) - iter_x_(i)) / direction_(i));
+                else if (direction_(i) < 0)
+                    max_step = std::min(max_step, (lower_(i) - iter_x_(i)) / direction_(i));
+            }
+            return std::max(max_step, Scalar(1));
+        }
+        //Add the pair of the last step, s = x - search_x, y = g - old_g, if its curvature is safely positive.
+        //The pair is formed in search_x_ and old_gradient_, which are not needed any more.
+        void update(const VectorKernels<Scalar>& kernels)
+        {
+            const Eigen::Index m = s_.cols();
+            typename Base::Vector& s = search_x_;
+            typename Base::Vector& y = old_gradient_;
+            kernels.axpy(s, iter_x_, Scalar(-1), s);
+            kernels.axpy(y, gradient_, Scalar(-1), y);
+            const Scalar sy = kernels.dot(s, y);
+            const Scalar yy = kernels.dot(y, y);
+            if (m == 0 || !(sy > NumericPolicy<Scalar>::epsilon * yy))
+                return;
+            if (count_ < m)
+            {
+                ++count_;
+            }
+            else
+            {
+                head_ = (head_ + 1) % m;
+                for (Eigen::Index i = 0; i + 1 < m; ++i)
+                {
+                    for (Eigen::Index j = 0; j + 1 < m; ++j)
+                    {
+                        sy_(i, j) = sy_(i + 1, j + 1);
+                        ss_(i, j) = ss_(i + 1, j + 1);
+                    }
+                }
+            }
+            const Eigen::Index last = count_ - 1;
+            auto newest_s = s_.col(slot(last));
+            auto newest_y = y_.col(slot(last));
+            kernels.copy(newest_s, s);
+            kernels.copy(newest_y, y);
+            for (Eigen::Index j = 0; j < count_; ++j)
+            {
+                const Eigen::Index c = slot(j);
+                sy_(last, j) = kernels.dot(s, y_.col(c));
+                sy_(j, last) = kernels.dot(s_.col(c), y);
+                ss_(last, j) = kernels.dot(s, s_.col(c));
+                ss_(j, last) = ss_(last, j);
+            }
+            theta_ = yy / sy;
+        }
+    private:
+        typename Base::Vector lower_;
+        typename Base::Vector upper_;
+        typename Base::Vector iter_x_;
+        typename Base::Vector gradient_;
+        typename Base::Vector old_gradient_;
+        typename Base::Vector direction_;
+        //Start point of the current step search, the previous iterate once it is done.
+        typename Base::Vector search_x_;
+        typename Base::Vector cauchy_x_;
+        //Breakpoint of each variable along the projected steepest descent path.
+        typename Base::Vector breakpoint_;
+        std::vector<std::pair<Scalar, Eigen::Index>> breakpoints_;
+        //Variables whose breakpoint is beyond the Cauchy point are free.
+        Scalar free_time_;
+        //Ring buffer of the correction pairs, count_ pairs from the column head_.
+        PairMatrix s_;
+        PairMatrix y_;
+        Eigen::Index count_;
+        Eigen::Index head_;
+        Scalar theta_;
+        //s_i^T y_j and s_i^T s_j from the oldest pair.
+        SmallMatrix sy_;
+        SmallMatrix ss_;
+        SmallMatrix kkt_;
+        SmallMatrix m_;
+        SmallVector p_;
+        SmallVector c_;
+        SmallVector w_;
+        SmallVector mp_;
+        SmallVector mc_;
+        SmallVector mw_;
+    };
+} // namespace Chimes
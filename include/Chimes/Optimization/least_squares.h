@@ -0,0 +1,504 @@
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+#include <Chimes/Optimization/solve_observer.h>
+
+namespace Chimes
+{
+    namespace optimization
+    {
+        //Describe the residuals of a least-squares problem, f(x) = 1/2 * |r(x)|^2 with r of fun.residuals() entries.
+        //fun(x, residual, jacobian) writes r(x) and its Jacobian, a dense matrix or an Eigen::SparseMatrix, both already
+        //sized m by n. A sparse Jacobian must keep the same pattern from one call to the next.
+        template <typename Fun, typename Vector, typename Jacobian>
+        concept concept_least_squares = requires(Fun & fun, const Vector & x, Vector & residual, Jacobian & jacobian)
+        {
+            { fun.residuals() } -> std::convertible_to<size_t>;
+            fun(x, residual, jacobian);
+        };
+        //Describe residuals that can also be evaluated without the Jacobian: fun(x, residual), used for the trial steps.
+        template <typename Fun, typename Vector>
+        concept concept_least_squares_residual = requires(Fun & fun, const Vector & x, Vector & residual)
+        {
+            fun(x, residual);
+        };
+    }
+
+    //Levenberg-Marquardt method for f(x) = 1/2 * |r(x)|^2, trust-region steps in the damped form of Nielsen:
+    //(J^T J + lambda * D) * d = -J^T r, with D the largest diagonal of J^T J seen so far (Marquardt's scaling, so the
+    //steps do not depend on the units of x). A step that reduces f as predicted by the linear model makes lambda smaller
+    //and the next steps closer to Gauss-Newton steps; a rejected step multiplies lambda by 2, 4, 8... and is tried again
+    //without evaluating the Jacobian again.
+    //Jacobian is Eigen::Matrix<Scalar, Dynamic, Dynamic> or Eigen::SparseMatrix<Scalar>. With CHOLESKY the normal matrix
+    //is assembled once per Jacobian and factorized for each lambda; a sparse one keeps the symbolic analysis (the fill
+    //reducing ordering and the pattern of the factor) for as long as the pattern of J does not change, so only the
+    //numeric factorization is repeated. CGLS never forms J^T J and only needs products with J and J^T, for very large
+    //sparse problems whose factor does not fit in memory.
+    template <class Fun, class Scalar = double, class Jacobian = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>
+        requires optimization::concept_least_squares<Fun, Eigen::Matrix<Scalar, Eigen::Dynamic, 1>, Jacobian>
+    class LevenbergMarquardt
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        using Clock = std::chrono::steady_clock;
+        static constexpr bool is_sparse = std::is_base_of_v<Eigen::SparseMatrixBase<Jacobian>, Jacobian>;
+        using NormalMatrix = std::conditional_t<is_sparse, Eigen::SparseMatrix<Scalar>, Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>;
+        using Factorization = std::conditional_t<is_sparse, Eigen::SimplicialLLT<Eigen::SparseMatrix<Scalar>, Eigen::Lower, Eigen::AMDOrdering<int>>,
+            Eigen::LLT<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>>;
+    public:
+        enum class LinearSolver
+        {
+            //Cholesky factorization of J^T J + lambda * D.
+            CHOLESKY,
+            //Conjugate gradient on the normal equations of [J; sqrt(lambda * D)] * d = [-r; 0].
+            CGLS
+        };
+        class Parameter
+        {
+        public:
+            Parameter() :max_iteration_(1000), min_xtol_(1e-10), min_ftol_(1e-15), epsilon_(1e-10), is_show_(true), max_time_(-1),
+                damping_(1e-3), max_damping_(1e32), linear_solver_(LinearSolver::CHOLESKY), max_cg_iteration_(1000), cg_tolerance_(1e-8),
+                observer_(nullptr), cancel_(nullptr), deadline_(Clock::time_point::max()), snapshot_(nullptr)
+            {
+
+            }
+        public:
+            size_t max_iteration_;
+            //Stop when |d| < min_xtol_ * (|x| + min_xtol_), or when an accepted step reduces f by less than min_ftol_ * f.
+            Scalar min_xtol_;
+            Scalar min_ftol_;
+            //Stop when |J^T r| < epsilon_.
+            Scalar epsilon_;
+            bool is_show_;
+            double max_time_;
+            //Initial lambda, relative to D, and the lambda at which the solve gives up.
+            Scalar damping_;
+            Scalar max_damping_;
+            LinearSolver linear_solver_;
+            //CGLS stops after max_cg_iteration_ iterations or when |J^T s| < cg_tolerance_ * |J^T r| for the residual s of
+            //the damped system.
+            size_t max_cg_iteration_;
+            Scalar cg_tolerance_;
+            //As in LineSearchMethod::Parameter, the observer, the cancel flag and the snapshot are owned by the caller.
+            SolveObserver<Scalar>* observer_;
+            const std::atomic<bool>* cancel_;
+            Clock::time_point deadline_;
+            SolveSnapshot<Scalar>* snapshot_;
+        };
+
+        class SolveResult
+        {
+        public:
+            //1/2 * |r|^2, and the gradient J^T r.
+            Scalar fval;
+            Vector res_x;
+            Vector res_gradient;
+            Vector res_residual;
+            size_t iter_time;
+            //Trial steps, the rejected ones included.
+            size_t stepsearch_time;
+            //Evaluations of the residuals, and of the residuals with the Jacobian.
+            size_t fval_eval_time;
+            size_t gradient_eval_time;
+            //Symbolic analyses and numeric factorizations of the normal matrix, CGLS iterations.
+            size_t analysis_time;
+            size_t factorization_time;
+            size_t cg_iteration_time;
+            Scalar damping;
+            double solve_seconds;
+        };
+
+    public:
+        LevenbergMarquardt(Fun& fun, const Vector& init_x) : fun_(fun), init_x_(init_x), lambda_(0), nu_(2)
+        {
+            parameter_ = Parameter();
+        }
+        const SolveResult& get_result() const
+        {
+            return result_;
+        }
+        void set_init_x(const Vector& init_x)
+        {
+            init_x_ = init_x;
+        }
+        void solve()
+        {
+            const Clock::time_point start = Clock::now();
+            const Eigen::Index n = init_x_.size();
+            const Eigen::Index m = Eigen::Index(fun_.residuals());
+            resize(m, n);
+            result_.iter_time = 0;
+            result_.stepsearch_time = 0;
+            result_.fval_eval_time = 0;
+            result_.gradient_eval_time = 0;
+            result_.factorization_time = 0;
+            result_.analysis_time = 0;
+            result_.cg_iteration_time = 0;
+            x_ = init_x_;
+            evaluateJacobian(x_, residual_, jacobian_);
+            Scalar fval = Scalar(0.5) * residual_.squaredNorm();
+            scale_.setZero();
+            normalEquations();
+            lambda_ = parameter_.damping_;
+            nu_ = 2;
+            if (parameter_.is_show_)
+            {
+                std::cout << 0 << "\t" << 0 << "\t" << secondsSince(start) << "\t" << gradient_.norm() << "\t" << fval << "\n";
+            }
+            size_t k = 0;
+            size_t l = 0;
+            bool is_stop = false;
+            while (!is_stop)
+            {
+                if (gradient_.norm() < parameter_.epsilon_)
+                {
+                    show("reach the gradient tolerance");
+                    break;
+                }
+                if (parameter_.max_time_ > 0 && parameter_.max_time_ < secondsSince(start) * 1000.0)
+                {
+                    show("reach the max time");
+                    break;
+                }
+                if (isCancelled())
+                {
+                    show("cancelled");
+                    break;
+                }
+                if (parameter_.max_iteration_ != 0 && parameter_.max_iteration_ == k)
+                {
+                    show("reach the max itertion time");
+                    break;
+                }
+                //Trial steps of this iteration, until one reduces f.
+                size_t trials = 0;
+                Scalar trial_fval = fval;
+                while (1)
+                {
+                    if (trials > 0 && isCancelled())
+                    {
+                        show("cancelled");
+                        is_stop = true;
+                        break;
+                    }
+                    if (lambda_ > parameter_.max_damping_)
+                    {
+                        show("can't fine a right step");
+                        is_stop = true;
+                        break;
+                    }
+                    ++trials;
+                    Scalar predicted;
+                    if (!dampedStep(predicted))
+                    {
+                        increaseDamping();
+                        continue;
+                    }
+                    if (step_.norm() < parameter_.min_xtol_ * (x_.norm() + parameter_.min_xtol_))
+                    {
+                        show("reach the xtol");
+                        is_stop = true;
+                        break;
+                    }
+                    trial_x_ = x_ + step_;
+                    trial_fval = evaluateResidual(trial_x_);
+                    const Scalar rho = (fval - trial_fval) / predicted;
+                    if (std::isfinite(trial_fval) && predicted > 0 && rho > 0)
+                    {
+                        lambda_ *= std::max(Scalar(1) / Scalar(3), Scalar(1) - std::pow(Scalar(2) * rho - Scalar(1), 3));
+                        nu_ = 2;
+                        break;
+                    }
+                    increaseDamping();
+                }
+                l += trials;
+                if (is_stop)
+                    break;
+                const Scalar decrease = fval - trial_fval;
+                x_.swap(trial_x_);
+                if constexpr (optimization::concept_least_squares_residual<Fun, Vector>)
+                {
+                    evaluateJacobian(x_, residual_, jacobian_);
+                }
+                else
+                {
+                    residual_.swap(trial_residual_);
+                    std::swap(jacobian_, trial_jacobian_);
+                }
+                fval = trial_fval;
+                normalEquations();
+                ++k;
+                if (parameter_.is_show_)
+                {
+                    std::cout << k << "\t" << l << "\t" << secondsSince(start) << "\t" << gradient_.norm() << "\t" << fval << "\n";
+                }
+                observe(k, trials, fval, start);
+                if (decrease < parameter_.min_ftol_ * fval)
+                {
+                    show("reach the ftol");
+                    break;
+                }
+            }
+            result_.fval = fval;
+            result_.res_x = x_;
+            result_.res_gradient = gradient_;
+            result_.res_residual = residual_;
+            result_.iter_time = k;
+            result_.stepsearch_time = l;
+            result_.damping = lambda_;
+            result_.solve_seconds = secondsSince(start);
+        }
+    public:
+        Parameter parameter_;
+    private:
+        static double secondsSince(Clock::time_point start)
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        void show(const char* message) const
+        {
+            if (parameter_.is_show_)
+            {
+                std::cout << "[info][LevenbergMarquardt]" << message << std::endl;
+            }
+        }
+        bool isCancelled() const
+        {
+            if (parameter_.cancel_ != nullptr && parameter_.cancel_->load(std::memory_order_relaxed))
+                return true;
+            return parameter_.deadline_ != Clock::time_point::max() && Clock::now() >= parameter_.deadline_;
+        }
+        void observe(size_t iteration, size_t trials, Scalar fval, Clock::time_point start)
+        {
+            if (parameter_.snapshot_ != nullptr)
+                parameter_.snapshot_->publish(iteration, fval, x_);
+            if (parameter_.observer_ == nullptr)
+                return;
+            IterationRecord<Scalar> record;
+            record.iteration = iteration;
+            record.stepsearch_time = trials;
+            record.fval = fval;
+            record.gradient_norm = gradient_.norm();
+            record.step = Scalar(1);
+            record.fval_eval_time = result_.fval_eval_time;
+            record.gradient_eval_time = result_.gradient_eval_time;
+            record.seconds = secondsSince(start);
+            parameter_.observer_->iteration(record);
+        }
+        void resize(Eigen::Index m, Eigen::Index n)
+        {
+            if (residual_.size() == m && x_.size() == n)
+                return;
+            x_.resize(n);
+            trial_x_.resize(n);
+            gradient_.resize(n);
+            step_.resize(n);
+            scale_.resize(n);
+            residual_.resize(m);
+            trial_residual_.resize(m);
+            jacobian_.resize(m, n);
+            trial_jacobian_.resize(m, n);
+            cg_residual_.resize(m);
+            cg_damped_residual_.resize(n);
+            cg_direction_.resize(n);
+            cg_gradient_.resize(n);
+            cg_product_.resize(m);
+            pattern_outer_.clear();
+            pattern_inner_.clear();
+        }
+        void evaluateJacobian(const Vector& x, Vector& residual, Jacobian& jacobian)
+        {
+            ++result_.fval_eval_time;
+            ++result_.gradient_eval_time;
+            fun_(x, residual, jacobian);
+        }
+        //1/2 * |r|^2 at x, into trial_residual_, and the Jacobian into trial_jacobian_ if fun can not skip it.
+        Scalar evaluateResidual(const Vector& x)
+        {
+            if constexpr (optimization::concept_least_squares_residual<Fun, Vector>)
+            {
+                ++result_.fval_eval_time;
+                fun_(x, trial_residual_);
+            }
+            else
+            {
+                evaluateJacobian(x, trial_residual_, trial_jacobian_);
+            }
+            return Scalar(0.5) * trial_residual_.squaredNorm();
+        }
+        //Gradient J^T r, the scaling D and, for CHOLESKY, the normal matrix J^T J at the current iterate.
+        void normalEquations()
+        {
+            gradient_.noalias() = jacobian_.transpose() * residual_;
+            if (parameter_.linear_solver_ == LinearSolver::CGLS)
+            {
+                if constexpr (is_sparse)
+                {
+                    for (Eigen::Index j = 0; j < jacobian_.outerSize(); ++j)
+                    {
+                        Scalar squared_norm = 0;
+                        for (typename Jacobian::InnerIterator it(jacobian_, j); it; ++it)
+                            squared_norm += it.value() * it.value();
+                        scale_(j) = std::max(scale_(j), squared_norm);
+                    }
+                }
+                else
+                {
+                    scale_ = scale_.cwiseMax(jacobian_.colwise().squaredNorm().transpose());
+                }
+                return;
+            }
+            if constexpr (is_sparse)
+            {
+                //J^T J with its whole diagonal in the pattern, so that adding lambda * D does not change the pattern.
+                if (identity_.rows() != jacobian_.cols())
+                {
+                    identity_.resize(jacobian_.cols(), jacobian_.cols());
+                    identity_.setIdentity();
+                }
+                normal_ = NormalMatrix(jacobian_.transpose() * jacobian_) + Scalar(0) * identity_;
+                normal_.makeCompressed();
+                normal_diagonal_.resize(normal_.cols());
+                diagonal_index_.resize(normal_.cols());
+                for (Eigen::Index j = 0; j < normal_.outerSize(); ++j)
+                {
+                    for (typename NormalMatrix::InnerIterator it(normal_, j); it; ++it)
+                    {
+                        if (it.index() == j)
+                        {
+                            diagonal_index_[j] = &it.valueRef() - normal_.valuePtr();
+                            normal_diagonal_(j) = it.value();
+                        }
+                    }
+                }
+                const bool is_same_pattern = pattern_outer_.size() == size_t(normal_.outerSize() + 1)
+                    && pattern_inner_.size() == size_t(normal_.nonZeros())
+                    && std::equal(pattern_outer_.begin(), pattern_outer_.end(), normal_.outerIndexPtr())
+                    && std::equal(pattern_inner_.begin(), pattern_inner_.end(), normal_.innerIndexPtr());
+                if (!is_same_pattern)
+                {
+                    pattern_outer_.assign(normal_.outerIndexPtr(), normal_.outerIndexPtr() + normal_.outerSize() + 1);
+                    pattern_inner_.assign(normal_.innerIndexPtr(), normal_.innerIndexPtr() + normal_.nonZeros());
+                    factorization_.analyzePattern(normal_);
+                    ++result_.analysis_time;
+                }
+            }
+            else
+            {
+                normal_.noalias() = jacobian_.transpose() * jacobian_;
+                normal_diagonal_ = normal_.diagonal();
+            }
+            scale_ = scale_.cwiseMax(normal_diagonal_);
+        }
+        //Solve the damped system for step_ and return false if the factorization fails. predicted is the reduction of f
+        //predicted by the linear model of r.
+        bool dampedStep(Scalar& predicted)
+        {
+            //Keep D away from 0 for the columns of J that are still 0.
+            const Scalar min_scale = std::numeric_limits<Scalar>::epsilon() * std::max(Scalar(1), scale_.maxCoeff());
+            if (parameter_.linear_solver_ == LinearSolver::CGLS)
+            {
+                cgls();
+                //r + J d = -cg_residual_.
+                predicted = Scalar(0.5) * (residual_.squaredNorm() - cg_residual_.squaredNorm());
+                return std::isfinite(predicted);
+            }
+            if constexpr (is_sparse)
+            {
+                Scalar* values = normal_.valuePtr();
+                for (Eigen::Index j = 0; j < normal_.cols(); ++j)
+                    values[diagonal_index_[j]] = normal_diagonal_(j) + lambda_ * std::max(scale_(j), min_scale);
+                factorization_.factorize(normal_);
+            }
+            else
+            {
+                normal_.diagonal() = normal_diagonal_ + lambda_ * scale_.cwiseMax(min_scale);
+                factorization_.compute(normal_);
+            }
+            ++result_.factorization_time;
+            if (factorization_.info() != Eigen::Success)
+                return false;
+            step_ = factorization_.solve(-gradient_);
+            //(J^T J + lambda D) d = -g, so the model reduction -g^T d - 1/2 |J d|^2 is 1/2 (lambda d^T D d - g^T d).
+            predicted = Scalar(0.5) * (lambda_ * (step_.array().square() * scale_.array().max(min_scale)).sum() - gradient_.dot(step_));
+            return std::isfinite(predicted);
+        }
+        //CGLS on min |J d + r|^2 + lambda |D^1/2 d|^2 from d = 0, into step_.
+        //cg_residual_ and cg_damped_residual_ hold the two parts of the residual [-r - J d; -sqrt(lambda D) d].
+        void cgls()
+        {
+            const Scalar min_scale = std::numeric_limits<Scalar>::epsilon() * std::max(Scalar(1), scale_.maxCoeff());
+            const Vector damping = (lambda_ * scale_.array().max(min_scale)).sqrt().matrix();
+            step_.setZero();
+            cg_residual_ = -residual_;
+            cg_damped_residual_.setZero();
+            cg_gradient_ = -gradient_;
+            cg_direction_ = cg_gradient_;
+            Scalar gamma = cg_gradient_.squaredNorm();
+            const Scalar tolerance = parameter_.cg_tolerance_ * parameter_.cg_tolerance_ * gamma;
+            for (size_t j = 0; j < parameter_.max_cg_iteration_ && gamma > tolerance; ++j)
+            {
+                ++result_.cg_iteration_time;
+                cg_product_.noalias() = jacobian_ * cg_direction_;
+                const Scalar curvature = cg_product_.squaredNorm() + damping.cwiseProduct(cg_direction_).squaredNorm();
+                if (!(curvature > 0))
+                    break;
+                const Scalar alpha = gamma / curvature;
+                step_ += alpha * cg_direction_;
+                cg_residual_ -= alpha * cg_product_;
+                cg_damped_residual_ -= alpha * damping.cwiseProduct(cg_direction_);
+                cg_gradient_.noalias() = jacobian_.transpose() * cg_residual_;
+                cg_gradient_ += damping.cwiseProduct(cg_damped_residual_);
+                const Scalar new_gamma = cg_gradient_.squaredNorm();
+                cg_direction_ = cg_gradient_ + (new_gamma / gamma) * cg_direction_;
+                gamma = new_gamma;
+            }
+        }
+        void increaseDamping()
+        {
+            lambda_ *= nu_;
+            nu_ *= 2;
+        }
+    private:
+        Fun& fun_;
+        Vector init_x_;
+        SolveResult result_;
+        Scalar lambda_;
+        Scalar nu_;
+        Vector x_;
+        Vector trial_x_;
+        Vector gradient_;
+        Vector step_;
+        //Marquardt's scaling D.
+        Vector scale_;
+        Vector residual_;
+        Vector trial_residual_;
+        Jacobian jacobian_;
+        Jacobian trial_jacobian_;
+        //J^T J, whose diagonal is replaced by normal_diagonal_ + lambda * D before each factorization.
+        NormalMatrix normal_;
+        Vector normal_diagonal_;
+        Factorization factorization_;
+        //Sparse: position of the diagonal in the values of normal_, and the pattern of the last symbolic analysis.
+        Eigen::SparseMatrix<Scalar> identity_;
+        std::vector<Eigen::Index> diagonal_index_;
+        std::vector<typename NormalMatrix::StorageIndex> pattern_outer_;
+        std::vector<typename NormalMatrix::StorageIndex> pattern_inner_;
+        Vector cg_residual_;
+        Vector cg_damped_residual_;
+        Vector cg_direction_;
+        Vector cg_gradient_;
+        Vector cg_product_;
+    };
+} // namespace Chimes
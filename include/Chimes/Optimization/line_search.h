@@ -1,25 +1,43 @@
 #pragma once
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 #include <Eigen/Core>
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Optimization/vector_kernels.h>
+#include <Chimes/Optimization/objective_concept.h>
+#include <Chimes/Optimization/solve_observer.h>
 namespace Chimes
 {
-    template <class Fun, class Scalar=double>
+    //Dim fixes the number of variables at compile time, so small problems run on unrolled fixed-size Eigen vectors
+    //that live on the stack.
+    //Fun is any objective of optimization::concept_objective, its type is kept so that every evaluation is a direct call.
+    template <class Fun, class Scalar=double, int Dim=Eigen::Dynamic>
+        requires optimization::concept_objective<Fun, Eigen::Matrix<Scalar, Dim, 1>>
     class LineSearchMethod
     {
     protected:
         //using Vector = Eigen::MatrixBase<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>;
-        using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using Clock = std::chrono::steady_clock;
     public:
         enum class StepSearchMethod
         {
             SUFFICIENT_DECREASE,
             WOLFE,
-            STRONG_WOLFE
+            STRONG_WOLFE,
+            //Strong Wolfe conditions reached by the safeguarded cubic and quadratic interpolation of More and Thuente.
+            MORE_THUENTE
         };
         class Parameter
         {
         public:
-            Parameter() :max_iteration_(1000), max_stepsearch_(100), min_step_(1e-7), min_xtol_(1e-7), min_ftol_(1e-7), epsilon_(1e-5), is_show_(true), descent_rate_(1e-4), wolfe_(0.9), max_time_(-1), lbfgs_remain_(6)
+            Parameter() :max_iteration_(1000), max_stepsearch_(100), min_step_(1e-7), min_xtol_(1e-7), min_ftol_(1e-7), epsilon_(1e-5), is_show_(true), descent_rate_(1e-4), wolfe_(0.9), max_time_(-1), lbfgs_remain_(6), max_step_(1e20), thread_pool_(nullptr), parallel_min_size_(65536), observer_(nullptr), is_profile_(false), max_cg_iteration_(100), cg_forcing_(0.5), restart_interval_(0), restart_orthogonality_(0.2), cancel_(nullptr),
+                deadline_(Clock::time_point::max()), snapshot_(nullptr)
             {
                 step_search_method_ = (StepSearchMethod::WOLFE);
             }
@@ -35,7 +53,33 @@ namespace Chimes
             Scalar wolfe_;
             double max_time_;
             int lbfgs_remain_;
+            //Upper bound of the step of MORE_THUENTE.
+            Scalar max_step_;
             StepSearchMethod step_search_method_;
+            //Opt-in parallel vector kernels, the pool is owned by the caller and may be shared by many solvers.
+            //Results are reproducible for a fixed number of threads in the pool.
+            ThreadPool* thread_pool_;
+            //Vectors shorter than this stay on the calling thread.
+            size_t parallel_min_size_;
+            //Called after each iteration, owned by the caller.
+            SolveObserver<Scalar>* observer_;
+            //Time the phases of the solve into SolveResult. Off by default, it reads the clock around every evaluation.
+            bool is_profile_;
+            //Inner conjugate gradient of NewtonCG: at most max_cg_iteration_ iterations, stopped when the residual is
+            //below min(cg_forcing_, sqrt(|g|)) * |g|.
+            size_t max_cg_iteration_;
+            Scalar cg_forcing_;
+            //Restarts of NonlinearCG: every restart_interval_ iterations, 0 for the number of variables, and when
+            //|g_k+1 . g_k| >= restart_orthogonality_ * |g_k+1|^2.
+            size_t restart_interval_;
+            Scalar restart_orthogonality_;
+            //The solve stops once *cancel_ is set, e.g. from another thread, or once the steady clock passes deadline_.
+            //Both are checked before each iteration and between the trials of a step search; an interrupted step search
+            //goes back to its start point, so the result is always a consistent iterate. cancel_ is owned by the caller.
+            const std::atomic<bool>* cancel_;
+            Clock::time_point deadline_;
+            //Receives the iterate after each iteration, owned by the caller.
+            SolveSnapshot<Scalar, Dim>* snapshot_;
         };
 
         class SolveResult
@@ -46,56 +90,206 @@ namespace Chimes
             Vector res_gradient;
             size_t iter_time;
             size_t stepsearch_time;
+            //Number of evaluations of the value and of the gradient.
+            size_t fval_eval_time;
+            size_t gradient_eval_time;
+            //Number of Hessian-vector products, of NewtonCG.
+            size_t hessian_product_time;
+            //Wall time of the solve.
+            double solve_seconds;
+            //Phases of the solve, only timed with is_profile_: the objective, the step search without the objective,
+            //and the search direction (the LBFGS recursion, the inner solve of NewtonCG).
+            double objective_seconds;
+            double stepsearch_seconds;
+            double direction_seconds;
         };
 
+        //Results of stepSearch() when no step is found: max_stepsearch_ trials were not enough, or the step fell below
+        //min_step_ or its interval of uncertainty vanished. Either way iter_x, fval and gradient are back at the start point.
+        static constexpr size_t stepsearch_exhausted = size_t(-2);
+        static constexpr size_t stepsearch_failed = size_t(-1);
+
     public:
         LineSearchMethod(Fun& fun, const Vector& init_x): fun_(fun), init_x_(init_x)
         {
             parameter_ = Parameter();
         }
+        //The solvers are final, so solve() on a solver object is a direct call.
         virtual void solve() = 0;
         const SolveResult& get_result() const
         {
             return result_;
         }
+        //Reset the start point, so that the same solver can be reused for another solve.
+        void set_init_x(const Vector& init_x)
+        {
+            init_x_ = init_x;
+        }
     protected:
-        size_t stepSearch(Scalar& fval, Vector& iter_x, Vector& gradient, Scalar& step, const Vector& direction)
+        //Value and gradient at x, counted in result_.
+        Scalar evaluate(const Vector& x, Vector& gradient)
+        {
+            ++result_.fval_eval_time;
+            ++result_.gradient_eval_time;
+            Scalar fval;
+            profile(result_.objective_seconds, [&]() { fval = optimization::evaluate(fun_, x, gradient); });
+            return fval;
+        }
+        //Zero the counters and timers of result_.
+        void resetStatistics()
+        {
+            result_.fval_eval_time = 0;
+            result_.gradient_eval_time = 0;
+            result_.hessian_product_time = 0;
+            result_.solve_seconds = 0;
+            result_.objective_seconds = 0;
+            result_.stepsearch_seconds = 0;
+            result_.direction_seconds = 0;
+        }
+        static double secondsSince(Clock::time_point start)
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        //Run f, adding its wall time to seconds if is_profile_ is set.
+        template <class F>
+        void profile(double& seconds, F&& f)
+        {
+            if (!parameter_.is_profile_)
+            {
+                f();
+                return;
+            }
+            const Clock::time_point start = Clock::now();
+            f();
+            seconds += secondsSince(start);
+        }
+        //Cancelled or past the deadline. The clock is only read if a deadline is set.
+        bool isCancelled() const
+        {
+            if (parameter_.cancel_ != nullptr && parameter_.cancel_->load(std::memory_order_relaxed))
+                return true;
+            return parameter_.deadline_ != Clock::time_point::max() && Clock::now() >= parameter_.deadline_;
+        }
+        //Pass the state after an iteration to the snapshot and the observer, if any.
+        void observe(size_t iteration, size_t stepsearch_time, Scalar fval, const Vector& x, const Vector& gradient, Scalar step,
+            Clock::time_point start, const VectorKernels<Scalar>& kernels)
+        {
+            if (parameter_.snapshot_ != nullptr)
+                parameter_.snapshot_->publish(iteration, fval, x);
+            if (parameter_.observer_ == nullptr)
+                return;
+            IterationRecord<Scalar> record;
+            record.iteration = iteration;
+            record.stepsearch_time = stepsearch_time;
+            record.fval = fval;
+            record.gradient_norm = kernels.norm(gradient);
+            record.step = step;
+            record.fval_eval_time = result_.fval_eval_time;
+            record.gradient_eval_time = result_.gradient_eval_time;
+            record.seconds = secondsSince(start);
+            parameter_.observer_->iteration(record);
+        }
+        //Vector kernels configured by parameter_.
+        //Fixed-size vectors are far below any useful parallel size and always stay on the calling thread.
+        VectorKernels<Scalar> kernels() const
+        {
+            if constexpr (Dim != Eigen::Dynamic)
+                return VectorKernels<Scalar>();
+            return VectorKernels<Scalar>(parameter_.thread_pool_, parameter_.parallel_min_size_);
+        }
+        //Search a step along direction from iter_x.
+        //ix is a caller-owned buffer of the same size as iter_x, used to keep the start point of the search.
+        //If the objective can evaluate the value alone, the gradient of a trial step is only evaluated when the step
+        //passes the sufficient decrease test.
+        //Steps are kept below max_step, e.g. the end of the feasible segment of a bound-constrained solver; a step at
+        //max_step with sufficient decrease is accepted even if the slope is still negative.
+        //If isCancelled() between two trials, the search goes back to ix and the caller must check isCancelled() before
+        //using the step.
+        //Returns the number of trials, or stepsearch_exhausted or stepsearch_failed.
+        size_t stepSearch(Scalar& fval, Vector& iter_x, Vector& gradient, Scalar& step, const Vector& direction, Vector& ix,
+            Scalar max_step = std::numeric_limits<Scalar>::infinity())
+        {
+            if (!parameter_.is_profile_)
+            {
+                return searchStep(fval, iter_x, gradient, step, direction, ix, max_step);
+            }
+            const double objective_seconds = result_.objective_seconds;
+            const Clock::time_point start = Clock::now();
+            const size_t k = searchStep(fval, iter_x, gradient, step, direction, ix, max_step);
+            result_.stepsearch_seconds += secondsSince(start) - (result_.objective_seconds - objective_seconds);
+            return k;
+        }
+    private:
+        size_t searchStep(Scalar& fval, Vector& iter_x, Vector& gradient, Scalar& step, const Vector& direction, Vector& ix,
+            Scalar max_step)
         {
             if (step < Scalar(0))
             {
                 std::cout << "[error][lineSearch] init step < 0" << std::endl;
                 throw std::runtime_error("[error][lineSearch] init step < 0");
             }
-            const Scalar idg = gradient.dot(direction);
+            const VectorKernels<Scalar> kernels = this->kernels();
+            const Scalar idg = kernels.dot(gradient, direction);
             if (idg > Scalar(0))
             {
                 std::cout << "[error][lineSearch] direction is not a descent direction." << std::endl;
                 throw std::runtime_error("[error][lineSearch] direction is not a descent direction");
             }
+            kernels.copy(ix, iter_x);
+            if (parameter_.step_search_method_ == StepSearchMethod::MORE_THUENTE)
+            {
+                return stepSearchMoreThuente(fval, iter_x, gradient, step, direction, ix, idg, max_step, kernels);
+            }
+            step = std::min(step, max_step);
             Scalar ndg = idg;
             const Scalar idescent = parameter_.descent_rate_ * idg;
             const Scalar ifval = fval;
-            const Vector ix = iter_x;
             Scalar step_l = 0;
             Scalar step_u = std::numeric_limits<Scalar>::infinity();
             size_t k = 1;
+            //Set once a trial overwrote the gradient at ix.
+            bool is_gradient_changed = false;
             while (1)
             {
-                iter_x = ix + step * direction;
-                fval = fun_(iter_x, gradient);
+                if (k > 1 && isCancelled())
+                {
+                    restoreStart(fval, iter_x, gradient, ix, ifval, is_gradient_changed, kernels);
+                    break;
+                }
+                kernels.axpy(iter_x, ix, step, direction);
+                ++result_.fval_eval_time;
+                if constexpr (!optimization::concept_objective_value<Fun, Vector>)
+                {
+                    ++result_.gradient_eval_time;
+                }
+                profile(result_.objective_seconds, [&]() { fval = optimization::evaluate_value(fun_, iter_x, gradient); });
+                if constexpr (!optimization::concept_objective_value<Fun, Vector>)
+                {
+                    is_gradient_changed = true;
+                }
                 if (fval > ifval + step * idescent)
                 {
                     step_u = step;
                 }
                 else
                 {
+                    if constexpr (optimization::concept_objective_value<Fun, Vector>)
+                    {
+                        ++result_.gradient_eval_time;
+                        profile(result_.objective_seconds, [&]() { optimization::evaluate_gradient(fun_, iter_x, gradient); });
+                        is_gradient_changed = true;
+                    }
                     if (parameter_.step_search_method_ == StepSearchMethod::SUFFICIENT_DECREASE)
                     {
                         break;
                     }
-                    ndg = gradient.dot(direction);
+                    ndg = kernels.dot(gradient, direction);
                     if (ndg < parameter_.wolfe_ * idg)
                     {
+                        if (step >= max_step)
+                        {
+                            break;
+                        }
                         step_l = step;
                     }
                     else
@@ -116,21 +310,244 @@ namespace Chimes
                 }
                 if (k == parameter_.max_stepsearch_)
                 {
-                    ++k;
-                    iter_x = ix;
+                    restoreStart(fval, iter_x, gradient, ix, ifval, is_gradient_changed, kernels);
+                    k = stepsearch_exhausted;
                     break;
                 }
                 if (step < parameter_.min_step_)
                 {
-                    k = -1;
-                    iter_x = ix;
+                    restoreStart(fval, iter_x, gradient, ix, ifval, is_gradient_changed, kernels);
+                    k = stepsearch_failed;
                     break;
                 }
                 ++k;
-                step = isinf(step_u) ? 2 * step : 0.5 * (step_l + step_u);
+                step = std::isinf(step_u) ? std::min(2 * step, max_step) : 0.5 * (step_l + step_u);
             }            
             return k;
         }
+        //Line search of More and Thuente (MINPACK-2 dcsrch), ix holds the start point and idg the initial slope.
+        //Every trial needs the slope, so the value and the gradient are evaluated together.
+        //Stage 1 works on the auxiliary function f(step) - descent_rate_ * idg * step until a step with sufficient decrease
+        //and a nonnegative slope of it is found, then stage 2 works on f itself.
+        size_t stepSearchMoreThuente(Scalar& fval, Vector& iter_x, Vector& gradient, Scalar& step, const Vector& direction,
+            const Vector& ix, Scalar idg, Scalar max_step, const VectorKernels<Scalar>& kernels)
+        {
+            const Scalar xtrapl = Scalar(1.1);
+            const Scalar xtrapu = Scalar(4);
+            const Scalar ifval = fval;
+            const Scalar gtest = parameter_.descent_rate_ * idg;
+            const Scalar min_step = parameter_.min_step_;
+            max_step = std::min(max_step, parameter_.max_step_);
+            step = std::min(std::max(step, min_step), max_step);
+            bool brackt = false;
+            bool stage1 = true;
+            Scalar width = max_step - min_step;
+            Scalar width1 = 2 * width;
+            //Best step so far (x) and the other end of the interval (y), with their values and slopes.
+            Scalar stx = 0, fx = ifval, gx = idg;
+            Scalar sty = 0, fy = ifval, gy = idg;
+            Scalar stmin = 0;
+            Scalar stmax = step + xtrapu * step;
+            size_t k = 1;
+            while (1)
+            {
+                if (k > 1 && isCancelled())
+                {
+                    restoreStart(fval, iter_x, gradient, ix, ifval, true, kernels);
+                    break;
+                }
+                kernels.axpy(iter_x, ix, step, direction);
+                fval = evaluate(iter_x, gradient);
+                const Scalar dg = kernels.dot(gradient, direction);
+                const Scalar ftest = ifval + step * gtest;
+                if (stage1 && fval <= ftest && dg >= 0)
+                {
+                    stage1 = false;
+                }
+                if (fval <= ftest && std::abs(dg) <= -parameter_.wolfe_ * idg)
+                {
+                    break;
+                }
+                //Interval of uncertainty below the rounding errors or the tolerance, or a step stuck on its bounds.
+                const bool stalled = (brackt && (step <= stmin || step >= stmax || stmax - stmin <= parameter_.min_xtol_ * stmax))
+                    || (step == max_step && fval <= ftest && dg <= gtest)
+                    || (step == min_step && (fval > ftest || dg >= gtest));
+                if (stalled)
+                {
+                    if (fval > ftest)
+                    {
+                        restoreStart(fval, iter_x, gradient, ix, ifval, true, kernels);
+                        k = stepsearch_failed;
+                    }
+                    break;
+                }
+                if (k == parameter_.max_stepsearch_)
+                {
+                    restoreStart(fval, iter_x, gradient, ix, ifval, true, kernels);
+                    k = stepsearch_exhausted;
+                    break;
+                }
+                if (stage1 && fval <= fx && fval > ftest)
+                {
+                    //Modified function values and slopes.
+                    Scalar fxm = fx - stx * gtest, fym = fy - sty * gtest;
+                    Scalar gxm = gx - gtest, gym = gy - gtest;
+                    updateTrialInterval(stx, fxm, gxm, sty, fym, gym, step, fval - step * gtest, dg - gtest, brackt, stmin, stmax);
+                    fx = fxm + stx * gtest;
+                    fy = fym + sty * gtest;
+                    gx = gxm + gtest;
+                    gy = gym + gtest;
+                }
+                else
+                {
+                    updateTrialInterval(stx, fx, gx, sty, fy, gy, step, fval, dg, brackt, stmin, stmax);
+                }
+                //Bisect if the interval does not shrink enough.
+                if (brackt)
+                {
+                    if (std::abs(sty - stx) >= Scalar(0.66) * width1)
+                    {
+                        step = stx + Scalar(0.5) * (sty - stx);
+                    }
+                    width1 = width;
+                    width = std::abs(sty - stx);
+                    stmin = std::min(stx, sty);
+                    stmax = std::max(stx, sty);
+                }
+                else
+                {
+                    stmin = step + xtrapl * (step - stx);
+                    stmax = step + xtrapu * (step - stx);
+                }
+                step = std::min(std::max(step, min_step), max_step);
+                if (brackt && (step <= stmin || step >= stmax || stmax - stmin <= parameter_.min_xtol_ * stmax))
+                {
+                    step = stx;
+                }
+                ++k;
+            }
+            return k;
+        }
+        //Go back to the start point ix of an interrupted or failed step search. The gradient at ix is evaluated again only
+        //if a trial overwrote it.
+        void restoreStart(Scalar& fval, Vector& iter_x, Vector& gradient, const Vector& ix, Scalar ifval, bool is_gradient_changed,
+            const VectorKernels<Scalar>& kernels)
+        {
+            kernels.copy(iter_x, ix);
+            fval = ifval;
+            if (is_gradient_changed)
+            {
+                ++result_.gradient_eval_time;
+                profile(result_.objective_seconds, [&]() { optimization::evaluate_gradient(fun_, iter_x, gradient); });
+            }
+        }
+        //Safeguarded step of More and Thuente (MINPACK-2 dcstep).
+        //Update the interval [stx, sty] with the trial step of value fp and slope dp, and replace step by the next trial.
+        static void updateTrialInterval(Scalar& stx, Scalar& fx, Scalar& dx, Scalar& sty, Scalar& fy, Scalar& dy, Scalar& step,
+            Scalar fp, Scalar dp, bool& brackt, Scalar stpmin, Scalar stpmax)
+        {
+            const Scalar sgnd = dp * (dx / std::abs(dx));
+            Scalar stpf;
+            if (fp > fx)
+            {
+                //Higher value: the minimum is bracketed, take the cubic step if it is closer to stx.
+                const Scalar theta = 3 * (fx - fp) / (step - stx) + dx + dp;
+                const Scalar s = std::max({ std::abs(theta), std::abs(dx), std::abs(dp) });
+                Scalar gamma = s * std::sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
+                if (step < stx)
+                    gamma = -gamma;
+                const Scalar p = (gamma - dx) + theta;
+                const Scalar q = ((gamma - dx) + gamma) + dp;
+                const Scalar stpc = stx + p / q * (step - stx);
+                const Scalar stpq = stx + dx / ((fx - fp) / (step - stx) + dx) / 2 * (step - stx);
+                stpf = std::abs(stpc - stx) < std::abs(stpq - stx) ? stpc : stpc + (stpq - stpc) / 2;
+                brackt = true;
+            }
+            else if (sgnd < 0)
+            {
+                //Slopes of opposite sign: the minimum is bracketed, take the step farthest from step.
+                const Scalar theta = 3 * (fx - fp) / (step - stx) + dx + dp;
+                const Scalar s = std::max({ std::abs(theta), std::abs(dx), std::abs(dp) });
+                Scalar gamma = s * std::sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
+                if (step > stx)
+                    gamma = -gamma;
+                const Scalar p = (gamma - dp) + theta;
+                const Scalar q = ((gamma - dp) + gamma) + dx;
+                const Scalar stpc = step + p / q * (stx - step);
+                const Scalar stpq = step + dp / (dp - dx) * (stx - step);
+                stpf = std::abs(stpc - step) > std::abs(stpq - step) ? stpc : stpq;
+                brackt = true;
+            }
+            else if (std::abs(dp) < std::abs(dx))
+            {
+                //Same sign and decreasing slope: the cubic step is used only if it goes the right way.
+                const Scalar theta = 3 * (fx - fp) / (step - stx) + dx + dp;
+                const Scalar s = std::max({ std::abs(theta), std::abs(dx), std::abs(dp) });
+                Scalar gamma = s * std::sqrt(std::max(Scalar(0), (theta / s) * (theta / s) - (dx / s) * (dp / s)));
+                if (step > stx)
+                    gamma = -gamma;
+                const Scalar p = (gamma - dp) + theta;
+                const Scalar q = (gamma + (dx - dp)) + gamma;
+                const Scalar r = p / q;
+                Scalar stpc;
+                if (r < 0 && gamma != 0)
+                    stpc = step + r * (stx - step);
+                else
+                    stpc = step > stx ? stpmax : stpmin;
+                const Scalar stpq = step + dp / (dp - dx) * (stx - step);
+                if (brackt)
+                {
+                    stpf = std::abs(stpc - step) < std::abs(stpq - step) ? stpc : stpq;
+                    if (step > stx)
+                        stpf = std::min(step + Scalar(0.66) * (sty - step), stpf);
+                    else
+                        stpf = std::max(step + Scalar(0.66) * (sty - step), stpf);
+                }
+                else
+                {
+                    stpf = std::abs(stpc - step) > std::abs(stpq - step) ? stpc : stpq;
+                    stpf = std::min(std::max(stpf, stpmin), stpmax);
+                }
+            }
+            else
+            {
+                //Same sign and the slope does not decrease: cubic step towards sty, or a bound.
+                if (brackt)
+                {
+                    const Scalar theta = 3 * (fp - fy) / (sty - step) + dy + dp;
+                    const Scalar s = std::max({ std::abs(theta), std::abs(dy), std::abs(dp) });
+                    Scalar gamma = s * std::sqrt((theta / s) * (theta / s) - (dy / s) * (dp / s));
+                    if (step > sty)
+                        gamma = -gamma;
+                    const Scalar p = (gamma - dp) + theta;
+                    const Scalar q = ((gamma - dp) + gamma) + dy;
+                    stpf = step + p / q * (sty - step);
+                }
+                else
+                {
+                    stpf = step > stx ? stpmax : stpmin;
+                }
+            }
+            if (fp > fx)
+            {
+                sty = step;
+                fy = fp;
+                dy = dp;
+            }
+            else
+            {
+                if (sgnd < 0)
+                {
+                    sty = stx;
+                    fy = fx;
+                    dy = dx;
+                }
+                stx = step;
+                fx = fp;
+                dx = dp;
+            }
+            step = stpf;
+        }
 
     public:
         Parameter parameter_;
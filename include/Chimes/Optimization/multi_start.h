@@ -0,0 +1,236 @@
+#pragma once
+#include <Chimes/Optimization/lbfgs.h>
+#include <Chimes/Core/thread_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace Chimes
+{
+    //Local solves of a non-convex objective from many starts, run on a ThreadPool, and the distinct minima they reach.
+    //Solver is a line-search solver of the objective, LBFGS by default or SteepestDescent, constructed as
+    //Solver(fun, init_x). Each solve runs on its own copy of the prototype objective
+    //(optimization::concept_copyable_objective).
+    //The starts are drawn uniformly in the box [lower, upper] from seed_, or set with set_starts(). The pool hands the
+    //starts out one at a time, so a thread that finishes early takes the next start and long solves do not hold back
+    //the others.
+    //The smallest value reached so far by any solve is shared: a solve still above it by more than
+    //cancel_margin_ * max(1, |best|) after cancel_iteration_ iterations is cancelled. So the minima depend on the timing
+    //of the solves unless cancel_iteration_ is 0.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic, class Solver = LBFGS<Fun, Scalar, Dim>>
+        requires optimization::concept_copyable_objective<Fun, Eigen::Matrix<Scalar, Dim, 1>>
+    class MultiStart
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using Clock = std::chrono::steady_clock;
+        class Parameter
+        {
+        public:
+            Parameter() : num_starts_(32), seed_(0), cancel_iteration_(20), cancel_margin_(1), distance_tolerance_(1e-4), thread_pool_(nullptr)
+            {
+                solver_parameter_.is_show_ = false;
+            }
+        public:
+            //Number of random starts, unused after set_starts().
+            size_t num_starts_;
+            uint64_t seed_;
+            //0 disables the cancellation.
+            size_t cancel_iteration_;
+            Scalar cancel_margin_;
+            //Two solutions are the same minimum if |x - x_min| <= distance_tolerance_ * (1 + |x_min|).
+            Scalar distance_tolerance_;
+            //Parameter of every solve. Its observer_ and cancel_ are replaced by the driver. Its thread_pool_ may be the
+            //pool of the driver, the loops of a solve then run on the thread of that solve.
+            typename Solver::Parameter solver_parameter_;
+            //Pool of the solves, owned by the caller. Without a pool they run one after another.
+            ThreadPool* thread_pool_;
+        };
+        //A distinct minimum, and the number of solves that reached it.
+        class Minimum
+        {
+        public:
+            Vector x;
+            Scalar fval;
+            size_t hit_time;
+        };
+        class SolveResult
+        {
+        public:
+            //Distinct minima by increasing value, minima.front() is the best.
+            std::vector<Minimum> minima;
+            size_t solve_time;
+            size_t cancel_time;
+            //Evaluations of all the solves.
+            size_t fval_eval_time;
+            size_t gradient_eval_time;
+            double solve_seconds;
+        };
+    public:
+        MultiStart(const Fun& fun, const Vector& lower, const Vector& upper) : fun_(fun), lower_(lower), upper_(upper), is_user_starts_(false), best_(0)
+        {
+
+        }
+        //Solve from these starts instead of random ones.
+        void set_starts(const std::vector<Vector>& starts)
+        {
+            starts_ = starts;
+            is_user_starts_ = true;
+        }
+        const SolveResult& get_result() const
+        {
+            return result_;
+        }
+        void solve()
+        {
+            const Clock::time_point start = Clock::now();
+            if (!is_user_starts_)
+                randomStarts();
+            const size_t count = starts_.size();
+            outcomes_.assign(count, Outcome());
+            best_.store(std::numeric_limits<Scalar>::infinity());
+            auto run = [&](size_t i) { solveStart(i); };
+            if (parameter_.thread_pool_ != nullptr)
+            {
+                parameter_.thread_pool_->parallelFor(count, run);
+            }
+            else
+            {
+                for (size_t i = 0; i < count; ++i)
+                    run(i);
+            }
+            collect();
+            result_.solve_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+    private:
+        class Outcome
+        {
+        public:
+            Vector x;
+            Scalar fval;
+            bool is_cancelled;
+            size_t fval_eval_time;
+            size_t gradient_eval_time;
+        };
+        //Share the values of a solve and cancel it once it is hopeless.
+        class StartObserver final : public SolveObserver<Scalar>
+        {
+        public:
+            explicit StartObserver(MultiStart& driver) : driver_(driver), cancel_(false)
+            {
+
+            }
+            void iteration(const IterationRecord<Scalar>& record) override
+            {
+                const Scalar best = driver_.offer(record.fval);
+                const size_t cancel_iteration = driver_.parameter_.cancel_iteration_;
+                if (cancel_iteration == 0 || record.iteration < cancel_iteration)
+                    return;
+                if (record.fval > best + driver_.parameter_.cancel_margin_ * std::max(Scalar(1), std::abs(best)))
+                    cancel_.store(true, std::memory_order_relaxed);
+            }
+            const std::atomic<bool>& cancel() const
+            {
+                return cancel_;
+            }
+        private:
+            MultiStart& driver_;
+            std::atomic<bool> cancel_;
+        };
+    private:
+        void randomStarts()
+        {
+            std::mt19937_64 random(parameter_.seed_);
+            std::uniform_real_distribution<Scalar> uniform(0, 1);
+            starts_.resize(parameter_.num_starts_);
+            for (Vector& x : starts_)
+            {
+                x.resize(lower_.size());
+                for (Eigen::Index j = 0; j < x.size(); ++j)
+                    x(j) = lower_(j) + uniform(random) * (upper_(j) - lower_(j));
+            }
+        }
+        //Lower the shared best value to fval if it is smaller, and return the best value.
+        Scalar offer(Scalar fval)
+        {
+            Scalar best = best_.load(std::memory_order_relaxed);
+            while (fval < best && !best_.compare_exchange_weak(best, fval, std::memory_order_relaxed))
+            {
+
+            }
+            return std::min(best, fval);
+        }
+        void solveStart(size_t i)
+        {
+            Fun fun = fun_;
+            Solver solver(fun, starts_[i]);
+            StartObserver observer(*this);
+            solver.parameter_ = parameter_.solver_parameter_;
+            solver.parameter_.observer_ = &observer;
+            solver.parameter_.cancel_ = &observer.cancel();
+            solver.solve();
+            const auto& result = solver.get_result();
+            Outcome& outcome = outcomes_[i];
+            outcome.x = result.res_x;
+            outcome.fval = result.fval;
+            outcome.is_cancelled = observer.cancel().load();
+            outcome.fval_eval_time = result.fval_eval_time;
+            outcome.gradient_eval_time = result.gradient_eval_time;
+            offer(result.fval);
+        }
+        //Merge the solutions of the completed solves into distinct minima, from the best one.
+        void collect()
+        {
+            result_.minima.clear();
+            result_.solve_time = outcomes_.size();
+            result_.cancel_time = 0;
+            result_.fval_eval_time = 0;
+            result_.gradient_eval_time = 0;
+            std::vector<size_t> order;
+            for (size_t i = 0; i < outcomes_.size(); ++i)
+            {
+                result_.fval_eval_time += outcomes_[i].fval_eval_time;
+                result_.gradient_eval_time += outcomes_[i].gradient_eval_time;
+                if (outcomes_[i].is_cancelled)
+                    ++result_.cancel_time;
+                else
+                    order.push_back(i);
+            }
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return outcomes_[a].fval < outcomes_[b].fval; });
+            for (size_t i : order)
+            {
+                const Outcome& outcome = outcomes_[i];
+                auto same = std::find_if(result_.minima.begin(), result_.minima.end(), [&](const Minimum& minimum)
+                {
+                    return (outcome.x - minimum.x).norm() <= parameter_.distance_tolerance_ * (1 + minimum.x.norm());
+                });
+                if (same != result_.minima.end())
+                {
+                    ++same->hit_time;
+                    continue;
+                }
+                Minimum minimum;
+                minimum.x = outcome.x;
+                minimum.fval = outcome.fval;
+                minimum.hit_time = 1;
+                result_.minima.push_back(minimum);
+            }
+        }
+    public:
+        Parameter parameter_;
+    private:
+        Fun fun_;
+        Vector lower_;
+        Vector upper_;
+        std::vector<Vector> starts_;
+        bool is_user_starts_;
+        std::vector<Outcome> outcomes_;
+        std::atomic<Scalar> best_;
+        SolveResult result_;
+    };
+} // namespace Chimes
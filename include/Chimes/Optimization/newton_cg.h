@@ -0,0 +1,287 @@
+#pragma once
+#include <Chimes/Optimization/line_search.h>
+#include <Chimes/Core/numerical.h>
+#include <Eigen/SparseCore>
+
+namespace Chimes
+{
+    namespace optimization
+    {
+        //Describe the Hessian given as products: hessian(x, v, hv) writes H(x) * v.
+        template <typename Hessian, typename Vector>
+        concept concept_hessian_product = requires(Hessian & hessian, const Vector & x, const Vector & v, Vector & hv)
+        {
+            hessian(x, v, hv);
+        };
+        //Describe the Hessian given as a sparse matrix: hessian(x, h) writes H(x) into h.
+        template <typename Hessian, typename Vector>
+        concept concept_sparse_hessian = requires(Hessian & hessian, const Vector & x, Eigen::SparseMatrix<typename Vector::Scalar> & h)
+        {
+            hessian(x, h);
+        };
+        template <typename Hessian, typename Vector>
+        concept concept_hessian = concept_hessian_product<Hessian, Vector> || concept_sparse_hessian<Hessian, Vector>;
+    }
+
+    //No preconditioning, z = r.
+    template <class Scalar = double, int Dim = Eigen::Dynamic>
+    class IdentityPreconditioner
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+    public:
+        void apply(const Vector& r, Vector& z) const
+        {
+            z = r;
+        }
+    };
+
+    //Jacobi preconditioner z = r / diag(H). With a sparse Hessian the diagonal is taken from it at each outer iteration,
+    //otherwise it is set by the caller with set_diagonal(). Entries below min_diagonal are raised to it.
+    //apply() throws if no diagonal of the size of r was set.
+    template <class Scalar = double, int Dim = Eigen::Dynamic>
+    class JacobiPreconditioner
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+    public:
+        explicit JacobiPreconditioner(Scalar min_diagonal = Scalar(1e-12)) : min_diagonal_(min_diagonal)
+        {
+
+        }
+        void set_diagonal(const Vector& diagonal)
+        {
+            inverse_ = diagonal.cwiseMax(min_diagonal_).cwiseInverse();
+        }
+        void update(const Eigen::SparseMatrix<Scalar>& hessian)
+        {
+            set_diagonal(hessian.diagonal());
+        }
+        void apply(const Vector& r, Vector& z) const
+        {
+            if (inverse_.size() != r.size())
+            {
+                std::cout << "[error][JacobiPreconditioner] the diagonal is not set." << std::endl;
+                throw std::runtime_error("[error][JacobiPreconditioner] the diagonal is not set");
+            }
+            z = inverse_.cwiseProduct(r);
+        }
+    private:
+        Scalar min_diagonal_;
+        Vector inverse_;
+    };
+
+    //Truncated Newton method (line-search Newton-CG): the Newton system H * d = -g is solved inexactly by preconditioned
+    //conjugate gradient, stopped at the residual min(cg_forcing_, sqrt(|g|)) * |g| or at a direction of negative
+    //curvature, and the step along d is found by stepSearch() from step 1.
+    //Hessian gives H(x) as products, hessian(x, v, hv), or as an Eigen::SparseMatrix, hessian(x, h), which is then
+    //assembled once per outer iteration.
+    //Preconditioner provides apply(r, z), z = P^-1 * r, and may provide update(x, gradient) or, with a sparse Hessian,
+    //update(h), called before each inner solve.
+    template <class Fun, class Hessian, class Scalar = double, int Dim = Eigen::Dynamic, class Preconditioner = IdentityPreconditioner<Scalar, Dim>>
+        requires optimization::concept_hessian<Hessian, Eigen::Matrix<Scalar, Dim, 1>>
+    class NewtonCG final : public LineSearchMethod<Fun, Scalar, Dim>
+    {
+    private:
+        using Base = LineSearchMethod<Fun, Scalar, Dim>;
+        static constexpr bool is_sparse = !optimization::concept_hessian_product<Hessian, Eigen::Matrix<Scalar, Dim, 1>>;
+    public:
+        NewtonCG(Fun& fun, Hessian& hessian, const typename Base::Vector& init_x) : Base(fun, init_x), hessian_(hessian)
+        {
+
+        }
+        NewtonCG(Fun& fun, Hessian& hessian, const typename Base::Vector& init_x, const Preconditioner& preconditioner) : Base(fun, init_x),
+            hessian_(hessian), preconditioner_(preconditioner)
+        {
+
+        }
+        Preconditioner& preconditioner()
+        {
+            return preconditioner_;
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
+            const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            resize(n);
+            typename Base::Vector& iter_x = iter_x_;
+            typename Base::Vector& gradient = gradient_;
+            typename Base::Vector& direction = direction_;
+            gradient.setZero();
+            kernels.copy(iter_x, Base::init_x_);
+            Base::resetStatistics();
+            Scalar fval = Base::evaluate(iter_x, gradient);
+            if (Base::parameter_.is_show_)
+            {
+                std::cout << 0 << "\t" << 0 << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient) << "\t"
+                    << fval << "\n";
+            }
+            size_t k = 0;
+            size_t l = 0;
+            while (1)
+            {
+                const Scalar gradient_norm = kernels.norm(gradient);
+                if (gradient_norm < Base::parameter_.epsilon_)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]reach the gradient tolerance" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < Base::secondsSince(start) * 1000.0)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]reach the max time" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_iteration_ != 0 && Base::parameter_.max_iteration_ == k)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]reach the max itertion time" << std::endl;
+                    }
+                    break;
+                }
+                Base::profile(Base::result_.direction_seconds, [&]() { newtonDirection(gradient_norm, kernels); });
+                Scalar step = Scalar(1.0);
+                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction, search_x_);
+                if (num_step_search == Base::stepsearch_exhausted)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]reach the max stepsearch time" << std::endl;
+                    }
+                    break;
+                }
+                if (num_step_search == Base::stepsearch_failed)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]can't fine a right step" << std::endl;
+                    }
+                    break;
+                }
+                //A step search interrupted between two trials is back at its start point.
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NewtonCG]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                l += num_step_search;
+                k++;
+                if (Base::parameter_.is_show_)
+                {
+                    std::cout << k << "\t" << l << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient)
+                        << "\t" << fval << "\n";
+                }
+                Base::observe(k, num_step_search, fval, iter_x, gradient, step, start, kernels);
+            }
+            Base::result_.fval = fval;
+            Base::result_.res_x = iter_x;
+            Base::result_.res_gradient = gradient;
+            Base::result_.iter_time = k;
+            Base::result_.stepsearch_time = l;
+            Base::result_.solve_seconds = Base::secondsSince(start);
+        }
+    private:
+        void resize(size_t n)
+        {
+            if (size_t(iter_x_.size()) == n)
+                return;
+            iter_x_.resize(n);
+            gradient_.resize(n);
+            direction_.resize(n);
+            search_x_.resize(n);
+            residual_.resize(n);
+            preconditioned_.resize(n);
+            conjugate_.resize(n);
+            product_.resize(n);
+        }
+        //hv = H * v at the current iterate.
+        void hessianProduct(const typename Base::Vector& v, typename Base::Vector& hv)
+        {
+            ++Base::result_.hessian_product_time;
+            if constexpr (is_sparse)
+                hv.noalias() = hessian_matrix_ * v;
+            else
+                hessian_(iter_x_, v, hv);
+        }
+        //Preconditioned CG on H * d = -g from d = 0, into direction_.
+        //On negative or zero curvature the last iterate is kept, or the preconditioned steepest descent on the first
+        //inner iteration, so the direction is always a descent direction.
+        void newtonDirection(Scalar gradient_norm, const VectorKernels<Scalar>& kernels)
+        {
+            if constexpr (is_sparse)
+            {
+                hessian_(iter_x_, hessian_matrix_);
+                if constexpr (requires { preconditioner_.update(hessian_matrix_); })
+                    preconditioner_.update(hessian_matrix_);
+            }
+            else if constexpr (requires { preconditioner_.update(iter_x_, gradient_); })
+            {
+                preconditioner_.update(iter_x_, gradient_);
+            }
+            const Scalar tolerance = std::min(Base::parameter_.cg_forcing_, std::sqrt(gradient_norm)) * gradient_norm;
+            typename Base::Vector& d = direction_;
+            typename Base::Vector& r = residual_;
+            typename Base::Vector& z = preconditioned_;
+            typename Base::Vector& p = conjugate_;
+            typename Base::Vector& hp = product_;
+            d.setZero();
+            kernels.copy(r, gradient_);
+            preconditioner_.apply(r, z);
+            kernels.scale(p, Scalar(-1), z);
+            Scalar rz = kernels.dot(r, z);
+            const size_t max_iteration = std::max<size_t>(1, Base::parameter_.max_cg_iteration_);
+            for (size_t j = 0; j < max_iteration; ++j)
+            {
+                hessianProduct(p, hp);
+                const Scalar curvature = kernels.dot(p, hp);
+                if (curvature <= NumericPolicy<Scalar>::epsilon * kernels.squaredNorm(p))
+                {
+                    if (j == 0)
+                        kernels.copy(d, p);
+                    break;
+                }
+                const Scalar alpha = rz / curvature;
+                kernels.axpy(d, d, alpha, p);
+                kernels.axpy(r, r, alpha, hp);
+                if (kernels.norm(r) <= tolerance)
+                    break;
+                preconditioner_.apply(r, z);
+                const Scalar new_rz = kernels.dot(r, z);
+                kernels.scale(p, new_rz / rz, p);
+                kernels.axpy(p, p, Scalar(-1), z);
+                rz = new_rz;
+            }
+        }
+    private:
+        Hessian& hessian_;
+        Preconditioner preconditioner_;
+        Eigen::SparseMatrix<Scalar> hessian_matrix_;
+        typename Base::Vector iter_x_;
+        typename Base::Vector gradient_;
+        typename Base::Vector direction_;
+        typename Base::Vector search_x_;
+        //Residual H * d + g, its preconditioned form, the conjugate direction and its product with H.
+        typename Base::Vector residual_;
+        typename Base::Vector preconditioned_;
+        typename Base::Vector conjugate_;
+        typename Base::Vector product_;
+    };
+} // namespace Chimes
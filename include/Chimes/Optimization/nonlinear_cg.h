@@ -0,0 +1,212 @@
+#pragma once
+
+#include <Chimes/Optimization/line_search.h>
+
+namespace Chimes
+{
+    //Nonlinear conjugate gradient, d = -g + beta * d with beta given by update_.
+    //It keeps five vectors of the size of the problem whatever the problem, against 5 + 2 * lbfgs_remain_ for LBFGS.
+    //The search restarts along -g every restart_interval_ iterations, when two successive gradients are far from
+    //orthogonal (Powell), and whenever the new direction is not a descent direction.
+    //The step search defaults to the strong Wolfe conditions of MORE_THUENTE with wolfe_ = 0.1, which keep the
+    //Fletcher-Reeves and Dai-Yuan directions descent directions; its interpolated steps are close enough to the exact ones
+    //to keep the directions conjugate, where the bisection of STRONG_WOLFE often is not. The first trial step of an
+    //iteration is the last step scaled by the ratio of the slopes.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+    class NonlinearCG final : public LineSearchMethod<Fun, Scalar, Dim>
+    {
+    private:
+        using Base = LineSearchMethod<Fun, Scalar, Dim>;
+    public:
+        enum class Update
+        {
+            FLETCHER_REEVES,
+            //Polak-Ribiere, clipped at 0.
+            POLAK_RIBIERE_PLUS,
+            //Hager-Zhang (CG_DESCENT), with their lower bound of beta.
+            HAGER_ZHANG,
+            DAI_YUAN
+        };
+    public:
+        NonlinearCG(Fun& fun, const typename Base::Vector& init_x, Update update = Update::HAGER_ZHANG) : Base(fun, init_x), update_(update),
+            restart_time_(0)
+        {
+            Base::parameter_.step_search_method_ = Base::StepSearchMethod::MORE_THUENTE;
+            Base::parameter_.wolfe_ = Scalar(0.1);
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
+            const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            const size_t restart_interval = Base::parameter_.restart_interval_ == 0 ? n : Base::parameter_.restart_interval_;
+            typename Base::Vector gradient(n);
+            gradient.setZero();
+            typename Base::Vector iter_x = Base::init_x_;
+            typename Base::Vector search_x(n);
+            typename Base::Vector old_gradient(n);
+            typename Base::Vector direction(n);
+            Base::resetStatistics();
+            restart_time_ = 0;
+            Scalar fval = Base::evaluate(iter_x, gradient);
+            if (Base::parameter_.is_show_)
+            {
+                std::cout << 0 << "\t" << 0 << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient) << "\t"
+                    << fval << "\n";
+            }
+            kernels.scale(direction, Scalar(-1), gradient);
+            Scalar gg = kernels.squaredNorm(gradient);
+            Scalar dg = -gg;
+            Scalar step = Scalar(1.0) / std::sqrt(gg);
+            size_t k = 0;
+            size_t l = 0;
+            //Iterations since the last restart.
+            size_t since_restart = 0;
+            while (1)
+            {
+                if (std::sqrt(gg) < Base::parameter_.epsilon_)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]reach the gradient tolerance" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < Base::secondsSince(start) * 1000.0)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]reach the max time" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                if (Base::parameter_.max_iteration_ != 0 && Base::parameter_.max_iteration_ == k)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]reach the max itertion time" << std::endl;
+                    }
+                    break;
+                }
+                kernels.copy(old_gradient, gradient);
+                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction, search_x);
+                if (num_step_search == Base::stepsearch_exhausted)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]reach the max stepsearch time" << std::endl;
+                    }
+                    break;
+                }
+                if (num_step_search == Base::stepsearch_failed)
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]can't fine a right step" << std::endl;
+                    }
+                    break;
+                }
+                //A step search interrupted between two trials is back at its start point.
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][NonlinearCG]cancelled" << std::endl;
+                    }
+                    break;
+                }
+                l += num_step_search;
+                k++;
+                ++since_restart;
+                const Scalar old_gg = gg;
+                gg = kernels.squaredNorm(gradient);
+                if (Base::parameter_.is_show_)
+                {
+                    std::cout << k << "\t" << l << "\t" << Base::secondsSince(start) << "\t" << std::sqrt(gg) << "\t" << fval << "\n";
+                }
+                Base::observe(k, num_step_search, fval, iter_x, gradient, step, start, kernels);
+                Base::profile(Base::result_.direction_seconds, [&]()
+                {
+                    const Scalar old_dg = dg;
+                    const bool is_orthogonal = std::abs(kernels.dot(gradient, old_gradient)) < Base::parameter_.restart_orthogonality_ * gg;
+                    Scalar beta = 0;
+                    bool is_restart = since_restart >= restart_interval || !is_orthogonal || !conjugate(beta, gradient, old_gradient,
+                        direction, gg, old_gg, kernels);
+                    if (!is_restart)
+                    {
+                        //d = beta * d - g
+                        kernels.scale(direction, beta, direction);
+                        kernels.axpy(direction, direction, Scalar(-1), gradient);
+                        dg = kernels.dot(gradient, direction);
+                        is_restart = !(dg < Scalar(0));
+                    }
+                    if (is_restart)
+                    {
+                        kernels.scale(direction, Scalar(-1), gradient);
+                        dg = -gg;
+                        since_restart = 0;
+                        ++restart_time_;
+                    }
+                    step *= old_dg / dg;
+                });
+            }
+            Base::result_.fval = fval;
+            Base::result_.res_x = iter_x;
+            Base::result_.res_gradient = gradient;
+            Base::result_.iter_time = k;
+            Base::result_.stepsearch_time = l;
+            Base::result_.solve_seconds = Base::secondsSince(start);
+        }
+        //Number of restarts along -g in the last solve.
+        size_t restarts() const
+        {
+            return restart_time_;
+        }
+    private:
+        //beta of update_ from the new gradient, the old gradient and direction, false if it is not defined. old_gradient
+        //is overwritten by y = gradient - old_gradient.
+        bool conjugate(Scalar& beta, const typename Base::Vector& gradient, typename Base::Vector& old_gradient,
+            const typename Base::Vector& direction, Scalar gg, Scalar old_gg, const VectorKernels<Scalar>& kernels) const
+        {
+            if (update_ == Update::FLETCHER_REEVES)
+            {
+                beta = gg / old_gg;
+                return std::isfinite(beta);
+            }
+            kernels.axpy(old_gradient, gradient, Scalar(-1), old_gradient);
+            const typename Base::Vector& y = old_gradient;
+            if (update_ == Update::POLAK_RIBIERE_PLUS)
+            {
+                beta = std::max(Scalar(0), kernels.dot(gradient, y) / old_gg);
+                return std::isfinite(beta);
+            }
+            const Scalar dy = kernels.dot(direction, y);
+            if (!(dy > Scalar(0)))
+            {
+                return false;
+            }
+            if (update_ == Update::DAI_YUAN)
+            {
+                beta = gg / dy;
+                return std::isfinite(beta);
+            }
+            const Scalar yy = kernels.squaredNorm(y);
+            beta = (kernels.dot(y, gradient) - Scalar(2) * yy / dy * kernels.dot(direction, gradient)) / dy;
+            const Scalar eta = Scalar(-1) / (kernels.norm(direction) * std::min(Scalar(0.01), std::sqrt(old_gg)));
+            beta = std::max(beta, eta);
+            return std::isfinite(beta);
+        }
+    public:
+        Update update_;
+    private:
+        size_t restart_time_;
+    };
+} // namespace Chimes
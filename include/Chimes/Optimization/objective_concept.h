@@ -0,0 +1,125 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <utility>
+
+namespace Chimes
+{
+    namespace optimization
+    {
+        //Describe the objective that returns the value and writes the gradient in one call.
+        template <typename Fun, typename Vector>
+        concept concept_objective_value_gradient = requires(Fun & fun, const Vector & x, Vector & gradient)
+        {
+            { fun(x, gradient) } -> std::convertible_to<typename Vector::Scalar>;
+        };
+        //Describe the objective that returns the value only.
+        template <typename Fun, typename Vector>
+        concept concept_objective_value = requires(Fun & fun, const Vector & x)
+        {
+            { fun(x) } -> std::convertible_to<typename Vector::Scalar>;
+        };
+        //Describe the objective that writes the gradient only.
+        template <typename Fun, typename Vector>
+        concept concept_objective_gradient = requires(Fun & fun, const Vector & x, Vector & gradient)
+        {
+            { fun(x, gradient) } -> std::same_as<void>;
+        };
+        //Describe the objective of the line-search solvers: value and gradient together, or each on its own.
+        //Solvers take the type of the objective as a template parameter, so lambdas and function objects are
+        //called directly and inlined. std::function still works, at the cost of an indirect call per evaluation.
+        template <typename Fun, typename Vector>
+        concept concept_objective = concept_objective_value_gradient<Fun, Vector>
+            || (concept_objective_value<Fun, Vector> && concept_objective_gradient<Fun, Vector>);
+
+        //Describe the objective of the parallel drivers. Solvers keep a reference to their objective and may call it with
+        //internal buffers, so concurrent solves each run on a copy: Fun must be copyable and its copies must not share
+        //mutable state (a lambda capturing a buffer by reference does not qualify, one capturing it by value does).
+        template <typename Fun, typename Vector>
+        concept concept_copyable_objective = concept_objective<Fun, Vector> && std::copy_constructible<Fun>;
+
+        //Return the value at x and write the gradient, with one call if fun provides both together.
+        template <typename Fun, typename Vector>
+            requires concept_objective<Fun, Vector>
+        typename Vector::Scalar evaluate(Fun& fun, const Vector& x, Vector& gradient)
+        {
+            if constexpr (concept_objective_value_gradient<Fun, Vector>)
+            {
+                return fun(x, gradient);
+            }
+            else
+            {
+                fun(x, gradient);
+                return fun(x);
+            }
+        }
+
+        //Return the value at x, without the gradient if fun can evaluate the value alone.
+        //Otherwise gradient is written as well.
+        template <typename Fun, typename Vector>
+            requires concept_objective<Fun, Vector>
+        typename Vector::Scalar evaluate_value(Fun& fun, const Vector& x, Vector& gradient)
+        {
+            if constexpr (concept_objective_value<Fun, Vector>)
+            {
+                return fun(x);
+            }
+            else
+            {
+                return fun(x, gradient);
+            }
+        }
+
+        //Write the gradient at x.
+        template <typename Fun, typename Vector>
+            requires concept_objective<Fun, Vector>
+        void evaluate_gradient(Fun& fun, const Vector& x, Vector& gradient)
+        {
+            static_cast<void>(fun(x, gradient));
+        }
+
+        //Describe the finite-sum objective of the stochastic solvers, f(x) = 1/N * sum_i f_i(x) over N = fun.samples().
+        //fun.load(samples, count, batch) gathers the data of count samples into a Fun::Batch, and fun(x, batch, gradient)
+        //returns the mean value over the batch and writes the mean gradient. With prefetching, load() runs on a
+        //background thread while the solver evaluates another batch, so it must not modify what the evaluation reads.
+        //StochasticLBFGS prefetches two streams, so there load() is also called from two threads at the same time.
+        template <typename Fun, typename Vector>
+        concept concept_finite_sum = requires(Fun & fun, const Vector & x, Vector & gradient, typename Fun::Batch & batch,
+            const size_t * samples, size_t count)
+        {
+            { fun.samples() } -> std::convertible_to<size_t>;
+            fun.load(samples, count, batch);
+            { fun(x, std::as_const(batch), gradient) } -> std::convertible_to<typename Vector::Scalar>;
+        };
+
+        //Objective made of a value function fval = value(x) and a gradient function gradient(x, g).
+        template <typename Value, typename Gradient>
+        class SeparateObjective
+        {
+        public:
+            SeparateObjective(Value value, Gradient gradient) : value_(std::move(value)), gradient_(std::move(gradient))
+            {
+
+            }
+            template <typename Vector>
+            auto operator()(const Vector& x)
+            {
+                return value_(x);
+            }
+            template <typename Vector>
+            void operator()(const Vector& x, Vector& gradient)
+            {
+                gradient_(x, gradient);
+            }
+        private:
+            Value value_;
+            Gradient gradient_;
+        };
+
+        template <typename Value, typename Gradient>
+        SeparateObjective<Value, Gradient> make_objective(Value value, Gradient gradient)
+        {
+            return SeparateObjective<Value, Gradient>(std::move(value), std::move(gradient));
+        }
+    }
+}
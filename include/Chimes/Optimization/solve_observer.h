@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <Eigen/Core>
+
+namespace Chimes
+{
+    //State of a line-search solver after one iteration.
+    template <class Scalar = double>
+    class IterationRecord
+    {
+    public:
+        size_t iteration;
+        //Trial steps of this iteration.
+        size_t stepsearch_time;
+        Scalar fval;
+        Scalar gradient_norm;
+        //Accepted step along the search direction.
+        Scalar step;
+        //Evaluations since the start of the solve.
+        size_t fval_eval_time;
+        size_t gradient_eval_time;
+        //Wall time since the start of the solve.
+        double seconds;
+    };
+
+    //Receives a record after each iteration of a solver, set with Parameter::observer_.
+    //Nothing is recorded or timed when no observer is set.
+    template <class Scalar = double>
+    class SolveObserver
+    {
+    public:
+        virtual ~SolveObserver() = default;
+        virtual void iteration(const IterationRecord<Scalar>& record) = 0;
+    };
+
+    //Latest iterate of a running solve, set with Parameter::snapshot_ and read from any thread.
+    //The line-search solvers only accept steps that decrease the value, so their latest iterate is also the best one.
+    //Each iteration copies the iterate under a lock, so it costs O(n) on the solving thread.
+    template <class Scalar = double, int Dim = Eigen::Dynamic>
+    class SolveSnapshot
+    {
+    public:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+    public:
+        SolveSnapshot() : iteration_(0), fval_(0), is_set_(false)
+        {
+
+        }
+        SolveSnapshot(const SolveSnapshot&) = delete;
+        SolveSnapshot& operator=(const SolveSnapshot&) = delete;
+        //Called by the solver after each iteration. Only the first call of a given size allocates.
+        void publish(size_t iteration, Scalar fval, const Vector& x)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            iteration_ = iteration;
+            fval_ = fval;
+            x_ = x;
+            is_set_ = true;
+        }
+        //Copy the latest iterate into x and its value into fval, false if no iteration was published yet.
+        bool read(Vector& x, Scalar& fval, size_t* iteration = nullptr) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!is_set_)
+                return false;
+            x = x_;
+            fval = fval_;
+            if (iteration != nullptr)
+                *iteration = iteration_;
+            return true;
+        }
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_set_ = false;
+        }
+    private:
+        mutable std::mutex mutex_;
+        size_t iteration_;
+        Scalar fval_;
+        Vector x_;
+        bool is_set_;
+    };
+} // namespace Chimes
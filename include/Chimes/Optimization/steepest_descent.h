@@ -1,40 +1,43 @@
 #pragma once
 
 #include <Chimes/Optimization/line_search.h>
-#include <time.h>
 
 namespace Chimes
 {
-    template <class Fun, class Scalar = double>
-    class SteepestDescent : public LineSearchMethod<Fun, Scalar>
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+    class SteepestDescent final : public LineSearchMethod<Fun, Scalar, Dim>
     {
     private:
-        using Base = LineSearchMethod<Fun, Scalar>;
+        using Base = LineSearchMethod<Fun, Scalar, Dim>;
     public:
         SteepestDescent(Fun& fun, const typename Base::Vector& init_x) : Base(fun, init_x)
         {
             
         }
-        virtual void solve()
+        void solve() override
         {
-            const clock_t start_t = clock();
+            const typename Base::Clock::time_point start = Base::Clock::now();
             const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
             typename Base::Vector gradient(n);
             gradient.setZero();
             typename Base::Vector iter_x = Base::init_x_;
-            Scalar fval = Base::fun_(iter_x, gradient);
+            typename Base::Vector search_x(n);
+            Base::resetStatistics();
+            Scalar fval = Base::evaluate(iter_x, gradient);
             if (Base::parameter_.is_show_)
             {
-                std::cout << 0 << "\t" << 0 << "\t" << (clock() - start_t) * 1.0 / CLOCKS_PER_SEC << "\t" << gradient.norm() << "\t"
-                    << fval << std::endl;
+                std::cout << 0 << "\t" << 0 << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient) << "\t"
+                    << fval << "\n";
             }
-            typename Base::Vector direction = -gradient;
+            typename Base::Vector direction(n);
+            kernels.scale(direction, Scalar(-1), gradient);
             size_t k = 0;
             size_t l = 0;
-            Scalar step = Scalar(1.0) / direction.norm();
+            Scalar step = Scalar(1.0) / kernels.norm(direction);
             while (1)
             {
-                if (gradient.norm() < Base::parameter_.epsilon_)
+                if (kernels.norm(gradient) < Base::parameter_.epsilon_)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -42,7 +45,7 @@ namespace Chimes
                     }
                     break;
                 }
-                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < (clock() - start_t) * 1000.0 / CLOCKS_PER_SEC)
+                if (Base::parameter_.max_time_ > 0 && Base::parameter_.max_time_ < Base::secondsSince(start) * 1000.0)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -50,6 +53,14 @@ namespace Chimes
                     }
                     break;
                 }
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][SteepestDescent]cancelled" << std::endl;
+                    }
+                    break;
+                }
                 if (Base::parameter_.max_iteration_ != 0 && Base::parameter_.max_iteration_ == k)
                 {
                     if (Base::parameter_.is_show_)
@@ -58,8 +69,8 @@ namespace Chimes
                     }
                     break;
                 }
-                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction);
-                if (num_step_search == Base::parameter_.max_stepsearch_)
+                size_t num_step_search = Base::stepSearch(fval, iter_x, gradient, step, direction, search_x);
+                if (num_step_search == Base::stepsearch_exhausted)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -67,7 +78,7 @@ namespace Chimes
                     }
                     break;
                 }
-                if (num_step_search < 0)
+                if (num_step_search == Base::stepsearch_failed)
                 {
                     if (Base::parameter_.is_show_)
                     {
@@ -75,21 +86,35 @@ namespace Chimes
                     }
                     break;
                 }
+                //A step search interrupted between two trials is back at its start point.
+                if (Base::isCancelled())
+                {
+                    if (Base::parameter_.is_show_)
+                    {
+                        std::cout << "[info][SteepestDescent]cancelled" << std::endl;
+                    }
+                    break;
+                }
                 l += num_step_search;
                 k++;
                 if (Base::parameter_.is_show_)
                 {
-                    std::cout << k << "\t" << l << "\t" << (clock() - start_t) * 1.0 / CLOCKS_PER_SEC << "\t" << gradient.norm()
-                        << "\t" << fval << std::endl;
+                    std::cout << k << "\t" << l << "\t" << Base::secondsSince(start) << "\t" << kernels.norm(gradient)
+                        << "\t" << fval << "\n";
                 }
-                direction = -gradient;
-                step = Scalar(1.0) / direction.norm();
+                Base::observe(k, num_step_search, fval, iter_x, gradient, step, start, kernels);
+                Base::profile(Base::result_.direction_seconds, [&]()
+                {
+                    kernels.scale(direction, Scalar(-1), gradient);
+                    step = Scalar(1.0) / kernels.norm(direction);
+                });
             }
             Base::result_.fval = fval;
             Base::result_.res_x = iter_x;
             Base::result_.res_gradient = gradient;
             Base::result_.iter_time = k;
             Base::result_.stepsearch_time = l;
+            Base::result_.solve_seconds = Base::secondsSince(start);
         }
     };
 } // namespace Chimes
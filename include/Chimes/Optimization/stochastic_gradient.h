@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Chimes/Optimization/stochastic_method.h>
+
+namespace Chimes
+{
+    //Mini-batch stochastic gradient descent, plain, with heavy ball momentum or Adam.
+    //The buffers are sized once per solve, the iterations do not allocate.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+    class StochasticGradient final : public StochasticMethod<Fun, Scalar, Dim>
+    {
+    private:
+        using Base = StochasticMethod<Fun, Scalar, Dim>;
+    public:
+        enum class UpdateMethod
+        {
+            SGD,
+            //v = momentum_ * v - step * g, x = x + v.
+            MOMENTUM,
+            //Adaptive moments of Kingma and Ba, with bias correction.
+            ADAM
+        };
+    public:
+        StochasticGradient(Fun& fun, const typename Base::Vector& init_x, UpdateMethod method = UpdateMethod::SGD) : Base(fun, init_x),
+            method_(method)
+        {
+
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
+            const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            BatchStream<Fun> stream(Base::fun_, Base::parameter_.batch_size_, Base::parameter_.seed_, Base::parameter_.is_prefetch_);
+            typename Base::Vector iter_x = Base::init_x_;
+            typename Base::Vector gradient(n);
+            //Velocity of MOMENTUM, first and second moments of ADAM.
+            typename Base::Vector first(n);
+            typename Base::Vector second(n);
+            gradient.setZero();
+            first.setZero();
+            second.setZero();
+            Base::resetStatistics();
+            Base::resetEpoch();
+            //Powers of beta1_ and beta2_ for the bias correction of ADAM.
+            Scalar beta1_power = 1;
+            Scalar beta2_power = 1;
+            size_t k = 0;
+            while (!Base::isStop(k, stream, start, "StochasticGradient"))
+            {
+                const typename Fun::Batch& batch = stream.next();
+                const Scalar fval = Base::evaluate(iter_x, stream, batch, gradient);
+                const Scalar step = Base::learningRate(k);
+                switch (method_)
+                {
+                case UpdateMethod::SGD:
+                    kernels.axpy(iter_x, iter_x, -step, gradient);
+                    break;
+                case UpdateMethod::MOMENTUM:
+                    kernels.scale(first, Base::parameter_.momentum_, first);
+                    kernels.axpy(first, first, -step, gradient);
+                    kernels.axpy(iter_x, iter_x, Scalar(1), first);
+                    break;
+                case UpdateMethod::ADAM:
+                {
+                    const Scalar beta1 = Base::parameter_.beta1_;
+                    const Scalar beta2 = Base::parameter_.beta2_;
+                    beta1_power *= beta1;
+                    beta2_power *= beta2;
+                    first = beta1 * first + (1 - beta1) * gradient;
+                    second = beta2 * second + (1 - beta2) * gradient.cwiseAbs2();
+                    const Scalar corrected_step = step * std::sqrt(1 - beta2_power) / (1 - beta1_power);
+                    iter_x.array() -= corrected_step * first.array()
+                        / (second.array().sqrt() + Base::parameter_.adam_epsilon_ * std::sqrt(1 - beta2_power));
+                    break;
+                }
+                }
+                k++;
+                Base::result_.iter_time = k;
+                Base::accumulate(fval, stream.count(), stream.epoch(), start);
+                Base::observe(k, fval, iter_x, gradient, step, start, kernels);
+            }
+            Base::finishEpoch();
+            Base::result_.res_x = iter_x;
+            Base::result_.iter_time = k;
+            Base::result_.epoch_time = stream.epoch();
+            Base::result_.solve_seconds = Base::secondsSince(start);
+        }
+    private:
+        UpdateMethod method_;
+    };
+} // namespace Chimes
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Chimes/Optimization/stochastic_method.h>
+#include <Chimes/Optimization/lbfgs_history.h>
+#include <Chimes/Core/numerical.h>
+#include <algorithm>
+#include <utility>
+
+namespace Chimes
+{
+    //Stochastic LBFGS of Byrd, Hansen, Nocedal and Singer (SQN): mini-batch steps x = x - step * H * g, with H the LBFGS
+    //matrix of correction pairs sampled apart from the steps. Every curvature_period_ iterations the mean of the iterates
+    //of the period is taken, s is the difference of two consecutive means and y the difference of the gradients at them
+    //on one curvature batch of curvature_batch_size_ samples, drawn from a second stream. So the pairs average out the
+    //noise of the steps, and y is a sampled Hessian-vector product instead of a difference of noisy gradients.
+    //Until the first pair the steps are plain SGD.
+    //The pairs are updated with the curvature gradients and the direction taken with the batch gradient, so History must
+    //take any gradient in searchDirection(): LBFGSVectorHistory, not the compact histories.
+    //With is_prefetch_ the step stream and the curvature stream each prefetch on their own thread, so fun_.load() is
+    //called from two threads at the same time, on different batches.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic, class History = LBFGSVectorHistory<Scalar, Dim>>
+    class StochasticLBFGS final : public StochasticMethod<Fun, Scalar, Dim>
+    {
+        static_assert(History::is_any_gradient, "StochasticLBFGS needs a history whose searchDirection() takes any gradient");
+    private:
+        using Base = StochasticMethod<Fun, Scalar, Dim>;
+    public:
+        StochasticLBFGS(Fun& fun, const typename Base::Vector& init_x) : Base(fun, init_x)
+        {
+
+        }
+        void solve() override
+        {
+            const typename Base::Clock::time_point start = Base::Clock::now();
+            const size_t n = Base::init_x_.size();
+            const VectorKernels<Scalar> kernels = Base::kernels();
+            const size_t period = std::max<size_t>(1, Base::parameter_.curvature_period_);
+            BatchStream<Fun> stream(Base::fun_, Base::parameter_.batch_size_, Base::parameter_.seed_, Base::parameter_.is_prefetch_);
+            BatchStream<Fun> curvature_stream(Base::fun_, Base::parameter_.curvature_batch_size_, Base::parameter_.seed_ + 1,
+                Base::parameter_.is_prefetch_);
+            history_.resize(n, Base::parameter_.lbfgs_remain_);
+            typename Base::Vector iter_x = Base::init_x_;
+            typename Base::Vector gradient(n);
+            typename Base::Vector direction(n);
+            //Sum of the iterates of the current period, the mean of the previous one, and the curvature gradients.
+            typename Base::Vector sum_x(n);
+            typename Base::Vector mean_x(n);
+            typename Base::Vector s(n);
+            typename Base::Vector curvature_gradient(n);
+            typename Base::Vector old_curvature_gradient(n);
+            gradient.setZero();
+            sum_x.setZero();
+            Base::resetStatistics();
+            Base::resetEpoch();
+            bool is_mean = false;
+            size_t k = 0;
+            while (!Base::isStop(k, stream, start, "StochasticLBFGS"))
+            {
+                const typename Fun::Batch& batch = stream.next();
+                const Scalar fval = Base::evaluate(iter_x, stream, batch, gradient);
+                const Scalar step = Base::learningRate(k);
+                if (history_.size() == 0)
+                    kernels.scale(direction, Scalar(-1), gradient);
+                else
+                    history_.searchDirection(gradient, direction, kernels);
+                kernels.axpy(iter_x, iter_x, step, direction);
+                kernels.axpy(sum_x, sum_x, Scalar(1), iter_x);
+                k++;
+                Base::result_.iter_time = k;
+                if (k % period == 0)
+                {
+                    kernels.scale(sum_x, Scalar(1) / Scalar(period), sum_x);
+                    if (is_mean)
+                        updateCurvature(sum_x, mean_x, s, curvature_stream, curvature_gradient, old_curvature_gradient, kernels);
+                    std::swap(sum_x, mean_x);
+                    sum_x.setZero();
+                    is_mean = true;
+                }
+                Base::accumulate(fval, stream.count(), stream.epoch(), start);
+                Base::observe(k, fval, iter_x, gradient, step, start, kernels);
+            }
+            Base::finishEpoch();
+            Base::result_.res_x = iter_x;
+            Base::result_.iter_time = k;
+            Base::result_.epoch_time = stream.epoch();
+            Base::result_.solve_seconds = Base::secondsSince(start);
+        }
+    private:
+        //Add the pair s = mean_x - old_mean_x, y = g_H(mean_x) - g_H(old_mean_x) on a new curvature batch H, if its
+        //curvature is safely positive.
+        void updateCurvature(const typename Base::Vector& mean_x, const typename Base::Vector& old_mean_x, typename Base::Vector& s,
+            BatchStream<Fun>& curvature_stream, typename Base::Vector& curvature_gradient, typename Base::Vector& old_curvature_gradient,
+            const VectorKernels<Scalar>& kernels)
+        {
+            const typename Fun::Batch& batch = curvature_stream.next();
+            Base::evaluate(mean_x, curvature_stream, batch, curvature_gradient);
+            Base::evaluate(old_mean_x, curvature_stream, batch, old_curvature_gradient);
+            kernels.axpy(s, mean_x, Scalar(-1), old_mean_x);
+            const Scalar sy = kernels.dot(s, curvature_gradient) - kernels.dot(s, old_curvature_gradient);
+            const Scalar ss = kernels.squaredNorm(s);
+            if (!(sy > NumericPolicy<Scalar>::epsilon * ss))
+                return;
+            history_.update(Scalar(1), s, curvature_gradient, old_curvature_gradient, kernels);
+        }
+    private:
+        History history_;
+    };
+} // namespace Chimes
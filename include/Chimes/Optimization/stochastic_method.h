@@ -0,0 +1,232 @@
+#pragma once
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <Eigen/Core>
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Optimization/vector_kernels.h>
+#include <Chimes/Optimization/objective_concept.h>
+#include <Chimes/Optimization/solve_observer.h>
+#include <Chimes/Optimization/batch_stream.h>
+namespace Chimes
+{
+    //Base of the solvers of finite-sum objectives (optimization::concept_finite_sum), which step on the gradient of a
+    //mini-batch instead of a full evaluation, so an iteration costs batch_size_ samples whatever the number of samples.
+    //The batches are streamed in epochs by a BatchStream. The value of a batch is noisy, so there is no gradient tolerance:
+    //a solve runs for max_epoch_ epochs, max_iteration_ iterations or max_time_ milliseconds.
+    template <class Fun, class Scalar = double, int Dim = Eigen::Dynamic>
+        requires optimization::concept_finite_sum<Fun, Eigen::Matrix<Scalar, Dim, 1>>
+    class StochasticMethod
+    {
+    protected:
+        using Vector = Eigen::Matrix<Scalar, Dim, 1>;
+        using Clock = std::chrono::steady_clock;
+    public:
+        class Parameter
+        {
+        public:
+            Parameter() :max_epoch_(10), max_iteration_(0), max_time_(-1), batch_size_(64), learning_rate_(1e-2), decay_(0), momentum_(0.9),
+                beta1_(0.9), beta2_(0.999), adam_epsilon_(1e-8), lbfgs_remain_(10), curvature_period_(10), curvature_batch_size_(256),
+                seed_(0), is_prefetch_(false), is_show_(true), thread_pool_(nullptr), parallel_min_size_(65536), observer_(nullptr), cancel_(nullptr),
+                deadline_(Clock::time_point::max()), snapshot_(nullptr)
+            {
+
+            }
+        public:
+            size_t max_epoch_;
+            //0 for no limit.
+            size_t max_iteration_;
+            double max_time_;
+            size_t batch_size_;
+            //Step of iteration k is learning_rate_ / (1 + decay_ * k).
+            Scalar learning_rate_;
+            Scalar decay_;
+            //Heavy ball momentum.
+            Scalar momentum_;
+            //Decay rates of the moment estimates of Adam, and the term keeping its denominator away from 0.
+            Scalar beta1_;
+            Scalar beta2_;
+            Scalar adam_epsilon_;
+            //Correction pairs of StochasticLBFGS, one pair formed every curvature_period_ iterations on a batch of
+            //curvature_batch_size_ samples.
+            int lbfgs_remain_;
+            size_t curvature_period_;
+            size_t curvature_batch_size_;
+            //Seed of the sample order, a solve is reproducible for a given seed.
+            uint64_t seed_;
+            //Load the next batch on a background thread while the current one is evaluated.
+            bool is_prefetch_;
+            bool is_show_;
+            //Opt-in parallel vector kernels, see LineSearchMethod::Parameter.
+            ThreadPool* thread_pool_;
+            size_t parallel_min_size_;
+            //Called after each iteration, owned by the caller.
+            SolveObserver<Scalar>* observer_;
+            //The solve stops at the next iteration once *cancel_ is set or the steady clock passes deadline_. Owned by the caller.
+            const std::atomic<bool>* cancel_;
+            Clock::time_point deadline_;
+            //Receives the iterate after each iteration, with the value of its batch. Owned by the caller.
+            SolveSnapshot<Scalar, Dim>* snapshot_;
+        };
+
+        class SolveResult
+        {
+        public:
+            //Mean of the batch values over the last epoch, an estimate of the objective.
+            Scalar fval;
+            Vector res_x;
+            size_t iter_time;
+            size_t epoch_time;
+            //Number of batch gradients, and of samples in them.
+            size_t batch_eval_time;
+            size_t sample_eval_time;
+            double solve_seconds;
+        };
+
+    public:
+        StochasticMethod(Fun& fun, const Vector& init_x) : fun_(fun), init_x_(init_x)
+        {
+            parameter_ = Parameter();
+        }
+        virtual ~StochasticMethod() = default;
+        virtual void solve() = 0;
+        const SolveResult& get_result() const
+        {
+            return result_;
+        }
+        void set_init_x(const Vector& init_x)
+        {
+            init_x_ = init_x;
+        }
+    protected:
+        //Mean value and gradient over the last batch of stream, counted in result_.
+        Scalar evaluate(const Vector& x, BatchStream<Fun>& stream, const typename Fun::Batch& batch, Vector& gradient)
+        {
+            ++result_.batch_eval_time;
+            result_.sample_eval_time += stream.count();
+            return fun_(x, batch, gradient);
+        }
+        void resetStatistics()
+        {
+            result_.iter_time = 0;
+            result_.epoch_time = 0;
+            result_.batch_eval_time = 0;
+            result_.sample_eval_time = 0;
+            result_.solve_seconds = 0;
+        }
+        static double secondsSince(Clock::time_point start)
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        Scalar learningRate(size_t k) const
+        {
+            return parameter_.learning_rate_ / (Scalar(1) + parameter_.decay_ * Scalar(k));
+        }
+        //Check the limits of the solve, k iterations done.
+        bool isStop(size_t k, const BatchStream<Fun>& stream, Clock::time_point start, const char* name) const
+        {
+            if (stream.epoch() >= parameter_.max_epoch_)
+            {
+                if (parameter_.is_show_)
+                {
+                    std::cout << "[info][" << name << "]reach the max epoch time" << std::endl;
+                }
+                return true;
+            }
+            if (parameter_.max_time_ > 0 && parameter_.max_time_ < secondsSince(start) * 1000.0)
+            {
+                if (parameter_.is_show_)
+                {
+                    std::cout << "[info][" << name << "]reach the max time" << std::endl;
+                }
+                return true;
+            }
+            if ((parameter_.cancel_ != nullptr && parameter_.cancel_->load(std::memory_order_relaxed))
+                || (parameter_.deadline_ != Clock::time_point::max() && Clock::now() >= parameter_.deadline_))
+            {
+                if (parameter_.is_show_)
+                {
+                    std::cout << "[info][" << name << "]cancelled" << std::endl;
+                }
+                return true;
+            }
+            if (parameter_.max_iteration_ != 0 && parameter_.max_iteration_ == k)
+            {
+                if (parameter_.is_show_)
+                {
+                    std::cout << "[info][" << name << "]reach the max itertion time" << std::endl;
+                }
+                return true;
+            }
+            return false;
+        }
+        //Add the value of a batch to the running mean of the epoch, and print the mean at the end of an epoch.
+        void accumulate(Scalar fval, size_t count, size_t epoch, Clock::time_point start)
+        {
+            epoch_sum_ += fval * Scalar(count);
+            epoch_count_ += count;
+            if (epoch == epoch_)
+                return;
+            epoch_ = epoch;
+            result_.fval = epoch_sum_ / Scalar(epoch_count_);
+            epoch_sum_ = 0;
+            epoch_count_ = 0;
+            if (parameter_.is_show_)
+            {
+                std::cout << epoch << "\t" << result_.iter_time << "\t" << secondsSince(start) << "\t" << result_.fval << "\n";
+            }
+        }
+        void resetEpoch()
+        {
+            epoch_ = 0;
+            epoch_sum_ = 0;
+            epoch_count_ = 0;
+            result_.fval = std::numeric_limits<Scalar>::quiet_NaN();
+        }
+        //Mean of a partial last epoch, if no epoch was completed.
+        void finishEpoch()
+        {
+            if (epoch_count_ > 0 && std::isnan(result_.fval))
+                result_.fval = epoch_sum_ / Scalar(epoch_count_);
+        }
+        //Pass the state after an iteration to the snapshot and the observer, if any. The gradient is the one of the batch.
+        void observe(size_t iteration, Scalar fval, const Vector& x, const Vector& gradient, Scalar step, Clock::time_point start,
+            const VectorKernels<Scalar>& kernels)
+        {
+            if (parameter_.snapshot_ != nullptr)
+                parameter_.snapshot_->publish(iteration, fval, x);
+            if (parameter_.observer_ == nullptr)
+                return;
+            IterationRecord<Scalar> record;
+            record.iteration = iteration;
+            record.stepsearch_time = 0;
+            record.fval = fval;
+            record.gradient_norm = kernels.norm(gradient);
+            record.step = step;
+            record.fval_eval_time = result_.batch_eval_time;
+            record.gradient_eval_time = result_.batch_eval_time;
+            record.seconds = secondsSince(start);
+            parameter_.observer_->iteration(record);
+        }
+        VectorKernels<Scalar> kernels() const
+        {
+            if constexpr (Dim != Eigen::Dynamic)
+                return VectorKernels<Scalar>();
+            return VectorKernels<Scalar>(parameter_.thread_pool_, parameter_.parallel_min_size_);
+        }
+
+    public:
+        Parameter parameter_;
+    protected:
+        Fun& fun_;
+        Vector init_x_;
+        SolveResult result_;
+    private:
+        size_t epoch_;
+        Scalar epoch_sum_;
+        size_t epoch_count_;
+    };
+} // namespace Chimes
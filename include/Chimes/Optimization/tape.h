@@ -0,0 +1,473 @@
+#pragma once
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace Chimes
+{
+    template <class Scalar>
+    class Tape;
+
+    //Variable of reverse-mode automatic differentiation: a value and the node of the tape that computed it, or no node for
+    //a constant. Every operation on variables records a node with the partial derivatives of its result to its operands,
+    //and Tape::gradient() sweeps the nodes backwards to sum the adjoints. The tape is the one of the operands, which must
+    //not come from two different tapes, so evaluations on different tapes, e.g. on different threads, share nothing.
+    template <class Scalar = double>
+    class TapeVar
+    {
+    public:
+        using Real = Scalar;
+        static constexpr size_t no_node = std::numeric_limits<size_t>::max();
+    public:
+        TapeVar() : value_(0), node_(no_node), tape_(nullptr)
+        {
+
+        }
+        //A constant.
+        TapeVar(const Scalar& value) : value_(value), node_(no_node), tape_(nullptr)
+        {
+
+        }
+        TapeVar(const Scalar& value, size_t node, Tape<Scalar>* tape) : value_(value), node_(node), tape_(tape)
+        {
+
+        }
+        const Scalar& value() const
+        {
+            return value_;
+        }
+        size_t node() const
+        {
+            return node_;
+        }
+        Tape<Scalar>* tape() const
+        {
+            return tape_;
+        }
+        TapeVar& operator+=(const TapeVar& b)
+        {
+            return *this = *this + b;
+        }
+        TapeVar& operator-=(const TapeVar& b)
+        {
+            return *this = *this - b;
+        }
+        TapeVar& operator*=(const TapeVar& b)
+        {
+            return *this = *this * b;
+        }
+        TapeVar& operator/=(const TapeVar& b)
+        {
+            return *this = *this / b;
+        }
+    private:
+        Scalar value_;
+        size_t node_;
+        Tape<Scalar>* tape_;
+    };
+
+    //Tape of reverse-mode automatic differentiation. Nodes are stored in an arena of fixed blocks that is kept by clear(),
+    //so once a tape has recorded an evaluation, recording the next ones of the same size does not allocate.
+    //A node has at most two operands; a constant operand is not recorded.
+    template <class Scalar = double>
+    class Tape
+    {
+    public:
+        using Var = TapeVar<Scalar>;
+        //Nodes per block of the arena.
+        static constexpr size_t block_size = size_t(1) << 16;
+    public:
+        Tape() : size_(0)
+        {
+
+        }
+        //A copy is a new empty tape, the nodes of a tape only make sense with the variables pointing to it.
+        Tape(const Tape&) : size_(0)
+        {
+
+        }
+        Tape& operator=(const Tape&)
+        {
+            clear();
+            return *this;
+        }
+        //Drop all nodes and keep the memory.
+        void clear()
+        {
+            size_ = 0;
+        }
+        //Number of recorded nodes.
+        size_t size() const
+        {
+            return size_;
+        }
+        //A new independent variable.
+        Var variable(const Scalar& value)
+        {
+            return Var(value, push(Var::no_node, 0, Var::no_node, 0), this);
+        }
+        //Record a result of value with partial derivatives da and db to a and b. The result is a constant if both
+        //operands are.
+        static Var record(const Scalar& value, const Var& a, const Scalar& da, const Var& b, const Scalar& db)
+        {
+            Tape* tape = a.tape() != nullptr ? a.tape() : b.tape();
+            if (tape == nullptr)
+                return Var(value);
+            return Var(value, tape->push(a.node(), da, b.node(), db), tape);
+        }
+        //Result of value with derivative d to a.
+        static Var record(const Scalar& value, const Var& a, const Scalar& d)
+        {
+            if (a.tape() == nullptr)
+                return Var(value);
+            return Var(value, a.tape()->push(a.node(), d, Var::no_node, 0), a.tape());
+        }
+        //Sum the adjoints of all nodes for the output, which reads them with adjoint().
+        void gradient(const Var& output)
+        {
+            if (adjoint_.size() < size_)
+                adjoint_.resize(std::max(size_, 2 * adjoint_.size()));
+            std::fill(adjoint_.begin(), adjoint_.begin() + size_, Scalar(0));
+            if (output.tape() != this)
+                return;
+            adjoint_[output.node()] = Scalar(1);
+            for (size_t i = output.node() + 1; i-- > 0;)
+            {
+                const Scalar a = adjoint_[i];
+                if (a == Scalar(0))
+                    continue;
+                const Node& node = at(i);
+                if (node.operand[0] != Var::no_node)
+                    adjoint_[node.operand[0]] += node.partial[0] * a;
+                if (node.operand[1] != Var::no_node)
+                    adjoint_[node.operand[1]] += node.partial[1] * a;
+            }
+        }
+        //d output / d var after gradient(), 0 for a constant.
+        Scalar adjoint(const Var& var) const
+        {
+            return var.tape() == this ? adjoint_[var.node()] : Scalar(0);
+        }
+    private:
+        class Node
+        {
+        public:
+            size_t operand[2];
+            Scalar partial[2];
+        };
+    private:
+        size_t push(size_t a, const Scalar& da, size_t b, const Scalar& db)
+        {
+            if (size_ == blocks_.size() * block_size)
+                blocks_.emplace_back(new Node[block_size]);
+            Node& node = at(size_);
+            node.operand[0] = a;
+            node.operand[1] = b;
+            node.partial[0] = da;
+            node.partial[1] = db;
+            return size_++;
+        }
+        Node& at(size_t i)
+        {
+            return blocks_[i / block_size][i % block_size];
+        }
+        const Node& at(size_t i) const
+        {
+            return blocks_[i / block_size][i % block_size];
+        }
+    private:
+        std::vector<std::unique_ptr<Node[]>> blocks_;
+        size_t size_;
+        std::vector<Scalar> adjoint_;
+    };
+
+    template <class Scalar>
+    TapeVar<Scalar> operator-(const TapeVar<Scalar>& a)
+    {
+        return Tape<Scalar>::record(-a.value(), a, Scalar(-1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator+(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a.value() + b.value(), a, Scalar(1), b, Scalar(1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator-(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a.value() - b.value(), a, Scalar(1), b, Scalar(-1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator*(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a.value() * b.value(), a, b.value(), b, a.value());
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator/(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        const Scalar inverse = Scalar(1) / b.value();
+        const Scalar value = a.value() * inverse;
+        return Tape<Scalar>::record(value, a, inverse, b, -value * inverse);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator+(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return Tape<Scalar>::record(a.value() + b, a, Scalar(1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator+(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a + b.value(), b, Scalar(1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator-(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return Tape<Scalar>::record(a.value() - b, a, Scalar(1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator-(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a - b.value(), b, Scalar(-1));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator*(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return Tape<Scalar>::record(a.value() * b, a, b);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator*(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return Tape<Scalar>::record(a * b.value(), b, a);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator/(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return Tape<Scalar>::record(a.value() / b, a, Scalar(1) / b);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> operator/(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        const Scalar value = a / b.value();
+        return Tape<Scalar>::record(value, b, -value / b.value());
+    }
+
+    //Comparisons look at the values only.
+    template <class Scalar>
+    bool operator<(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() < b.value();
+    }
+    template <class Scalar>
+    bool operator>(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() > b.value();
+    }
+    template <class Scalar>
+    bool operator<=(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() <= b.value();
+    }
+    template <class Scalar>
+    bool operator>=(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() >= b.value();
+    }
+    template <class Scalar>
+    bool operator==(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() == b.value();
+    }
+    template <class Scalar>
+    bool operator!=(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return a.value() != b.value();
+    }
+
+    template <class Scalar>
+    bool operator<(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() < b;
+    }
+    template <class Scalar>
+    bool operator<(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a < b.value();
+    }
+    template <class Scalar>
+    bool operator>(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() > b;
+    }
+    template <class Scalar>
+    bool operator>(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a > b.value();
+    }
+    template <class Scalar>
+    bool operator<=(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() <= b;
+    }
+    template <class Scalar>
+    bool operator<=(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a <= b.value();
+    }
+    template <class Scalar>
+    bool operator>=(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() >= b;
+    }
+    template <class Scalar>
+    bool operator>=(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a >= b.value();
+    }
+    template <class Scalar>
+    bool operator==(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() == b;
+    }
+    template <class Scalar>
+    bool operator==(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a == b.value();
+    }
+    template <class Scalar>
+    bool operator!=(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& b)
+    {
+        return a.value() != b;
+    }
+    template <class Scalar>
+    bool operator!=(const typename TapeVar<Scalar>::Real& a, const TapeVar<Scalar>& b)
+    {
+        return a != b.value();
+    }
+
+    //f(a) with f'(a) = d, recorded on the tape of a.
+    template <class Scalar>
+    TapeVar<Scalar> chain(const TapeVar<Scalar>& a, const Scalar& value, const Scalar& d)
+    {
+        return Tape<Scalar>::record(value, a, d);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> sqrt(const TapeVar<Scalar>& a)
+    {
+        const Scalar value = std::sqrt(a.value());
+        return chain(a, value, Scalar(0.5) / value);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> exp(const TapeVar<Scalar>& a)
+    {
+        const Scalar value = std::exp(a.value());
+        return chain(a, value, value);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> log(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::log(a.value()), Scalar(1) / a.value());
+    }
+    template <class Scalar>
+    TapeVar<Scalar> log1p(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::log1p(a.value()), Scalar(1) / (Scalar(1) + a.value()));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> sin(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::sin(a.value()), std::cos(a.value()));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> cos(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::cos(a.value()), -std::sin(a.value()));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> tan(const TapeVar<Scalar>& a)
+    {
+        const Scalar value = std::tan(a.value());
+        return chain(a, value, Scalar(1) + value * value);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> sinh(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::sinh(a.value()), std::cosh(a.value()));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> cosh(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::cosh(a.value()), std::sinh(a.value()));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> tanh(const TapeVar<Scalar>& a)
+    {
+        const Scalar value = std::tanh(a.value());
+        return chain(a, value, Scalar(1) - value * value);
+    }
+    template <class Scalar>
+    TapeVar<Scalar> atan(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::atan(a.value()), Scalar(1) / (Scalar(1) + a.value() * a.value()));
+    }
+    //The derivative at 0 is taken as 0.
+    template <class Scalar>
+    TapeVar<Scalar> abs(const TapeVar<Scalar>& a)
+    {
+        return chain(a, std::abs(a.value()), Scalar(a.value() > 0) - Scalar(a.value() < 0));
+    }
+    template <class Scalar>
+    TapeVar<Scalar> pow(const TapeVar<Scalar>& a, const typename TapeVar<Scalar>::Real& p)
+    {
+        //At a = 0 the derivative is 0 for p = 0, and pow(0, p - 1) gives 0 for p > 1, 1 for p = 1 and inf for p < 1.
+        const Scalar derivative = p == Scalar(0) ? Scalar(0) : p * std::pow(a.value(), p - Scalar(1));
+        return chain(a, std::pow(a.value(), p), derivative);
+    }
+    //a^b = exp(b * log(a)), a > 0.
+    template <class Scalar>
+    TapeVar<Scalar> pow(const TapeVar<Scalar>& a, const TapeVar<Scalar>& b)
+    {
+        return exp(b * log(a));
+    }
+    template <class Scalar>
+    std::ostream& operator<<(std::ostream& os, const TapeVar<Scalar>& a)
+    {
+        return os << a.value();
+    }
+} // namespace Chimes
+
+namespace Eigen
+{
+    //Tape variables as the scalar of Eigen matrices.
+    template <class Scalar>
+    struct NumTraits<Chimes::TapeVar<Scalar>> : NumTraits<Scalar>
+    {
+        using Real = Chimes::TapeVar<Scalar>;
+        using NonInteger = Chimes::TapeVar<Scalar>;
+        using Nested = Chimes::TapeVar<Scalar>;
+        using Literal = Scalar;
+        enum
+        {
+            IsComplex = 0,
+            IsInteger = 0,
+            IsSigned = 1,
+            RequireInitialization = 1,
+            ReadCost = 1,
+            AddCost = 4,
+            MulCost = 4
+        };
+    };
+    template <class Scalar>
+    struct ScalarBinaryOpTraits<Chimes::TapeVar<Scalar>, Scalar>
+    {
+        using ReturnType = Chimes::TapeVar<Scalar>;
+    };
+    template <class Scalar>
+    struct ScalarBinaryOpTraits<Scalar, Chimes::TapeVar<Scalar>>
+    {
+        using ReturnType = Chimes::TapeVar<Scalar>;
+    };
+} // namespace Eigen
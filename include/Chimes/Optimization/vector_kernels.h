@@ -0,0 +1,123 @@
+#pragma once
+#include <Chimes/Core/thread_pool.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace Chimes
+{
+    //Vector operations of the solvers, run on a ThreadPool for long vectors.
+    //A vector of size n is cut into blocks(n) fixed blocks, one task per block, and reductions add the partial
+    //results of the blocks in block order. So the results are bitwise reproducible for a fixed number of threads,
+    //whichever thread runs which block. Without a pool everything runs as plain Eigen expressions.
+    template <class Scalar = double>
+    class VectorKernels
+    {
+    public:
+        //Upper bound of the number of blocks, the partial sums live on the stack.
+        static constexpr size_t max_blocks = 256;
+    public:
+        //Vectors shorter than min_size are not split.
+        VectorKernels(ThreadPool* pool = nullptr, size_t min_size = 65536) : pool_(pool), min_size_(min_size)
+        {
+
+        }
+        //Number of blocks a vector of size n is cut into.
+        size_t blocks(size_t n) const
+        {
+            if (pool_ == nullptr || pool_->size() == 1 || n < min_size_)
+                return 1;
+            return std::min(pool_->size(), max_blocks);
+        }
+        //Call f(block, begin, length) for each block of [0, n).
+        template <class F>
+        void forEachBlock(size_t n, F&& f) const
+        {
+            const size_t p = blocks(n);
+            if (p == 1)
+            {
+                f(size_t(0), size_t(0), n);
+                return;
+            }
+            pool_->parallelFor(p, [&](size_t i)
+            {
+                const size_t begin = n * i / p;
+                f(i, begin, n * (i + 1) / p - begin);
+            });
+        }
+        //Sum of f(begin, length) over the blocks of [0, n), in block order.
+        template <class F>
+        Scalar reduce(size_t n, F&& f) const
+        {
+            const size_t p = blocks(n);
+            if (p == 1)
+                return f(size_t(0), n);
+            std::array<Scalar, max_blocks> partial{};
+            forEachBlock(n, [&](size_t i, size_t begin, size_t length) { partial[i] = f(begin, length); });
+            Scalar sum = partial[0];
+            for (size_t i = 1; i < p; ++i)
+                sum += partial[i];
+            return sum;
+        }
+        //Vectors that are not split are handled as whole Eigen expressions, so fixed-size vectors stay unrolled.
+        template <class A, class B>
+        Scalar dot(const Eigen::MatrixBase<A>& a, const Eigen::MatrixBase<B>& b) const
+        {
+            if (blocks(a.size()) == 1)
+                return a.dot(b);
+            return reduce(a.size(), [&](size_t begin, size_t length) { return a.segment(begin, length).dot(b.segment(begin, length)); });
+        }
+        template <class A>
+        Scalar squaredNorm(const Eigen::MatrixBase<A>& a) const
+        {
+            if (blocks(a.size()) == 1)
+                return a.squaredNorm();
+            return reduce(a.size(), [&](size_t begin, size_t length) { return a.segment(begin, length).squaredNorm(); });
+        }
+        template <class A>
+        Scalar norm(const Eigen::MatrixBase<A>& a) const
+        {
+            return std::sqrt(squaredNorm(a));
+        }
+        //y = x
+        template <class Y, class X>
+        void copy(Eigen::MatrixBase<Y>& y, const Eigen::MatrixBase<X>& x) const
+        {
+            if (blocks(x.size()) == 1)
+            {
+                y = x;
+                return;
+            }
+            forEachBlock(x.size(), [&](size_t, size_t begin, size_t length) { y.segment(begin, length) = x.segment(begin, length); });
+        }
+        //y = alpha * x
+        template <class Y, class X>
+        void scale(Eigen::MatrixBase<Y>& y, Scalar alpha, const Eigen::MatrixBase<X>& x) const
+        {
+            if (blocks(x.size()) == 1)
+            {
+                y = alpha * x;
+                return;
+            }
+            forEachBlock(x.size(), [&](size_t, size_t begin, size_t length) { y.segment(begin, length) = alpha * x.segment(begin, length); });
+        }
+        //y = x + alpha * d, y may be x or d.
+        template <class Y, class X, class D>
+        void axpy(Eigen::MatrixBase<Y>& y, const Eigen::MatrixBase<X>& x, Scalar alpha, const Eigen::MatrixBase<D>& d) const
+        {
+            if (blocks(x.size()) == 1)
+            {
+                y = x + alpha * d;
+                return;
+            }
+            forEachBlock(x.size(), [&](size_t, size_t begin, size_t length)
+            {
+                y.segment(begin, length) = x.segment(begin, length) + alpha * d.segment(begin, length);
+            });
+        }
+    private:
+        ThreadPool* pool_;
+        size_t min_size_;
+    };
+} // namespace Chimes
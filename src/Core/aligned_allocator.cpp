@@ -0,0 +1,6 @@
+#include "Chimes/Core/aligned_allocator.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Core/executor.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Core/mapped_file.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Core/thread_pool.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
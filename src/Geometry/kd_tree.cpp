@@ -0,0 +1,6 @@
+#include "Chimes/Geometry/kd_tree.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Geometry/matrix.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Geometry/point.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
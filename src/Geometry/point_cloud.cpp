@@ -0,0 +1,6 @@
+#include "Chimes/Geometry/point_cloud.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/async_solve.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
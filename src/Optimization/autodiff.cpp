@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/autodiff.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/batch_lbfgs.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
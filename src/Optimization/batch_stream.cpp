@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/batch_stream.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/dual.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
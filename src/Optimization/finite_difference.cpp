@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/finite_difference.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/lbfgs_history.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/lbfgs_state.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
\ No newline at end of file
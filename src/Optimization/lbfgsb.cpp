@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/lbfgsb.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
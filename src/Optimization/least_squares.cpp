@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/least_squares.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
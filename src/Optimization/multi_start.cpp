@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/multi_start.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
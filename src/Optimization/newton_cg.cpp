@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/newton_cg.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
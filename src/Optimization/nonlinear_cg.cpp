@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/nonlinear_cg.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
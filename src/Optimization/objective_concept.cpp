@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/objective_concept.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
\ No newline at end of file
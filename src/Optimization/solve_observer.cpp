@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/solve_observer.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
\ No newline at end of file
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/stochastic_gradient.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
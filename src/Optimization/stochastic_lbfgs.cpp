@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/stochastic_lbfgs.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/stochastic_method.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
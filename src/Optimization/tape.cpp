@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/tape.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
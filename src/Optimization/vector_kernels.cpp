@@ -0,0 +1,6 @@
+#include "Chimes/Optimization/vector_kernels.h"
+
+namespace Chimes
+{
+
+} // namespace Chimes
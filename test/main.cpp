@@ -1,25 +1,1748 @@
+//Keep assertions in release builds, Eigen reports forbidden heap allocations through them.
+#undef NDEBUG
+#define EIGEN_RUNTIME_NO_MALLOC
 #include <iostream>
 #include <Chimes/Optimization/steepest_descent.h>
-#include <functional>
+#include <Chimes/Optimization/lbfgs.h>
+#include <Chimes/Optimization/autodiff.h>
+#include <Chimes/Optimization/async_solve.h>
+#include <Chimes/Optimization/finite_difference.h>
+#include <Chimes/Optimization/lbfgs_mapped_history.h>
+#include <Chimes/Optimization/lbfgsb.h>
+#include <Chimes/Optimization/newton_cg.h>
+#include <Chimes/Optimization/nonlinear_cg.h>
+#include <Chimes/Optimization/least_squares.h>
+#include <Chimes/Optimization/multi_start.h>
+#include <Chimes/Optimization/batch_lbfgs.h>
+#include <Chimes/Optimization/stochastic_gradient.h>
+#include <Chimes/Optimization/stochastic_lbfgs.h>
+#include <Chimes/Core/thread_pool.h>
+#include <Chimes/Core/template_concept.h>
+#include <Chimes/Geometry/kd_tree.h>
+#include <Chimes/Geometry/point_cloud.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//Number of calls to the global operator new.
+static std::atomic<size_t> g_allocation_count(0);
+
+//Not inlined, so GCC does not pair the std::free below with the new-expressions of the callers.
+[[gnu::noinline]] void* operator new(size_t size)
+{
+    ++g_allocation_count;
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+bool test_steepest_descent()
+{
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = (x(0) - 1) * (x(0) - 1) + (x(1) - 1) * (x(1) - 1);
+        gradient.setZero();
+        gradient(0) = 2 * (x(0) - 1);
+        gradient(1) = 2 * (x(1) - 1);
+        return fval;
+    };
+    using Fun = decltype(fun);
+    Eigen::VectorXd init_x(2);
+    init_x(0) = 53;
+    init_x(1) = -68;
+    Chimes::SteepestDescent<Fun, double> steepest_descent = Chimes::SteepestDescent<Fun, double>(fun, init_x);
+    steepest_descent.solve();
+    Chimes::SteepestDescent<Fun, double>::SolveResult result = steepest_descent.get_result();
+    std::cout << "fval: " << result.fval << "  x: " << result.res_x[0] << " " << result.res_x[1] << std::endl;
+    return result.fval < 1e-8;
+}
+
+//An objective given as a value function and a gradient function must solve like the combined one,
+//and the line search must skip the gradient of rejected steps.
+bool test_separate_objective()
+{
+    size_t value_count = 0;
+    size_t gradient_count = 0;
+    auto value = [&value_count](const Eigen::VectorXd& x)
+    {
+        ++value_count;
+        return 100 * (x(1) - x(0) * x(0)) * (x(1) - x(0) * x(0)) + (1 - x(0)) * (1 - x(0));
+    };
+    auto gradient = [&gradient_count](const Eigen::VectorXd& x, Eigen::VectorXd& g)
+    {
+        ++gradient_count;
+        g(0) = -400 * (x(1) - x(0) * x(0)) * x(0) - 2 * (1 - x(0));
+        g(1) = 200 * (x(1) - x(0) * x(0));
+    };
+    auto combined = [&](const Eigen::VectorXd& x, Eigen::VectorXd& g)
+    {
+        gradient(x, g);
+        return value(x);
+    };
+    auto fun = Chimes::optimization::make_objective(value, gradient);
+    static_assert(!Chimes::optimization::concept_objective_value_gradient<decltype(fun), Eigen::VectorXd>);
+    static_assert(Chimes::optimization::concept_objective<decltype(fun), Eigen::VectorXd>);
+    Eigen::VectorXd init_x(2);
+    init_x(0) = -1.2;
+    init_x(1) = 1;
+    Chimes::LBFGS<decltype(fun), double> lbfgs(fun, init_x);
+    Chimes::LBFGS<decltype(combined), double> combined_lbfgs(combined, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    combined_lbfgs.parameter_.is_show_ = false;
+    combined_lbfgs.solve();
+    value_count = 0;
+    gradient_count = 0;
+    lbfgs.solve();
+    const auto& result = lbfgs.get_result();
+    const auto& combined_result = combined_lbfgs.get_result();
+    std::cout << "separate objective values: " << result.fval_eval_time << "  gradients: " << result.gradient_eval_time
+        << "  combined gradients: " << combined_result.gradient_eval_time << "  fval: " << result.fval << std::endl;
+    return result.fval < 1e-8 && (result.res_x - combined_result.res_x).norm() == 0
+        && result.fval_eval_time == value_count && result.gradient_eval_time == gradient_count
+        && result.fval_eval_time == combined_result.fval_eval_time && result.gradient_eval_time < combined_result.gradient_eval_time;
+}
+
+//The interpolating line search must solve Rosenbrock with LBFGS, and take far fewer evaluations per steepest
+//descent iteration than bisection.
+bool test_more_thuente()
+{
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = 0;
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const double t = x(j + 1) - x(j) * x(j);
+            const double u = 1.0 - x(j);
+            fval += 100.0 * t * t + u * u;
+            gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+            gradient(j + 1) += 200.0 * t;
+        }
+        return fval;
+    };
+    using Solver = Chimes::LBFGS<decltype(fun), double>;
+    using Steepest = Chimes::SteepestDescent<decltype(fun), double>;
+    Eigen::VectorXd init_x(10);
+    for (int i = 0; i < 10; ++i)
+        init_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+    Solver lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.step_search_method_ = Solver::StepSearchMethod::MORE_THUENTE;
+    lbfgs.solve();
+    Steepest bisection(fun, init_x);
+    Steepest more_thuente(fun, init_x);
+    bisection.parameter_.is_show_ = false;
+    more_thuente.parameter_.is_show_ = false;
+    bisection.parameter_.max_iteration_ = 200;
+    more_thuente.parameter_.max_iteration_ = 200;
+    more_thuente.parameter_.step_search_method_ = Steepest::StepSearchMethod::MORE_THUENTE;
+    bisection.solve();
+    more_thuente.solve();
+    const auto& result = lbfgs.get_result();
+    std::cout << "More-Thuente LBFGS fval: " << result.fval << "  steepest descent evaluations: " << more_thuente.get_result().fval_eval_time
+        << "  bisection: " << bisection.get_result().fval_eval_time << std::endl;
+    return result.fval < 1e-10 && more_thuente.get_result().iter_time == 200
+        && 2 * more_thuente.get_result().fval_eval_time < bisection.get_result().fval_eval_time;
+}
+
+//A step search out of trials must leave the solver at its start point with the value and gradient of that point.
+template <template <class, class, int> class Solver>
+bool test_step_search_exhausted()
+{
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 200.0 * x;
+        return 100.0 * x.squaredNorm();
+    };
+    using S = Solver<decltype(fun), double, Eigen::Dynamic>;
+    const Eigen::VectorXd init_x = Eigen::VectorXd::Constant(1, 0.1);
+    bool success = true;
+    for (auto method : { S::StepSearchMethod::WOLFE, S::StepSearchMethod::MORE_THUENTE })
+    {
+        S solver(fun, init_x);
+        solver.parameter_.is_show_ = false;
+        solver.parameter_.max_stepsearch_ = 1;
+        solver.parameter_.step_search_method_ = method;
+        solver.solve();
+        const auto& result = solver.get_result();
+        success &= result.res_x(0) == 0.1 && std::abs(result.fval - 1.0) < 1e-12 && std::abs(result.res_gradient(0) - 20.0) < 1e-12
+            && result.iter_time == 0 && result.stepsearch_time == 0;
+    }
+    return success;
+}
+
+//A bounded quadratic must be solved at the projection of its unconstrained minimum, and bounded Rosenbrock must end
+//feasible with the KKT conditions met, for both step searches. Without finite bounds it must solve like LBFGS.
+bool test_lbfgsb()
+{
+    const Eigen::Index n = 20;
+    Eigen::VectorXd lambda(n);
+    Eigen::VectorXd center(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        lambda(i) = std::pow(100.0, double(i) / double(n - 1));
+        center(i) = i % 3 == 0 ? 2.0 : (i % 3 == 1 ? -3.0 : 0.5);
+    }
+    auto quadratic = [&](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = (lambda.array() * (x - center).array()).matrix();
+        return 0.5 * (lambda.array() * (x - center).array().square()).sum();
+    };
+    const double inf = std::numeric_limits<double>::infinity();
+    Eigen::VectorXd lower = Eigen::VectorXd::Constant(n, -1.0);
+    Eigen::VectorXd upper = Eigen::VectorXd::Constant(n, 1.0);
+    lower(1) = -inf;
+    upper(3) = inf;
+    Eigen::VectorXd expected(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+        expected(i) = std::min(std::max(center(i), lower(i)), upper(i));
+    Chimes::LBFGSB<decltype(quadratic), double> bounded(quadratic, Eigen::VectorXd::Zero(n), lower, upper);
+    bounded.parameter_.is_show_ = false;
+    bounded.parameter_.epsilon_ = 1e-8;
+    bounded.solve();
+    const double quadratic_error = (bounded.get_result().res_x - expected).lpNorm<Eigen::Infinity>();
+
+    auto rosenbrock = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = 0;
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const double t = x(j + 1) - x(j) * x(j);
+            const double u = 1.0 - x(j);
+            fval += 100.0 * t * t + u * u;
+            gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+            gradient(j + 1) += 200.0 * t;
+        }
+        return fval;
+    };
+    using Solver = Chimes::LBFGSB<decltype(rosenbrock), double>;
+    const Eigen::Index m = 10;
+    Eigen::VectorXd init_x(m);
+    for (Eigen::Index i = 0; i < m; ++i)
+        init_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+    Eigen::VectorXd rosenbrock_lower = Eigen::VectorXd::Constant(m, -2.0);
+    Eigen::VectorXd rosenbrock_upper = Eigen::VectorXd::Constant(m, 0.8);
+    bool is_kkt = true;
+    for (auto method : { Solver::StepSearchMethod::WOLFE, Solver::StepSearchMethod::MORE_THUENTE })
+    {
+        Solver solver(rosenbrock, init_x, rosenbrock_lower, rosenbrock_upper);
+        solver.parameter_.is_show_ = false;
+        solver.parameter_.epsilon_ = 1e-8;
+        solver.parameter_.step_search_method_ = method;
+        solver.solve();
+        const auto& result = solver.get_result();
+        for (Eigen::Index i = 0; i < m; ++i)
+        {
+            const double x = result.res_x(i);
+            const double g = result.res_gradient(i);
+            is_kkt &= x >= rosenbrock_lower(i) && x <= rosenbrock_upper(i);
+            if (x == rosenbrock_lower(i))
+                is_kkt &= g >= -1e-6;
+            else if (x == rosenbrock_upper(i))
+                is_kkt &= g <= 1e-6;
+            else
+                is_kkt &= std::abs(g) < 1e-6;
+        }
+        std::cout << "bounded Rosenbrock iterations: " << result.iter_time << "  fval: " << result.fval << "  x_0: "
+            << result.res_x(0) << std::endl;
+        //The descent towards (1, ..., 1) is stopped by the upper bound of the first variable.
+        is_kkt &= result.res_x(0) == rosenbrock_upper(0);
+    }
+    Solver unbounded(rosenbrock, init_x, Eigen::VectorXd::Constant(m, -inf), Eigen::VectorXd::Constant(m, inf));
+    unbounded.parameter_.is_show_ = false;
+    unbounded.solve();
+    std::cout << "bounded quadratic error: " << quadratic_error << "  iterations: " << bounded.get_result().iter_time
+        << "  unbounded Rosenbrock fval: " << unbounded.get_result().fval << std::endl;
+    return quadratic_error < 1e-8 && is_kkt && unbounded.get_result().fval < 1e-10;
+}
+
+//Finite-sum least squares 1/N * sum_i 0.5 * (a_i^T x - b_i)^2 with b = A * x_star, so every sample is solved at x_star.
+class LeastSquaresSum
+{
+public:
+    using Batch = std::vector<size_t>;
+public:
+    LeastSquaresSum(size_t samples, size_t n) : a_(samples, n), b_(samples), x_star_(n), visits_(samples, 0)
+    {
+        std::mt19937_64 random(7);
+        std::normal_distribution<double> normal;
+        for (Eigen::Index j = 0; j < a_.cols(); ++j)
+            for (Eigen::Index i = 0; i < a_.rows(); ++i)
+                a_(i, j) = normal(random);
+        for (Eigen::Index j = 0; j < x_star_.size(); ++j)
+            x_star_(j) = normal(random);
+        b_.noalias() = a_ * x_star_;
+    }
+    size_t samples() const
+    {
+        return b_.size();
+    }
+    void load(const size_t* samples, size_t count, Batch& batch)
+    {
+        batch.assign(samples, samples + count);
+        for (size_t i = 0; i < count; ++i)
+            ++visits_[samples[i]];
+    }
+    double operator()(const Eigen::VectorXd& x, const Batch& batch, Eigen::VectorXd& gradient) const
+    {
+        double fval = 0;
+        gradient.setZero();
+        for (size_t i : batch)
+        {
+            const double r = a_.row(i).dot(x) - b_(i);
+            fval += 0.5 * r * r;
+            gradient += r * a_.row(i).transpose();
+        }
+        gradient /= double(batch.size());
+        return fval / double(batch.size());
+    }
+    const Eigen::VectorXd& x_star() const
+    {
+        return x_star_;
+    }
+    const std::vector<size_t>& visits() const
+    {
+        return visits_;
+    }
+private:
+    Eigen::MatrixXd a_;
+    Eigen::VectorXd b_;
+    Eigen::VectorXd x_star_;
+    std::vector<size_t> visits_;
+};
+
+//The stochastic solvers must reach the common minimizer of the samples, every epoch must visit each sample once, and
+//prefetching must not change the sequence of batches.
+bool test_stochastic()
+{
+    using SGD = Chimes::StochasticGradient<LeastSquaresSum, double>;
+    const size_t n = 10;
+    const Eigen::VectorXd init_x = Eigen::VectorXd::Zero(n);
+    LeastSquaresSum fun(1000, n);
+    SGD sgd(fun, init_x);
+    sgd.parameter_.is_show_ = false;
+    sgd.parameter_.batch_size_ = 32;
+    sgd.parameter_.learning_rate_ = 0.05;
+    sgd.parameter_.max_epoch_ = 3;
+    sgd.solve();
+    bool is_visited = true;
+    for (size_t v : fun.visits())
+        is_visited &= v == 3;
+    sgd.parameter_.max_epoch_ = 30;
+    sgd.solve();
+    SGD prefetch(fun, init_x);
+    prefetch.parameter_ = sgd.parameter_;
+    prefetch.parameter_.is_prefetch_ = true;
+    prefetch.solve();
+    SGD momentum(fun, init_x, SGD::UpdateMethod::MOMENTUM);
+    momentum.parameter_ = sgd.parameter_;
+    momentum.parameter_.learning_rate_ = 0.005;
+    momentum.solve();
+    SGD adam(fun, init_x, SGD::UpdateMethod::ADAM);
+    adam.parameter_ = sgd.parameter_;
+    adam.parameter_.learning_rate_ = 0.05;
+    adam.parameter_.decay_ = 0.01;
+    adam.solve();
+    Chimes::StochasticLBFGS<LeastSquaresSum, double> sqn(fun, init_x);
+    sqn.parameter_ = sgd.parameter_;
+    sqn.parameter_.learning_rate_ = 0.2;
+    sqn.solve();
+    const auto error = [&](const auto& solver) { return (solver.get_result().res_x - fun.x_star()).norm(); };
+    std::cout << "stochastic errors, sgd: " << error(sgd) << "  momentum: " << error(momentum) << "  adam: " << error(adam)
+        << "  lbfgs: " << error(sqn) << "  epochs: " << sgd.get_result().epoch_time << "  samples: " << sgd.get_result().sample_eval_time
+        << std::endl;
+    return is_visited && prefetch.get_result().res_x == sgd.get_result().res_x && sgd.get_result().epoch_time == 30
+        && sgd.get_result().sample_eval_time == 30000 && error(sgd) < 1e-8 && error(momentum) < 1e-8 && error(adam) < 1e-6
+        && error(sqn) < 1e-8;
+}
+
+//Newton-CG on a badly scaled graph Laplacian plus log cosh terms must need an order of magnitude fewer outer iterations
+//than LBFGS, with products or a sparse Hessian, and the Jacobi preconditioner must save inner iterations.
+bool test_newton_cg()
+{
+    const Eigen::Index n = 1000;
+    Eigen::VectorXd scale(n);
+    Eigen::VectorXd b(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        scale(i) = std::pow(10.0, -4.0 + 6.0 * double((i * 37) % n) / double(n - 1));
+        b(i) = std::sin(double(i));
+    }
+    //A = tridiag(-1, 2, -1) + diag(scale), f = 0.5 * x^T A x - b^T x + 0.01 * sum_i log cosh(x_i).
+    auto laplacian = [&](const Eigen::VectorXd& v, Eigen::VectorXd& av)
+    {
+        av = (2.0 + scale.array()) * v.array();
+        av.head(n - 1) -= v.tail(n - 1);
+        av.tail(n - 1) -= v.head(n - 1);
+    };
+    Eigen::VectorXd av(n);
+    auto fun = [&](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        laplacian(x, av);
+        gradient = av - b + 0.01 * x.array().tanh().matrix();
+        return 0.5 * x.dot(av) - b.dot(x) + 0.01 * x.array().cosh().log().sum();
+    };
+    auto product = [&](const Eigen::VectorXd& x, const Eigen::VectorXd& v, Eigen::VectorXd& hv)
+    {
+        laplacian(v, hv);
+        hv.array() += 0.01 * (1.0 - x.array().tanh().square()) * v.array();
+    };
+    auto sparse = [&](const Eigen::VectorXd& x, Eigen::SparseMatrix<double>& h)
+    {
+        std::vector<Eigen::Triplet<double>> triplets;
+        for (Eigen::Index i = 0; i < n; ++i)
+        {
+            const double t = std::tanh(x(i));
+            triplets.emplace_back(i, i, 2.0 + scale(i) + 0.01 * (1.0 - t * t));
+            if (i + 1 < n)
+            {
+                triplets.emplace_back(i, i + 1, -1.0);
+                triplets.emplace_back(i + 1, i, -1.0);
+            }
+        }
+        h.resize(n, n);
+        h.setFromTriplets(triplets.begin(), triplets.end());
+    };
+    const Eigen::VectorXd init_x = Eigen::VectorXd::Zero(n);
+    Chimes::NewtonCG<decltype(fun), decltype(product), double> newton(fun, product, init_x);
+    newton.parameter_.is_show_ = false;
+    newton.solve();
+    Chimes::NewtonCG<decltype(fun), decltype(sparse), double, Eigen::Dynamic, Chimes::JacobiPreconditioner<double>> jacobi(fun, sparse, init_x);
+    jacobi.parameter_.is_show_ = false;
+    jacobi.solve();
+    Chimes::LBFGS<decltype(fun), double> lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.max_iteration_ = 10000;
+    lbfgs.solve();
+    //With Hessian products nothing sets the Jacobi diagonal, which must not pass silently.
+    bool is_unset_thrown = false;
+    try
+    {
+        Chimes::NewtonCG<decltype(fun), decltype(product), double, Eigen::Dynamic, Chimes::JacobiPreconditioner<double>> unset(fun, product, init_x);
+        unset.parameter_.is_show_ = false;
+        unset.solve();
+    }
+    catch (const std::runtime_error&)
+    {
+        is_unset_thrown = true;
+    }
+    const auto& result = newton.get_result();
+    std::cout << "Newton-CG iterations: " << result.iter_time << "  products: " << result.hessian_product_time << "  Jacobi iterations: "
+        << jacobi.get_result().iter_time << "  products: " << jacobi.get_result().hessian_product_time << "  LBFGS iterations: "
+        << lbfgs.get_result().iter_time << std::endl;
+    return result.res_gradient.norm() < 1e-5 && jacobi.get_result().res_gradient.norm() < 1e-5
+        && (result.res_x - jacobi.get_result().res_x).norm() < 1e-4 && 10 * result.iter_time <= lbfgs.get_result().iter_time
+        && jacobi.get_result().hessian_product_time < result.hessian_product_time && is_unset_thrown;
+}
+
+//Every update of the nonlinear conjugate gradient must solve the extended Rosenbrock function, in far fewer iterations
+//than steepest descent. PR+ and Hager-Zhang must be within a small factor of LBFGS.
+bool test_nonlinear_cg()
+{
+    const Eigen::Index n = 1000;
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = 0;
+        for (Eigen::Index i = 0; i < x.size(); i += 2)
+        {
+            const double t = x(i + 1) - x(i) * x(i);
+            const double u = 1.0 - x(i);
+            fval += 100.0 * t * t + u * u;
+            gradient(i) = -400.0 * t * x(i) - 2.0 * u;
+            gradient(i + 1) = 200.0 * t;
+        }
+        return fval;
+    };
+    using CG = Chimes::NonlinearCG<decltype(fun), double>;
+    Eigen::VectorXd init_x(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+        init_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+    Chimes::LBFGS<decltype(fun), double> lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.solve();
+    Chimes::SteepestDescent<decltype(fun), double> steepest(fun, init_x);
+    steepest.parameter_.is_show_ = false;
+    steepest.parameter_.max_iteration_ = 5000;
+    steepest.solve();
+    const std::pair<CG::Update, const char*> updates[] = { { CG::Update::FLETCHER_REEVES, "FR" },
+        { CG::Update::POLAK_RIBIERE_PLUS, "PR+" }, { CG::Update::HAGER_ZHANG, "HZ" }, { CG::Update::DAI_YUAN, "DY" } };
+    bool success = true;
+    std::cout << "nonlinear CG iterations:";
+    for (const auto& update : updates)
+    {
+        CG cg(fun, init_x, update.first);
+        cg.parameter_.is_show_ = false;
+        cg.parameter_.max_iteration_ = 5000;
+        cg.solve();
+        const auto& result = cg.get_result();
+        std::cout << "  " << update.second << " " << result.iter_time << " (" << cg.restarts() << " restarts)";
+        success &= result.res_gradient.norm() < 1e-5 && (result.res_x.array() - 1.0).abs().maxCoeff() < 1e-4
+            && 5 * result.iter_time < steepest.get_result().iter_time;
+        if (update.first == CG::Update::POLAK_RIBIERE_PLUS || update.first == CG::Update::HAGER_ZHANG)
+            success &= result.iter_time < 3 * lbfgs.get_result().iter_time;
+    }
+    std::cout << "  LBFGS " << lbfgs.get_result().iter_time << "  steepest " << steepest.get_result().iter_time << std::endl;
+    return success;
+}
+
+//A step search that can't find a step must stop NonlinearCG at a point whose value and gradient are those of the result.
+bool test_nonlinear_cg_step_failure()
+{
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * x;
+        return x.squaredNorm();
+    };
+    using CG = Chimes::NonlinearCG<decltype(fun), double>;
+    CG cg(fun, Eigen::VectorXd::Constant(1, 1.0));
+    cg.parameter_.is_show_ = false;
+    cg.parameter_.min_step_ = 10;
+    cg.parameter_.max_step_ = 10;
+    cg.parameter_.max_iteration_ = 3;
+    cg.solve();
+    const auto& result = cg.get_result();
+    std::cout << "NonlinearCG failed step search x: " << result.res_x(0) << "  fval: " << result.fval << "  gradient: "
+        << result.res_gradient(0) << "  step searches: " << result.stepsearch_time << std::endl;
+    return result.fval == result.res_x.squaredNorm() && result.res_gradient == 2.0 * result.res_x && result.iter_time < 3
+        && result.stepsearch_time <= 3 * cg.parameter_.max_stepsearch_;
+}
+
+//Residuals a * exp(b * t_i) + c - y_i of a fit of 3 parameters to 40 exact samples of a = 2, b = -1.3, c = 0.5.
+class ExponentialFit
+{
+public:
+    ExponentialFit() : t(Eigen::VectorXd::LinSpaced(40, 0.0, 4.0))
+    {
+        y = 2.0 * (-1.3 * t).array().exp() + 0.5;
+    }
+    size_t residuals() const
+    {
+        return t.size();
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual) const
+    {
+        residual = x(0) * (x(1) * t).array().exp() + x(2) - y.array();
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual, Eigen::MatrixXd& jacobian) const
+    {
+        const Eigen::ArrayXd e = (x(1) * t).array().exp();
+        residual = x(0) * e + x(2) - y.array();
+        jacobian.col(0) = e.matrix();
+        jacobian.col(1) = (x(0) * t.array() * e).matrix();
+        jacobian.col(2).setOnes();
+    }
+public:
+    Eigen::VectorXd t;
+    Eigen::VectorXd y;
+};
+
+//Residuals 10 (x_j+1 - x_j^2) and 1 - x_j of the chained Rosenbrock function, with a sparse or a dense Jacobian.
+class RosenbrockResiduals
+{
+public:
+    explicit RosenbrockResiduals(Eigen::Index n) : n(n)
+    {
+
+    }
+    size_t residuals() const
+    {
+        return 2 * (n - 1);
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual) const
+    {
+        for (Eigen::Index j = 0; j + 1 < n; ++j)
+        {
+            residual(2 * j) = 10.0 * (x(j + 1) - x(j) * x(j));
+            residual(2 * j + 1) = 1.0 - x(j);
+        }
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual, Eigen::SparseMatrix<double>& jacobian)
+    {
+        (*this)(x, residual);
+        triplets.clear();
+        for (Eigen::Index j = 0; j + 1 < n; ++j)
+        {
+            triplets.emplace_back(2 * j, j, -20.0 * x(j));
+            triplets.emplace_back(2 * j, j + 1, 10.0);
+            triplets.emplace_back(2 * j + 1, j, -1.0);
+        }
+        jacobian.setFromTriplets(triplets.begin(), triplets.end());
+    }
+    void operator()(const Eigen::VectorXd& x, Eigen::VectorXd& residual, Eigen::MatrixXd& jacobian)
+    {
+        Eigen::SparseMatrix<double> sparse(jacobian.rows(), jacobian.cols());
+        (*this)(x, residual, sparse);
+        jacobian = sparse;
+    }
+public:
+    Eigen::Index n;
+    std::vector<Eigen::Triplet<double>> triplets;
+};
+
+//Levenberg-Marquardt must fit the exponential in far fewer iterations than LBFGS on the sum of squares, give the same
+//iterates with a dense and a sparse Jacobian, analyze the sparse normal matrix once per solve, and converge with CGLS.
+bool test_least_squares()
+{
+    ExponentialFit fit;
+    Eigen::VectorXd init_x(3);
+    init_x << 1.0, -0.5, 0.0;
+    Chimes::LevenbergMarquardt<ExponentialFit> lm(fit, init_x);
+    lm.parameter_.is_show_ = false;
+    lm.solve();
+    const auto& result = lm.get_result();
+    Eigen::VectorXd exact(3);
+    exact << 2.0, -1.3, 0.5;
+    auto sum_of_squares = [&](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        Eigen::VectorXd residual(fit.residuals());
+        Eigen::MatrixXd jacobian(fit.residuals(), 3);
+        fit(x, residual, jacobian);
+        gradient = jacobian.transpose() * residual;
+        return 0.5 * residual.squaredNorm();
+    };
+    Chimes::LBFGS<decltype(sum_of_squares), double> lbfgs(sum_of_squares, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.epsilon_ = 1e-10;
+    lbfgs.parameter_.max_iteration_ = 10000;
+    lbfgs.solve();
+    bool success = (result.res_x - exact).norm() < 1e-8 && 3 * result.iter_time < lbfgs.get_result().iter_time
+        && result.fval_eval_time > result.gradient_eval_time;
+    const Eigen::Index n = 2000;
+    RosenbrockResiduals rosenbrock(n);
+    const Eigen::VectorXd rosenbrock_x = Eigen::VectorXd::Constant(n, -1.2);
+    //From -1.2 each iteration only fixes one more link of the chain, so the large problems start from 0.5.
+    Chimes::LevenbergMarquardt<RosenbrockResiduals, double, Eigen::SparseMatrix<double>> sparse(rosenbrock, Eigen::VectorXd::Constant(n, 0.5));
+    Chimes::LevenbergMarquardt<RosenbrockResiduals, double, Eigen::SparseMatrix<double>> cgls(rosenbrock, Eigen::VectorXd::Constant(n, 0.5));
+    sparse.parameter_.is_show_ = false;
+    cgls.parameter_.is_show_ = false;
+    cgls.parameter_.linear_solver_ = decltype(cgls)::LinearSolver::CGLS;
+    sparse.solve();
+    cgls.solve();
+    RosenbrockResiduals small_rosenbrock(50);
+    Chimes::LevenbergMarquardt<RosenbrockResiduals, double, Eigen::SparseMatrix<double>> small_sparse(small_rosenbrock, rosenbrock_x.head(50));
+    Chimes::LevenbergMarquardt<RosenbrockResiduals> small_dense(small_rosenbrock, rosenbrock_x.head(50));
+    small_sparse.parameter_.is_show_ = false;
+    small_dense.parameter_.is_show_ = false;
+    small_sparse.solve();
+    small_dense.solve();
+    const auto& sparse_result = sparse.get_result();
+    const auto& cgls_result = cgls.get_result();
+    const double layout_difference = (small_sparse.get_result().res_x - small_dense.get_result().res_x).norm();
+    success &= sparse_result.fval < 1e-20 && sparse_result.analysis_time == 1 && sparse_result.factorization_time >= sparse_result.iter_time
+        && cgls_result.fval < 1e-20 && cgls_result.factorization_time == 0 && layout_difference < 1e-10
+        && small_sparse.get_result().iter_time == small_dense.get_result().iter_time;
+    std::cout << "LM fit error: " << (result.res_x - exact).norm() << "  iterations: " << result.iter_time << "  LBFGS iterations: "
+        << lbfgs.get_result().iter_time << "  sparse Rosenbrock iterations: " << sparse_result.iter_time << "  factorizations: "
+        << sparse_result.factorization_time << "  analyses: " << sparse_result.analysis_time << "  CGLS iterations: " << cgls_result.iter_time
+        << " (" << cgls_result.cg_iteration_time << " inner)  dense and sparse differ by " << layout_difference << std::endl;
+    return success;
+}
+
+//Tilted double well in each variable, (x_i^2 - 1)^2 + 0.1 * (i + 1) * x_i, with 2^n minima near x_i = +-1.
+//The evaluation counter is state of the object, so concurrent solves need their own copies.
+class DoubleWell
+{
+public:
+    DoubleWell() : evaluations_(0)
+    {
+
+    }
+    double operator()(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        ++evaluations_;
+        double fval = 0;
+        for (Eigen::Index i = 0; i < x.size(); ++i)
+        {
+            const double t = x(i) * x(i) - 1;
+            fval += t * t + 0.1 * double(i + 1) * x(i);
+            gradient(i) = 4 * t * x(i) + 0.1 * double(i + 1);
+        }
+        return fval;
+    }
+private:
+    size_t evaluations_;
+};
+
+//The multi-start driver must find the 4 minima of a 2D double well from many starts, the same ones with and without a
+//pool, with the best one first, and cancel hopeless solves when asked to.
+bool test_multi_start()
+{
+    using Driver = Chimes::MultiStart<DoubleWell, double>;
+    const Eigen::VectorXd lower = Eigen::VectorXd::Constant(2, -2.0);
+    const Eigen::VectorXd upper = Eigen::VectorXd::Constant(2, 2.0);
+    DoubleWell fun;
+    Driver serial(fun, lower, upper);
+    serial.parameter_.num_starts_ = 64;
+    serial.parameter_.cancel_iteration_ = 0;
+    serial.solve();
+    Chimes::ThreadPool pool(4);
+    Driver parallel(fun, lower, upper);
+    parallel.parameter_ = serial.parameter_;
+    parallel.parameter_.thread_pool_ = &pool;
+    //The same pool in the solves nests parallelFor, which must run inline instead of waiting for the driver's loop.
+    parallel.parameter_.solver_parameter_.thread_pool_ = &pool;
+    parallel.parameter_.solver_parameter_.parallel_min_size_ = 1;
+    parallel.solve();
+    //An objective using the pool of the driver nests parallelFor the same way.
+    std::atomic<size_t> nested(0);
+    pool.parallelFor(8, [&](size_t) { pool.parallelFor(8, [&](size_t j) { nested += j; }); });
+    Driver cancelling(fun, lower, upper);
+    cancelling.parameter_ = parallel.parameter_;
+    cancelling.parameter_.cancel_iteration_ = 3;
+    cancelling.parameter_.cancel_margin_ = 0.05;
+    cancelling.solve();
+    const auto& result = parallel.get_result();
+    bool is_same = result.minima.size() == serial.get_result().minima.size();
+    size_t hits = 0;
+    for (size_t i = 0; is_same && i < result.minima.size(); ++i)
+    {
+        is_same &= (result.minima[i].x - serial.get_result().minima[i].x).norm() < 1e-10;
+        hits += result.minima[i].hit_time;
+    }
+    std::cout << "multi-start minima: " << result.minima.size() << "  best: " << result.minima.front().fval << " at "
+        << result.minima.front().x.transpose() << "  cancelled: " << cancelling.get_result().cancel_time << " of "
+        << cancelling.get_result().solve_time << std::endl;
+    return result.minima.size() == 4 && is_same && hits == 64 && nested == 8 * 28 && result.minima.front().x(0) < 0 && result.minima.front().x(1) < 0
+        && cancelling.get_result().cancel_time > 0 && cancelling.get_result().minima.front().x(0) < 0;
+}
+
+//A float history must take half the memory of a double one and still solve Rosenbrock to the same tolerance, with the
+//first iterates close to the double ones.
+bool test_mixed_precision_history()
+{
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = 0;
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const double t = x(j + 1) - x(j) * x(j);
+            const double u = 1.0 - x(j);
+            fval += 100.0 * t * t + u * u;
+            gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+            gradient(j + 1) += 200.0 * t;
+        }
+        return fval;
+    };
+    using DoubleHistory = Chimes::LBFGSVectorHistory<double>;
+    using FloatHistory = Chimes::LBFGSVectorHistory<double, Eigen::Dynamic, Eigen::Dynamic, float>;
+    Eigen::VectorXd init_x(100);
+    for (Eigen::Index i = 0; i < init_x.size(); ++i)
+        init_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+    Chimes::LBFGSWorkspace<double, Eigen::Dynamic, Eigen::Dynamic, DoubleHistory> double_workspace;
+    Chimes::LBFGSWorkspace<double, Eigen::Dynamic, Eigen::Dynamic, FloatHistory> float_workspace;
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, DoubleHistory> double_lbfgs(fun, init_x, double_workspace);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, FloatHistory> float_lbfgs(fun, init_x, float_workspace);
+    double_lbfgs.parameter_.is_show_ = false;
+    float_lbfgs.parameter_.is_show_ = false;
+    double_lbfgs.parameter_.max_iteration_ = 5;
+    float_lbfgs.parameter_.max_iteration_ = 5;
+    double_lbfgs.solve();
+    float_lbfgs.solve();
+    const double difference = (double_lbfgs.get_result().res_x - float_lbfgs.get_result().res_x).norm();
+    double_lbfgs.parameter_.max_iteration_ = 1000;
+    float_lbfgs.parameter_.max_iteration_ = 1000;
+    double_lbfgs.solve();
+    float_lbfgs.solve();
+    std::cout << "float history iterations: " << float_lbfgs.get_result().iter_time << "  double: " << double_lbfgs.get_result().iter_time
+        << "  fval: " << float_lbfgs.get_result().fval << "  early difference: " << difference << std::endl;
+    return 2 * float_workspace.history.bytes() == double_workspace.history.bytes() && float_lbfgs.get_result().fval < 1e-10
+        && float_lbfgs.get_result().res_gradient.norm() < 1e-5 && difference < 1e-4;
+}
+
+//A solve resumed from a serialized state must follow the uninterrupted solve, and a warm start on a slightly changed
+//objective must need fewer iterations than a cold start from the same point.
+template <class History>
+bool test_lbfgs_warm_start()
+{
+    const int n = 500;
+    Eigen::VectorXd scale(n);
+    Eigen::VectorXd target = Eigen::VectorXd::Ones(n);
+    for (int i = 0; i < n; ++i)
+        scale(i) = 1.0 + i;
+    auto fun = [&](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * scale.cwiseProduct(x - target);
+        return scale.dot((x - target).array().square().matrix());
+    };
+    using Solver = Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, History>;
+    const Eigen::VectorXd init_x = Eigen::VectorXd::LinSpaced(n, -2.0, 2.0);
+    Solver full(fun, init_x);
+    full.parameter_.is_show_ = false;
+    full.parameter_.max_iteration_ = 40;
+    full.solve();
+
+    Solver first(fun, init_x);
+    first.parameter_.is_show_ = false;
+    first.parameter_.max_iteration_ = 20;
+    first.solve();
+    typename Solver::State state;
+    first.get_state(state);
+    std::stringstream stream;
+    state.save(stream);
+    typename Solver::State loaded;
+    loaded.load(stream);
+    Solver resumed(fun, init_x);
+    resumed.parameter_.is_show_ = false;
+    resumed.parameter_.max_iteration_ = 20;
+    resumed.set_init_state(loaded, false);
+    resumed.solve();
+    const double difference = (resumed.get_result().res_x - full.get_result().res_x).norm();
+    //A state whose number of pairs exceeds the stream must be rejected before the pairs are allocated.
+    std::string bytes = stream.str();
+    const uint64_t corrupt_pairs = uint64_t(1) << 40;
+    std::memcpy(bytes.data() + 3 * sizeof(uint32_t) + sizeof(uint64_t), &corrupt_pairs, sizeof(corrupt_pairs));
+    std::stringstream corrupt(bytes);
+    bool is_corrupt_thrown = false;
+    try
+    {
+        loaded.load(corrupt);
+    }
+    catch (const std::runtime_error&)
+    {
+        is_corrupt_thrown = true;
+    }
+
+    //Few variables, so that the pairs carry most of the curvature.
+    const int small_n = 5;
+    scale = Eigen::VectorXd::LinSpaced(small_n, 1.0, 50.0);
+    target = Eigen::VectorXd::Ones(small_n);
+    Solver solved(fun, Eigen::VectorXd::Zero(small_n));
+    solved.parameter_.is_show_ = false;
+    solved.solve();
+    solved.get_state(state);
+    target.array() += 0.01 * Eigen::ArrayXd::LinSpaced(small_n, -1.0, 1.0);
+    Solver cold(fun, state.x);
+    Solver warm(fun, state.x);
+    cold.parameter_.is_show_ = false;
+    warm.parameter_.is_show_ = false;
+    warm.set_init_state(state);
+    cold.solve();
+    warm.solve();
+    std::cout << "resumed solve differs by " << difference << "  pairs: " << loaded.pairs() << "  cold iterations: "
+        << cold.get_result().iter_time << "  warm: " << warm.get_result().iter_time << std::endl;
+    return difference < 1e-8 && resumed.get_result().fval_eval_time + 20 < full.get_result().fval_eval_time
+        && warm.get_result().fval < 1e-8 && warm.get_result().iter_time < cold.get_result().iter_time && is_corrupt_thrown;
+}
+
+//Keeps the records of a solve.
+class RecordingObserver : public Chimes::SolveObserver<double>
+{
+public:
+    void iteration(const Chimes::IterationRecord<double>& record) override
+    {
+        records.push_back(record);
+    }
+public:
+    std::vector<Chimes::IterationRecord<double>> records;
+};
+
+//The observer must see every iteration, and the profiled phases must fit in the wall time of the solve.
+bool test_solve_observer()
+{
+    const int n = 1000;
+    auto fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * (x.array() - 1.0).matrix();
+        gradient.array() *= Eigen::ArrayXd::LinSpaced(x.size(), 1.0, 100.0);
+        return 0.5 * gradient.dot((x.array() - 1.0).matrix());
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::Zero(n);
+    RecordingObserver observer;
+    Chimes::LBFGS<decltype(fun), double> lbfgs(fun, init_x);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.observer_ = &observer;
+    lbfgs.parameter_.is_profile_ = true;
+    lbfgs.solve();
+    const auto& result = lbfgs.get_result();
+    bool success = observer.records.size() == result.iter_time && !observer.records.empty();
+    for (size_t i = 0; success && i < observer.records.size(); ++i)
+    {
+        const auto& record = observer.records[i];
+        success = record.iteration == i + 1 && record.step > 0 && record.seconds <= result.solve_seconds
+            && (i == 0 || record.fval <= observer.records[i - 1].fval);
+    }
+    const auto& last = observer.records.back();
+    const double phases = result.objective_seconds + result.stepsearch_seconds + result.direction_seconds;
+    std::cout << "observed iterations: " << observer.records.size() << "  solve: " << result.solve_seconds << " s  objective: "
+        << result.objective_seconds << " s  stepsearch: " << result.stepsearch_seconds << " s  direction: " << result.direction_seconds << " s" << std::endl;
+    return success && last.fval == result.fval && last.fval_eval_time == result.fval_eval_time
+        && result.objective_seconds > 0 && result.direction_seconds > 0 && result.stepsearch_seconds >= 0 && phases <= result.solve_seconds;
+}
+
+//A step search cancelled between two trials must go back to its start point, and the async solves must finish,
+//stop on cancel() and on a deadline with a consistent result, and pass the exceptions of the objective to get().
+bool test_async_solve()
+{
+    std::atomic<bool> cancel(false);
+    size_t evaluations = 0;
+    auto quadratic = [&](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        //The first trial step overshoots, cancel before the second one.
+        if (++evaluations == 2)
+            cancel.store(true);
+        gradient = 2.0 * x;
+        return x.squaredNorm();
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::Constant(2, 0.1);
+    Chimes::LBFGS<decltype(quadratic), double> interrupted(quadratic, init_x);
+    interrupted.parameter_.is_show_ = false;
+    interrupted.parameter_.cancel_ = &cancel;
+    interrupted.solve();
+    const auto& restored = interrupted.get_result();
+    bool success = restored.iter_time == 0 && restored.res_x == init_x && restored.fval == init_x.squaredNorm()
+        && restored.res_gradient == 2.0 * init_x;
+    //A slow chained Rosenbrock, far from converged when the solves are stopped.
+    auto slow = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        double fval = 0;
+        gradient.setZero();
+        for (Eigen::Index i = 0; i + 1 < x.size(); ++i)
+        {
+            const double t = x(i + 1) - x(i) * x(i);
+            const double u = 1.0 - x(i);
+            fval += 100.0 * t * t + u * u;
+            gradient(i) += -400.0 * x(i) * t - 2.0 * u;
+            gradient(i + 1) += 200.0 * t;
+        }
+        return fval;
+    };
+    auto throwing = [](const Eigen::VectorXd&, Eigen::VectorXd&) -> double
+    {
+        throw std::runtime_error("objective failed");
+    };
+    using Slow = Chimes::LBFGS<decltype(slow), double>;
+    const Eigen::VectorXd slow_x = Eigen::VectorXd::Constant(1000, -1.2);
+    Chimes::QueueExecutor executor(2);
+    Slow cancelled(slow, slow_x);
+    Slow deadlined(slow, slow_x);
+    Chimes::LBFGS<decltype(quadratic), double> finished(quadratic, init_x);
+    Chimes::LBFGS<decltype(throwing), double> failed(throwing, init_x);
+    for (auto* parameter : { &cancelled.parameter_, &deadlined.parameter_ })
+    {
+        parameter->is_show_ = false;
+        parameter->epsilon_ = 0;
+        parameter->max_iteration_ = 0;
+    }
+    finished.parameter_.is_show_ = false;
+    failed.parameter_.is_show_ = false;
+    deadlined.parameter_.deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    auto cancelled_handle = Chimes::solve_async(cancelled, executor);
+    auto deadlined_handle = Chimes::solve_async(deadlined, executor);
+    //Queued behind the slow solves on the two threads.
+    auto finished_handle = Chimes::solve_async(finished, executor);
+    auto failed_handle = Chimes::solve_async(failed, executor);
+    const Chimes::SolveHandle<Slow> empty_handle;
+    success &= !empty_handle.valid() && cancelled_handle.valid();
+    Eigen::VectorXd snapshot_x;
+    double snapshot_fval = 0;
+    size_t snapshot_iteration = 0;
+    while (!cancelled_handle.snapshot(snapshot_x, snapshot_fval, &snapshot_iteration) || snapshot_iteration < 3)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    success &= !cancelled_handle.isDone();
+    cancelled_handle.cancel();
+    success &= cancelled_handle.waitFor(std::chrono::seconds(10));
+    Eigen::VectorXd gradient(slow_x.size());
+    const auto& cancelled_result = cancelled_handle.get();
+    const auto& deadlined_result = deadlined_handle.get();
+    success &= cancelled_result.iter_time >= snapshot_iteration && cancelled_result.fval <= snapshot_fval
+        && cancelled_result.fval == slow(cancelled_result.res_x, gradient) && cancelled_result.res_gradient == gradient;
+    success &= deadlined_result.solve_seconds < 5 && deadlined_result.iter_time > 0
+        && deadlined_result.fval == slow(deadlined_result.res_x, gradient) && deadlined_result.res_gradient == gradient;
+    success &= finished_handle.get().fval < 1e-10 && cancelled.parameter_.cancel_ == nullptr && cancelled.parameter_.snapshot_ == nullptr;
+    bool is_rethrown = false;
+    try
+    {
+        failed_handle.get();
+    }
+    catch (const std::runtime_error&)
+    {
+        is_rethrown = true;
+    }
+    success &= is_rethrown;
+    std::cout << "cancelled after " << cancelled_result.iter_time << " iterations (snapshot at " << snapshot_iteration
+        << "), deadline after " << deadlined_result.iter_time << " iterations in " << deadlined_result.solve_seconds << " s" << std::endl;
+    return success;
+}
+
+//A solve with a warmed-up workspace must not allocate at all.
+template <class History>
+bool test_lbfgs_workspace()
+{
+    const int n = 100;
+    Eigen::VectorXd scale(n);
+    for (int i = 0; i < n; ++i)
+        scale(i) = 1.0 + i;
+    auto fun = [&scale](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * scale.cwiseProduct(x - Eigen::VectorXd::Ones(x.size()));
+        return scale.dot((x.array() - 1.0).square().matrix());
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::Constant(n, 5.0);
+    Chimes::LBFGSWorkspace<double, Eigen::Dynamic, Eigen::Dynamic, History> workspace;
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, History> lbfgs(fun, init_x, workspace);
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.solve();
+
+    const size_t before = g_allocation_count;
+    Eigen::internal::set_is_malloc_allowed(false);
+    lbfgs.solve();
+    Eigen::internal::set_is_malloc_allowed(true);
+    const size_t allocations = g_allocation_count - before;
+    const auto& result = lbfgs.get_result();
+    std::cout << "iterations: " << result.iter_time << "  allocations: " << allocations << "  fval: " << result.fval << std::endl;
+    return allocations == 0 && result.iter_time > 5 && result.fval < 1e-8;
+}
+
+//The compact representation on [S Y] must follow the same iterates as the two-loop recursion.
+bool test_lbfgs_history()
+{
+    const int n = 3000;
+    Eigen::VectorXd scale(n);
+    for (int i = 0; i < n; ++i)
+        scale(i) = 1.0 + 0.1 * (i % 97);
+    auto fun = [&scale](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * scale.cwiseProduct(x - Eigen::VectorXd::Ones(x.size()));
+        return scale.dot((x.array() - 1.0).square().matrix());
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::LinSpaced(n, -3.0, 3.0);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, Chimes::LBFGSVectorHistory<double>> vector_lbfgs(fun, init_x);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, Chimes::LBFGSMatrixHistory<double>> matrix_lbfgs(fun, init_x);
+    vector_lbfgs.parameter_.is_show_ = false;
+    matrix_lbfgs.parameter_.is_show_ = false;
+    vector_lbfgs.parameter_.max_iteration_ = 8;
+    matrix_lbfgs.parameter_.max_iteration_ = 8;
+    vector_lbfgs.solve();
+    matrix_lbfgs.solve();
+    const double difference = (vector_lbfgs.get_result().res_x - matrix_lbfgs.get_result().res_x).norm();
+    std::cout << "history layouts differ by " << difference << std::endl;
+    return difference < 1e-8;
+}
+
+//The pairs in a mapped file, cut into chunks that the parallel blocks straddle, must follow the same iterates as [S Y]
+//in memory.
+bool test_mapped_history()
+{
+    const int n = 3000;
+    Eigen::VectorXd scale(n);
+    for (int i = 0; i < n; ++i)
+        scale(i) = 1.0 + 0.1 * (i % 97);
+    auto fun = [&scale](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * scale.cwiseProduct(x - Eigen::VectorXd::Ones(x.size()));
+        return scale.dot((x.array() - 1.0).square().matrix());
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::LinSpaced(n, -3.0, 3.0);
+    Chimes::ThreadPool pool(3);
+    Chimes::LBFGSWorkspace<double, Eigen::Dynamic, Eigen::Dynamic, Chimes::LBFGSMappedHistory<double>> workspace;
+    workspace.history.set_chunk(256, 2);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, Chimes::LBFGSMatrixHistory<double>> matrix_lbfgs(fun, init_x);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, Chimes::LBFGSMappedHistory<double>> mapped_lbfgs(fun, init_x, workspace);
+    matrix_lbfgs.parameter_.is_show_ = false;
+    mapped_lbfgs.parameter_.is_show_ = false;
+    mapped_lbfgs.parameter_.thread_pool_ = &pool;
+    mapped_lbfgs.parameter_.parallel_min_size_ = 1000;
+    matrix_lbfgs.parameter_.max_iteration_ = 8;
+    mapped_lbfgs.parameter_.max_iteration_ = 8;
+    matrix_lbfgs.solve();
+    mapped_lbfgs.solve();
+    const double difference = (matrix_lbfgs.get_result().res_x - mapped_lbfgs.get_result().res_x).norm();
+    mapped_lbfgs.parameter_.max_iteration_ = 0;
+    mapped_lbfgs.solve();
+    //12 chunks of 256 rows, each with the 6 pairs.
+    const size_t expected_bytes = 12 * 2 * 6 * 256 * sizeof(double);
+    std::cout << "mapped history differs by " << difference << "  file: " << workspace.history.bytes() << " bytes  iterations: "
+        << mapped_lbfgs.get_result().iter_time << "  fval: " << mapped_lbfgs.get_result().fval << std::endl;
+    return difference < 1e-8 && workspace.history.bytes() == expected_bytes && mapped_lbfgs.get_result().fval < 1e-8;
+}
+
+//Parallel kernels must give the same bits on every run with the same pool, stay close to the serial solve
+//and keep the iterations allocation-free.
+template <class History>
+bool test_parallel_lbfgs()
+{
+    const int n = 20000;
+    Eigen::VectorXd scale(n);
+    for (int i = 0; i < n; ++i)
+        scale(i) = 1.0 + 0.01 * (i % 1000);
+    auto fun = [&scale](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        gradient = 2.0 * scale.cwiseProduct(x - Eigen::VectorXd::Ones(x.size()));
+        return scale.dot((x.array() - 1.0).square().matrix());
+    };
+    Eigen::VectorXd init_x = Eigen::VectorXd::LinSpaced(n, -3.0, 3.0);
+    Chimes::ThreadPool pool(4);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, History> serial(fun, init_x);
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, History> parallel(fun, init_x);
+    serial.parameter_.is_show_ = false;
+    parallel.parameter_.is_show_ = false;
+    parallel.parameter_.thread_pool_ = &pool;
+    parallel.parameter_.parallel_min_size_ = 1000;
+    serial.solve();
+    parallel.solve();
+    const Eigen::VectorXd first_x = parallel.get_result().res_x;
+
+    const size_t before = g_allocation_count;
+    Eigen::internal::set_is_malloc_allowed(false);
+    parallel.solve();
+    Eigen::internal::set_is_malloc_allowed(true);
+    const size_t allocations = g_allocation_count - before;
+    const bool reproducible = (first_x.array() == parallel.get_result().res_x.array()).all();
+    const double difference = (serial.get_result().res_x - first_x).norm();
+    std::cout << "parallel iterations: " << parallel.get_result().iter_time << "  allocations: " << allocations
+        << "  reproducible: " << reproducible << "  difference to serial: " << difference << std::endl;
+    return allocations == 0 && reproducible && difference < 1e-6;
+}
+
+//Every problem of a batch must reach its own minimum, problems stop independently.
+bool test_batch_lbfgs()
+{
+    const int batch = 64;
+    const int n = 6;
+    auto fun = [](Eigen::Ref<const Eigen::ArrayXXd> x, Eigen::Ref<Eigen::ArrayXXd> gradient, Eigen::Ref<Eigen::ArrayXd> fval)
+    {
+        //Extended Rosenbrock, one problem per row.
+        fval.setZero();
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.cols(); ++j)
+        {
+            const Eigen::ArrayXd t = x.col(j + 1) - x.col(j).square();
+            const Eigen::ArrayXd u = 1.0 - x.col(j);
+            fval += 100.0 * t.square() + u.square();
+            gradient.col(j) += -400.0 * t * x.col(j) - 2.0 * u;
+            gradient.col(j + 1) += 200.0 * t;
+        }
+    };
+    Eigen::ArrayXXd init_x(batch, n);
+    for (int i = 0; i < batch; ++i)
+        for (int j = 0; j < n; ++j)
+            init_x(i, j) = (i == 0) ? 1.0 : -1.2 + 0.05 * ((i * 7 + j * 3) % 13);
+    Chimes::BatchLBFGS<decltype(fun), double> solver(fun, init_x);
+    solver.parameter_.max_iteration_ = 500;
+    solver.solve();
+    const auto& result = solver.get_result();
+    size_t min_iter = result.iter_time[1];
+    size_t max_iter = 0;
+    bool converged = true;
+    for (int i = 0; i < batch; ++i)
+    {
+        converged &= result.status[i] == Chimes::BatchLBFGS<decltype(fun), double>::Status::GRADIENT_TOLERANCE;
+        converged &= (result.res_x.row(i) - 1.0).abs().maxCoeff() < 1e-4;
+        if (i > 0)
+        {
+            min_iter = std::min(min_iter, result.iter_time[i]);
+            max_iter = std::max(max_iter, result.iter_time[i]);
+        }
+    }
+    std::cout << "batch iterations: " << min_iter << " to " << max_iter << "  evaluations: " << result.evaluation_time << std::endl;
+    return converged && result.iter_time[0] == 0 && min_iter < max_iter;
+}
+
+//A fixed-size solve must not allocate even on the first call, and must follow the dynamic solve.
+template <template <class, int, int> class History>
+bool test_fixed_size_lbfgs()
+{
+    auto fun = [](const auto& x, auto& gradient)
+    {
+        double fval = 0;
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const double t = x(j + 1) - x(j) * x(j);
+            const double u = 1.0 - x(j);
+            fval += 100.0 * t * t + u * u;
+            gradient(j) += -400.0 * t * x(j) - 2.0 * u;
+            gradient(j + 1) += 200.0 * t;
+        }
+        return fval;
+    };
+    Eigen::Matrix<double, 4, 1> init_x(-1.2, 1.0, -1.2, 1.0);
+    Chimes::LBFGS<decltype(fun), double, 4, 5, History<double, 4, 5>> fixed(fun, init_x);
+    fixed.parameter_.is_show_ = false;
+    const size_t before = g_allocation_count;
+    Eigen::internal::set_is_malloc_allowed(false);
+    fixed.solve();
+    Eigen::internal::set_is_malloc_allowed(true);
+    const size_t allocations = g_allocation_count - before;
+
+    Eigen::VectorXd dynamic_init_x = init_x;
+    Chimes::LBFGS<decltype(fun), double, Eigen::Dynamic, Eigen::Dynamic, History<double, Eigen::Dynamic, Eigen::Dynamic>> dynamic(fun, dynamic_init_x);
+    dynamic.parameter_.is_show_ = false;
+    dynamic.parameter_.lbfgs_remain_ = 5;
+    dynamic.solve();
+    const double difference = (fixed.get_result().res_x - dynamic.get_result().res_x).norm();
+    std::cout << "fixed size iterations: " << fixed.get_result().iter_time << "  allocations: " << allocations
+        << "  difference: " << difference << std::endl;
+    return allocations == 0 && fixed.get_result().fval < 1e-8 && fixed.get_result().iter_time == dynamic.get_result().iter_time
+        && difference < 1e-10;
+}
+
+//Extended Rosenbrock on any scalar, for the automatic differentiation.
+class RosenbrockValue
+{
+public:
+    template <class Vector>
+    typename Vector::Scalar operator()(const Vector& x) const
+    {
+        using Real = typename Vector::Scalar;
+        Real fval(0);
+        for (Eigen::Index i = 0; i + 1 < x.size(); i += 2)
+        {
+            const Real t1 = 1.0 - x(i);
+            const Real t2 = 10.0 * (x(i + 1) - x(i) * x(i));
+            fval += t1 * t1 + t2 * t2;
+        }
+        return fval;
+    }
+};
+
+//Forward and reverse mode must reproduce a hand-written gradient and the finite differences of the elementary
+//functions, solve like the hand-written objective, and evaluate without allocating once warmed up.
+bool test_autodiff()
+{
+    const int n = 20;
+    Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1.5, 1.5);
+    Eigen::VectorXd hand(n);
+    for (int i = 0; i + 1 < n; i += 2)
+    {
+        const double t1 = 1 - x(i);
+        const double t2 = 10 * (x(i + 1) - x(i) * x(i));
+        hand(i) = -2 * t1 - 40 * x(i) * t2;
+        hand(i + 1) = 20 * t2;
+    }
+    auto forward = Chimes::optimization::make_forward_objective(RosenbrockValue());
+    auto reverse = Chimes::optimization::make_reverse_objective(RosenbrockValue());
+    Eigen::VectorXd forward_gradient(n);
+    Eigen::VectorXd reverse_gradient(n);
+    const double forward_fval = forward(x, forward_gradient);
+    const double reverse_fval = reverse(x, reverse_gradient);
+    const double rosenbrock_error = std::max((forward_gradient - hand).norm(), (reverse_gradient - hand).norm()) / hand.norm();
+    bool success = forward_fval == RosenbrockValue()(x) && reverse_fval == forward_fval && rosenbrock_error < 1e-14;
+
+    auto elementary = [](const auto& x)
+    {
+        using std::sqrt, std::exp, std::log, std::log1p, std::sin, std::cos, std::tan, std::tanh, std::cosh, std::atan, std::abs, std::pow;
+        using Real = typename std::decay_t<decltype(x)>::Scalar;
+        Real fval = 0.5 * x.squaredNorm();
+        for (Eigen::Index i = 0; i < x.size(); ++i)
+        {
+            const Real& xi = x(i);
+            fval += exp(0.1 * xi) + log(2.0 + xi) + log1p(xi * xi) + sin(xi) * cos(2.0 * xi) + tan(0.3 * xi) + tanh(xi)
+                + log(cosh(xi)) + atan(xi) / sqrt(1.0 + xi * xi) + abs(xi - 0.05) + pow(1.5 + xi, 2.5) + pow(2.0 + xi, xi) - 3.0 / (4.0 + xi);
+        }
+        return fval;
+    };
+    const Eigen::VectorXd y = Eigen::VectorXd::LinSpaced(7, -0.9, 0.9);
+    auto forward_elementary = Chimes::optimization::make_forward_objective(elementary);
+    auto reverse_elementary = Chimes::optimization::make_reverse_objective(elementary);
+    Eigen::VectorXd forward_elementary_gradient(7);
+    Eigen::VectorXd reverse_elementary_gradient(7);
+    forward_elementary(y, forward_elementary_gradient);
+    reverse_elementary(y, reverse_elementary_gradient);
+    Eigen::VectorXd difference_gradient(7);
+    for (int i = 0; i < 7; ++i)
+    {
+        const double h = 1e-6;
+        Eigen::VectorXd up = y;
+        Eigen::VectorXd down = y;
+        up(i) += h;
+        down(i) -= h;
+        difference_gradient(i) = (elementary(up) - elementary(down)) / (2 * h);
+    }
+    const double elementary_error = (forward_elementary_gradient - difference_gradient).norm() / difference_gradient.norm();
+    const double mode_difference = (forward_elementary_gradient - reverse_elementary_gradient).norm() / difference_gradient.norm();
+    success &= elementary_error < 1e-8 && mode_difference < 1e-14;
+
+    //pow at 0: the value of x^p and the one-sided derivative, never NaN. The infinite derivative of x^0.5 is checked
+    //alone, as forward mode multiplies it by the 0 derivatives along the other directions.
+    auto power = [](const auto& x)
+    {
+        using std::pow;
+        return pow(x(0), 0.0) + pow(x(1), 2.0) + pow(x(2), 1.0);
+    };
+    auto root = [](const auto& x)
+    {
+        using std::pow;
+        return pow(x(0), 0.5);
+    };
+    auto forward_power = Chimes::optimization::make_forward_objective(power);
+    auto reverse_power = Chimes::optimization::make_reverse_objective(power);
+    auto forward_root = Chimes::optimization::make_forward_objective(root);
+    auto reverse_root = Chimes::optimization::make_reverse_objective(root);
+    const Eigen::Vector3d power_gradient(0.0, 0.0, 1.0);
+    Eigen::VectorXd zero = Eigen::VectorXd::Zero(3);
+    Eigen::VectorXd forward_power_gradient(3);
+    Eigen::VectorXd reverse_power_gradient(3);
+    success &= forward_power(zero, forward_power_gradient) == 1.0 && reverse_power(zero, reverse_power_gradient) == 1.0
+        && forward_power_gradient == power_gradient && reverse_power_gradient == power_gradient;
+    zero.resize(1);
+    zero(0) = 0.0;
+    Eigen::VectorXd forward_root_gradient(1);
+    Eigen::VectorXd reverse_root_gradient(1);
+    success &= forward_root(zero, forward_root_gradient) == 0.0 && reverse_root(zero, reverse_root_gradient) == 0.0
+        && std::isinf(forward_root_gradient(0)) && std::isinf(reverse_root_gradient(0));
+
+    const int m = 100;
+    Eigen::VectorXd init_x(m);
+    for (int i = 0; i < m; ++i)
+        init_x(i) = i % 2 == 0 ? -1.2 : 1.0;
+    auto hand_fun = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        double fval = 0;
+        for (Eigen::Index i = 0; i + 1 < x.size(); i += 2)
+        {
+            const double t1 = 1 - x(i);
+            const double t2 = 10 * (x(i + 1) - x(i) * x(i));
+            gradient(i) = -2 * t1 - 40 * x(i) * t2;
+            gradient(i + 1) = 20 * t2;
+            fval += t1 * t1 + t2 * t2;
+        }
+        return fval;
+    };
+    Chimes::LBFGS<decltype(hand_fun), double> hand_lbfgs(hand_fun, init_x);
+    Chimes::LBFGS<decltype(reverse), double> reverse_lbfgs(reverse, init_x);
+    Chimes::LBFGS<decltype(forward), double> forward_lbfgs(forward, init_x);
+    hand_lbfgs.parameter_.is_show_ = false;
+    reverse_lbfgs.parameter_.is_show_ = false;
+    forward_lbfgs.parameter_.is_show_ = false;
+    hand_lbfgs.solve();
+    reverse_lbfgs.solve();
+    forward_lbfgs.solve();
+    const double solve_difference = std::max((hand_lbfgs.get_result().res_x - reverse_lbfgs.get_result().res_x).norm(),
+        (hand_lbfgs.get_result().res_x - forward_lbfgs.get_result().res_x).norm());
+    success &= solve_difference < 1e-8 && reverse_lbfgs.get_result().fval < 1e-8;
+
+    Eigen::VectorXd gradient(m);
+    const size_t before = g_allocation_count;
+    Eigen::internal::set_is_malloc_allowed(false);
+    reverse(init_x, gradient);
+    forward(init_x, gradient);
+    Eigen::internal::set_is_malloc_allowed(true);
+    const size_t allocations = g_allocation_count - before;
+    std::cout << "autodiff gradient error: " << rosenbrock_error << "  elementary error: " << elementary_error << "  solves differ by "
+        << solve_difference << "  tape nodes: " << reverse.tape_size() << "  allocations: " << allocations << std::endl;
+    return success && allocations == 0;
+}
+
+//The elements 100 (x_j+1 - x_j^2)^2 + (1 - x_j)^2 of the chained Rosenbrock function, on any scalar.
+class ChainedRosenbrockElements
+{
+public:
+    template <class Vector, class ElementVector>
+    void operator()(const Vector& x, ElementVector& elements) const
+    {
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const auto t = x(j + 1) - x(j) * x(j);
+            const auto u = 1.0 - x(j);
+            elements(j) = 100.0 * t * t + u * u;
+        }
+    }
+};
+
+//Finite differences must match the analytic gradient to the accuracy of their scheme, give the same gradient on any
+//number of threads, and color a chain of elements with 2 colors whatever n.
+bool test_finite_difference()
+{
+    using Chimes::optimization::DifferenceScheme;
+    const int n = 20;
+    const Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1.5, 1.5);
+    Eigen::VectorXd exact(n);
+    for (Eigen::Index i = 0; i + 1 < n; i += 2)
+    {
+        const double t1 = 1.0 - x(i);
+        const double t2 = 10.0 * (x(i + 1) - x(i) * x(i));
+        exact(i) = -2.0 * t1 - 40.0 * x(i) * t2;
+        exact(i + 1) = 20.0 * t2;
+    }
+    Chimes::ThreadPool pool(4);
+    Eigen::VectorXd gradient(n), parallel_gradient(n);
+    double errors[3];
+    const DifferenceScheme schemes[3] = { DifferenceScheme::FORWARD, DifferenceScheme::CENTRAL, DifferenceScheme::COMPLEX_STEP };
+    bool success = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        auto serial = Chimes::optimization::make_finite_difference_objective(RosenbrockValue(), schemes[i]);
+        auto parallel = Chimes::optimization::make_finite_difference_objective(RosenbrockValue(), schemes[i], &pool);
+        success &= serial(x, gradient) == RosenbrockValue()(x) && parallel(x, parallel_gradient) == RosenbrockValue()(x);
+        success &= gradient == parallel_gradient && serial.evaluations() == size_t(i == 1 ? 2 * n + 1 : n + 1);
+        errors[i] = (gradient - exact).norm() / exact.norm();
+    }
+    success &= errors[0] < 1e-6 && errors[1] < 1e-9 && errors[2] < 1e-14;
+    //The chained Rosenbrock function of 1000 variables, element j on x_j and x_j+1.
+    const int m = 1000;
+    Chimes::optimization::ColoredFiniteDifferenceObjective<ChainedRosenbrockElements>::Pattern pattern(m - 1);
+    for (int j = 0; j + 1 < m; ++j)
+        pattern[j] = { j, j + 1 };
+    Chimes::optimization::ColoredFiniteDifferenceObjective<ChainedRosenbrockElements> colored(ChainedRosenbrockElements(), pattern);
+    Chimes::optimization::ColoredFiniteDifferenceObjective<ChainedRosenbrockElements> complex_colored(ChainedRosenbrockElements(), pattern,
+        DifferenceScheme::COMPLEX_STEP, &pool);
+    const Eigen::VectorXd y = Eigen::VectorXd::LinSpaced(m, -1.2, 1.2);
+    Eigen::VectorXd chained_exact = Eigen::VectorXd::Zero(m), chained_gradient(m), complex_gradient(m);
+    for (int j = 0; j + 1 < m; ++j)
+    {
+        const double t = y(j + 1) - y(j) * y(j);
+        chained_exact(j) += -400.0 * y(j) * t - 2.0 * (1.0 - y(j));
+        chained_exact(j + 1) += 200.0 * t;
+    }
+    colored(y, chained_gradient);
+    complex_colored(y, complex_gradient);
+    const double colored_error = (chained_gradient - chained_exact).norm() / chained_exact.norm();
+    const double complex_error = (complex_gradient - chained_exact).norm() / chained_exact.norm();
+    success &= colored.colors() == 2 && colored.evaluations() == 5 && complex_colored.evaluations() == 3
+        && colored_error < 1e-9 && complex_error < 1e-14;
+    //20 iterations of LBFGS on the complex-step colored gradient must follow those on the exact gradient.
+    auto chained = [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
+    {
+        Eigen::VectorXd elements(x.size() - 1);
+        ChainedRosenbrockElements()(x, elements);
+        gradient.setZero();
+        for (Eigen::Index j = 0; j + 1 < x.size(); ++j)
+        {
+            const double t = x(j + 1) - x(j) * x(j);
+            gradient(j) += -400.0 * x(j) * t - 2.0 * (1.0 - x(j));
+            gradient(j + 1) += 200.0 * t;
+        }
+        return elements.sum();
+    };
+    Chimes::LBFGS<decltype(complex_colored), double> lbfgs(complex_colored, Eigen::VectorXd::Constant(m, -1.2));
+    Chimes::LBFGS<decltype(chained), double> exact_lbfgs(chained, Eigen::VectorXd::Constant(m, -1.2));
+    lbfgs.parameter_.is_show_ = false;
+    lbfgs.parameter_.max_iteration_ = 20;
+    exact_lbfgs.parameter_.is_show_ = false;
+    exact_lbfgs.parameter_.max_iteration_ = 20;
+    lbfgs.solve();
+    exact_lbfgs.solve();
+    const double solve_difference = (lbfgs.get_result().res_x - exact_lbfgs.get_result().res_x).norm();
+    success &= solve_difference < 1e-6 && lbfgs.get_result().iter_time == 20;
+    std::cout << "finite difference errors, forward: " << errors[0] << "  central: " << errors[1] << "  complex step: " << errors[2]
+        << "  colors: " << colored.colors() << "  colored errors: " << colored_error << " " << complex_error << "  solves differ by "
+        << solve_difference << std::endl;
+    return success;
+}
+
+//The compile-time policies must compare like Numerical with its default precisions, and set_precision() must be safe
+//while other threads compare.
+bool test_numeric_policy()
+{
+    using Sign = Chimes::Numerical::Sign;
+    static_assert(Chimes::geometry::concept_real<double> && Chimes::geometry::concept_real<float>);
+    static_assert(Chimes::NumericPolicy<double>::sign(1e-17) == Sign::ZERO);
+    static_assert(Chimes::NumericPolicy<float>::sign(1.0f, 1.1f) == Sign::NEGATIVE);
+    static_assert(Chimes::PrecisionPolicy<double, 1e-9>::sign(1.0, 1.0 + 1e-10) == Sign::ZERO);
+    Chimes::Numerical& numerical = Chimes::Numerical::instance();
+    bool success = numerical.sign(1e-17) == Chimes::NumericPolicy<double>::sign(1e-17)
+        && numerical.sign(1e-5f) == Chimes::NumericPolicy<float>::sign(1e-5f);
+    std::atomic<size_t> zeros(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (int i = 0; i < 100000; ++i)
+            {
+                if (t == 0)
+                    numerical.set_precision(i % 2 == 0 ? 1e-3 : 1e-16);
+                else if (numerical.sign(1e-6) == Sign::ZERO)
+                    ++zeros;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    numerical.set_precision(1e-16);
+    success &= numerical.sign(1e-6) == Sign::POSITIVE;
+    std::cout << "comparisons under a concurrent precision: " << zeros.load() << " of 300000 zero" << std::endl;
+    return success;
+}
+
+//The point and matrix types must model the geometry concepts, and points must keep their padding and alignment.
+bool test_geometry_types()
+{
+    using namespace Chimes::geometry;
+    static_assert(concept_point_index<Point3d> && concept_point_xyz<Point3d> && concept_point_operater<Point3d>
+        && concept_point_normal<Point3d> && concept_point_ostream<Point3d> && concept_point_istream<Point3d>);
+    static_assert(concept_point_index<Point2f> && !concept_point_xyz<Point2f> && concept_point_operater<Point2f>
+        && concept_point_normal<Point2f>);
+    static_assert(concept_matrix_index<Matrix3d> && concept_matrix_index<Matrix4f>);
+    static_assert(sizeof(Point3f) == 16 && alignof(Point3f) == 16 && sizeof(Point3d) == 32 && sizeof(Point2d) == 16);
+    const Point3d p(1, 2, 2);
+    const Point3d q(0, 1, 0);
+    bool success = p.Norm() == 3 && p * q == 2 && p.Cross(q) == Point3d(-2, 0, 1) && (p - q) * 2.0 == Point3d(2, 2, 4)
+        && std::abs(p.Normalized().Norm() - 1) < 1e-15 && Point3d().Normalized() == Point3d();
+    Matrix3d rotation;
+    rotation(0, 1) = -1;
+    rotation(1, 0) = 1;
+    rotation(2, 2) = 1;
+    success &= rotation * p == Point3d(-2, 1, 2) && rotation.Transpose() * rotation * p == p
+        && (rotation * Matrix3d::Identity()).Trace() == 1;
+    std::stringstream stream;
+    stream << p << " " << q;
+    Point3d r, s;
+    stream >> r >> s;
+    return success && r == p && s == q;
+}
+
+//The batch kernels of the point cloud must match the point operations, with and without a thread pool, and the sums must
+//be the same for every run on the same pool.
+bool test_point_cloud()
+{
+    using namespace Chimes::geometry;
+    const size_t n = 100003;
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<Point3d> points(n);
+    PointCloud3d cloud;
+    for (size_t i = 0; i < n; ++i)
+    {
+        points[i] = Point3d(1e3 + uniform(generator), uniform(generator), 2.0 * uniform(generator));
+        cloud.push_back(points[i]);
+    }
+    points[5] = Point3d();
+    cloud.set(5, points[5]);
+    Matrix3d rotation;
+    const double c = std::cos(0.3), s = std::sin(0.3);
+    rotation(0, 0) = c;
+    rotation(0, 1) = -s;
+    rotation(1, 0) = s;
+    rotation(1, 1) = c;
+    rotation(2, 2) = 1;
+    const Point3d translation(-1e3, 0.5, 0.25);
+    Chimes::ThreadPool pool(4);
+    PointCloud3d parallel = cloud;
+    parallel.set_thread_pool(&pool, 1000);
+    bool success = (parallel.centroid() - cloud.centroid()).Norm() < 1e-12;
+    cloud.transform(rotation, translation);
+    parallel.transform(rotation, translation);
+    Point3d centroid;
+    for (Point3d& p : points)
+    {
+        p = rotation * p + translation;
+        centroid += p;
+    }
+    centroid /= double(n);
+    Matrix3d covariance;
+    for (const Point3d& p : points)
+    {
+        const Point3d d = p - centroid;
+        for (size_t a = 0; a < 3; ++a)
+        {
+            for (size_t b = 0; b < 3; ++b)
+                covariance(a, b) += d[a] * d[b] / double(n);
+        }
+    }
+    double point_error = 0;
+    std::vector<double> dots(n);
+    cloud.dot(translation, dots.data());
+    for (size_t i = 0; i < n; ++i)
+    {
+        point_error = std::max(point_error, (cloud.point(i) - points[i]).Norm() + (parallel.point(i) - points[i]).Norm());
+        //The dot products are about 1e6, relative to them, as FMA contraction may differ between the vectorized loop
+        //and its scalar peel, whose length depends on the alignment of dots.
+        const double dot = points[i] * translation;
+        point_error = std::max(point_error, std::abs(dots[i] - dot) / (1.0 + std::abs(dot)));
+    }
+    const double centroid_error = (cloud.centroid() - centroid).Norm() + (parallel.centroid() - centroid).Norm();
+    double covariance_error = 0;
+    for (size_t a = 0; a < 3; ++a)
+    {
+        for (size_t b = 0; b < 3; ++b)
+        {
+            covariance_error = std::max(covariance_error, std::abs(cloud.covariance()(a, b) - covariance(a, b)));
+            covariance_error = std::max(covariance_error, std::abs(parallel.covariance()(a, b) - covariance(a, b)));
+        }
+    }
+    const Matrix3d first = parallel.covariance();
+    for (int run = 0; run < 10; ++run)
+        success &= std::memcmp(parallel.covariance().data(), first.data(), sizeof(first)) == 0;
+    cloud.normalize();
+    cloud.squaredNorm(dots.data());
+    double norm_error = 0;
+    for (size_t i = 0; i < n; ++i)
+        norm_error = std::max(norm_error, std::abs(dots[i] - (points[i] == Point3d() ? 0.0 : 1.0)));
+    PointCloud2f plane(3);
+    plane.set(1, Point2f(3, 4));
+    plane.set(2, Point2f(0, 2));
+    plane.normalize();
+    success &= plane.point(0) == Point2f() && plane.point(1) == Point2f(0.6f, 0.8f) && plane.centroid() == Point2f(0.2f, 0.6f);
+    success &= reinterpret_cast<uintptr_t>(cloud.coordinate(2)) % 64 == 0;
+    std::cout << "point cloud error: points " << point_error << "  centroid " << centroid_error << "  covariance " << covariance_error
+        << "  norms " << norm_error << std::endl;
+    return success && point_error < 1e-12 && centroid_error < 1e-12 && covariance_error < 1e-12 && norm_error < 1e-14;
+}
+
+//A point with coordinates by x(), y() and z() only, as brought by an application.
+class XyzPoint
+{
+public:
+    float x() const
+    {
+        return x_;
+    }
+    float y() const
+    {
+        return y_;
+    }
+    float z() const
+    {
+        return z_;
+    }
+public:
+    float x_, y_, z_;
+};
+
+//k nearest neighbours and radius queries of the k-d tree must match a brute force search, the tree built on a pool must be
+//the same as the serial one, and a saved tree mapped back must answer the same.
+bool test_kd_tree()
+{
+    using namespace Chimes::geometry;
+    using Tree = KdTree<Point3d>;
+    const size_t n = 20000, m = 300, k = 8;
+    const double r = 0.08;
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<Point3d> points(n), queries(m);
+    for (Point3d& p : points)
+        p = Point3d(uniform(generator), uniform(generator), 0.1 * uniform(generator));
+    for (Point3d& q : queries)
+        q = Point3d(uniform(generator), uniform(generator), 0.1 * uniform(generator));
+    Chimes::ThreadPool pool(4);
+    Tree serial(points);
+    Tree parallel(points, &pool);
+    std::vector<Tree::Index> indices(m * k), parallel_indices(m * k);
+    std::vector<double> distances(m * k), parallel_distances(m * k);
+    serial.knn(queries.data(), m, k, indices.data(), distances.data());
+    parallel.knn(queries.data(), m, k, parallel_indices.data(), parallel_distances.data(), &pool);
+    std::vector<std::vector<Tree::Index>> neighbours;
+    parallel.radius(queries.data(), m, r, neighbours, &pool);
+    bool success = serial.nodes() == parallel.nodes() && indices == parallel_indices && distances == parallel_distances;
+    size_t mismatches = 0;
+    size_t found = 0;
+    std::vector<double> brute(n);
+    for (size_t j = 0; j < m; ++j)
+    {
+        for (size_t i = 0; i < n; ++i)
+            brute[i] = (points[i] - queries[j]).SquaredNorm();
+        std::vector<Tree::Index> inside;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (brute[i] <= r * r)
+                inside.push_back(Tree::Index(i));
+        }
+        std::vector<Tree::Index> tree_inside = neighbours[j];
+        std::sort(tree_inside.begin(), tree_inside.end());
+        mismatches += tree_inside != inside;
+        found += inside.size();
+        std::vector<double> sorted = brute;
+        std::partial_sort(sorted.begin(), sorted.begin() + k, sorted.end());
+        for (size_t l = 0; l < k; ++l)
+            mismatches += distances[j * k + l] != sorted[l] || brute[indices[j * k + l]] != sorted[l];
+    }
+    const std::string path = (std::filesystem::temp_directory_path() / "chimes_test_kd_tree.bin").string();
+    parallel.save(path);
+    Tree mapped;
+    mapped.open(path);
+    mapped.knn(queries.data(), m, k, parallel_indices.data(), parallel_distances.data(), &pool);
+    success &= mapped.isMapped() && mapped.size() == n && indices == parallel_indices && distances == parallel_distances;
+    bool is_rejected = false;
+    try
+    {
+        KdTree<Point2d, 2> plane;
+        plane.open(path);
+    }
+    catch (const std::runtime_error&)
+    {
+        is_rejected = true;
+    }
+    mapped = Tree();
+    //A right child out of the nodes: the root starts at byte 64, its right child follows its box of 6 doubles.
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        const Tree::Index broken_right = Tree::npos - 1;
+        file.seekp(64 + 6 * sizeof(double));
+        file.write(reinterpret_cast<const char*>(&broken_right), sizeof(broken_right));
+    }
+    bool is_broken_rejected = false;
+    try
+    {
+        mapped.open(path);
+    }
+    catch (const std::runtime_error&)
+    {
+        is_broken_rejected = true;
+    }
+    std::filesystem::remove(path);
+    std::vector<XyzPoint> xyz(n);
+    for (size_t i = 0; i < n; ++i)
+        xyz[i] = XyzPoint{ float(points[i].x()), float(points[i].y()), float(points[i].z()) };
+    KdTree<XyzPoint> float_tree(xyz, &pool, 4);
+    Tree::Index nearest;
+    float nearest_distance;
+    float_tree.knn(xyz[123], 1, &nearest, &nearest_distance);
+    Tree empty(points.data(), 0);
+    success &= nearest == 123 && nearest_distance == 0 && empty.knn(queries[0], k, indices.data(), distances.data()) == 0
+        && indices[0] == Tree::npos;
+    std::cout << "k-d tree nodes: " << serial.nodes() << "  mismatches: " << mismatches << "  radius neighbours: " << found
+        << "  mismatched file rejected: " << is_rejected << std::endl;
+    return success && mismatches == 0 && is_rejected && is_broken_rejected && !mapped.isMapped();
+}
 
 int main(int argv, char* argc[])
 {
-	using Fun = std::function<double(const Eigen::VectorXd& x, Eigen::VectorXd& gradient)>;
-	Fun fun
-		= [](const Eigen::VectorXd& x, Eigen::VectorXd& gradient)
-	{
-		double fval = (x(0) - 1) * (x(0) - 1) + (x(1) - 1) * (x(1) - 1);
-		gradient.setZero();
-		gradient(0) = 2 * (x(0) - 1);
-		gradient(1) = 2 * (x(1) - 1);
-		return fval;
-	};
-	Eigen::VectorXd init_x(2);
-	init_x(0) = 53;
-	init_x(1) = -68;
-	Chimes::SteepestDescent<Fun, double> steepest_descent = Chimes::SteepestDescent<Fun, double>(fun, init_x);
-	steepest_descent.solve();
-	Chimes::SteepestDescent<Fun, double>::SolveResult result = steepest_descent.get_result();
-	std::cout << "fval: " << result.fval << "  x: " << result.res_x[0] << " " << result.res_x[1] << std::endl;
-    return 0;
-}
\ No newline at end of file
+    bool success = true;
+    success &= test_numeric_policy();
+    success &= test_geometry_types();
+    success &= test_point_cloud();
+    success &= test_kd_tree();
+    success &= test_autodiff();
+    success &= test_finite_difference();
+    success &= test_steepest_descent();
+    success &= test_separate_objective();
+    success &= test_more_thuente();
+    success &= test_step_search_exhausted<Chimes::LBFGS>();
+    success &= test_step_search_exhausted<Chimes::SteepestDescent>();
+    success &= test_solve_observer();
+    success &= test_async_solve();
+    success &= test_lbfgsb();
+    success &= test_newton_cg();
+    success &= test_nonlinear_cg();
+    success &= test_nonlinear_cg_step_failure();
+    success &= test_least_squares();
+    success &= test_multi_start();
+    success &= test_stochastic();
+    success &= test_lbfgs_workspace<Chimes::LBFGSVectorHistory<double>>();
+    success &= test_lbfgs_workspace<Chimes::LBFGSMatrixHistory<double>>();
+    success &= test_lbfgs_workspace<Chimes::LBFGSMappedHistory<double>>();
+    success &= test_lbfgs_history();
+    success &= test_mapped_history();
+    success &= test_mixed_precision_history();
+    success &= test_lbfgs_warm_start<Chimes::LBFGSVectorHistory<double>>();
+    success &= test_lbfgs_warm_start<Chimes::LBFGSMatrixHistory<double>>();
+    success &= test_lbfgs_warm_start<Chimes::LBFGSMappedHistory<double>>();
+    success &= test_parallel_lbfgs<Chimes::LBFGSVectorHistory<double>>();
+    success &= test_parallel_lbfgs<Chimes::LBFGSMatrixHistory<double>>();
+    success &= test_parallel_lbfgs<Chimes::LBFGSMappedHistory<double>>();
+    success &= test_batch_lbfgs();
+    success &= test_fixed_size_lbfgs<Chimes::LBFGSVectorHistory>();
+    success &= test_fixed_size_lbfgs<Chimes::LBFGSMatrixHistory>();
+    std::cout << (success ? "Success!" : "Failed!") << std::endl;
+    return success ? 0 : 1;
+}